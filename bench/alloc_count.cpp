@@ -0,0 +1,65 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "alloc_count.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<uint64_t> Allocations(0);
+
+uint64_t allocationCount() {
+  return Allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) {
+  Allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+// C++14 and later free through the sized forms, which must match the counting versions above
+void operator delete(void* p, std::size_t) noexcept {
+  operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  operator delete[](p);
+}
@@ -0,0 +1,101 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+/*
+Counts heap allocations made by parseLog per million $LogFile records
+Usage: bench_log_alloc [number of log records]
+*/
+
+#include "alloc_count.h"
+#include "synth.h"
+
+#include "file.h"
+#include "log.h"
+#include "sqlite_util.h"
+#include "util.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+Builds a $LogFile of at least numRecords log records, cycling through
+create, rename and delete transactions, with an embedded $UsnJrnl record in each create
+*/
+std::string buildLogFile(uint64_t numRecords) {
+  synth::LogFileWriter writer;
+  uint64_t time = 130000000000000000ULL;
+  uint64_t usn = 0;
+  for (uint32_t record = 64; writer.NumRecords < numRecords; ++record) {
+    const uint32_t parent = 5;
+    std::string name = "document_" + std::to_string(record) + ".txt";
+    std::string newName = "renamed_" + std::to_string(record) + ".txt";
+    time += 10000000;
+
+    synth::createTransaction(writer, record, parent, name, time, usn += 0x60);
+    synth::renameTransaction(writer, record, parent, name, newName, time);
+    synth::deleteTransaction(writer, record, parent, newName, time);
+  }
+  return writer.finish();
+}
+
+int main(int argc, char** argv) {
+  uint64_t numRecords = argc > 1 ? std::strtoull(argv[1], NULL, 10) : 1000000;
+  std::string logFile = buildLogFile(numRecords);
+
+  std::vector<File> records(64);
+  records[5] = File(".", 5, 5, "");
+
+  std::string dbName = "bench_log_alloc.db";
+  SQLiteHelper sqliteHelper;
+  sqliteHelper.init(dbName, true);
+  VersionInfo version("bench/volume_0/vss_base", "bench/volume_0");
+  std::ostream nullOut(NULL);
+
+  std::cout << "$LogFile: " << numRecords << " records, " << logFile.size() << " bytes" << std::endl;
+  for (int extra = 0; extra < 2; ++extra) {
+    std::istringstream input(logFile);
+    sqliteHelper.beginTransaction();
+    uint64_t before = allocationCount();
+    auto start = std::chrono::steady_clock::now();
+    parseLog(records, sqliteHelper, input, nullOut, version, extra);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    uint64_t allocations = allocationCount() - before;
+    sqliteHelper.endTransaction();
+
+    std::cout << "extra=" << extra
+              << " allocations=" << allocations
+              << " per_1M_records=" << static_cast<double>(allocations) * 1000000 / numRecords
+              << " ms=" << elapsed.count() << std::endl;
+  }
+  sqliteHelper.close();
+  std::remove(dbName.c_str());
+  return 0;
+}
@@ -0,0 +1,340 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+/*
+Times each phase of the ntfs_linker pipeline, and each parser on its own,
+against generated artifacts or a given ntfs-dir, and writes the results as JSON
+Usage: bench_pipeline [--records N] [--input ntfs-dir] [--json bench.json]
+*/
+
+#include "alloc_count.h"
+#include "generator.h"
+
+#include "controller.h"
+#include "file.h"
+#include "log.h"
+#include "mft.h"
+#include "phases.h"
+#include "sqlite_util.h"
+#include "usn.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+/*
+Resets the peak resident set size of the process, so that it can be measured per phase
+*/
+void resetPeakRSS() {
+  std::ofstream clearRefs("/proc/self/clear_refs");
+  clearRefs << "5";
+}
+
+/*
+Peak resident set size in bytes since the last reset, or 0 where it can't be read
+*/
+uint64_t peakRSS() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::strtoull(line.c_str() + 6, NULL, 10) * 1024;
+    }
+  }
+  return 0;
+}
+
+struct Measurement {
+  Measurement(const std::string& name, const std::string& volume, const std::string& snapshot)
+    : Name(name), Volume(volume), Snapshot(snapshot), Records(0), Bytes(0), Allocations(0), PeakRSS(0), Seconds(0) {}
+
+  std::string Name, Volume, Snapshot;
+  uint64_t Records, Bytes, Allocations, PeakRSS;
+  double Seconds;
+};
+
+/*
+Measures the time, allocations and peak RSS of one phase or parser
+*/
+class Stopwatch {
+public:
+  Stopwatch() : Start(std::chrono::steady_clock::now()), StartAllocations(allocationCount()) {
+    resetPeakRSS();
+  }
+
+  void stop(Measurement& m) {
+    m.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    m.Allocations = allocationCount() - StartAllocations;
+    m.PeakRSS = peakRSS();
+  }
+
+private:
+  std::chrono::steady_clock::time_point Start;
+  uint64_t StartAllocations;
+};
+
+/*
+Collects a measurement for each phase of run()
+*/
+class PhaseCollector: public PhaseObserver {
+public:
+  void beginPhase(const PhaseInfo&) {
+    Running.push_back(Stopwatch());
+  }
+
+  void endPhase(const PhaseInfo& info) {
+    Measurement m(toString(info.Phase), info.Volume, info.Snapshot);
+    m.Records = info.Records;
+    m.Bytes = info.Bytes;
+    Running.back().stop(m);
+    Running.pop_back();
+    Results.push_back(m);
+  }
+
+  std::vector<Measurement> Results;
+private:
+  std::vector<Stopwatch> Running;
+};
+
+/*
+Finds the first snapshot folder, i.e. one holding a $MFT, under dir
+*/
+fs::path findSnapshot(const fs::path& dir) {
+  if (fs::exists(dir / "$MFT")) {
+    return dir;
+  }
+  std::vector<fs::path> children;
+  std::copy(fs::directory_iterator(dir), fs::directory_iterator(), std::back_inserter(children));
+  std::sort(children.begin(), children.end());
+  for (auto& child: children) {
+    if (fs::is_directory(child)) {
+      fs::path found = findSnapshot(child);
+      if (!found.empty()) {
+        return found;
+      }
+    }
+  }
+  return fs::path();
+}
+
+uint64_t fileSize(const fs::path& path) {
+  return fs::exists(path) ? fs::file_size(path) : 0;
+}
+
+/*
+Runs parseMFT, parseUSN and parseLog on their own against one snapshot, also reporting how
+the SQLite writer kept up with them
+*/
+std::vector<Measurement> benchParsers(const fs::path& snapshot, const fs::path& work, WriterStats& writer) {
+  std::vector<Measurement> results;
+  std::vector<File> records;
+  std::ostream nullOut(NULL);
+  VersionInfo version(snapshot.string(), snapshot.parent_path().string());
+  SQLiteHelper sqliteHelper;
+  sqliteHelper.init((work / "parsers.db").string(), true);
+
+  fs::path usnPath = fs::exists(snapshot / "$UsnJrnl") ? snapshot / "$UsnJrnl" : snapshot / "$J";
+  {
+    Measurement m("parseMFT", version.Volume, version.Snapshot);
+    std::ifstream input((snapshot / "$MFT").string(), std::ios::binary);
+    m.Bytes = fileSize(snapshot / "$MFT");
+    Stopwatch watch;
+    parseMFT(records, input);
+    watch.stop(m);
+    m.Records = records.size();
+    results.push_back(m);
+  }
+  sqliteHelper.beginTransaction();
+  {
+    Measurement m("parseUSN", version.Volume, version.Snapshot);
+    std::ifstream input(usnPath.string(), std::ios::binary);
+    m.Bytes = fileSize(usnPath);
+    Stopwatch watch;
+    m.Records = parseUSN(records, sqliteHelper, input, nullOut, version, false);
+    watch.stop(m);
+    results.push_back(m);
+  }
+  {
+    Measurement m("parseLog", version.Volume, version.Snapshot);
+    std::ifstream input((snapshot / "$LogFile").string(), std::ios::binary);
+    m.Bytes = fileSize(snapshot / "$LogFile");
+    Stopwatch watch;
+    m.Records = parseLog(records, sqliteHelper, input, nullOut, version, false);
+    watch.stop(m);
+    results.push_back(m);
+  }
+  sqliteHelper.endTransaction();
+  writer = sqliteHelper.writerStats();
+  sqliteHelper.close();
+  return results;
+}
+
+void writeMeasurements(std::ostream& out, const std::vector<Measurement>& results) {
+  out << "[";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Measurement& m = results[i];
+    double seconds = m.Seconds > 0 ? m.Seconds : 1e-9;
+    out << (i ? ",\n    " : "\n    ")
+        << "{\"name\": " << jsonString(m.Name)
+        << ", \"volume\": " << jsonString(m.Volume)
+        << ", \"snapshot\": " << jsonString(m.Snapshot)
+        << ", \"seconds\": " << m.Seconds
+        << ", \"records\": " << m.Records
+        << ", \"bytes\": " << m.Bytes
+        << ", \"records_per_sec\": " << m.Records / seconds
+        << ", \"mb_per_sec\": " << m.Bytes / seconds / (1024 * 1024)
+        << ", \"allocations\": " << m.Allocations
+        << ", \"peak_rss_bytes\": " << m.PeakRSS << "}";
+  }
+  out << (results.empty() ? "]" : "\n  ]");
+}
+
+/*
+Sums the measurements of each phase over all volumes and snapshots
+*/
+std::vector<Measurement> totals(const std::vector<Measurement>& results) {
+  std::vector<Measurement> sums;
+  for (unsigned int phase = 0; phase < NUM_PHASES; ++phase) {
+    Measurement sum(toString(static_cast<Phases>(phase)), "", "");
+    for (auto& m: results) {
+      if (m.Name == sum.Name) {
+        sum.Seconds += m.Seconds;
+        sum.Records += m.Records;
+        sum.Bytes += m.Bytes;
+        sum.Allocations += m.Allocations;
+        sum.PeakRSS = std::max(sum.PeakRSS, m.PeakRSS);
+      }
+    }
+    sums.push_back(sum);
+  }
+  return sums;
+}
+
+int main(int argc, char** argv) {
+  synth::GeneratorOptions genOpts;
+  std::string input, work, json;
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("records", po::value<uint64_t>(&genOpts.Records)->default_value(genOpts.Records), "number of $MFT records to generate")
+    ("churn", po::value<double>(&genOpts.Churn)->default_value(genOpts.Churn), "file system events per generated $MFT record")
+    ("seed", po::value<uint64_t>(&genOpts.Seed)->default_value(genOpts.Seed), "random seed for the generated artifacts")
+    ("input", po::value<std::string>(&input), "ntfs-dir to benchmark instead of generated artifacts")
+    ("work", po::value<std::string>(&work)->default_value("bench_pipeline.work"), "directory for generated artifacts and output")
+    ("json", po::value<std::string>(&json)->default_value("bench.json"), "file to which results are written")
+    ("help", "display help and exit");
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+  }
+  catch (std::exception& err) {
+    std::cerr << "Error: " << err.what() << std::endl;
+    return 1;
+  }
+  if (vm.count("help")) {
+    std::cout << "Usage: bench_pipeline [options]" << std::endl << desc << std::endl;
+    return 0;
+  }
+
+  fs::path workDir(work);
+  fs::create_directories(workDir);
+  fs::path inputDir(input);
+  if (input.empty()) {
+    inputDir = workDir / "input";
+    fs::path snapshot = inputDir / "volume_0" / "vss_base";
+    fs::create_directories(snapshot);
+    std::cout << "Generating " << genOpts.Records << " $MFT records in " << snapshot.string() << std::endl;
+    synth::generate(genOpts, snapshot.string());
+  }
+
+  fs::path snapshot = findSnapshot(inputDir);
+  if (snapshot.empty()) {
+    std::cerr << "Error: no $MFT found under " << inputDir << std::endl;
+    return 1;
+  }
+  WriterStats writer;
+  std::vector<Measurement> parsers = benchParsers(snapshot, workDir, writer);
+
+  PhaseCollector collector;
+  Options opts;
+  opts.input = inputDir;
+  opts.output = workDir / "output";
+  opts.overwrite = true;
+  opts.observers.push_back(&collector);
+
+  // run() reports its progress on std::cout, which would drown out the results
+  std::ostringstream progress;
+  std::streambuf* coutBuf = std::cout.rdbuf(progress.rdbuf());
+  auto start = std::chrono::steady_clock::now();
+  run(opts);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout.rdbuf(coutBuf);
+
+  std::vector<Measurement> phaseTotals = totals(collector.Results);
+  std::ofstream out(json);
+  out << "{\n  \"input\": " << jsonString(inputDir.string())
+      << ",\n  \"run_seconds\": " << seconds
+      << ",\n  \"totals\": ";
+  writeMeasurements(out, phaseTotals);
+  out << ",\n  \"phases\": ";
+  writeMeasurements(out, collector.Results);
+  out << ",\n  \"parsers\": ";
+  writeMeasurements(out, parsers);
+  out << ",\n  \"writer\": {\"rows\": " << writer.Rows
+      << ", \"batches\": " << writer.Batches
+      << ", \"max_depth\": " << writer.MaxDepth
+      << ", \"stalls\": " << writer.Stalls
+      << ", \"stall_seconds\": " << writer.StallNanoseconds / 1e9 << "}";
+  out << "\n}\n";
+  if (!out) {
+    std::cerr << "Error: unable to write " << json << std::endl;
+    return 1;
+  }
+
+  for (auto& m: phaseTotals) {
+    std::cout << m.Name << ": " << m.Seconds << " s, " << m.Records << " records, "
+              << m.Allocations << " allocations, peak RSS " << m.PeakRSS / 1024 << " KiB" << std::endl;
+  }
+  for (auto& m: parsers) {
+    std::cout << m.Name << ": " << m.Seconds << " s, " << m.Records << " records, "
+              << m.Allocations << " allocations, peak RSS " << m.PeakRSS / 1024 << " KiB" << std::endl;
+  }
+  std::cout << "SQLite writer: " << writer.Rows << " rows in " << writer.Batches << " batches, "
+            << writer.Stalls << " stalls" << std::endl;
+  std::cout << "run: " << seconds << " s" << std::endl << "Results written to " << json << std::endl;
+  return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+/*
+Microbenchmarks for the per-record kernels in util.cpp, unicode.h and tsv.h
+Usage: bench_util [seconds per benchmark]
+Each kernel runs over a fixed, seeded set of inputs, so results are comparable between builds
+*/
+
+#include "file.h"
+#include "layout.h"
+#include "tsv.h"
+#include "unicode.h"
+#include "util.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+static const unsigned int NUM_INPUTS = 4096;
+
+// Results are folded into this so that the compiler can't drop the work being measured
+volatile uint64_t Sink;
+
+/*
+Calls fn(i) over the inputs, cycling i through [0, NUM_INPUTS), until at least minSeconds has passed
+and prints the time per call, plus the throughput if bytesPerCall is given
+*/
+template <typename F>
+void measure(const std::string& name, double minSeconds, double bytesPerCall, F fn) {
+  uint64_t calls = 0;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed = 0;
+  do {
+    for (unsigned int i = 0; i < NUM_INPUTS; ++i) {
+      fn(i);
+    }
+    calls += NUM_INPUTS;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  } while (elapsed < minSeconds);
+
+  std::cout << std::left << std::setw(36) << name << std::right
+            << std::setw(10) << std::fixed << std::setprecision(1) << elapsed * 1e9 / calls << " ns/op";
+  if (bytesPerCall > 0) {
+    std::cout << std::setw(10) << std::setprecision(1) << bytesPerCall * calls / elapsed / (1024 * 1024) << " MB/s";
+  }
+  std::cout << std::endl;
+}
+
+/*
+Encodes code points as UTF-16LE
+*/
+std::string toUTF16(const std::vector<int32_t>& cps) {
+  std::string out;
+  for (int32_t cp: cps) {
+    if (cp >= 0x10000) {
+      cp -= 0x10000;
+      uint16_t lead = 0xD800 + (cp >> 10), trail = 0xDC00 + (cp & 0x3FF);
+      out += static_cast<char>(lead & 0xFF);
+      out += static_cast<char>(lead >> 8);
+      out += static_cast<char>(trail & 0xFF);
+      out += static_cast<char>(trail >> 8);
+    }
+    else {
+      out += static_cast<char>(cp & 0xFF);
+      out += static_cast<char>(cp >> 8);
+    }
+  }
+  return out;
+}
+
+/*
+File names of 4 to 40 characters, drawn from the given code point ranges
+*/
+std::vector<std::string> makeNames(std::mt19937_64& rng, const std::vector<std::pair<int32_t, int32_t>>& ranges) {
+  std::vector<std::string> names;
+  std::uniform_int_distribution<unsigned int> length(4, 40);
+  std::uniform_int_distribution<size_t> range(0, ranges.size() - 1);
+  for (unsigned int i = 0; i < NUM_INPUTS; ++i) {
+    std::vector<int32_t> cps(length(rng));
+    for (auto& cp: cps) {
+      auto& r = ranges[range(rng)];
+      cp = std::uniform_int_distribution<int32_t>(r.first, r.second)(rng);
+    }
+    names.push_back(toUTF16(cps));
+  }
+  return names;
+}
+
+double averageSize(const std::vector<std::string>& inputs) {
+  double total = 0;
+  for (auto& input: inputs) {
+    total += input.size();
+  }
+  return total / inputs.size();
+}
+
+void benchNames(const std::string& kind, const std::vector<std::string>& names, double seconds) {
+  double bytes = averageSize(names);
+  std::string out;
+  measure("mbcatos/" + kind, seconds, bytes, [&](unsigned int i) {
+    Sink += mbcatos(names[i].data(), names[i].size()).size();
+  });
+  measure("mbcatos(reuse)/" + kind, seconds, bytes, [&](unsigned int i) {
+    mbcatos(names[i].data(), names[i].size(), out);
+    Sink += out.size();
+  });
+  measure("utf16_to_cp+cp_to_utf8/" + kind, seconds, bytes, [&](unsigned int i) {
+    const byte* buf = reinterpret_cast<const byte*>(names[i].data());
+    const byte* end = buf + names[i].size();
+    char utf8[4];
+    char* utf8Buf = utf8;
+    int32_t cp;
+    uint64_t total = 0;
+    while (buf < end) {
+      size_t rtn = utf16_to_cp<true>(buf, end, cp);
+      if (rtn == 0) {
+        break;
+      }
+      buf += rtn;
+      total += cp_to_utf8(cp, utf8Buf);
+    }
+    Sink += total;
+  });
+}
+
+/*
+NTFS records of recordSize bytes with a valid update sequence array, or with
+a torn sector in every one when corrupt is set
+*/
+std::vector<std::string> makeFixupRecords(std::mt19937_64& rng, unsigned int recordSize, bool corrupt) {
+  std::vector<std::string> records;
+  const unsigned int seqOffset = 0x30, sectors = recordSize / 512;
+  for (unsigned int i = 0; i < NUM_INPUTS; ++i) {
+    std::string record(recordSize, '\0');
+    for (auto& c: record) {
+      c = static_cast<char>(rng());
+    }
+    record[4] = seqOffset;
+    record[5] = 0;
+    record[6] = sectors + 1;
+    record[7] = 0;
+    for (unsigned int s = 1; s <= sectors; ++s) {
+      // The array holds the real sector tails, and the tails hold the sequence number
+      std::memcpy(&record[seqOffset + 2 * s], &record[512 * s - 2], 2);
+      std::memcpy(&record[512 * s - 2], &record[seqOffset], 2);
+    }
+    if (corrupt) {
+      record[512 * (1 + i % sectors) - 1] ^= 0x5A;
+    }
+    records.push_back(record);
+  }
+  return records;
+}
+
+void benchFixup(const std::string& kind, const std::vector<std::string>& records, double seconds) {
+  // doFixup works in place, so each call fixes up a fresh copy; "copy" measures that overhead alone
+  std::vector<char> buf(records[0].size());
+  measure("copy/" + kind, seconds, buf.size(), [&](unsigned int i) {
+    std::memcpy(buf.data(), records[i].data(), buf.size());
+    Sink += buf[i % buf.size()];
+  });
+  measure("doFixup/" + kind, seconds, buf.size(), [&](unsigned int i) {
+    std::memcpy(buf.data(), records[i].data(), buf.size());
+    Sink += doFixup(buf.data(), buf.size());
+  });
+}
+
+/*
+A tree of files where each path is between minDepth and maxDepth directories deep
+*/
+std::vector<File> makeTree(std::mt19937_64& rng, unsigned int minDepth, unsigned int maxDepth, std::vector<unsigned int>& leaves) {
+  std::vector<File> records;
+  records.push_back(File(".", 0, 0, ""));
+  std::uniform_int_distribution<unsigned int> depth(minDepth, maxDepth);
+  std::uniform_int_distribution<unsigned int> length(4, 24);
+  for (unsigned int i = 0; i < NUM_INPUTS; ++i) {
+    unsigned int parent = 0, levels = depth(rng);
+    for (unsigned int level = 0; level <= levels; ++level) {
+      // Reuse an existing directory at this level most of the time, as real trees share prefixes
+      unsigned int record = records.size();
+      if (level < levels && records.size() > 1 && rng() % 4 != 0) {
+        for (unsigned int candidate = 1 + rng() % (records.size() - 1); candidate < records.size(); ++candidate) {
+          if (records[candidate].Parent == parent && records[candidate].Record != records[candidate].Parent) {
+            record = candidate;
+            break;
+          }
+        }
+      }
+      if (record == records.size()) {
+        std::string name(length(rng), 'a');
+        for (auto& c: name) {
+          c = 'a' + rng() % 26;
+        }
+        records.push_back(File(name, record, parent, ""));
+      }
+      parent = record;
+    }
+    leaves.push_back(parent);
+  }
+  return records;
+}
+
+void benchPaths(const std::string& kind, unsigned int minDepth, unsigned int maxDepth, std::mt19937_64& rng, double seconds) {
+  std::vector<unsigned int> leaves;
+  std::vector<File> records = makeTree(rng, minDepth, maxDepth, leaves);
+  measure("getFullPath/" + kind, seconds, 0, [&](unsigned int i) {
+    Sink += getFullPath(records, leaves[i]).size();
+  });
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? std::strtod(argv[1], NULL) : 0.25;
+  std::mt19937_64 rng(1);
+
+  std::vector<uint64_t> fields(NUM_INPUTS);
+  for (auto& field: fields) {
+    field = rng();
+  }
+  const char* fieldBytes = reinterpret_cast<const char*>(fields.data());
+  for (int size: {2, 4, 6, 8}) {
+    measure("hex_to_long/" + std::to_string(size), seconds, size, [&](unsigned int i) {
+      Sink += hex_to_long(fieldBytes + 8 * i, size);
+    });
+  }
+  // Offset by one byte, as fields in records needn't be aligned
+  measure("le<uint16_t>", seconds, 2, [&](unsigned int i) {
+    Sink += le<uint16_t>(fieldBytes + 8 * i + 1);
+  });
+  measure("le<uint32_t>", seconds, 4, [&](unsigned int i) {
+    Sink += le<uint32_t>(fieldBytes + 8 * i + 1);
+  });
+  measure("le48", seconds, 6, [&](unsigned int i) {
+    Sink += le48(fieldBytes + 8 * i + 1);
+  });
+  measure("le<uint64_t>", seconds, 8, [&](unsigned int i) {
+    Sink += le<uint64_t>(fieldBytes + 8 * (i % (NUM_INPUTS - 1)) + 1);
+  });
+
+  std::vector<uint64_t> times(NUM_INPUTS);
+  // Uniform over 2000 to 2030
+  std::uniform_int_distribution<uint64_t> time(125911584000000000ULL, 135379296000000000ULL);
+  for (auto& t: times) {
+    t = time(rng);
+  }
+  measure("filetime_to_iso_8601", seconds, 0, [&](unsigned int i) {
+    Sink += filetime_to_iso_8601(times[i]).size();
+  });
+  char timeBuf[ISO_8601_LENGTH + 1];
+  measure("filetime_to_iso_8601(buf)", seconds, 0, [&](unsigned int i) {
+    Sink += filetime_to_iso_8601(times[i], timeBuf);
+  });
+
+  benchNames("ascii", makeNames(rng, {{'a', 'z'}, {'A', 'Z'}, {'0', '9'}, {'_', '_'}, {'.', '.'}}), seconds);
+  benchNames("latin", makeNames(rng, {{'a', 'z'}, {0xC0, 0xFF}}), seconds);
+  benchNames("cjk", makeNames(rng, {{0x4E00, 0x9FFF}}), seconds);
+  benchNames("cyrillic+emoji", makeNames(rng, {{0x0410, 0x044F}, {0x1F600, 0x1F64F}}), seconds);
+
+  benchFixup("valid", makeFixupRecords(rng, 1024, false), seconds);
+  benchFixup("corrupt", makeFixupRecords(rng, 1024, true), seconds);
+  benchFixup("valid-4096", makeFixupRecords(rng, 4096, false), seconds);
+
+  // A usnjrnl.txt row: integers, a timestamp and names, to /dev/null so the cost is formatting and write calls
+  std::ofstream devNull("/dev/null", std::ios::binary);
+  std::string name("file_12345.dat"), path("\\Users\\someone\\Documents\\file_12345.dat");
+  measure("tsv row/ostream+endl", seconds, 0, [&](unsigned int i) {
+    devNull << fields[i] << "\t" << (fields[i] & 0xFFFFFF) << "\t" << times[i] << "\t"
+            << name << "\t" << path << "\t" << (fields[i] >> 40) << std::endl;
+  });
+  {
+    TsvWriter tsv(devNull);
+    measure("tsv row/TsvWriter", seconds, 0, [&](unsigned int i) {
+      tsv.field(fields[i]).field(fields[i] & 0xFFFFFF).field(times[i])
+         .field(name).field(path).field(fields[i] >> 40).endRow();
+    });
+  }
+
+  benchPaths("shallow", 1, 3, rng, seconds);
+  benchPaths("deep", 16, 32, rng, seconds);
+  return 0;
+}
@@ -0,0 +1,279 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "generator.h"
+#include "synth.h"
+
+#include "usn.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace synth {
+
+static const uint64_t START_TIME = 130000000000000000ULL;
+// Records 0 through 15 are reserved for the NTFS metafiles
+static const uint32_t FIRST_USER_RECORD = 16;
+static const uint32_t ROOT_RECORD = 5;
+
+enum EventKinds { EVENT_CREATE, EVENT_WRITE, EVENT_RENAME, EVENT_DELETE };
+
+struct Event {
+  EventKinds Kind;
+  uint32_t Record;
+  uint64_t Time;
+};
+
+/*
+The directory tree. Every sixth record is a directory, and files and directories are
+spread over the directories which are shallower than the maximum depth.
+*/
+struct Tree {
+  Tree(const GeneratorOptions& opts) : Parent(opts.Records, ROOT_RECORD), IsDir(opts.Records, false) {
+    std::mt19937_64 rng(opts.Seed);
+    std::vector<uint32_t> parents(1, ROOT_RECORD);
+    std::vector<unsigned int> depth(opts.Records, 0);
+    if (ROOT_RECORD < opts.Records)
+      IsDir[ROOT_RECORD] = true;
+    for (uint64_t r = FIRST_USER_RECORD; r < opts.Records; ++r) {
+      uint32_t parent = parents[rng() % parents.size()];
+      Parent[r] = parent;
+      depth[r] = depth[parent] + 1;
+      if (rng() % 6 == 0) {
+        IsDir[r] = true;
+        if (depth[r] < opts.Depth)
+          parents.push_back(r);
+      }
+    }
+  }
+
+  std::string name(uint32_t record) const {
+    if (record == ROOT_RECORD)
+      return ".";
+    if (record < FIRST_USER_RECORD)
+      return "$Meta" + std::to_string(record);
+    return (IsDir[record] ? "dir_" : "file_") + std::to_string(record) + (IsDir[record] ? "" : ".dat");
+  }
+
+  std::vector<uint32_t> Parent;
+  std::vector<bool> IsDir;
+};
+
+/*
+The sequence of file system events, which can be replayed from the start
+*/
+class EventStream {
+public:
+  EventStream(const GeneratorOptions& opts) : Rng(opts.Seed + 1), Records(opts.Records), Time(START_TIME) {}
+
+  Event next() {
+    Event event;
+    unsigned int roll = Rng() % 20;
+    event.Kind = roll < 4 ? EVENT_CREATE : roll < 14 ? EVENT_WRITE : roll < 17 ? EVENT_RENAME : EVENT_DELETE;
+    event.Record = Records > FIRST_USER_RECORD ? FIRST_USER_RECORD + Rng() % (Records - FIRST_USER_RECORD) : ROOT_RECORD;
+    Time += 10000 + Rng() % 10000;  // 1 to 2 ms apart
+    event.Time = Time;
+    return event;
+  }
+
+private:
+  std::mt19937_64 Rng;
+  uint64_t Records, Time;
+};
+
+static std::string oldName(uint32_t record) {
+  return "old_" + std::to_string(record) + ".dat";
+}
+
+/*
+Writes $UsnJrnl records. Records never straddle a 4096 byte page, and the part
+of the journal which has been overwritten is left as a sparse hole.
+*/
+class UsnWriter {
+public:
+  UsnWriter(const std::string& path) : Out(path.c_str(), std::ios::binary | std::ios::trunc), Pos(0), Started(false) {}
+
+  uint64_t nextUsn(size_t len) {
+    if (Pos % 4096 + len > 4096)
+      Pos += 4096 - Pos % 4096;
+    return Pos;
+  }
+
+  void add(const std::string& rec, bool keep) {
+    uint64_t usn = nextUsn(rec.size());
+    if (keep) {
+      if (!Started) {
+        // Leaves the overwritten part of the journal as a hole
+        Out.seekp(usn - usn % 4096);
+        Started = true;
+      }
+      // Pad out to the record's position in the page
+      std::string padding(usn - std::min<uint64_t>(usn, static_cast<uint64_t>(Out.tellp())), '\0');
+      Out.write(padding.data(), padding.size());
+      Out.write(rec.data(), rec.size());
+    }
+    Pos = usn + rec.size();
+  }
+
+  uint64_t size() { return Started ? static_cast<uint64_t>(Out.tellp()) : 0; }
+
+private:
+  std::ofstream Out;
+  uint64_t Pos;
+  bool Started;
+};
+
+/*
+Replays the events as $LogFile transactions
+*/
+static void writeTransactions(const GeneratorOptions& opts, const Tree& tree, uint64_t numEvents, LogFileWriter& writer) {
+  EventStream events(opts);
+  uint64_t usn = 0;
+  for (uint64_t i = 0; i < numEvents; ++i) {
+    Event event = events.next();
+    uint32_t parent = tree.Parent[event.Record];
+    std::string name = tree.name(event.Record);
+    switch (event.Kind) {
+      case EVENT_CREATE:
+        createTransaction(writer, event.Record, parent, name, event.Time, usn += 0x60);
+        break;
+      case EVENT_RENAME:
+        renameTransaction(writer, event.Record, parent, oldName(event.Record), name, event.Time);
+        break;
+      case EVENT_DELETE:
+        deleteTransaction(writer, event.Record, parent, name, event.Time);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static void corrupt(std::string& buf, size_t start, size_t end, std::mt19937_64& rng) {
+  if (end <= start + 8)
+    return;
+  size_t offset = start + rng() % (end - start - 8);
+  for (int i = 0; i < 8; ++i)
+    buf[offset + i] = static_cast<char>(rng());
+}
+
+GeneratorStats generate(const GeneratorOptions& opts, const std::string& dir) {
+  GeneratorStats stats;
+  Tree tree(opts);
+  // Damage is drawn from its own generator, so the corruption rate doesn't change the events
+  std::mt19937_64 damage(opts.Seed + 2);
+  std::bernoulli_distribution isCorrupt(opts.Corrupt);
+  uint64_t numEvents = static_cast<uint64_t>(opts.Churn * opts.Records);
+  stats.Events = numEvents;
+
+  // $MFT
+  std::ofstream mft((dir + "/$MFT").c_str(), std::ios::binary | std::ios::trunc);
+  for (uint64_t r = 0; r < opts.Records; ++r) {
+    std::string rec = mftRecord(r, tree.Parent[r], tree.name(r), START_TIME + r, tree.IsDir[r]);
+    size_t used = rec.size();
+    rec.resize(opts.RecordSize, '\0');
+    // 4096 byte records come from 4Kn disks, so they hold a single sector
+    unsigned int sectorSize = opts.RecordSize == 4096 ? 4096 : 512;
+    putLE(rec, 0x06, opts.RecordSize / sectorSize + 1, 2);
+    putLE(rec, 0x1C, opts.RecordSize, 4);
+    protect(rec, 0, opts.RecordSize, static_cast<uint16_t>(r % 0xFFFF + 1), sectorSize);
+    if (isCorrupt(damage))
+      corrupt(rec, 0x38, used, damage);
+    mft.write(rec.data(), rec.size());
+  }
+
+  // $UsnJrnl/$J
+  UsnWriter usnWriter(dir + "/$J");
+  EventStream events(opts);
+  uint64_t kept = numEvents - static_cast<uint64_t>(opts.Wrap * numEvents);
+  for (uint64_t i = 0; i < numEvents; ++i) {
+    Event event = events.next();
+    bool keep = i >= numEvents - kept;
+    uint32_t parent = tree.Parent[event.Record];
+    std::string name = tree.name(event.Record);
+    std::vector<std::pair<unsigned int, std::string>> reasons;
+    switch (event.Kind) {
+      case EVENT_CREATE:
+        reasons = {{UsnReasons::USN_FILE_CREATE, name}, {UsnReasons::USN_CLOSE | UsnReasons::USN_FILE_CREATE, name}};
+        break;
+      case EVENT_WRITE:
+        reasons = {{UsnReasons::USN_DATA_EXTEND, name}, {UsnReasons::USN_CLOSE | UsnReasons::USN_DATA_EXTEND, name}};
+        break;
+      case EVENT_RENAME:
+        reasons = {{UsnReasons::USN_RENAME_OLD_NAME, oldName(event.Record)}, {UsnReasons::USN_RENAME_NEW_NAME, name},
+                   {UsnReasons::USN_CLOSE | UsnReasons::USN_RENAME_NEW_NAME, name}};
+        break;
+      case EVENT_DELETE:
+        reasons = {{UsnReasons::USN_CLOSE | UsnReasons::USN_FILE_DELETE, name}};
+        break;
+    }
+    for (auto& reason: reasons) {
+      std::string rec = usnRecord(event.Record, parent, 0, event.Time, reason.first, reason.second);
+      putLE(rec, 0x18, usnWriter.nextUsn(rec.size()), 8);
+      if (keep && isCorrupt(damage))
+        putLE(rec, 0x00, 0x123456, 4);  // A record length longer than the parser's buffer
+      usnWriter.add(rec, keep);
+      stats.UsnRecords += keep;
+    }
+  }
+  stats.UsnBytes = usnWriter.size();
+
+  /*
+  $LogFile. The log is circular: once it wraps, new pages overwrite the oldest ones
+  after the restart area. Working out its size takes a dry run of the transactions.
+  */
+  uint64_t capacity = UINT64_MAX;
+  if (opts.Wrap > 0) {
+    LogFileWriter counter([](const std::string&) {});
+    writeTransactions(opts, tree, numEvents, counter);
+    counter.finish();
+    capacity = std::max<uint64_t>(1, static_cast<uint64_t>((counter.NumPages - 4) * (1 - opts.Wrap)));
+  }
+  std::fstream log((dir + "/$LogFile").c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+  uint64_t page = 0;
+  LogFileWriter writer([&](const std::string& content) {
+    uint64_t slot = page < 4 ? page : 4 + (page - 4) % capacity;
+    std::string copy;
+    const std::string* out = &content;
+    if (page >= 4 && isCorrupt(damage)) {
+      copy = content;
+      corrupt(copy, 0x40, copy.size(), damage);
+      out = &copy;
+    }
+    log.seekp(slot * 4096);
+    log.write(out->data(), out->size());
+    ++page;
+  });
+  writeTransactions(opts, tree, numEvents, writer);
+  writer.finish();
+  stats.LogRecords = writer.NumRecords;
+  stats.LogPages = capacity == UINT64_MAX ? page : std::min<uint64_t>(page, capacity + 4);
+  return stats;
+}
+
+}
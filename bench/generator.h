@@ -0,0 +1,65 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/*
+Generates a $MFT, a sparse $UsnJrnl/$J and a $LogFile from a seeded model of a file system,
+so that the parsers can be benchmarked at scale without real images.
+The same options always produce the same files.
+*/
+namespace synth {
+  struct GeneratorOptions {
+    GeneratorOptions() : Records(100000), Depth(8), Churn(1.0), Wrap(0.0), Corrupt(0.0), Seed(1), RecordSize(1024) {}
+
+    // Number of $MFT records
+    uint64_t Records;
+    // Maximum depth of the directory tree
+    unsigned int Depth;
+    // File system events (create, write, rename, delete) per $MFT record
+    double Churn;
+    // Fraction of the event history which has been overwritten in the $UsnJrnl and $LogFile
+    double Wrap;
+    // Fraction of $MFT records, $UsnJrnl records and $LogFile pages which are damaged
+    double Corrupt;
+    uint64_t Seed;
+    // 1024, or 4096 as on 4Kn disks
+    unsigned int RecordSize;
+  };
+
+  struct GeneratorStats {
+    GeneratorStats() : Events(0), UsnRecords(0), UsnBytes(0), LogRecords(0), LogPages(0) {}
+    uint64_t Events, UsnRecords, UsnBytes, LogRecords, LogPages;
+  };
+
+  /*
+  Writes $MFT, $J and $LogFile into dir, which must exist
+  */
+  GeneratorStats generate(const GeneratorOptions& opts, const std::string& dir);
+}
@@ -0,0 +1,89 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+/*
+Writes a synthetic $MFT, $UsnJrnl/$J and $LogFile for benchmarking
+Usage: ntfs_synth output-dir [options]
+The output directory can be used as a snapshot folder in the ntfs-dir given to ntfs_linker
+*/
+
+#include "generator.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include <iostream>
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+int main(int argc, char** argv) {
+  synth::GeneratorOptions opts;
+  po::options_description desc("Allowed options");
+  po::positional_options_description posOpts;
+  posOpts.add("output", 1);
+  desc.add_options()
+    ("output", po::value<std::string>(), "directory in which to write $MFT, $J and $LogFile")
+    ("records", po::value<uint64_t>(&opts.Records)->default_value(opts.Records), "number of $MFT records")
+    ("depth", po::value<unsigned int>(&opts.Depth)->default_value(opts.Depth), "maximum directory depth")
+    ("churn", po::value<double>(&opts.Churn)->default_value(opts.Churn), "file system events per $MFT record")
+    ("wrap", po::value<double>(&opts.Wrap)->default_value(opts.Wrap), "fraction of the event history overwritten in the $UsnJrnl and $LogFile")
+    ("corrupt", po::value<double>(&opts.Corrupt)->default_value(opts.Corrupt), "fraction of records and pages damaged")
+    ("seed", po::value<uint64_t>(&opts.Seed)->default_value(opts.Seed), "random seed")
+    ("record-size", po::value<unsigned int>(&opts.RecordSize)->default_value(opts.RecordSize), "$MFT record size, 1024 or 4096")
+    ("help", "display help and exit");
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(posOpts).run(), vm);
+    po::notify(vm);
+  }
+  catch (std::exception& err) {
+    std::cerr << "Error: " << err.what() << std::endl;
+    return 1;
+  }
+  if (vm.count("help") || !vm.count("output")) {
+    std::cout << "Usage: ntfs_synth output [options]" << std::endl << desc << std::endl;
+    return vm.count("help") ? 0 : 1;
+  }
+  if (opts.RecordSize != 1024 && opts.RecordSize != 4096) {
+    std::cerr << "Error: record size must be 1024 or 4096" << std::endl;
+    return 1;
+  }
+  if (opts.Wrap < 0 || opts.Wrap >= 1 || opts.Corrupt < 0 || opts.Corrupt > 1) {
+    std::cerr << "Error: wrap must be in [0, 1) and corrupt in [0, 1]" << std::endl;
+    return 1;
+  }
+
+  std::string dir = vm["output"].as<std::string>();
+  fs::create_directories(dir);
+  synth::GeneratorStats stats = synth::generate(opts, dir);
+  std::cout << "$MFT: " << opts.Records << " records" << std::endl
+            << "$J: " << stats.UsnRecords << " records, " << stats.UsnBytes << " bytes" << std::endl
+            << "$LogFile: " << stats.LogRecords << " records, " << stats.LogPages << " pages" << std::endl
+            << "Events: " << stats.Events << std::endl;
+  return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "synth.h"
+
+#include "log.h"
+
+#include <algorithm>
+
+namespace synth {
+
+void putLE(std::string& buf, size_t offset, uint64_t value, int size) {
+  if (buf.size() < offset + size)
+    buf.resize(offset + size, '\0');
+  for (int i = 0; i < size; ++i) {
+    buf[offset + i] = static_cast<char>(value & 0xFF);
+    value >>= 8;
+  }
+}
+
+static size_t align8(size_t n) {
+  return (n + 7) & ~static_cast<size_t>(7);
+}
+
+std::string toUtf16(const std::string& ascii) {
+  std::string out;
+  out.reserve(2 * ascii.size());
+  for (char c: ascii) {
+    out.push_back(c);
+    out.push_back('\0');
+  }
+  return out;
+}
+
+std::string fileName(uint64_t parent, const std::string& name, uint64_t time) {
+  std::string fn(0x42, '\0');
+  putLE(fn, 0x00, parent, 8);
+  putLE(fn, 0x08, time,   8); // Created
+  putLE(fn, 0x10, time,   8); // Modified
+  putLE(fn, 0x18, time,   8); // MFT Modified
+  putLE(fn, 0x20, time,   8); // Accessed
+  putLE(fn, 0x40, name.size(), 1);
+  putLE(fn, 0x41, 1, 1);      // Win32 namespace
+  fn += toUtf16(name);
+  return fn;
+}
+
+std::string residentAttribute(uint32_t type, const std::string& content) {
+  std::string attr(0x18, '\0');
+  putLE(attr, 0x00, type, 4);
+  putLE(attr, 0x04, align8(0x18 + content.size()), 4);
+  putLE(attr, 0x0A, 0x18, 2);
+  putLE(attr, 0x10, content.size(), 4);
+  putLE(attr, 0x14, 0x18, 2);
+  attr += content;
+  attr.resize(align8(attr.size()), '\0');
+  return attr;
+}
+
+std::string indexEntry(uint64_t record, const std::string& fileNameContent) {
+  std::string entry(0x10, '\0');
+  putLE(entry, 0x00, record, 8);
+  putLE(entry, 0x08, align8(0x10 + fileNameContent.size()), 2);
+  putLE(entry, 0x0A, fileNameContent.size(), 2);
+  entry += fileNameContent;
+  entry.resize(align8(entry.size()), '\0');
+  return entry;
+}
+
+std::string mftRecord(uint32_t record, uint32_t parent, const std::string& name, uint64_t time, bool isDir) {
+  std::string rec(0x38, '\0');
+  rec.replace(0, 4, "FILE");
+  putLE(rec, 0x04, 0x30, 2);  // Update sequence offset
+  putLE(rec, 0x06, 3, 2);     // Update sequence count, for 1024 byte records
+  putLE(rec, 0x10, 1, 2);     // Sequence number
+  putLE(rec, 0x12, 1, 2);     // Link count
+  putLE(rec, 0x14, 0x38, 2);  // First attribute
+  putLE(rec, 0x16, isDir ? 3 : 1, 2);
+  putLE(rec, 0x1C, 1024, 4);
+  putLE(rec, 0x2C, record, 4);
+
+  std::string si(0x48, '\0');
+  for (int i = 0; i < 4; ++i)
+    putLE(si, 8 * i, time, 8);
+  rec += residentAttribute(0x10, si);
+  rec += residentAttribute(0x30, fileName(parent, name, time));
+  putLE(rec, rec.size(), 0xFFFFFFFF, 4);
+  putLE(rec, rec.size(), 0, 4);
+  putLE(rec, 0x18, rec.size(), 4);
+  return rec;
+}
+
+std::string usnRecord(uint64_t record, uint64_t parent, uint64_t usn, uint64_t time, uint32_t reason, const std::string& name) {
+  std::string rec(0x3C, '\0');
+  std::string utf16 = toUtf16(name);
+  putLE(rec, 0x04, 2, 2);   // Major version
+  putLE(rec, 0x08, record, 8);
+  putLE(rec, 0x10, parent, 8);
+  putLE(rec, 0x18, usn, 8);
+  putLE(rec, 0x20, time, 8);
+  putLE(rec, 0x28, reason, 4);
+  putLE(rec, 0x38, utf16.size(), 2);
+  putLE(rec, 0x3A, 0x3C, 2);
+  rec += utf16;
+  rec.resize(align8(rec.size()), '\0');
+  putLE(rec, 0x00, rec.size(), 4);
+  return rec;
+}
+
+void protect(std::string& buf, size_t offset, unsigned int len, uint16_t usn, unsigned int sectorSize) {
+  size_t seqOffset = offset + (static_cast<unsigned char>(buf[offset + 4]) | (static_cast<unsigned char>(buf[offset + 5]) << 8));
+  putLE(buf, seqOffset, usn, 2);
+  for (unsigned int i = 1; i * sectorSize <= len; ++i) {
+    size_t dataOffset = offset + i * sectorSize - 2;
+    buf[seqOffset + 2 * i]     = buf[dataOffset];
+    buf[seqOffset + 2 * i + 1] = buf[dataOffset + 1];
+    putLE(buf, dataOffset, usn, 2);
+  }
+}
+
+// RCRD page header, including the update sequence array, is 0x40 bytes
+static const unsigned int PAGE_SIZE = 4096;
+static const unsigned int PAGE_HEADER = 0x40;
+
+LogFileWriter::LogFileWriter(PageSink sink)
+  : NumRecords(0), NumPages(0), Sink(sink), Pos(PAGE_HEADER), FirstRecordOffset(0), Lsn(0x100000), PageUsn(1) {
+  // Restart area and buffer pages, which the parser skips
+  for (int i = 0; i < 4; ++i) {
+    Page.assign(PAGE_SIZE, '\0');
+    if (i < 2)
+      Page.replace(0, 4, "RSTR");
+    emit(Page);
+  }
+  Page.assign(PAGE_SIZE, '\0');
+}
+
+void LogFileWriter::emit(const std::string& page) {
+  if (Sink)
+    Sink(page);
+  else
+    Out += page;
+  ++NumPages;
+}
+
+uint64_t LogFileWriter::addRecord(int redoOp, int undoOp, const std::string& redo, const std::string& undo) {
+  std::string rec(0x58, '\0');
+  size_t redoLen = align8(redo.size()), undoLen = align8(undo.size());
+  uint64_t lsn = Lsn++;
+  putLE(rec, 0x00, lsn, 8);
+  putLE(rec, 0x08, lsn - 1, 8);
+  putLE(rec, 0x18, 0x28 + redoLen + undoLen, 4);
+  putLE(rec, 0x20, 1, 4);   // Client record
+  putLE(rec, 0x30, redoOp, 2);
+  putLE(rec, 0x32, undoOp, 2);
+  putLE(rec, 0x34, 0x28, 2);
+  putLE(rec, 0x36, redo.size(), 2);
+  putLE(rec, 0x38, 0x28 + redoLen, 2);
+  putLE(rec, 0x3A, undo.size(), 2);
+  rec += redo;
+  rec.resize(0x58 + redoLen, '\0');
+  rec += undo;
+  rec.resize(0x58 + redoLen + undoLen, '\0');
+
+  if (PAGE_SIZE - Pos < 0x30)
+    flushPage();
+  if (rec.size() > PAGE_SIZE - Pos)
+    putLE(rec, 0x28, 1, 2);   // Record continues on the next page
+  if (!FirstRecordOffset)
+    FirstRecordOffset = Pos;
+  write(rec);
+  ++NumRecords;
+  return lsn;
+}
+
+void LogFileWriter::write(const std::string& bytes) {
+  size_t written = 0;
+  while (written < bytes.size()) {
+    size_t n = std::min(bytes.size() - written, static_cast<size_t>(PAGE_SIZE - Pos));
+    Page.replace(Pos, n, bytes, written, n);
+    Pos += n;
+    written += n;
+    if (Pos == PAGE_SIZE)
+      flushPage();
+  }
+}
+
+void LogFileWriter::flushPage() {
+  Page.replace(0, 4, "RCRD");
+  putLE(Page, 0x04, 0x28, 2);
+  putLE(Page, 0x06, PAGE_SIZE / 512 + 1, 2);
+  putLE(Page, 0x08, Lsn - 1, 8);
+  putLE(Page, 0x14, 1, 2);
+  putLE(Page, 0x16, 1, 2);
+  putLE(Page, 0x18, FirstRecordOffset ? FirstRecordOffset : PAGE_HEADER, 2);
+  putLE(Page, 0x20, Lsn - 1, 8);
+  protect(Page, 0, PAGE_SIZE, PageUsn++);
+  if (PageUsn == 0)
+    PageUsn = 1;
+  emit(Page);
+  Page.assign(PAGE_SIZE, '\0');
+  Pos = PAGE_HEADER;
+  FirstRecordOffset = 0;
+}
+
+std::string LogFileWriter::finish() {
+  if (Pos > PAGE_HEADER)
+    flushPage();
+  return Out;
+}
+
+static std::string le32(uint32_t v) {
+  std::string s;
+  putLE(s, 0, v, 4);
+  return s;
+}
+
+void createTransaction(LogFileWriter& writer, uint32_t record, uint32_t parent, const std::string& name, uint64_t time, uint64_t usn) {
+  std::string fn = fileName(parent, name, time);
+  writer.addRecord(LogOps::SET_BITS_IN_NONRESIDENT_BIT_MAP, LogOps::CLEAR_BITS_IN_NONRESIDENT_BIT_MAP, le32(record), le32(record));
+  writer.addRecord(LogOps::NOOP, LogOps::DEALLOCATE_FILE_RECORD_SEGMENT, "", "");
+  writer.addRecord(LogOps::ADD_INDEX_ENTRY_ALLOCATION, LogOps::DELETE_INDEX_ENTRY_ALLOCATION, indexEntry(record, fn), "");
+  writer.addRecord(LogOps::INITIALIZE_FILE_RECORD_SEGMENT, LogOps::NOOP, mftRecord(record, parent, name, time, false), "");
+  writer.addRecord(LogOps::UPDATE_NONRESIDENT_VALUE, LogOps::NOOP, usnRecord(record, parent, usn, time, 0x100, name), "");
+  writer.addRecord(LogOps::FORGET_TRANSACTION, LogOps::COMPENSATION_LOG_RECORD, "", "");
+}
+
+void renameTransaction(LogFileWriter& writer, uint32_t record, uint32_t parent, const std::string& oldName, const std::string& newName, uint64_t time) {
+  std::string fn = fileName(parent, oldName, time);
+  std::string newFn = fileName(parent, newName, time);
+  writer.addRecord(LogOps::DELETE_INDEX_ENTRY_ALLOCATION, LogOps::ADD_INDEX_ENTRY_ALLOCATION, "", indexEntry(record, fn));
+  writer.addRecord(LogOps::DELETE_ATTRIBUTE, LogOps::CREATE_ATTRIBUTE, "", residentAttribute(0x30, fn));
+  writer.addRecord(LogOps::CREATE_ATTRIBUTE, LogOps::DELETE_ATTRIBUTE, residentAttribute(0x30, newFn), "");
+  writer.addRecord(LogOps::ADD_INDEX_ENTRY_ALLOCATION, LogOps::DELETE_INDEX_ENTRY_ALLOCATION, indexEntry(record, newFn), "");
+  writer.addRecord(LogOps::FORGET_TRANSACTION, LogOps::COMPENSATION_LOG_RECORD, "", "");
+}
+
+void deleteTransaction(LogFileWriter& writer, uint32_t record, uint32_t parent, const std::string& name, uint64_t time) {
+  std::string fn = fileName(parent, name, time);
+  writer.addRecord(LogOps::DELETE_INDEX_ENTRY_ALLOCATION, LogOps::ADD_INDEX_ENTRY_ALLOCATION, "", indexEntry(record, fn));
+  writer.addRecord(LogOps::DEALLOCATE_FILE_RECORD_SEGMENT, LogOps::INITIALIZE_FILE_RECORD_SEGMENT, "", mftRecord(record, parent, name, time, false));
+  writer.addRecord(LogOps::CLEAR_BITS_IN_NONRESIDENT_BIT_MAP, LogOps::SET_BITS_IN_NONRESIDENT_BIT_MAP, le32(record), le32(record));
+  writer.addRecord(LogOps::FORGET_TRANSACTION, LogOps::COMPENSATION_LOG_RECORD, "", "");
+}
+
+}
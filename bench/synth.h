@@ -0,0 +1,107 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/*
+Builders for synthetic NTFS artifacts, used by the benchmarks
+Everything is written little endian, in the on-disk layout the parsers expect
+*/
+namespace synth {
+  void putLE(std::string& buf, size_t offset, uint64_t value, int size);
+
+  std::string toUtf16(const std::string& ascii);
+
+  /*
+  Content of a $FILE_NAME attribute (no attribute header)
+  */
+  std::string fileName(uint64_t parent, const std::string& name, uint64_t time);
+
+  /*
+  A resident attribute, header included
+  */
+  std::string residentAttribute(uint32_t type, const std::string& content);
+
+  /*
+  An index entry wrapping a $FILE_NAME, as found in index allocation/root
+  */
+  std::string indexEntry(uint64_t record, const std::string& fileNameContent);
+
+  /*
+  A FILE record segment, without fixups applied. The record is truncated to its used size
+  */
+  std::string mftRecord(uint32_t record, uint32_t parent, const std::string& name, uint64_t time, bool isDir);
+
+  /*
+  A USN_RECORD_V2
+  */
+  std::string usnRecord(uint64_t record, uint64_t parent, uint64_t usn, uint64_t time, uint32_t reason, const std::string& name);
+
+  /*
+  Applies the update sequence array protection to a multi-sector record in place
+  The update sequence array must already be described by the header at offsets 4 and 6
+  */
+  void protect(std::string& buf, size_t offset, unsigned int len, uint16_t usn, unsigned int sectorSize=512);
+
+  /*
+  Assembles $LogFile client records into RCRD pages, splitting records across pages
+  the same way NTFS does.
+  Pages are collected and returned by finish(), or, if a sink is given, handed to it
+  as they are completed so that large files can be streamed.
+  */
+  class LogFileWriter {
+  public:
+    typedef std::function<void(const std::string& page)> PageSink;
+
+    LogFileWriter(PageSink sink = PageSink());
+    uint64_t addRecord(int redoOp, int undoOp, const std::string& redo, const std::string& undo);
+    std::string finish();
+
+    uint64_t NumRecords, NumPages;
+  private:
+    void write(const std::string& bytes);
+    void flushPage();
+    void emit(const std::string& page);
+
+    PageSink Sink;
+    std::string Out, Page;
+    unsigned int Pos, FirstRecordOffset;
+    uint64_t Lsn;
+    uint16_t PageUsn;
+  };
+
+  /*
+  $LogFile transactions as NTFS writes them for a create, rename and delete of a file.
+  The create includes an embedded $UsnJrnl record with the given usn.
+  */
+  void createTransaction(LogFileWriter& writer, uint32_t record, uint32_t parent, const std::string& name, uint64_t time, uint64_t usn);
+  void renameTransaction(LogFileWriter& writer, uint32_t record, uint32_t parent, const std::string& oldName, const std::string& newName, uint64_t time);
+  void deleteTransaction(LogFileWriter& writer, uint32_t record, uint32_t parent, const std::string& name, uint64_t time);
+}
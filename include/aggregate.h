@@ -26,29 +26,152 @@
 
 #pragma once
 
-#include "controller.h"
+#include "arrow.h"
 #include "file.h"
+#include "record_observer.h"
 #include "util.h"
 #include "sqlite_util.h"
+#include "tsv.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <list>
+#include <mutex>
 #include <sqlite3.h>
 #include <vector>
 #include <string>
+#include <unordered_map>
+#include <utility>
+
+// The paths of an event's record, parent and previous parent, "" where there's no record
+struct EventPaths {
+  std::string Folder, FullPath, PreviousFolder;
+};
 
 class Event {
 public:
   Event();
   void init(sqlite3_stmt* stmt);
-  void write(std::ostream& out, const std::vector<File>& records);
-  void updateRecords(std::vector<File>& records);
-  void insert(sqlite3_stmt* stmt, std::vector<File>& records);
+  void setVersion(const VersionInfo& version);
+  void write(TsvWriter& out);
+  void write(ArrowWriter& out);
+  std::string toJSON();
+  // Writes the event as a JSON line to StreamFd
+  void stream();
+  // Undoes the event in records. Returns whether any record changed
+  bool updateRecords(std::vector<File>& records);
+  void insert(SQLiteHelper& sqliteHelper);
   static std::string getColumnHeaders();
 
-  int64_t Record, Parent, PreviousParent, UsnLsn, Type, Source, Offset, Id, Order;
+  template<class Records>
+  EventPaths pathsIn(const Records& records) const {
+    EventPaths paths;
+    paths.Folder = Parent == -1 ? "" : getFullPath(records, Parent);
+    paths.FullPath = Record == -1 ? "" : getFullPath(records, Record);
+    paths.PreviousFolder = PreviousParent == -1 ? "" : getFullPath(records, PreviousParent);
+    return paths;
+  }
+
+  int64_t Record, Parent, PreviousParent, UsnLsn, Type, Source, Offset, Id, Order, SnapshotId;
   std::string Timestamp, Name, PreviousName, Created, Modified, Comment, Snapshot, Volume;
   bool IsAnchor, IsEmbedded;
+  /*
+  Paths as of the event, for events.txt, the stream and observers, and as of just before
+  it, once it's undone, which the database and Arrow tables have always had
+  */
+  EventPaths Paths, OlderPaths;
+
+  /*
+  File descriptor to which each event is written as a JSON line as soon as it's output, or -1.
+  Volumes processed in parallel share it, so each line is written whole under a lock
+  */
+  static std::atomic<int> StreamFd;
 };
 
-void outputEvents(std::vector<File>& records, SQLiteHelper& sqliteHelper, VolumeIO& volumeIO, const VersionInfo& version);
+/*
+The records of a snapshot at each step of a batch of events. Undoing the events changes
+records in place, in order; the changes are also logged, so that the records as they were
+before any event of the batch can be looked up afterwards, from any thread.
+*/
+class RecordVersions {
+public:
+  RecordVersions(std::vector<File>& records) : Records(records) {}
+
+  // The records before the version'th event of the batch was undone
+  class At {
+  public:
+    At(const RecordVersions& versions, unsigned int version) : Versions(versions), Version(version) {}
+    size_t size() const { return Versions.Records.size(); }
+    const File& operator[](unsigned int record) const;
+  private:
+    const RecordVersions& Versions;
+    unsigned int Version;
+  };
+
+  // Undoes event, the version'th of the batch. Returns whether any record changed
+  bool apply(Event& event, unsigned int version);
+  At at(unsigned int version) const { return At(*this, version); }
+  // Starts a new batch from the records as they are now
+  void clear() { Changes.clear(); }
+
+private:
+  std::vector<File>& Records;
+  // The values each changed record took, and the version from which it had each
+  std::unordered_map<unsigned int, std::vector<std::pair<unsigned int, File>>> Changes;
+};
+
+// The text of a column, or "" if it's NULL
+std::string textToString(const unsigned char* text);
+
+// Takes the events found in a snapshot, a batch at a time
+class EventSink {
+public:
+  virtual ~EventSink() {}
+  // The batch may be taken with swap
+  virtual void events(std::vector<Event>& batch) = 0;
+};
+
+/*
+Hands batches of events from the thread finding them to the one writing them. It holds at most
+capacity batches, the finder waiting for room, or any number if capacity is 0.
+*/
+class EventQueue : public EventSink {
+public:
+  EventQueue(size_t capacity) : Capacity(capacity), Closed(false) {}
+  void events(std::vector<Event>& batch);
+  // No more batches are coming
+  void close();
+  // Takes the next batch, waiting for one. Returns false once the queue is closed and empty
+  bool pop(std::vector<Event>& batch);
+
+private:
+  std::deque<std::vector<Event>> Batches;
+  size_t Capacity;
+  bool Closed;
+  std::mutex Mutex;
+  std::condition_variable Ready, Taken;
+};
+
+/*
+Merges the snapshot's $UsnJrnl and $LogFile events into one timeline, newest first, undoing each
+in records, and passes them to sink in batches, with their paths but not yet their positions.
+version must already be identified. Uses its own statements, so several snapshots can be read
+at once on different threads
+*/
+void findEvents(std::vector<File>& records, SQLiteHelper& sqliteHelper, const VersionInfo& version, EventSink& sink);
+
+/*
+Gives the events the next positions in the volume's timeline after position, which is advanced
+past them, then writes them to out and the database and passes them to the observers
+*/
+void writeEvents(std::vector<Event>& events, SQLiteHelper& sqliteHelper, TsvWriter& out, unsigned int& position,
+                 const std::vector<RecordObserver*>& observers);
+
+/*
+Finds the snapshot's events and writes them out, on this thread. position is the last position
+used in the volume's timeline, and is advanced past these events
+*/
+void outputEvents(std::vector<File>& records, SQLiteHelper& sqliteHelper, std::ostream& output, unsigned int& position, const VersionInfo& version,
+                  const std::vector<RecordObserver*>& observers = std::vector<RecordObserver*>());
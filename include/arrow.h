@@ -0,0 +1,169 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/*
+Just enough of a FlatBuffers builder for Arrow's metadata. As in the FlatBuffers library, the
+buffer is built back to front, so everything a table refers to has to be added before the table.
+Objects are identified by their distance from the end of the buffer.
+*/
+class FlatBufferBuilder {
+public:
+  FlatBufferBuilder() : MinAlign(1), TableStart(0) {}
+
+  uint32_t string(const std::string& str);
+  // Vector of tables or strings
+  uint32_t offsets(const std::vector<uint32_t>& items);
+  // Vector of count structs, already laid out in bytes
+  uint32_t structs(const std::string& bytes, uint32_t count, size_t align);
+
+  void startTable();
+  template<typename T>
+  void add(unsigned int id, T value) {
+    static_assert(std::is_arithmetic<T>::value, "scalars only");
+    align(sizeof(T));
+    prepend(static_cast<typename std::conditional<std::is_same<T, bool>::value, uint8_t, T>::type>(value));
+    Fields.push_back(std::make_pair(id, static_cast<uint32_t>(Data.size())));
+  }
+  void addOffset(unsigned int id, uint32_t object);
+  uint32_t endTable();
+
+  // Returns the finished buffer, with root as its root table
+  std::string finish(uint32_t root);
+
+private:
+  void align(size_t size, size_t extra = 0);
+  template<typename T>
+  void prepend(T value) {
+    // Data is stored reversed, so prepending is appending
+    for (int i = sizeof(T) - 1; i >= 0; i--)
+      Data += static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xFF);
+  }
+  void prepend(const char* bytes, size_t len);
+
+  std::string Data;
+  size_t MinAlign;
+  uint32_t TableStart;
+  std::vector<std::pair<unsigned int, uint32_t>> Fields;
+};
+
+/*
+Writes a table as an Arrow IPC file, which pandas, polars, DuckDB and pyarrow read directly and
+can convert to Parquet. Rows are buffered into record batches of BatchRows rows. Fields are
+added in column order, as with TsvWriter. Dictionary columns are strings stored as int32 keys
+into one dictionary per column, which is written once, after the last batch.
+*/
+class ArrowWriter {
+public:
+  enum ColumnType {
+    INT64,
+    UTF8,
+    DICTIONARY
+  };
+
+  struct Column {
+    Column(const std::string& name, ColumnType type) : Name(name), Type(type) {}
+    std::string Name;
+    ColumnType Type;
+  };
+
+  ArrowWriter(std::ostream& out, const std::vector<Column>& columns, size_t batchRows = DefaultBatchRows);
+  ~ArrowWriter();
+
+  template<typename T>
+  typename std::enable_if<std::is_integral<T>::value, ArrowWriter&>::type field(T value) {
+    return fieldInt(static_cast<int64_t>(value));
+  }
+  ArrowWriter& field(const std::string& value) { return field(value.data(), value.size()); }
+  ArrowWriter& field(const char* value) { return field(value, std::char_traits<char>::length(value)); }
+  ArrowWriter& field(const char* value, size_t len);
+  ArrowWriter& null();
+  void endRow();
+  // Writes the last batch, the dictionaries and the footer
+  void close();
+
+  static const size_t DefaultBatchRows = 1 << 16;
+
+private:
+  struct ColumnData {
+    ColumnData(const Column& column) : Name(column.Name), Type(column.Type), NullCount(0) {}
+    std::string Name;
+    ColumnType Type;
+    std::vector<uint8_t> Validity;
+    int64_t NullCount;
+    std::vector<int64_t> Ints;
+    std::vector<int32_t> Keys;
+    // Offsets and Chars hold the strings of UTF8 columns, and the dictionary of DICTIONARY ones
+    std::vector<int32_t> Offsets;
+    std::string Chars;
+    std::unordered_map<std::string, int32_t> Lookup;
+  };
+
+  struct Block {
+    int64_t Offset;
+    int32_t MetadataLength;
+    int64_t BodyLength;
+  };
+
+  ArrowWriter& fieldInt(int64_t value);
+  ColumnData& next(bool valid);
+  uint32_t buildSchema(FlatBufferBuilder& fbb);
+  uint32_t recordBatch(FlatBufferBuilder& fbb, const std::vector<const ColumnData*>& columns, bool dictionary, std::string& body);
+  void writeMessage(const std::string& metadata, const std::string& body, std::vector<Block>* blocks);
+  void writeBatch();
+  void write(const std::string& bytes);
+
+  std::ostream& Out;
+  std::vector<ColumnData> Columns;
+  size_t BatchRows, Rows, Current;
+  int64_t Position;
+  std::vector<Block> Dictionaries, Batches;
+  bool Closed;
+};
+
+/*
+The usn, log and event tables, as Arrow IPC files next to the database
+*/
+struct ArrowTables {
+  ArrowTables(const std::string& dir);
+
+  // Declared before the writers, so that they're opened first and closed last
+  std::ofstream UsnFile, LogFile, EventFile;
+  ArrowWriter Usn, Log, Events;
+
+  static const std::vector<ArrowWriter::Column> UsnColumns, LogColumns, EventColumns;
+  // The tables rows are written to, or NULL when not exporting
+  static ArrowTables* Active;
+};
@@ -0,0 +1,86 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Returns the length of the $LogFile record at buf if its 0x30-byte header and
+operation header look like a complete, plausible client record, or 0 otherwise.
+avail is the number of bytes available at buf.
+*/
+unsigned int carveRecordLength(const char* buf, unsigned int avail);
+
+/*
+A record recovered from a region of the $LogFile that the main parse skipped
+*/
+struct CarvedRecord {
+  uint64_t Offset;
+  std::vector<char> Data;
+};
+
+/*
+Scans slack space and stale pages of the $LogFile for older records.
+Regions are copied and queued by the parsing thread, and scanned on a worker
+thread so that carving doesn't slow down the main parse.
+*/
+class LogCarver {
+public:
+  LogCarver();
+  ~LogCarver();
+
+  /*
+  Queues bytes [start, end) of the page at buffer, which begins at pageOffset in the $LogFile
+  */
+  void submit(const char* buffer, uint64_t pageOffset, unsigned int start, unsigned int end);
+
+  /*
+  Waits for all queued regions to be scanned, and returns the carved records in file order
+  */
+  std::vector<CarvedRecord>& finish();
+
+private:
+  struct Region {
+    std::vector<char> Data;
+    uint64_t Offset;
+  };
+
+  void run();
+  void carve(const Region& region);
+
+  std::vector<CarvedRecord> Records;
+  std::deque<Region> Queue;
+  std::mutex Mutex;
+  std::condition_variable Ready;
+  bool Done;
+  std::thread Worker;
+};
@@ -0,0 +1,127 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include "pool.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum Compression: unsigned int {
+  COMPRESS_NONE,
+  COMPRESS_ZSTD
+};
+
+// The compressed and decompressed size of each frame of a seekable zstd file
+typedef std::vector<std::pair<uint32_t, uint32_t>> SeekTable;
+
+/*
+Compresses everything written to it into independent zstd frames of FrameSize bytes, on a pool
+of worker threads, and writes the frames out in order. On close, a seek table in the zstd
+seekable format is appended, so readers can start decompressing at any frame. Standard zstd
+tools skip the table and read the file as usual.
+*/
+class ZstdFrameBuf : public std::streambuf {
+public:
+  ZstdFrameBuf(std::streambuf* out, WorkerPool& pool = WorkerPool::shared(), int level = 3);
+  ~ZstdFrameBuf();
+
+  // The frames already in out, when appending, for the seek table to cover them as well
+  void resume(const SeekTable& frames);
+  // Compresses what's left and writes the seek table. Returns false on error
+  bool close();
+
+  /*
+  Reads the seek table at the end of a seekable zstd file. Returns false if there's none;
+  otherwise tableSize is the size of the skippable frame holding it
+  */
+  static bool readSeekTable(std::istream& in, SeekTable& frames, uint64_t& tableSize);
+
+  static const size_t FrameSize = 1 << 21;
+
+protected:
+  int_type overflow(int_type c);
+  int sync();
+
+private:
+  struct Frame {
+    Frame() : OutSize(0), Done(false), Failed(false) {}
+    std::vector<char> In, Out;
+    size_t OutSize;
+    bool Done, Failed;
+  };
+
+  void submit();
+  void compress(Frame& frame);
+  bool writeFinished(bool all);
+  void writeSeekTable();
+
+  std::streambuf* Out;
+  WorkerPool& Pool;
+  int Level;
+  // The frame being filled, allocated on the first write to it
+  std::vector<char> Buffer;
+  // In file order; the first MaxInFlight may be waiting for or in compression
+  std::deque<std::shared_ptr<Frame>> Frames;
+  size_t MaxInFlight;
+  SeekTable Written;
+  bool Closed, Failed;
+
+  std::mutex Mutex;
+  std::condition_variable Finished;
+};
+
+/*
+One of the text reports: a file stream, compressed if asked for
+*/
+class TextFile : public std::ostream {
+public:
+  TextFile() : std::ostream(NULL) {}
+  ~TextFile() { close(); }
+
+  /*
+  Opens name, with the compression's extension added, for appending or overwriting. A compressed
+  file is appended to by replacing its seek table with one covering the old and new frames.
+  */
+  void open(const std::string& name, bool overwrite, Compression compression);
+  void close();
+
+  static bool isSupported(Compression compression);
+
+private:
+  std::filebuf File;
+  std::unique_ptr<ZstdFrameBuf> Zstd;
+};
@@ -25,6 +25,8 @@
  */
 
 #pragma once
+#include "compress.h"
+#include "phases.h"
 #include "sqlite_util.h"
 
 #include <boost/filesystem.hpp>
@@ -33,16 +35,25 @@
 #include <vector>
 #include <fstream>
 #include <memory>
+#include <sstream>
 
 namespace fs = boost::filesystem;
 
 struct Options {
-  Options() : overwrite(false), extra(false) {}
+  Options() : overwrite(false), extra(false), carve(false), perfCounters(false), arrow(false), serial(false), compress(COMPRESS_NONE) {}
   fs::path input;
   fs::path output;
   bool overwrite;
   bool extra;
+  bool carve;
+  bool perfCounters;
+  bool arrow;
+  // Processes volumes and snapshots one at a time, as when SQLite can't be used from several threads
+  bool serial;
+  Compression compress;
   std::vector<std::string> imgSegs;
+  // Told about each phase of processing, e.g. for benchmarking
+  std::vector<PhaseObserver*> observers;
 };
 
 struct VolumeIO;
@@ -52,7 +63,7 @@ struct SnapshotIO {
 
   VolumeIO* Parent;
   std::ifstream IMft, IUsnJrnl, ILogFile;
-  std::ofstream OUsnJrnl, OLogFile;
+  TextFile OUsnJrnl, OLogFile;
   std::string Name;
   bool Good;
 };
@@ -62,10 +73,17 @@ struct ImageIO;
 
 struct VolumeIO {
   VolumeIO(Options& opts, ImageIO* parent);
+  // The volume's shard, while volumes are processed at once, otherwise the image's database
+  SQLiteHelper& sqliteHelper();
 
   ImageIO* Parent;
   std::vector<SnapshotIOPtr> Snapshots;
-  std::ofstream Events;
+  TextFile Events;
+  std::unique_ptr<SQLiteHelper> Shard;
+  std::string ShardName;
+  // Where status lines go; they're held back while volumes are processed at once
+  std::ostream* Status;
+  std::ostringstream HeldStatus;
   unsigned int Count;
   std::string Name;
   bool Good;
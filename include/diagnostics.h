@@ -0,0 +1,103 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include "sqlite_util.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+Kinds of damage or inconsistency found while parsing the input files
+*/
+enum AnomalyKinds: unsigned int {
+  ANOMALY_LOG_INVALID_RECORD_TYPE = 0,
+  ANOMALY_LOG_INVALID_OP_CODE = 1,
+  ANOMALY_USN_BAD_RECORD = 2,
+  ANOMALY_USN_RECOVERED = 3,
+  ANOMALY_USN_RECOVERY_FAILED = 4,
+  ANOMALY_USN_INCONSISTENT_USN = 5,
+  NUM_ANOMALY_KINDS = 6
+};
+
+std::string toString(AnomalyKinds kind);
+
+/*
+Counts the anomalies found while parsing one file of a snapshot, and keeps a sample of them
+(the first few of each kind, then every power of two) so that damaged images don't
+produce an unbounded amount of diagnostics.
+Anomalies are written to the diagnostics tables rather than reported one by one;
+the terminal only sees a periodic count and a summary at the end.
+*/
+class Diagnostics {
+public:
+  Diagnostics(const VersionInfo& version, const std::string& fileName);
+
+  /*
+  Counts an anomaly of the given kind at offset in the file. value holds kind-specific detail,
+  such as a bad record length or the number of bytes skipped
+  */
+  void record(AnomalyKinds kind, uint64_t offset, uint64_t value = 0);
+
+  uint64_t count(AnomalyKinds kind) const { return Counts[kind]; }
+  uint64_t total() const { return Total; }
+
+  /*
+  Writes the counters and sampled anomalies to the database
+  */
+  void insert(SQLiteHelper& sqliteHelper) const;
+
+  /*
+  Writes a one line summary of the counters to out, if there were any anomalies
+  */
+  void printSummary(std::ostream& out) const;
+
+  /*
+  Returns whether the n-th (1-based) anomaly of a kind is kept as a sample
+  */
+  static bool isSampled(uint64_t n);
+
+  struct Sample {
+    AnomalyKinds Kind;
+    uint64_t Offset, Value;
+  };
+  const std::vector<Sample>& samples() const { return Samples; }
+
+  // Minimum time between progress reports to std::cerr
+  static std::chrono::steady_clock::duration ReportInterval;
+
+private:
+  const VersionInfo* Version;
+  std::string FileName;
+  uint64_t Counts[NUM_ANOMALY_KINDS];
+  std::vector<Sample> Samples;
+  uint64_t Total, LastReported;
+  std::chrono::steady_clock::time_point LastReport;
+};
@@ -26,6 +26,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 /*
@@ -38,15 +39,24 @@ class File {
       Record(0),
       Parent(0),
       Timestamp(""),
-      Valid(false) {}
+      Valid(false),
+      DataSize(0),
+      HasData(false),
+      DataResident(false) {}
     File(std::string name, unsigned int record, unsigned int parent, std::string timestamp) :
       Name(name),
       Record(record),
       Parent(parent),
       Timestamp(timestamp),
-      Valid(true) {}
+      Valid(true),
+      DataSize(0),
+      HasData(false),
+      DataResident(false) {}
     std::string Name;
     unsigned int Record, Parent;
     std::string Timestamp;
     bool Valid;
+    // Size of the unnamed $DATA stream, if the file has one
+    uint64_t DataSize;
+    bool HasData, DataResident;
 };
@@ -0,0 +1,110 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include "file.h"
+#include "record_observer.h"
+#include "sqlite_util.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Keeps the name and parent each record had over time in the record_history table, as events
+are output from newest to oldest. Each row is one version of a record, valid from ValidFrom
+(inclusive) to ValidTo (exclusive), between the events at FromPosition and ToPosition. ValidFrom
+is '' for versions older than any event, and ValidTo is '' for those current in the newest
+snapshot. $LogFile events without a timestamp of their own take that of the nearest newer
+event which has one, and an event which claims to be newer than one before it in the timeline
+takes that one's time.
+
+Record numbers are reused, so a record's versions can belong to several files in turn; they're
+separated by the times it was created and deleted. Sequence numbers aren't tracked.
+*/
+class RecordHistory : public RecordObserver {
+public:
+  RecordHistory(SQLiteHelper& sqliteHelper) : SqliteHelper(sqliteHelper), VolumeId(-1), NumRecords(0), Seeded(false) {}
+
+  /*
+  Starts from the records of the newest snapshot, before any of its events are undone; the
+  versions in older snapshots follow from the events
+  */
+  void seed(const std::vector<File>& records);
+  // Called before the events of each snapshot, with the size of its $MFT
+  void start(const VersionInfo& version, size_t numRecords);
+  void event(const Event& event);
+  // Writes the versions which go back past the oldest event
+  void finish();
+
+private:
+  struct Version {
+    Version() : Parent(-1), ToPosition(-1), Exists(false) {}
+    std::string Name;
+    int64_t Parent;
+    std::string ValidTo;
+    int64_t ToPosition;
+    bool Exists;
+  };
+
+  Version& at(int64_t record);
+  void write(int64_t record, const Version& version, const std::string& validFrom, int64_t fromPosition);
+
+  SQLiteHelper& SqliteHelper;
+  // The oldest version seen of each record so far
+  std::vector<Version> Versions;
+  std::string LastTimestamp;
+  int64_t VolumeId;
+  // Size of the $MFT of the snapshot being finalized
+  size_t NumRecords;
+  bool Seeded;
+};
+
+/*
+Answers what path a record had at a given time, from the record_history table of an existing
+database. Each step up the path is one indexed lookup.
+*/
+class PathHistory {
+public:
+  PathHistory(const std::string& dbName);
+  ~PathHistory();
+
+  bool good() const { return Select != NULL; }
+  // Volume names and keys in the database
+  std::vector<std::pair<std::string, int64_t>> volumes();
+  /*
+  The full path of record at time, an ISO 8601 timestamp as in events.txt, e.g.
+  "2012-12-14 23:13:26.0000000". Returns false if the record didn't exist then
+  */
+  bool pathAt(int64_t volumeId, int64_t record, const std::string& time, std::string& path);
+
+private:
+  bool lookup(int64_t volumeId, int64_t record, const std::string& time, std::string& name, int64_t& parent);
+
+  sqlite3* Db;
+  sqlite3_stmt* Select;
+};
@@ -0,0 +1,196 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+/*
+Decoders for the little-endian fields of NTFS structures, and typed views of the
+structures which name their fields instead of scattering offsets through the parsers.
+*/
+
+/*
+Reads a little-endian T from an unaligned buffer. On little-endian hosts this is a
+single unaligned load.
+*/
+template <typename T>
+inline T le(const char* buf) {
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  T value;
+  memcpy(&value, buf, sizeof(T));
+  return value;
+#else
+  T value = 0;
+  for (int i = sizeof(T) - 1; i >= 0; --i)
+    value = (value << 8) | static_cast<unsigned char>(buf[i]);
+  return value;
+#endif
+}
+
+template <>
+inline uint8_t le<uint8_t>(const char* buf) {
+  return static_cast<uint8_t>(buf[0]);
+}
+
+/*
+Reads the 48-bit record number of a file reference
+*/
+inline uint64_t le48(const char* buf) {
+  return le<uint32_t>(buf) | static_cast<uint64_t>(le<uint16_t>(buf + 4)) << 32;
+}
+
+/*
+USN_RECORD_V2, as found in $UsnJrnl:$J and embedded in $LogFile records
+*/
+struct UsnRecordV2 {
+  explicit UsnRecordV2(const char* data) : Data(data) {}
+
+  uint32_t length() const          { return le<uint32_t>(Data); }
+  uint64_t record() const          { return le48(Data + 0x8); }
+  uint64_t reference() const       { return le<uint64_t>(Data + 0x8); }
+  uint64_t parent() const          { return le48(Data + 0x10); }
+  uint64_t parentReference() const { return le<uint64_t>(Data + 0x10); }
+  uint64_t usn() const             { return le<uint64_t>(Data + 0x18); }
+  uint64_t timestamp() const       { return le<uint64_t>(Data + 0x20); }
+  uint32_t reason() const          { return le<uint32_t>(Data + 0x28); }
+  uint16_t nameLength() const      { return le<uint16_t>(Data + 0x38); }
+  uint16_t nameOffset() const      { return le<uint16_t>(Data + 0x3A); }
+
+  const char* Data;
+};
+
+/*
+Header shared by multi-sector structures ($MFT FILE records, $LogFile RCRD pages)
+*/
+struct MultiSectorHeader {
+  explicit MultiSectorHeader(const char* data) : Data(data) {}
+
+  uint32_t magic() const     { return le<uint32_t>(Data); }
+  uint16_t usaOffset() const { return le<uint16_t>(Data + 0x4); }
+  uint16_t usaCount() const  { return le<uint16_t>(Data + 0x6); }
+
+  const char* Data;
+};
+
+// "FILE"
+const uint32_t FILE_MAGIC = 0x454C4946;
+// "RCRD"
+const uint32_t RCRD_MAGIC = 0x44524352;
+
+/*
+FILE record segment header at the start of each $MFT record
+*/
+struct FileRecordHeader: public MultiSectorHeader {
+  explicit FileRecordHeader(const char* data) : MultiSectorHeader(data) {}
+
+  uint64_t lsn() const             { return le<uint64_t>(Data + 0x8); }
+  uint16_t attributeOffset() const { return le<uint16_t>(Data + 0x14); }
+  uint16_t flags() const           { return le<uint16_t>(Data + 0x16); }
+  uint32_t usedSize() const        { return le<uint32_t>(Data + 0x18); }
+  uint32_t allocatedSize() const   { return le<uint32_t>(Data + 0x1C); }
+  uint64_t baseRecord() const      { return le48(Data + 0x20); }
+  uint32_t record() const          { return le<uint32_t>(Data + 0x2C); }
+
+  static const unsigned int SIZE = 0x30;
+};
+
+/*
+Header of an attribute in a FILE record, or in a $LogFile attribute operation
+*/
+struct AttributeHeader {
+  explicit AttributeHeader(const char* data) : Data(data) {}
+
+  uint32_t type() const        { return le<uint32_t>(Data); }
+  uint32_t length() const      { return le<uint32_t>(Data + 0x4); }
+  uint8_t nonResident() const  { return le<uint8_t>(Data + 0x8); }
+  uint8_t nameLength() const   { return le<uint8_t>(Data + 0x9); }
+  // Resident attributes
+  uint32_t contentSize() const   { return le<uint32_t>(Data + 0x10); }
+  uint16_t contentOffset() const { return le<uint16_t>(Data + 0x14); }
+  // Non-resident attributes
+  uint64_t startingVcn() const { return le<uint64_t>(Data + 0x10); }
+  uint64_t dataSize() const    { return le<uint64_t>(Data + 0x30); }
+
+  const char* Data;
+};
+
+/*
+Header of a $LogFile record page
+*/
+struct RcrdPageHeader: public MultiSectorHeader {
+  explicit RcrdPageHeader(const char* data) : MultiSectorHeader(data) {}
+
+  uint64_t lastLsn() const          { return le<uint64_t>(Data + 0x8); }
+  uint16_t nextRecordOffset() const { return le<uint16_t>(Data + 0x18); }
+  // Where the records start, after the header and update sequence array
+  unsigned int dataOffset() const   { return usaOffset() + (usaCount() + 3) / 4 * 8; }
+};
+
+/*
+The 0x30-byte header of each $LogFile record, followed by ClientDataLength bytes
+*/
+struct LogRecordHeader {
+  explicit LogRecordHeader(const char* data) : Data(data) {}
+
+  uint64_t currentLsn() const       { return le<uint64_t>(Data); }
+  uint64_t previousLsn() const      { return le<uint64_t>(Data + 0x8); }
+  uint64_t undoLsn() const          { return le<uint64_t>(Data + 0x10); }
+  uint32_t clientDataLength() const { return le<uint32_t>(Data + 0x18); }
+  uint32_t clientId() const         { return le<uint32_t>(Data + 0x1C); }
+  uint32_t recordType() const       { return le<uint32_t>(Data + 0x20); }
+  uint16_t flags() const            { return le<uint16_t>(Data + 0x28); }
+
+  static const unsigned int SIZE = 0x30;
+  const char* Data;
+};
+
+/*
+The redo/undo operation header which starts the client data of a $LogFile record.
+Redo and undo offsets are relative to it.
+*/
+struct LogOperationHeader {
+  explicit LogOperationHeader(const char* data) : Data(data) {}
+
+  uint16_t redoOp() const          { return le<uint16_t>(Data); }
+  uint16_t undoOp() const          { return le<uint16_t>(Data + 0x2); }
+  uint16_t redoOffset() const      { return le<uint16_t>(Data + 0x4); }
+  uint16_t redoLength() const      { return le<uint16_t>(Data + 0x6); }
+  uint16_t undoOffset() const      { return le<uint16_t>(Data + 0x8); }
+  uint16_t undoLength() const      { return le<uint16_t>(Data + 0xA); }
+  uint16_t targetAttribute() const { return le<uint16_t>(Data + 0xC); }
+  uint16_t lcnsToFollow() const    { return le<uint16_t>(Data + 0xE); }
+  uint16_t recordOffset() const    { return le<uint16_t>(Data + 0x10); }
+  uint16_t attributeOffset() const { return le<uint16_t>(Data + 0x12); }
+  uint16_t mftClusterIndex() const { return le<uint16_t>(Data + 0x14); }
+  uint32_t targetVcn() const       { return le<uint32_t>(Data + 0x18); }
+  uint32_t targetLcn() const       { return le<uint32_t>(Data + 0x20); }
+
+  // Up to the end of the first target LCN's low half, the last field read
+  static const unsigned int SIZE = 0x24;
+  const char* Data;
+};
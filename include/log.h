@@ -26,10 +26,13 @@
 
 #pragma once
 
+#include "arrow.h"
 #include "file.h"
 #include "mft.h"
+#include "record_observer.h"
 #include "sqlite_util.h"
 #include "usn.h"
+#include "util.h"
 
 #include <iostream>
 #include <string>
@@ -38,21 +41,32 @@
 /*
 returns the meaning of the operation code
 */
-std::string decodeLogFileOpCode(int op);
+const char* decodeLogFileOpCode(int op);
 
 /*
-Parses the $LogFile stream input
+Parses the $LogFile stream input, and returns the number of log records parsed
 Writes output to designated streams
+If carve is set, slack space and stale pages skipped by the parser are scanned for older records,
+whose events are recorded with the SOURCE_LOG_CARVED source
+Each log record, and each $UsnJrnl record embedded in one, is passed to the observers
 */
-void parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std::istream& input, std::ostream& output, const VersionInfo& version, bool extra);
+uint64_t parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std::istream& input, std::ostream& output, const VersionInfo& version, bool extra, bool carve = false,
+                  const std::vector<RecordObserver*>& observers = std::vector<RecordObserver*>());
 
 class LogRecord {
 public:
-  LogRecord(const VersionInfo& version) : Snapshot(version.Snapshot), Volume(version.Volume) {}
+  LogRecord(const VersionInfo& version) : Version(&version) { clearFields(); }
 
-  int init(char* buffer, uint64_t offset, bool prev_has_next);
+  /*
+  Parses the record at buffer, of which size bytes may be read. Returns the record's length, -1
+  if the record continues on the next page, -2 if there's no record here, or -3 if the record
+  has invalid op codes
+  */
+  int init(char* buffer, unsigned int size, uint64_t offset);
   void clearFields();
-  void insert(sqlite3_stmt* stmt);
+  void insert(SQLiteHelper& sqliteHelper);
+  void write(TsvWriter& out) const;
+  void write(ArrowWriter& out) const;
   static std::string getColumnHeaders();
 
   uint64_t CurrentLsn, PreviousLsn, UndoLsn, Offset;
@@ -60,13 +74,16 @@ public:
   unsigned int TargetAttribute, LcnsToFollow, RecordOffset, AttributeOffset, MftClusterIndex, TargetVcn, TargetLcn;
   unsigned int ClientDataLength;
   char* Data;
-  std::string Snapshot, Volume;
+  // The bytes of client data actually in the buffer, which a damaged ClientDataLength may exceed
+  unsigned int AvailableLength;
+  const VersionInfo* Version;
 };
-std::ostream& operator<<(std::ostream& out, const LogRecord& rec);
 
 class LogData {
 public:
-  LogData(const VersionInfo& version) : Snapshot(version.Snapshot), Volume(version.Volume), PrevUsnRecord(version, true) {}
+  LogData(const VersionInfo& version) : Source(EventSources::SOURCE_LOG), Version(&version), PrevUsnRecord(version, true), ScratchUsnRecord(version) {
+    ScratchUsnRecord.IsEmbedded = true;
+  }
 
   void clearFields();
   void processLogRecord(const std::vector<File>& records, LogRecord& rec, SQLiteHelper& sqliteHelper, uint64_t fileOffset);
@@ -74,22 +91,32 @@ public:
   std::string toDeleteString(std::vector<File>& records);
   std::string toRenameString(std::vector<File>& records);
   std::string toMoveString(std::vector<File>& records);
-  void insertEvent(unsigned int type, sqlite3_stmt* stmt);
+  void insertEvent(unsigned int type, SQLiteHelper& sqliteHelper);
   bool isCreateEvent();
   bool isDeleteEvent();
   bool isRenameEvent();
   bool isMoveEvent();
   bool isTransactionOver();
 
+  /*
+  Folds rec into the current transaction, and records any events once the transaction is over
+  */
+  void addRecord(const std::vector<File>& records, LogRecord& rec, SQLiteHelper& sqliteHelper, uint64_t fileOffset);
+
+  // Event source recorded for this transaction run's events
+  unsigned int Source;
   int64_t Record, Offset;
   uint64_t Lsn;
-  std::string Timestamp, Created, Modified, Comment, Snapshot, Volume;
+  std::string Timestamp, Created, Modified, Comment;
+  const VersionInfo* Version;
   FNAttribute Fna, PreviousFna;
   std::vector<int> RedoOps, UndoOps;
 
   static const std::vector<int> createRedo, createUndo, deleteRedo, deleteUndo;
   static const std::vector<int> renameRedo, renameUndo, writeRedo, writeUndo;
   UsnRecord PrevUsnRecord;
+  // Told about embedded $UsnJrnl records
+  std::vector<RecordObserver*> Observers;
 private:
   /*
   Used for $LogFile event analysis
@@ -98,6 +125,11 @@ private:
   if interchange is set, then it is considered that 0xc == 0xe and 0xd == 0xf
   */
   bool transactionRunMatch(const std::vector<int>& redo2, const std::vector<int>& undo2, bool interchange = true);
+
+  // Scratch objects reused for every record, so that parsing doesn't allocate per record
+  MFTRecord ScratchMft;
+  FNAttribute ScratchFna;
+  UsnRecord ScratchUsnRecord;
 };
 
 namespace LogOps {
@@ -27,6 +27,7 @@
 #pragma once
 
 #include "file.h"
+#include "pool.h"
 #include "sqlite_util.h"
 
 #include <iostream>
@@ -37,10 +38,17 @@ Returns the column headers used in the MFT csv file
 */
 std::string getMFTColumnHeaders();
 
+// Most bytes of records parsed by one task, and read but not yet parsed over all of them
+const unsigned int MFT_SHARD_BYTES = 16 << 20;
+const unsigned int MFT_MAX_BYTES_IN_FLIGHT = 64 << 20;
+
 /*
-Parses all the MFT records
+Parses all the MFT records into records, indexed by record number
+Names and $DATA sizes held in extension records are attributed to their base record
+The $MFT is split into shards which are parsed concurrently on pool
 */
-void parseMFT(std::vector<File>& records, std::istream& input);
+void parseMFT(std::vector<File>& records, std::istream& input, WorkerPool& pool = WorkerPool::shared(),
+              uint64_t maxBytesInFlight = MFT_MAX_BYTES_IN_FLIGHT);
 
 class SIAttribute {
 public:
@@ -48,6 +56,9 @@ public:
                   Usn(0), Valid(false) {}
   SIAttribute(char* buffer);
 
+  // Up to and including the update sequence number, as of NTFS 3.0
+  static const unsigned int SIZE = 0x48;
+
   uint64_t Created, Modified, MFTModified, Accessed;
   uint64_t Usn;
 private:
@@ -58,7 +69,13 @@ class FNAttribute {
 public:
   FNAttribute() : Parent(0), Created(0), Modified(0), MFTModified(0), Accessed(0),
                   LogicalSize(0), PhysicalSize(0), Name(""), Valid(false), NameType(0) {}
-  FNAttribute(char* buffer);
+  FNAttribute(char* buffer, size_t len);
+  /*
+  Parses the attribute's content, of which len bytes may be read. Returns false, leaving the
+  attribute invalid, if the name doesn't fit
+  */
+  bool init(char* buffer, size_t len);
+  void clear();
   unsigned int Parent;
   uint64_t Created, Modified, MFTModified, Accessed;
   uint64_t LogicalSize, PhysicalSize;
@@ -67,22 +84,38 @@ public:
   int NameType;
 
   bool operator<(const FNAttribute& other) const;
+
+  static const unsigned int NAME_OFFSET = 0x42;
 };
 
 class MFTRecord {
 public:
+  MFTRecord() : Record(0), BaseRecord(0), DataSize(0), HasData(false), DataResident(false) {}
   MFTRecord(char* buffer, unsigned int len=1024);
+  /*
+  Parses the record in buffer. Returns false if buffer doesn't hold a FILE record
+  */
+  bool init(char* buffer, unsigned int len=1024);
   std::string toString(std::vector<File>& records);
   void insert(sqlite3_stmt* stmt, std::vector<File>& records);
   File asFile();
 
   unsigned int Record;
+  // For an extension record, the record holding its $STANDARD_INFORMATION and $ATTRIBUTE_LIST. 0 otherwise.
+  unsigned int BaseRecord;
   SIAttribute Sia;
 
   // There may be multiple, but we'll pick just one.
   FNAttribute Fna;
 
+  // The unnamed $DATA stream
+  uint64_t DataSize;
+  bool HasData, DataResident;
+
 private:
   uint64_t Lsn;
   bool isDir, isAllocated;
+
+  // Scratch space for $FILE_NAME candidates, kept so that init() can be called repeatedly
+  FNAttribute Candidate;
 };
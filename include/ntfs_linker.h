@@ -0,0 +1,120 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+
+/*
+The embeddable interface to ntfs-linker: parses a volume's $MFT, $UsnJrnl:$J and $LogFile from
+streams and hands back records and events through callbacks, without writing any files. SQLite
+is only used internally, in memory. Separate Volumes may be run on separate threads at once.
+
+Times are FILETIMEs, the number of 100ns intervals since 1601-01-01 UTC, and record numbers are
+MFT record numbers. Either is -1 where unknown.
+*/
+namespace ntfs_linker {
+
+struct UsnRecord {
+  int64_t Record, Parent, Usn, Timestamp;
+  uint32_t Reason;
+  // Reason flags as text, e.g. "USN|CLOSE|FILE_CREATE"
+  std::string Reasons;
+  std::string Name, FullPath, Folder, Snapshot;
+  // Offset in $J, or in $LogFile if the record was embedded in a $LogFile record
+  uint64_t Offset;
+  bool IsEmbedded;
+  // Size of the unnamed $DATA stream of the file in the snapshot's $MFT, like FullPath, or -1 if it has none
+  int64_t DataSize;
+  // Whether that $DATA is resident, stored in the MFT record itself
+  bool DataResident;
+};
+
+struct LogRecord {
+  uint64_t CurrentLsn, PreviousLsn, UndoLsn, Offset;
+  uint32_t ClientId, RecordType, RedoOp, UndoOp, TargetAttribute, MftClusterIndex, TargetVcn, TargetLcn;
+  // Names of the operations, e.g. "InitializeFileRecordSegment"
+  std::string RedoOpName, UndoOpName, Snapshot;
+};
+
+struct Event {
+  // Position in the volume's timeline, which runs from newest to oldest
+  int64_t Position;
+  // Only set on anchor events; see the docs on event ordering
+  int64_t Timestamp;
+  // E.g. "$UsnJrnl/$J" and "Create", as in events.txt
+  std::string Source, Type;
+  std::string Name, Folder, FullPath;
+  int64_t Record, Parent;
+  int64_t UsnLsn;
+  std::string PreviousName, PreviousFolder;
+  int64_t PreviousParent;
+  int64_t Offset;
+  int64_t Created, Modified;
+  std::string Comment, Snapshot, Volume;
+};
+
+/*
+Receives the results of a Volume, on the thread which runs it. Override what's needed.
+*/
+class Handler {
+public:
+  virtual ~Handler() {}
+  virtual void usnRecord(const UsnRecord&) {}
+  virtual void logRecord(const LogRecord&) {}
+  virtual void event(const Event&) {}
+};
+
+/*
+One volume, with its snapshots added from oldest to newest, the live volume last. run() parses
+every snapshot, passing on their $UsnJrnl and $LogFile records, and then outputs the volume's
+events, newest first. The streams must stay valid and seekable until run() returns; $MFT is
+read twice.
+*/
+class Volume {
+public:
+  Volume(const std::string& name, Handler& handler, bool carve = false);
+  ~Volume();
+
+  void addSnapshot(const std::string& name, std::istream& mft, std::istream& usnJrnl, std::istream& logFile);
+  // Returns the number of events
+  uint64_t run();
+
+private:
+  struct State;
+  std::unique_ptr<State> Impl;
+};
+
+/*
+Whether parsing draws progress bars on std::cout, for the whole process. Defaults to false. It may
+be changed while Volumes run, but the bars of Volumes run at once are drawn over each other
+*/
+void showProgress(bool show);
+
+}
@@ -0,0 +1,71 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include "phases.h"
+#include "sqlite_util.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+enum PerfCounterKinds: unsigned int {
+  PERF_CYCLES = 0,
+  PERF_INSTRUCTIONS = 1,
+  PERF_CACHE_MISSES = 2,
+  PERF_BRANCH_MISSES = 3,
+  NUM_PERF_COUNTERS = 4
+};
+
+typedef std::array<int64_t, NUM_PERF_COUNTERS> PerfValues;
+
+/*
+Reads hardware performance counters around each phase with perf_event_open, and inserts
+them into the perf_stats table. Counters follow the thread which created them, and the
+threads it starts once they've exited, so phases should be reported from that thread, and
+the SQLiteHelper's rows are only counted if it's initialized without its writer thread.
+Only available on Linux; elsewhere good() is false.
+*/
+class PerfCounters: public PhaseObserver {
+public:
+  PerfCounters(SQLiteHelper& sqliteHelper);
+  ~PerfCounters();
+
+  // Whether any counter could be opened
+  bool good() const;
+  // Counts since the counters were opened, scaled for multiplexing; -1 where a counter isn't available
+  PerfValues read() const;
+
+  void beginPhase(const PhaseInfo& info);
+  void endPhase(const PhaseInfo& info);
+
+private:
+  SQLiteHelper& SqliteHelper;
+  int Fds[NUM_PERF_COUNTERS];
+  // Counts at the start of each phase in progress, innermost last
+  std::vector<PerfValues> Open;
+};
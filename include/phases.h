@@ -0,0 +1,81 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+The stages of processing a volume
+*/
+enum Phases: unsigned int {
+  PHASE_MFT = 0,
+  PHASE_USN = 1,
+  PHASE_LOG = 2,
+  PHASE_FINALIZE = 3,
+  PHASE_COMMIT = 4,
+  NUM_PHASES = 5
+};
+
+std::string toString(Phases phase);
+
+struct PhaseInfo {
+  PhaseInfo(Phases phase, const std::string& volume, const std::string& snapshot)
+    : Phase(phase), Volume(volume), Snapshot(snapshot), Records(0), Bytes(0) {}
+
+  Phases Phase;
+  std::string Volume, Snapshot;
+  // Records processed and input bytes read, when known at the end of the phase
+  uint64_t Records, Bytes;
+};
+
+/*
+Notified as processing enters and leaves each phase, on the thread doing the work
+*/
+class PhaseObserver {
+public:
+  virtual ~PhaseObserver() {}
+  virtual void beginPhase(const PhaseInfo& info) = 0;
+  virtual void endPhase(const PhaseInfo& info) = 0;
+  // Whether phases may begin and end on several threads at once, as when volumes are processed in parallel
+  virtual bool isThreadSafe() const { return false; }
+};
+
+/*
+Notifies the observers of a phase for as long as it's in scope.
+Info.Records and Info.Bytes should be filled in before the scope ends.
+*/
+class PhaseScope {
+public:
+  PhaseScope(const std::vector<PhaseObserver*>& observers, Phases phase, const std::string& volume, const std::string& snapshot);
+  ~PhaseScope();
+
+  PhaseInfo Info;
+private:
+  const std::vector<PhaseObserver*>& Observers;
+};
@@ -0,0 +1,91 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Worker threads shared by everything which splits its work into tasks: the shards of the $MFT,
+the paths of event batches and the frames of compressed reports. Sharing one pool keeps the
+threads at one per core, however many snapshots and volumes are processed at once.
+The workers are started by the first task.
+*/
+class WorkerPool {
+public:
+  // threads of 0 uses one per core
+  explicit WorkerPool(unsigned int threads = 0);
+  ~WorkerPool();
+
+  unsigned int size() const { return Size; }
+  void submit(std::function<void()> task);
+  // Runs the next queued task on the calling thread. Returns false if there was none
+  bool runOne();
+  /*
+  Stops the workers once the queue is empty; the next task starts new ones. Hardware counters
+  inherited by threads only include them once they've exited, so this is done after each phase.
+  */
+  void retire();
+
+  // The pool used unless another is given
+  static WorkerPool& shared();
+
+private:
+  void work(uint64_t generation);
+
+  unsigned int Size;
+  // Bumped by retire(); workers of an older generation exit when there's nothing left to do
+  uint64_t Generation;
+  std::deque<std::function<void()>> Queue;
+  std::vector<std::thread> Workers;
+  std::mutex Mutex;
+  std::condition_variable Ready;
+};
+
+/*
+Tasks on a pool which are waited for together. The waiting thread runs queued tasks as well,
+so waiting never depends on a worker being free.
+*/
+class TaskGroup {
+public:
+  explicit TaskGroup(WorkerPool& pool) : Pool(pool), Pending(0) {}
+  ~TaskGroup() { wait(); }
+
+  void run(std::function<void()> task);
+  void wait();
+
+private:
+  WorkerPool& Pool;
+  unsigned int Pending;
+  std::mutex Mutex;
+  std::condition_variable Done;
+};
@@ -26,21 +26,50 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
 
+/*
+Reports the progress of one parse. Any number of workers may update the counters, which
+are atomic and cheap enough to update per record. A separate thread renders them at a
+fixed rate, as a bar with MB/s, records/s and ETA on std::cout, and optionally as JSON
+lines to a file descriptor for programs which poll it.
+*/
 class ProgressBar {
-private:
-  uint64_t done;
-  uint64_t toDo;
-  int last;
 public:
-  void addToDo(uint64_t x);
-  void addDone(uint64_t x);
-  void setDone(uint64_t x);
-  void printProgress();
-  ProgressBar(uint64_t x);
+  ProgressBar(uint64_t toDo, const std::string& label = "");
+  ~ProgressBar();
+
+  void addToDo(uint64_t bytes);
+  void addDone(uint64_t bytes, uint64_t records = 0);
+  // For a single worker which tracks its own totals
+  void setDone(uint64_t bytes, uint64_t records);
+  void setDone(uint64_t bytes);
+  // Stops rendering, and reports the parse as complete
   void finish();
   void clear();
-};
 
+  // Whether the bar is drawn on std::cout. Off unless the program turns it on, as ntfs_linker does
+  static std::atomic<bool> Visible;
+  // File descriptor to which JSON progress lines are written, or -1 for none
+  static int JSONFd;
+  static std::chrono::milliseconds Interval;
 
+private:
+  void run();
+  void stop();
+  void render(bool finished);
+
+  std::string Label;
+  std::atomic<uint64_t> ToDo, Done, Records;
+  std::chrono::steady_clock::time_point Start;
+  std::mutex Mutex;
+  std::condition_variable Wake;
+  bool Stopped;
+  std::thread Renderer;
+};
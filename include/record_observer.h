@@ -0,0 +1,47 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <vector>
+
+class Event;
+class File;
+class LogRecord;
+class UsnRecord;
+
+/*
+Told about each record as it's parsed, and each event as it's output, on the thread doing the
+work. For records, records is the $MFT as of that point, for resolving paths; it's only valid
+during the call. Events have their paths filled in.
+*/
+class RecordObserver {
+public:
+  virtual ~RecordObserver() {}
+  virtual void usnRecord(const UsnRecord&, const std::vector<File>&) {}
+  virtual void logRecord(const LogRecord&) {}
+  virtual void event(const Event&) {}
+};
@@ -26,35 +26,192 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
 #include <sqlite3.h>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 struct VersionInfo {
-  VersionInfo(std::string snapshot, std::string volume) : Snapshot(snapshot), Volume(volume){}
+  VersionInfo(std::string snapshot, std::string volume) : Snapshot(snapshot), Volume(volume), SnapshotId(-1), VolumeId(-1) {}
   std::string Snapshot, Volume;
+  // Keys into the snapshots and volumes tables, filled in by SQLiteHelper::identify
+  mutable int64_t SnapshotId, VolumeId;
 };
 
+// The insert statements, which are run on the writer thread
+enum Inserts: unsigned int {
+  INSERT_USN = 0,
+  INSERT_LOG = 1,
+  INSERT_EVENT_TEMP = 2,
+  INSERT_EVENT = 3,
+  INSERT_DIAGNOSTIC = 4,
+  INSERT_DIAGNOSTIC_SAMPLE = 5,
+  INSERT_PERF = 6,
+  INSERT_HISTORY = 7,
+  NUM_INSERTS = 8
+};
+
+// How the writer thread has kept up, e.g. for benchmarking
+struct WriterStats {
+  WriterStats() : Rows(0), Batches(0), Errors(0), Depth(0), MaxDepth(0), Stalls(0), StallNanoseconds(0) {}
+  uint64_t Rows, Batches;
+  // Rows SQLite failed to insert
+  uint64_t Errors;
+  // Batches waiting to be written, now and at most
+  size_t Depth, MaxDepth;
+  // Times a caller had to wait for room in the queue, and for how long in all
+  uint64_t Stalls, StallNanoseconds;
+};
+
+class SQLiteRow;
+
+/*
+Rows are written to the database by a separate thread, so that parsing doesn't wait on SQLite.
+Callers encode rows with SQLiteRow, which adds each to a batch, and full batches go through a
+bounded queue to the writer, the caller waiting if the queue is full. Without the writer thread,
+full batches are written on the spot. Anything which reads what's been written,
+and the transactions, first waits for the rows queued so far.
+*/
 class SQLiteHelper {
 public:
-  SQLiteHelper() : UsnInsert(NULL), LogInsert(NULL),
-                   EventInsert(NULL), EventUsnSelect(NULL), EventLogSelect(NULL),
-                   Db(NULL) {}
-  void init(std::string dbName, bool overwrite);
+  SQLiteHelper() : PathInsert(NULL), PathSelect(NULL), Db(NULL),
+                   Submitted(0), ReportedErrors(0), Stopping(false) {
+    for (unsigned int i = 0; i < NUM_INSERTS; i++)
+      Statements[i] = NULL;
+  }
+  ~SQLiteHelper();
+  /*
+  Without writerThread, each batch is written by the thread which fills it, holding up the others
+  meanwhile, e.g. so that counters of that thread's work include the rows it writes
+  */
+  void init(std::string dbName, bool overwrite, bool writerThread = true);
   void beginTransaction();
   void endTransaction();
   void close();
-  void bindForSelect(const VersionInfo& version);
-  void resetSelect();
+  /*
+  Appends the tables of another database written by SQLiteHelper, e.g. one volume's shard, as if
+  its rows had been written here. Volumes, snapshots and paths are matched up by name, and the
+  keys in its rows are translated to the ones here
+  */
+  void merge(const std::string& shardName);
+  void identify(const VersionInfo& version);
+  // Used by the writer; elsewhere, only while no rows are queued
+  int64_t pathId(int64_t snapshotId, const std::string& path);
+  // Drops the cached path ids of a snapshot which has no more rows to write, after the rows queued so far
+  void forgetPaths(int64_t snapshotId);
+  /*
+  Prepares selects of the snapshot's $UsnJrnl and $LogFile events in event_temp, newest first.
+  Each caller gets its own, so snapshots can be read on several threads; the caller finalizes them
+  */
+  void prepareSelect(const VersionInfo& version, sqlite3_stmt** usnSelect, sqlite3_stmt** logSelect);
+  // Waits until the rows queued so far have been written, and reports any which failed to std::cerr
+  void drain();
+  WriterStats writerStats();
+
+  // Rows per batch handed to the writer, and the batches which may wait for it
+  static const size_t BatchRows = 4096;
+  static const size_t MaxQueuedBatches = 16;
+  // The most parameters any of the inserts takes
+  static const unsigned int MaxRowValues = 32;
 
-  sqlite3_stmt *UsnInsert, *LogInsert, *EventInsert, *EventUsnSelect, *EventLogSelect, *EventFinalInsert;
 private:
+  friend class SQLiteRow;
+
+  struct Value {
+    enum Kinds: uint8_t { INTEGER, TEXT, NUL, PATH };
+    Kinds Kind;
+    // The integer, or the snapshot of a path
+    int64_t Integer;
+    // Where text and paths are in the batch's Text
+    size_t Offset, Length;
+  };
+  struct Batch {
+    // Each row's statement and number of values
+    std::vector<std::pair<Inserts, unsigned int>> Rows;
+    std::vector<Value> Values;
+    std::string Text;
+    // Snapshots whose path ids are dropped once the rows are written
+    std::vector<int64_t> Forget;
+  };
+
+  void checkLayout();
+  void fillDimensions();
+  int64_t lookupId(const std::string& insertSql, const std::string& selectSql, const std::string& name, int64_t parent);
   void finalizeStatements();
+  std::string mergeRows(const std::string& table, const std::vector<std::vector<std::string>>& cols);
   int prepareStatement(sqlite3_stmt **stmt, std::string& sql);
   void prepareStatements();
   std::string toColumnList(std::vector<std::vector<std::string>>& cols);
+  void addRow(const SQLiteRow& row);
+  void submit(std::unique_lock<std::mutex>& lock);
+  // Returns the number of rows which failed, and the first one's error in error
+  uint64_t write(Batch& batch, std::string& error);
+  void written(const Batch& batch, uint64_t errors, const std::string& error);
+  void writerLoop();
+  void stopWriter();
 
   static const std::vector<std::vector<std::string>> EventColumns, LogColumns, UsnColumns, EventTempColumns;
+  static const std::vector<std::vector<std::string>> DiagnosticColumns, DiagnosticSampleColumns, PerfColumns, HistoryColumns;
+
+  sqlite3_stmt* Statements[NUM_INSERTS];
+  sqlite3_stmt *PathInsert, *PathSelect;
+  /*
+  Ids of the paths already stored, by snapshot, as events of several snapshots may be written at
+  once. A snapshot's are dropped once its events have all been written
+  */
+  std::unordered_map<int64_t, std::unordered_map<std::string, int64_t>> PathIds;
 
   sqlite3* Db;
+
+  // The batch being filled, the ones waiting for the writer and how many were queued, under WriterMutex
+  Batch Pending;
+  std::deque<Batch> Queue;
+  uint64_t Submitted;
+  WriterStats Stats;
+  // The first failure not yet reported, and the failed rows reported so far
+  std::string WriteError;
+  uint64_t ReportedErrors;
+  bool Stopping;
+  std::thread Writer;
+  std::mutex WriterMutex;
+  std::condition_variable Ready, Room, Written;
+};
+
+/*
+Encodes one row for an insert statement, with its values in the order of the statement's
+parameters. The row is built up on its own and only added to the writer's pending batch once
+the builder goes out of scope, so other threads and other rows aren't held up meanwhile, e.g.
+  SQLiteRow(sqliteHelper, INSERT_LOG).integer(lsn).text(name);
+*/
+class SQLiteRow {
+public:
+  SQLiteRow(SQLiteHelper& sqliteHelper, Inserts insert) : SqliteHelper(sqliteHelper), Insert(insert), NumValues(0) {}
+  ~SQLiteRow();
+  SQLiteRow& integer(int64_t value);
+  // NULL if value is -1
+  SQLiteRow& integerOrNull(int64_t value);
+  // Up to any NUL, as SQLite takes C strings
+  SQLiteRow& text(const std::string& value) { return text(value.c_str()); }
+  SQLiteRow& text(const char* value);
+  SQLiteRow& null();
+  // The key of path in the paths table of the snapshot, added if need be by the writer
+  SQLiteRow& path(int64_t snapshotId, const std::string& path);
+
+private:
+  friend class SQLiteHelper;
+
+  void add(SQLiteHelper::Value::Kinds kind, int64_t integer, const char* text = NULL, size_t length = 0);
+
+  SQLiteHelper& SqliteHelper;
+  Inserts Insert;
+  unsigned int NumValues;
+  SQLiteHelper::Value Values[SQLiteHelper::MaxRowValues];
+  // Text and paths, which the values' offsets are into
+  std::string Text;
 };
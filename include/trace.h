@@ -0,0 +1,107 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include "phases.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TraceEvent {
+  std::string Name, Category;
+  // Microseconds since the trace started
+  uint64_t Start, Duration;
+  unsigned int Thread;
+  // Argument names and their values, already encoded as JSON
+  std::vector<std::pair<std::string, std::string>> Args;
+};
+
+/*
+Collects timed spans from any thread, and writes them in the Chrome trace-event format,
+which can be loaded in Perfetto or chrome://tracing
+*/
+class TraceLog {
+public:
+  TraceLog();
+
+  uint64_t now() const;
+  void add(TraceEvent& event);
+  // Small number for the calling thread, which is named on its first use.
+  // Threads started one after another may share a number, and so a row in the viewer.
+  unsigned int threadId(const std::string& name = "");
+  bool write(const std::string& fileName) const;
+
+  // The log spans are recorded to, or NULL when not tracing
+  static TraceLog* Active;
+
+private:
+  std::chrono::steady_clock::time_point Epoch;
+  mutable std::mutex Mutex;
+  std::vector<TraceEvent> Events;
+  std::map<std::thread::id, unsigned int> Threads;
+  std::vector<std::string> ThreadNames;
+};
+
+/*
+Records a span from construction to destruction in the active trace, if any.
+Does no work when tracing is off.
+*/
+class TraceSpan {
+public:
+  TraceSpan(const std::string& name, const char* category);
+  ~TraceSpan();
+
+  void arg(const std::string& key, uint64_t value);
+  void arg(const std::string& key, const std::string& value);
+
+private:
+  TraceLog* Log;
+  TraceEvent Event;
+};
+
+/*
+Turns each phase of processing into a span, with its volume, snapshot, records and bytes as args
+*/
+class PhaseTracer: public PhaseObserver {
+public:
+  PhaseTracer(TraceLog& log) : Log(log) {}
+
+  void beginPhase(const PhaseInfo& info);
+  void endPhase(const PhaseInfo& info);
+  bool isThreadSafe() const { return true; }
+
+private:
+  TraceLog& Log;
+  std::mutex Mutex;
+  // Start times of the phases in progress on each thread, innermost last
+  std::map<std::thread::id, std::vector<uint64_t>> Open;
+};
@@ -0,0 +1,86 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+Writes the tab-separated reports. Fields are formatted straight into a large buffer, which goes
+to the stream only when it fills up or the writer is flushed. There's no flush per line, and no
+iostream formatting per field. With Threaded set, full buffers are written by a separate thread
+while the caller formats into a second buffer.
+*/
+class TsvWriter {
+public:
+  TsvWriter(std::ostream& out, size_t capacity = DefaultCapacity);
+  ~TsvWriter();
+
+  template<typename T>
+  typename std::enable_if<std::is_integral<T>::value, TsvWriter&>::type field(T value) {
+    return std::is_signed<T>::value ? fieldSigned(static_cast<int64_t>(value))
+                                    : fieldUnsigned(static_cast<uint64_t>(value));
+  }
+  TsvWriter& field(const std::string& value) { return field(value.data(), value.size()); }
+  TsvWriter& field(const char* value) { return field(value, std::char_traits<char>::length(value)); }
+  TsvWriter& field(const char* value, size_t len);
+  // Ends the current row
+  void endRow();
+  // Hands everything buffered to the stream
+  void flush();
+
+  // Writes decimal value ending at end, returning where it starts
+  static char* formatUnsigned(uint64_t value, char* end);
+
+  static const size_t DefaultCapacity = 1 << 20;
+  // Write full buffers from a separate thread
+  static bool Threaded;
+
+private:
+  TsvWriter& fieldSigned(int64_t value);
+  TsvWriter& fieldUnsigned(uint64_t value);
+  void separate();
+  void reserve(size_t len);
+  void writeBuffer();
+  void drain();
+  void writerLoop();
+
+  std::ostream& Out;
+  std::vector<char> Buffer, Pending;
+  size_t Used, PendingUsed;
+  bool RowStarted, Done;
+
+  std::thread Writer;
+  std::mutex Mutex;
+  std::condition_variable Ready, Written;
+};
@@ -26,9 +26,13 @@
 
 #pragma once
 
+#include "arrow.h"
 #include "file.h"
+#include "record_observer.h"
 #include "sqlite_util.h"
+#include "tsv.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 
@@ -38,33 +42,59 @@ std::string getUSNColumnHeaders();
 
 std::streampos advanceStream(std::istream& stream, char* buffer, bool sparse=false);
 
-void parseUSN(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std::istream& input, std::ostream& output, const VersionInfo& version, bool extra);
+/*
+Parses the $UsnJrnl/$J stream input, and returns the number of records parsed
+Each record is passed to the observers
+*/
+uint64_t parseUSN(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std::istream& input, std::ostream& output, const VersionInfo& version, bool extra,
+                  const std::vector<RecordObserver*>& observers = std::vector<RecordObserver*>());
 
 int recoverPosition(const char* buffer, unsigned int offset, unsigned int usn_offset);
 
+/*
+Rendered reason strings by mask, in a small open-addressing table.
+Only a few hundred distinct masks occur in practice.
+*/
+class ReasonCache {
+public:
+  ReasonCache() : Count(0) { std::fill(Used, Used + SLOTS, false); }
+  const std::string& get(unsigned int reason);
+
+private:
+  static const unsigned int SLOT_BITS = 10, SLOTS = 1 << SLOT_BITS, MAX_PROBES = 16;
+  unsigned int Masks[SLOTS];
+  bool Used[SLOTS];
+  std::string Strings[SLOTS];
+  std::string Uncached;
+  unsigned int Count;
+};
+
 class UsnRecord {
 public:
   UsnRecord(const VersionInfo& version, bool isEmbedded=false);
   UsnRecord(const char* buffer, uint64_t fileOffset, const VersionInfo& version, int len = -1, bool isEmbedded=false);
+  void init(const char* buffer, uint64_t fileOffset, int len = -1);
 
-  std::string getReasonString();
+  const std::string& getReasonString() const;
   std::string toCreateString(const  std::vector<File> &records);
   std::string toDeleteString(const  std::vector<File> &records);
   std::string toMoveString(const    std::vector<File> &records);
   std::string toRenameString(const  std::vector<File> &records);
-  std::string toString(const        std::vector<File> &records);
+  void write(TsvWriter& out, const std::vector<File>& records);
+  void write(ArrowWriter& out, const std::vector<File>& records);
 
-  void checkTypeAndInsert(sqlite3_stmt* stmt, bool strict=true);
-  void update(UsnRecord rec);
+  void checkTypeAndInsert(SQLiteHelper& sqliteHelper, bool strict=true);
+  void update(const UsnRecord& rec);
   void clearFields();
 
-  void insert(sqlite3_stmt* stmt, const std::vector<File>& records);
-  void insertEvent(unsigned int type, sqlite3_stmt* stmt);
+  void insert(SQLiteHelper& sqliteHelper, const std::vector<File>& records);
+  void insertEvent(unsigned int type, SQLiteHelper& sqliteHelper);
 
   uint64_t Reference, ParentReference, Usn, FileOffset;
   int64_t Record, Parent, PreviousParent;
   unsigned int Reason;
-  std::string Name, PreviousName, Timestamp, Snapshot, Volume;
+  std::string Name, PreviousName, Timestamp;
+  const VersionInfo* Version;
   bool IsEmbedded;
 };
 
@@ -29,6 +29,7 @@
 #include "file.h"
 #include "sqlite_util.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -37,22 +38,68 @@
 
 static const std::string VERSION = __VERSION;
 
+// Little-endian value of size bytes. Fixed-width fields should use le<T> from layout.h
 uint64_t hex_to_long(const char* arr, int size);
 
 int64_t filetime_to_unixtime(int64_t t);
 
+// Length of "YYYY-MM-DD HH:MM:SS.nnnnnnn", excluding the terminating NUL
+const unsigned int ISO_8601_LENGTH = 27;
+
 std::string filetime_to_iso_8601(uint64_t t);
 
+size_t filetime_to_iso_8601(uint64_t t, char* buf);
+
+// The FILETIME of a timestamp from filetime_to_iso_8601, or -1 if str isn't one
+int64_t iso_8601_to_filetime(const std::string& str);
+
+/*
+A time given by hand, as a date, to the second or with up to 7 digits of fraction, completed to
+the full form of filetime_to_iso_8601. Returns "" if it isn't one, or isn't a real date and time
+*/
+std::string complete_iso_8601(const std::string& str);
+
 std::string mbcatos(const char* arr, uint64_t len);
 
-std::string getFullPath(const std::vector<File>& records, unsigned int recordNo);
+void mbcatos(const char* arr, uint64_t len, std::string& out);
+
+/*
+Writes up to size bytes to a file descriptor, with _write on Windows. Returns the number written,
+or -1 with errno set. A function rather than a #define, which would also rename members called write
+*/
+long writeFd(int fd, const char* data, size_t size);
 
-void prep_ofstream(std::ofstream& out, const std::string& name, bool overwrite);
+/*
+Uses the map of file records to construct the full file path.
+If a file record is not present in the map then the empty stry "" is returned.
+Records may be anything with size() and operator[] giving Files, such as a std::vector<File>
+*/
+template<class Records>
+std::string getFullPath(const Records& records, unsigned int record, std::vector<unsigned int>& stack) {
+  if (record >= records.size())
+    return "";
+  if (std::find(stack.begin(), stack.end(), record) != stack.end())
+    return "CYCLICAL_HARD_LINK";
+  const File& file(records[record]);
+  if(record == file.Parent)
+    return "";
+  stack.push_back(record);
+  return getFullPath(records, file.Parent, stack) + "\\" + file.Name;
+}
+
+template<class Records>
+std::string getFullPath(const Records& records, unsigned int recordNo) {
+  std::vector<unsigned int> stack;
+  return getFullPath(records, recordNo, stack);
+}
+
+std::string jsonString(const std::string& str);
 
 enum EventSources: unsigned int {
   SOURCE_USN = 0,
   SOURCE_LOG = 1,
   SOURCE_EMBEDDED_USN = 2,
+  SOURCE_LOG_CARVED = 3,
 };
 
 enum EventTypes: unsigned int {
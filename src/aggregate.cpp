@@ -25,83 +25,224 @@
  */
 
 #include "aggregate.h"
-#include "controller.h"
 #include "file.h"
+#include "pool.h"
 #include "util.h"
 #include "sqlite_util.h"
+#include "tsv.h"
 
+#include <algorithm>
 #include <fstream>
 #include <sqlite3.h>
 #include <sstream>
 #include <string>
 #include <vector>
 
-int writeAndStep(Event& event, sqlite3_stmt* step, sqlite3_stmt* insert, std::vector<File>& records, int order, std::ofstream& out) {
-  event.Order = order;
-  event.write(out, records);
-  event.updateRecords(records);
-  event.insert(insert, records);
+#include <cerrno>
 
-  return sqlite3_step(step);
+std::atomic<int> Event::StreamFd(-1);
+
+static std::mutex StreamMutex;
+
+const unsigned int EVENT_BATCH = 1 << 16;
+
+const File& RecordVersions::At::operator[](unsigned int record) const {
+  auto it = Versions.Changes.find(record);
+  if (it == Versions.Changes.end())
+    return Versions.Records[record];
+  // The last value the record took at or before this version; the first is from version 0
+  const auto& values = it->second;
+  auto next = std::upper_bound(values.begin(), values.end(), Version,
+                               [](unsigned int version, const std::pair<unsigned int, File>& value) { return version < value.first; });
+  return (next - 1)->second;
+}
+
+bool RecordVersions::apply(Event& event, unsigned int version) {
+  if (static_cast<uint64_t>(event.Record) >= Records.size())
+    return false;
+  unsigned int record = event.Record;
+  bool first = Changes.find(record) == Changes.end();
+  File original(first ? Records[record] : File());
+  if (!event.updateRecords(Records))
+    return false;
+  auto& values = Changes[record];
+  if (first)
+    values.emplace_back(0, original);
+  values.emplace_back(version + 1, Records[record]);
+  return true;
+}
+
+/*
+Events are read and undone in order, a batch at a time. Then the paths of the batch are found
+on the shared workers, each from the records as they were at that event, and the batch goes to the sink.
+*/
+class EventBatch {
+public:
+  EventBatch(std::vector<File>& records, EventSink& sink, WorkerPool& pool = WorkerPool::shared())
+    : Versions(records), Sink(sink), Pool(pool) {}
+
+  int addAndStep(const Event& event, sqlite3_stmt* step) {
+    Events.push_back(event);
+    Changed.push_back(Versions.apply(Events.back(), Events.size() - 1));
+    if (Events.size() == EVENT_BATCH)
+      flush();
+    return sqlite3_step(step);
+  }
+
+  void flush() {
+    if (Events.empty())
+      return;
+    size_t slice = ceilingDivide(Events.size(), Pool.size());
+    TaskGroup paths(Pool);
+    for (size_t first = 0; first < Events.size(); first += slice) {
+      size_t last = std::min(first + slice, Events.size());
+      paths.run([this, first, last]() { findPaths(first, last); });
+    }
+    paths.wait();
+
+    Sink.events(Events);
+    Events.clear();
+    Changed.clear();
+    Versions.clear();
+  }
+
+private:
+  void findPaths(size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) {
+      Event& event = Events[i];
+      event.Paths = event.pathsIn(Versions.at(i));
+      event.OlderPaths = Changed[i] ? event.pathsIn(Versions.at(i + 1)) : event.Paths;
+    }
+  }
+
+  RecordVersions Versions;
+  EventSink& Sink;
+  WorkerPool& Pool;
+  std::vector<Event> Events;
+  std::vector<bool> Changed;
+};
+
+void EventQueue::events(std::vector<Event>& batch) {
+  std::unique_lock<std::mutex> lock(Mutex);
+  Taken.wait(lock, [this]{ return Capacity == 0 || Batches.size() < Capacity; });
+  Batches.emplace_back();
+  Batches.back().swap(batch);
+  Ready.notify_one();
+}
+
+void EventQueue::close() {
+  std::lock_guard<std::mutex> lock(Mutex);
+  Closed = true;
+  Ready.notify_one();
+}
+
+bool EventQueue::pop(std::vector<Event>& batch) {
+  std::unique_lock<std::mutex> lock(Mutex);
+  Ready.wait(lock, [this]{ return !Batches.empty() || Closed; });
+  if (Batches.empty())
+    return false;
+  batch.swap(Batches.front());
+  Batches.pop_front();
+  Taken.notify_one();
+  return true;
 }
 
-void outputEvents(std::vector<File>& records, SQLiteHelper& sqliteHelper, VolumeIO& volumeIO, const VersionInfo& version) {
+void findEvents(std::vector<File>& records, SQLiteHelper& sqliteHelper, const VersionInfo& version, EventSink& sink) {
   int u, l;
   Event usnEvent, logEvent;
-  int order = volumeIO.Count;
-  std::ofstream& out(volumeIO.Events);
+  sqlite3_stmt *usnSelect, *logSelect;
+  EventBatch batch(records, sink);
 
-  sqliteHelper.bindForSelect(version);
-  u = sqlite3_step(sqliteHelper.EventUsnSelect);
-  l = sqlite3_step(sqliteHelper.EventLogSelect);
+  usnEvent.setVersion(version);
+  logEvent.setVersion(version);
+  sqliteHelper.prepareSelect(version, &usnSelect, &logSelect);
+  u = sqlite3_step(usnSelect);
+  l = sqlite3_step(logSelect);
 
   // Output log events until the log event is a create, so we can compare timestamps properly.
   while (l == SQLITE_ROW) {
-    logEvent.init(sqliteHelper.EventLogSelect);
+    logEvent.init(logSelect);
     if (logEvent.Type == EventTypes::TYPE_CREATE) {
       break;
     }
     logEvent.IsAnchor = false;
-    l = writeAndStep(logEvent, sqliteHelper.EventLogSelect, sqliteHelper.EventFinalInsert, records, ++order, out);
+    l = batch.addAndStep(logEvent, logSelect);
   }
 
   while (u == SQLITE_ROW && l == SQLITE_ROW) {
-    usnEvent.init(sqliteHelper.EventUsnSelect);
-    logEvent.init(sqliteHelper.EventLogSelect);
+    usnEvent.init(usnSelect);
+    logEvent.init(logSelect);
 
     if (usnEvent.Timestamp > logEvent.Timestamp) {
       usnEvent.IsAnchor = true;
-      u = writeAndStep(usnEvent, sqliteHelper.EventUsnSelect, sqliteHelper.EventFinalInsert, records, ++order, out);
+      u = batch.addAndStep(usnEvent, usnSelect);
     }
     else {
       logEvent.IsAnchor = true;
-      l = writeAndStep(logEvent, sqliteHelper.EventLogSelect, sqliteHelper.EventFinalInsert, records, ++order, out);
+      l = batch.addAndStep(logEvent, logSelect);
 
       while (l == SQLITE_ROW) {
-        logEvent.init(sqliteHelper.EventLogSelect);
+        logEvent.init(logSelect);
         if (logEvent.Type == EventTypes::TYPE_CREATE) {
           break;
         }
-        l = writeAndStep(logEvent, sqliteHelper.EventLogSelect, sqliteHelper.EventFinalInsert, records, ++order, out);
+        l = batch.addAndStep(logEvent, logSelect);
       }
     }
   }
 
   while (u == SQLITE_ROW) {
-    usnEvent.init(sqliteHelper.EventUsnSelect);
+    usnEvent.init(usnSelect);
     usnEvent.IsAnchor = true;
-    u = writeAndStep(usnEvent, sqliteHelper.EventUsnSelect, sqliteHelper.EventFinalInsert, records, ++order, out);
+    u = batch.addAndStep(usnEvent, usnSelect);
   }
 
   while (l == SQLITE_ROW) {
-    logEvent.init(sqliteHelper.EventLogSelect);
+    logEvent.init(logSelect);
     logEvent.IsAnchor = false;
-    l = writeAndStep(logEvent, sqliteHelper.EventLogSelect, sqliteHelper.EventFinalInsert, records, ++order, out);
+    l = batch.addAndStep(logEvent, logSelect);
   }
 
-  sqliteHelper.resetSelect();
-  volumeIO.Count = order;
-  return;
+  batch.flush();
+  sqlite3_finalize(usnSelect);
+  sqlite3_finalize(logSelect);
+}
+
+void writeEvents(std::vector<Event>& events, SQLiteHelper& sqliteHelper, TsvWriter& out, unsigned int& position,
+                 const std::vector<RecordObserver*>& observers) {
+  for (auto& event: events) {
+    event.Order = ++position;
+    event.write(out);
+    if (Event::StreamFd >= 0)
+      event.stream();
+    for (auto observer: observers)
+      observer->event(event);
+    event.insert(sqliteHelper);
+    if (ArrowTables::Active)
+      event.write(ArrowTables::Active->Events);
+  }
+}
+
+// Writes each batch as soon as it's found
+class EventWriter : public EventSink {
+public:
+  EventWriter(SQLiteHelper& sqliteHelper, std::ostream& output, unsigned int& position, const std::vector<RecordObserver*>& observers)
+    : SqliteHelper(sqliteHelper), Out(output), Position(position), Observers(observers) {}
+  void events(std::vector<Event>& batch) { writeEvents(batch, SqliteHelper, Out, Position, Observers); }
+
+private:
+  SQLiteHelper& SqliteHelper;
+  TsvWriter Out;
+  unsigned int& Position;
+  const std::vector<RecordObserver*>& Observers;
+};
+
+void outputEvents(std::vector<File>& records, SQLiteHelper& sqliteHelper, std::ostream& output, unsigned int& position, const VersionInfo& version,
+                  const std::vector<RecordObserver*>& observers) {
+  EventWriter writer(sqliteHelper, output, position, observers);
+  sqliteHelper.identify(version);
+  findEvents(records, sqliteHelper, version, writer);
+  sqliteHelper.forgetPaths(version.SnapshotId);
 }
 
 std::string textToString(const unsigned char* text) {
@@ -124,8 +265,6 @@ void Event::init(sqlite3_stmt* stmt) {
   Created        = textToString(sqlite3_column_text(stmt, ++i));
   Modified       = textToString(sqlite3_column_text(stmt, ++i));
   Comment        = textToString(sqlite3_column_text(stmt, ++i));
-  Snapshot       = textToString(sqlite3_column_text(stmt, ++i));
-  Volume         = textToString(sqlite3_column_text(stmt, ++i));
 
   if (PreviousParent == Parent)
     PreviousParent = -1;
@@ -135,10 +274,19 @@ void Event::init(sqlite3_stmt* stmt) {
 }
 
 Event::Event() {
-  Record = Parent = PreviousParent = UsnLsn = Type = Source = -1;
+  Record = Parent = PreviousParent = UsnLsn = Type = Source = SnapshotId = -1;
   Volume = Snapshot = Timestamp = Name = PreviousName = "";
 }
 
+/*
+The select only returns events of a single snapshot, so its names and key are set once up front
+*/
+void Event::setVersion(const VersionInfo& version) {
+  Snapshot = version.Snapshot;
+  Volume = version.Volume;
+  SnapshotId = version.SnapshotId;
+}
+
 std::string Event::getColumnHeaders() {
   std::stringstream ss;
   ss << "Index"             << "\t"
@@ -163,89 +311,174 @@ std::string Event::getColumnHeaders() {
   return ss.str();
 }
 
-void Event::write(std::ostream& out, const std::vector<File>& records) {
-  out << Order                                                                         << "\t"
-      << (IsAnchor ? Timestamp : "")                                                   << "\t"
-      << (IsEmbedded ? EventSources::SOURCE_EMBEDDED_USN : static_cast<EventSources>(Source)) << "\t"
-      << static_cast<EventTypes>(Type)                                                 << "\t"
-      << Name                                                                          << "\t"
-      << (Parent == -1 ? "" : getFullPath(records, Parent))                            << "\t"
-      << (Record == -1 ? "" : getFullPath(records, Record))                            << "\t"
-      << (Record == -1 ? "" : std::to_string(Record))                                  << "\t"
-      << (Parent == -1 ? "" : std::to_string(Parent))                                  << "\t"
-      << UsnLsn                                                                        << "\t"
-      << PreviousName                                                                  << "\t"
-      << (PreviousParent == -1 ? "" : getFullPath(records, PreviousParent))            << "\t"
-      << (PreviousParent == -1 ? "" : std::to_string(PreviousParent))                  << "\t"
-      << Offset                                                                        << "\t"
-      << Created                                                                       << "\t"
-      << Modified                                                                      << "\t"
-      << Comment                                                                       << "\t"
-      << Snapshot                                                                      << "\t"
-      << Volume                                                                        << std::endl;
-}
-
-void bind_int_or_null(sqlite3_stmt* stmt, int i, int64_t value) {
+void write_int_or_empty(TsvWriter& out, int64_t value) {
   if (value == -1) {
-    sqlite3_bind_null(stmt, i);
+    out.field("");
   }
   else {
-    sqlite3_bind_int64(stmt, i, value);
+    out.field(value);
   }
 }
 
-void Event::insert(sqlite3_stmt* stmt, std::vector<File>& records) {
-  int i = 0;
-  sqlite3_bind_int64(stmt, ++i, Order);
-  sqlite3_bind_text (stmt, ++i, (IsAnchor ? Timestamp : "").c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, toString(IsEmbedded ? EventSources::SOURCE_EMBEDDED_USN : static_cast<EventSources>(Source)).c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, toString(static_cast<EventTypes>(Type)).c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Name.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, (Parent == -1 ? "" : getFullPath(records, Parent)).c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, (Record == -1 ? "" : getFullPath(records, Record)).c_str(), -1, SQLITE_TRANSIENT);
-  bind_int_or_null  (stmt, ++i, Record);
-  bind_int_or_null  (stmt, ++i, Parent);
-  sqlite3_bind_int64(stmt, ++i, UsnLsn);
-  sqlite3_bind_text (stmt, ++i, PreviousName.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, (PreviousParent == -1 ? "" : getFullPath(records, PreviousParent)).c_str(), -1, SQLITE_TRANSIENT);
-  bind_int_or_null  (stmt, ++i, PreviousParent);
-  sqlite3_bind_int64(stmt, ++i, Offset);
-  sqlite3_bind_text (stmt, ++i, Created.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Modified.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Comment.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Snapshot.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Volume.c_str(), -1, SQLITE_TRANSIENT);
-
-  sqlite3_step(stmt);
-  sqlite3_reset(stmt);
-}
-
-void Event::updateRecords(std::vector<File>& records) {
-  if (static_cast<uint64_t>(Record) >= records.size())
+void Event::write(TsvWriter& out) {
+  out.field(Order)
+     .field(IsAnchor ? Timestamp : "")
+     .field(toString(IsEmbedded ? EventSources::SOURCE_EMBEDDED_USN : static_cast<EventSources>(Source)))
+     .field(toString(static_cast<EventTypes>(Type)))
+     .field(Name)
+     .field(Paths.Folder)
+     .field(Paths.FullPath);
+  write_int_or_empty(out, Record);
+  write_int_or_empty(out, Parent);
+  out.field(UsnLsn)
+     .field(PreviousName)
+     .field(Paths.PreviousFolder);
+  write_int_or_empty(out, PreviousParent);
+  out.field(Offset)
+     .field(Created)
+     .field(Modified)
+     .field(Comment)
+     .field(Snapshot)
+     .field(Volume)
+     .endRow();
+}
+
+void write_int_or_null(ArrowWriter& out, int64_t value) {
+  if (value == -1) {
+    out.null();
+  }
+  else {
+    out.field(value);
+  }
+}
+
+void Event::write(ArrowWriter& out) {
+  out.field(Order);
+  write_int_or_null(out, IsAnchor ? iso_8601_to_filetime(Timestamp) : -1);
+  out.field(toString(IsEmbedded ? EventSources::SOURCE_EMBEDDED_USN : static_cast<EventSources>(Source)))
+     .field(toString(static_cast<EventTypes>(Type)))
+     .field(Name)
+     .field(OlderPaths.Folder)
+     .field(OlderPaths.FullPath);
+  write_int_or_null(out, Record);
+  write_int_or_null(out, Parent);
+  out.field(UsnLsn)
+     .field(PreviousName)
+     .field(OlderPaths.PreviousFolder);
+  write_int_or_null(out, PreviousParent);
+  out.field(Offset);
+  write_int_or_null(out, iso_8601_to_filetime(Created));
+  write_int_or_null(out, iso_8601_to_filetime(Modified));
+  out.field(Comment)
+     .field(Snapshot)
+     .field(Volume)
+     .endRow();
+}
+
+std::string json_int_or_null(int64_t value) {
+  return value == -1 ? "null" : std::to_string(value);
+}
+
+/*
+The fields of events.txt, as a JSON object on one line
+*/
+std::string Event::toJSON() {
+  std::string json;
+  json.reserve(512);
+  json += "{\"position\": " + std::to_string(Order);
+  json += ", \"timestamp\": " + (IsAnchor ? jsonString(Timestamp) : "null");
+  json += ", \"source\": " + jsonString(toString(IsEmbedded ? EventSources::SOURCE_EMBEDDED_USN : static_cast<EventSources>(Source)));
+  json += ", \"type\": " + jsonString(toString(static_cast<EventTypes>(Type)));
+  json += ", \"file_name\": " + jsonString(Name);
+  json += ", \"folder\": " + jsonString(Paths.Folder);
+  json += ", \"full_path\": " + jsonString(Paths.FullPath);
+  json += ", \"mft_record\": " + json_int_or_null(Record);
+  json += ", \"parent_mft_record\": " + json_int_or_null(Parent);
+  json += ", \"usn_lsn\": " + std::to_string(UsnLsn);
+  json += ", \"old_file_name\": " + jsonString(PreviousName);
+  json += ", \"old_folder\": " + jsonString(Paths.PreviousFolder);
+  json += ", \"old_parent_record\": " + json_int_or_null(PreviousParent);
+  json += ", \"offset\": " + std::to_string(Offset);
+  json += ", \"created\": " + jsonString(Created);
+  json += ", \"modified\": " + jsonString(Modified);
+  json += ", \"comment\": " + jsonString(Comment);
+  json += ", \"snapshot\": " + jsonString(Snapshot);
+  json += ", \"volume\": " + jsonString(Volume);
+  json += "}\n";
+  return json;
+}
+
+void Event::stream() {
+  std::string line(toJSON());
+  const char* data = line.data();
+  size_t left = line.size();
+  // Lines from other volumes' threads mustn't interleave with this one, however many writes it takes
+  std::lock_guard<std::mutex> lock(StreamMutex);
+  int fd = StreamFd;
+  if (fd < 0)
     return;
-  std::vector<File>::iterator it;
+  while (left > 0) {
+    long written = writeFd(fd, data, left);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "Error: unable to stream events, the reader may have gone away" << std::endl;
+      StreamFd = -1;
+      return;
+    }
+    data += written;
+    left -= written;
+  }
+}
+
+void Event::insert(SQLiteHelper& sqliteHelper) {
+  SQLiteRow(sqliteHelper, INSERT_EVENT)
+    .integer(Order)
+    .text(IsAnchor ? Timestamp : "")
+    .integer(IsEmbedded ? static_cast<int64_t>(EventSources::SOURCE_EMBEDDED_USN) : Source)
+    .integer(Type)
+    .text(Name)
+    .path(SnapshotId, OlderPaths.Folder)
+    .path(SnapshotId, OlderPaths.FullPath)
+    .integerOrNull(Record)
+    .integerOrNull(Parent)
+    .integer(UsnLsn)
+    .text(PreviousName)
+    .path(SnapshotId, OlderPaths.PreviousFolder)
+    .integerOrNull(PreviousParent)
+    .integer(Offset)
+    .text(Created)
+    .text(Modified)
+    .text(Comment)
+    .integer(SnapshotId);
+}
+
+bool Event::updateRecords(std::vector<File>& records) {
+  if (static_cast<uint64_t>(Record) >= records.size())
+    return false;
   switch(Type) {
     case EventTypes::TYPE_CREATE:
       // A file was created, so to move backwards, we should delete it
       // But let's leave it be.
       //records[Record].Valid = false;
       //records[Record] = File();
-      break;
+      return false;
     case EventTypes::TYPE_DELETE:
       // A file was deleted, so to move backwards, create it
-      if (Record >= 0)
-        records[Record] = File(Name, Record, Parent, Timestamp);
-      break;
+      records[Record] = File(Name, Record, Parent, Timestamp);
+      return true;
     case EventTypes::TYPE_MOVE:
       // Embedded events haven't been aggregated, so before/after name not known
-      if (!IsEmbedded)
-        records[Record].Parent = PreviousParent;
-      break;
+      if (IsEmbedded)
+        return false;
+      records[Record].Parent = PreviousParent;
+      return true;
     case EventTypes::TYPE_RENAME:
       // Embedded events haven't been aggregated, so before/after name not known
-      if (!IsEmbedded && PreviousName != "")
-        records[Record].Name = PreviousName;
-      break;
+      if (IsEmbedded || PreviousName == "")
+        return false;
+      records[Record].Name = PreviousName;
+      return true;
   }
-  return;
+  return false;
 }
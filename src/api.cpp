@@ -0,0 +1,182 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "ntfs_linker.h"
+
+#include "aggregate.h"
+#include "log.h"
+#include "mft.h"
+#include "progress.h"
+#include "record_observer.h"
+#include "sqlite_util.h"
+#include "usn.h"
+#include "util.h"
+
+#include <vector>
+
+namespace ntfs_linker {
+
+namespace {
+
+/*
+Passes records and events on to a Handler, as the public types
+*/
+class HandlerObserver : public RecordObserver {
+public:
+  HandlerObserver(Handler& handler) : Out(handler) {}
+
+  void usnRecord(const ::UsnRecord& rec, const std::vector<File>& records) {
+    UsnRecord out;
+    out.Record = rec.Record;
+    out.Parent = rec.Parent;
+    out.Usn = rec.Usn;
+    out.Timestamp = iso_8601_to_filetime(rec.Timestamp);
+    out.Reason = rec.Reason;
+    out.Reasons = rec.getReasonString();
+    out.Name = rec.Name;
+    out.FullPath = getFullPath(records, rec.Record);
+    out.Folder = getFullPath(records, rec.Parent);
+    out.Snapshot = rec.Version->Snapshot;
+    out.Offset = rec.FileOffset;
+    out.IsEmbedded = rec.IsEmbedded;
+    const File* file = rec.Record >= 0 && static_cast<uint64_t>(rec.Record) < records.size() ? &records[rec.Record] : NULL;
+    out.DataSize = file && file->HasData ? static_cast<int64_t>(file->DataSize) : -1;
+    out.DataResident = file && file->HasData && file->DataResident;
+    Out.usnRecord(out);
+  }
+
+  void logRecord(const ::LogRecord& rec) {
+    LogRecord out;
+    out.CurrentLsn = rec.CurrentLsn;
+    out.PreviousLsn = rec.PreviousLsn;
+    out.UndoLsn = rec.UndoLsn;
+    out.Offset = rec.Offset;
+    out.ClientId = rec.ClientId;
+    out.RecordType = rec.RecordType;
+    out.RedoOp = rec.RedoOp;
+    out.UndoOp = rec.UndoOp;
+    out.TargetAttribute = rec.TargetAttribute;
+    out.MftClusterIndex = rec.MftClusterIndex;
+    out.TargetVcn = rec.TargetVcn;
+    out.TargetLcn = rec.TargetLcn;
+    out.RedoOpName = decodeLogFileOpCode(rec.RedoOp);
+    out.UndoOpName = decodeLogFileOpCode(rec.UndoOp);
+    out.Snapshot = rec.Version->Snapshot;
+    Out.logRecord(out);
+  }
+
+  void event(const ::Event& event) {
+    Event out;
+    out.Position = event.Order;
+    out.Timestamp = event.IsAnchor ? iso_8601_to_filetime(event.Timestamp) : -1;
+    out.Source = toString(event.IsEmbedded ? EventSources::SOURCE_EMBEDDED_USN : static_cast<EventSources>(event.Source));
+    out.Type = toString(static_cast<EventTypes>(event.Type));
+    out.Name = event.Name;
+    out.Folder = event.Paths.Folder;
+    out.FullPath = event.Paths.FullPath;
+    out.Record = event.Record;
+    out.Parent = event.Parent;
+    out.UsnLsn = event.UsnLsn;
+    out.PreviousName = event.PreviousName;
+    out.PreviousFolder = event.Paths.PreviousFolder;
+    out.PreviousParent = event.PreviousParent;
+    out.Offset = event.Offset;
+    out.Created = iso_8601_to_filetime(event.Created);
+    out.Modified = iso_8601_to_filetime(event.Modified);
+    out.Comment = event.Comment;
+    out.Snapshot = event.Snapshot;
+    out.Volume = event.Volume;
+    Out.event(out);
+  }
+
+private:
+  Handler& Out;
+};
+
+}
+
+struct Volume::State {
+  State(const std::string& name, Handler& handler, bool carve) : Name(name), Observer(handler), Carve(carve) {
+    Observers.push_back(&Observer);
+  }
+
+  struct Snapshot {
+    std::string Name;
+    std::istream *Mft, *UsnJrnl, *LogFile;
+  };
+
+  std::string Name;
+  HandlerObserver Observer;
+  std::vector<RecordObserver*> Observers;
+  bool Carve;
+  std::vector<Snapshot> Snapshots;
+};
+
+Volume::Volume(const std::string& name, Handler& handler, bool carve) : Impl(new State(name, handler, carve)) {}
+
+Volume::~Volume() {}
+
+void Volume::addSnapshot(const std::string& name, std::istream& mft, std::istream& usnJrnl, std::istream& logFile) {
+  State::Snapshot snapshot = {name, &mft, &usnJrnl, &logFile};
+  Impl->Snapshots.push_back(snapshot);
+}
+
+/*
+The same steps as run() in the controller, for one volume, with a private in-memory database
+and no text output
+*/
+uint64_t Volume::run() {
+  SQLiteHelper sqliteHelper;
+  sqliteHelper.init(":memory:", false);
+  std::ostream nullOut(NULL);
+
+  sqliteHelper.beginTransaction();
+  for (auto& snapshot: Impl->Snapshots) {
+    std::vector<File> records;
+    VersionInfo version(snapshot.Name, Impl->Name);
+    parseMFT(records, *snapshot.Mft);
+    parseUSN(records, sqliteHelper, *snapshot.UsnJrnl, nullOut, version, false, Impl->Observers);
+    parseLog(records, sqliteHelper, *snapshot.LogFile, nullOut, version, false, Impl->Carve, Impl->Observers);
+  }
+  sqliteHelper.endTransaction();
+
+  sqliteHelper.beginTransaction();
+  unsigned int position = 0;
+  for (auto it = Impl->Snapshots.rbegin(); it != Impl->Snapshots.rend(); ++it) {
+    std::vector<File> records;
+    parseMFT(records, *it->Mft);
+    outputEvents(records, sqliteHelper, nullOut, position, VersionInfo(it->Name, Impl->Name), Impl->Observers);
+  }
+  sqliteHelper.endTransaction();
+  sqliteHelper.close();
+  return position;
+}
+
+void showProgress(bool show) {
+  ProgressBar::Visible = show;
+}
+
+}
@@ -0,0 +1,464 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "arrow.h"
+
+#include <algorithm>
+#include <iostream>
+
+void FlatBufferBuilder::align(size_t size, size_t extra) {
+  MinAlign = std::max(MinAlign, size);
+  while ((Data.size() + extra) % size)
+    Data += '\0';
+}
+
+void FlatBufferBuilder::prepend(const char* bytes, size_t len) {
+  for (size_t i = len; i > 0; i--)
+    Data += bytes[i - 1];
+}
+
+uint32_t FlatBufferBuilder::string(const std::string& str) {
+  align(4, str.size() + 1);
+  Data += '\0';
+  prepend(str.data(), str.size());
+  prepend(static_cast<uint32_t>(str.size()));
+  return Data.size();
+}
+
+uint32_t FlatBufferBuilder::offsets(const std::vector<uint32_t>& items) {
+  align(4);
+  for (auto it = items.rbegin(); it != items.rend(); ++it)
+    prepend(static_cast<uint32_t>(Data.size() + 4 - *it));
+  prepend(static_cast<uint32_t>(items.size()));
+  return Data.size();
+}
+
+uint32_t FlatBufferBuilder::structs(const std::string& bytes, uint32_t count, size_t alignment) {
+  align(std::max<size_t>(alignment, 4), bytes.size());
+  prepend(bytes.data(), bytes.size());
+  prepend(count);
+  return Data.size();
+}
+
+void FlatBufferBuilder::startTable() {
+  Fields.clear();
+  TableStart = Data.size();
+}
+
+void FlatBufferBuilder::addOffset(unsigned int id, uint32_t object) {
+  align(4);
+  prepend(static_cast<uint32_t>(Data.size() + 4 - object));
+  Fields.push_back(std::make_pair(id, static_cast<uint32_t>(Data.size())));
+}
+
+/*
+Adds the offset to the table's vtable, and the vtable itself just before the table
+*/
+uint32_t FlatBufferBuilder::endTable() {
+  align(4);
+  prepend(static_cast<int32_t>(0));
+  uint32_t table = Data.size();
+
+  unsigned int numFields = 0;
+  for (auto& field: Fields)
+    numFields = std::max(numFields, field.first + 1);
+  std::vector<uint16_t> vtable(numFields, 0);
+  for (auto& field: Fields)
+    vtable[field.first] = table - field.second;
+  for (auto it = vtable.rbegin(); it != vtable.rend(); ++it)
+    prepend(*it);
+  prepend(static_cast<uint16_t>(table - TableStart));
+  prepend(static_cast<uint16_t>(4 + 2 * numFields));
+
+  // The table starts with the distance back to its vtable
+  uint32_t distance = Data.size() - table;
+  for (int i = 0; i < 4; i++)
+    Data[table - 1 - i] = static_cast<char>((distance >> (8 * i)) & 0xFF);
+  Fields.clear();
+  return table;
+}
+
+std::string FlatBufferBuilder::finish(uint32_t root) {
+  align(MinAlign, 4);
+  prepend(static_cast<uint32_t>(Data.size() + 4 - root));
+  return std::string(Data.rbegin(), Data.rend());
+}
+
+// Arrow's flatbuffer enums, from Schema.fbs and Message.fbs
+namespace {
+  const int16_t METADATA_V5 = 4;
+  const uint8_t TYPE_INT = 2, TYPE_UTF8 = 5;
+  const uint8_t HEADER_SCHEMA = 1, HEADER_DICTIONARY_BATCH = 2, HEADER_RECORD_BATCH = 3;
+  const char MAGIC[] = "ARROW1";
+
+  void putLE(std::string& out, uint64_t value, int size) {
+    for (int i = 0; i < size; i++)
+      out += static_cast<char>((value >> (8 * i)) & 0xFF);
+  }
+
+  uint32_t intType(FlatBufferBuilder& fbb, int32_t bitWidth) {
+    fbb.startTable();
+    fbb.add<int32_t>(0, bitWidth);
+    fbb.add<bool>(1, true);
+    return fbb.endTable();
+  }
+
+  uint32_t emptyTable(FlatBufferBuilder& fbb) {
+    fbb.startTable();
+    return fbb.endTable();
+  }
+
+  /*
+  Adds a buffer to the body, padded to 8 bytes, and its location to buffers
+  */
+  void addBuffer(std::string& body, std::string& buffers, const void* data, size_t len) {
+    putLE(buffers, body.size(), 8);
+    putLE(buffers, len, 8);
+    body.append(static_cast<const char*>(data), len);
+    body.append((8 - body.size() % 8) % 8, '\0');
+  }
+}
+
+ArrowWriter::ArrowWriter(std::ostream& out, const std::vector<Column>& columns, size_t batchRows)
+  : Out(out), BatchRows(batchRows), Rows(0), Current(0), Position(0), Closed(false) {
+  for (auto& column: columns) {
+    Columns.push_back(ColumnData(column));
+    Columns.back().Offsets.push_back(0);
+  }
+
+  write(std::string(MAGIC, 6) + std::string(2, '\0'));
+  FlatBufferBuilder fbb;
+  uint32_t schema = buildSchema(fbb);
+  fbb.startTable();
+  fbb.add<int16_t>(0, METADATA_V5);
+  fbb.add<uint8_t>(1, HEADER_SCHEMA);
+  fbb.addOffset(2, schema);
+  fbb.add<int64_t>(3, 0);
+  writeMessage(fbb.finish(fbb.endTable()), "", NULL);
+}
+
+ArrowWriter::~ArrowWriter() {
+  close();
+}
+
+uint32_t ArrowWriter::buildSchema(FlatBufferBuilder& fbb) {
+  std::vector<uint32_t> fields;
+  for (size_t i = 0; i < Columns.size(); i++) {
+    const ColumnData& column = Columns[i];
+    uint32_t name = fbb.string(column.Name);
+    uint32_t type = column.Type == INT64 ? intType(fbb, 64) : emptyTable(fbb);
+    uint32_t dictionary = 0;
+    if (column.Type == DICTIONARY) {
+      uint32_t indexType = intType(fbb, 32);
+      fbb.startTable();
+      fbb.add<int64_t>(0, i);
+      fbb.addOffset(1, indexType);
+      fbb.add<bool>(2, false);
+      dictionary = fbb.endTable();
+    }
+    uint32_t children = fbb.offsets(std::vector<uint32_t>());
+
+    fbb.startTable();
+    fbb.addOffset(0, name);
+    fbb.add<bool>(1, true);
+    fbb.add<uint8_t>(2, column.Type == INT64 ? TYPE_INT : TYPE_UTF8);
+    fbb.addOffset(3, type);
+    if (dictionary)
+      fbb.addOffset(4, dictionary);
+    fbb.addOffset(5, children);
+    fields.push_back(fbb.endTable());
+  }
+  uint32_t fieldVector = fbb.offsets(fields);
+  fbb.startTable();
+  fbb.add<int16_t>(0, 0); // little endian
+  fbb.addOffset(1, fieldVector);
+  return fbb.endTable();
+}
+
+ArrowWriter::ColumnData& ArrowWriter::next(bool valid) {
+  ColumnData& column = Columns[Current++ % Columns.size()];
+  if (Rows % 8 == 0)
+    column.Validity.push_back(0);
+  if (valid)
+    column.Validity.back() |= 1 << (Rows % 8);
+  else
+    ++column.NullCount;
+  return column;
+}
+
+ArrowWriter& ArrowWriter::fieldInt(int64_t value) {
+  ColumnData& column = next(true);
+  column.Ints.push_back(value);
+  return *this;
+}
+
+ArrowWriter& ArrowWriter::field(const char* value, size_t len) {
+  ColumnData& column = next(true);
+  if (column.Type == DICTIONARY) {
+    auto it = column.Lookup.find(std::string(value, len));
+    if (it == column.Lookup.end()) {
+      it = column.Lookup.insert(std::make_pair(std::string(value, len), static_cast<int32_t>(column.Lookup.size()))).first;
+      column.Chars.append(value, len);
+      column.Offsets.push_back(column.Chars.size());
+    }
+    column.Keys.push_back(it->second);
+  }
+  else {
+    column.Chars.append(value, len);
+    column.Offsets.push_back(column.Chars.size());
+  }
+  return *this;
+}
+
+ArrowWriter& ArrowWriter::null() {
+  ColumnData& column = next(false);
+  switch (column.Type) {
+    case INT64:
+      column.Ints.push_back(0);
+      break;
+    case DICTIONARY:
+      column.Keys.push_back(0);
+      break;
+    case UTF8:
+      column.Offsets.push_back(column.Chars.size());
+      break;
+  }
+  return *this;
+}
+
+void ArrowWriter::endRow() {
+  if (++Rows == BatchRows)
+    writeBatch();
+}
+
+/*
+Lays out the columns' buffers in body, and returns the RecordBatch table describing them.
+With dictionary set, the columns' dictionaries are laid out instead of their keys.
+*/
+uint32_t ArrowWriter::recordBatch(FlatBufferBuilder& fbb, const std::vector<const ColumnData*>& columns, bool dictionary, std::string& body) {
+  std::string nodes, buffers;
+  int64_t length = 0;
+  for (auto column: columns) {
+    length = dictionary ? column->Lookup.size() : Rows;
+    int64_t nullCount = dictionary ? 0 : column->NullCount;
+    putLE(nodes, length, 8);
+    putLE(nodes, nullCount, 8);
+    addBuffer(body, buffers, column->Validity.data(), nullCount == 0 ? 0 : column->Validity.size());
+    if (column->Type == INT64) {
+      addBuffer(body, buffers, column->Ints.data(), column->Ints.size() * sizeof(int64_t));
+    }
+    else if (column->Type == DICTIONARY && !dictionary) {
+      addBuffer(body, buffers, column->Keys.data(), column->Keys.size() * sizeof(int32_t));
+    }
+    else {
+      addBuffer(body, buffers, column->Offsets.data(), column->Offsets.size() * sizeof(int32_t));
+      addBuffer(body, buffers, column->Chars.data(), column->Chars.size());
+    }
+  }
+  uint32_t nodeVector = fbb.structs(nodes, nodes.size() / 16, 8);
+  uint32_t bufferVector = fbb.structs(buffers, buffers.size() / 16, 8);
+  fbb.startTable();
+  fbb.add<int64_t>(0, length);
+  fbb.addOffset(1, nodeVector);
+  fbb.addOffset(2, bufferVector);
+  return fbb.endTable();
+}
+
+void ArrowWriter::writeBatch() {
+  if (Rows == 0)
+    return;
+  FlatBufferBuilder fbb;
+  std::vector<const ColumnData*> columns;
+  for (auto& column: Columns)
+    columns.push_back(&column);
+  std::string body;
+  uint32_t batch = recordBatch(fbb, columns, false, body);
+  fbb.startTable();
+  fbb.add<int16_t>(0, METADATA_V5);
+  fbb.add<uint8_t>(1, HEADER_RECORD_BATCH);
+  fbb.addOffset(2, batch);
+  fbb.add<int64_t>(3, body.size());
+  writeMessage(fbb.finish(fbb.endTable()), body, &Batches);
+
+  for (auto& column: Columns) {
+    column.Validity.clear();
+    column.NullCount = 0;
+    column.Ints.clear();
+    column.Keys.clear();
+    if (column.Type == UTF8) {
+      column.Offsets.assign(1, 0);
+      column.Chars.clear();
+    }
+  }
+  Rows = 0;
+}
+
+/*
+An encapsulated message: a continuation marker, the metadata's length, the metadata padded to
+8 bytes, then the body
+*/
+void ArrowWriter::writeMessage(const std::string& metadata, const std::string& body, std::vector<Block>* blocks) {
+  size_t padded = (metadata.size() + 7) / 8 * 8;
+  std::string prefix;
+  putLE(prefix, 0xFFFFFFFF, 4);
+  putLE(prefix, padded, 4);
+  if (blocks) {
+    Block block = {Position, static_cast<int32_t>(prefix.size() + padded), static_cast<int64_t>(body.size())};
+    blocks->push_back(block);
+  }
+  write(prefix + metadata + std::string(padded - metadata.size(), '\0'));
+  write(body);
+}
+
+void ArrowWriter::write(const std::string& bytes) {
+  Out.write(bytes.data(), bytes.size());
+  Position += bytes.size();
+}
+
+void ArrowWriter::close() {
+  if (Closed)
+    return;
+  Closed = true;
+  if (Current % Columns.size() != 0)
+    std::cerr << "Error: partial row in Arrow output" << std::endl;
+  writeBatch();
+
+  // Dictionaries can't change between batches in a file, so each is written once, complete
+  for (size_t i = 0; i < Columns.size(); i++) {
+    if (Columns[i].Type != DICTIONARY)
+      continue;
+    FlatBufferBuilder fbb;
+    std::string body;
+    uint32_t batch = recordBatch(fbb, std::vector<const ColumnData*>(1, &Columns[i]), true, body);
+    fbb.startTable();
+    fbb.add<int64_t>(0, i);
+    fbb.addOffset(1, batch);
+    fbb.add<bool>(2, false);
+    uint32_t dictionary = fbb.endTable();
+    fbb.startTable();
+    fbb.add<int16_t>(0, METADATA_V5);
+    fbb.add<uint8_t>(1, HEADER_DICTIONARY_BATCH);
+    fbb.addOffset(2, dictionary);
+    fbb.add<int64_t>(3, body.size());
+    writeMessage(fbb.finish(fbb.endTable()), body, &Dictionaries);
+  }
+  // End of stream
+  std::string end;
+  putLE(end, 0xFFFFFFFF, 4);
+  putLE(end, 0, 4);
+  write(end);
+
+  FlatBufferBuilder fbb;
+  uint32_t schema = buildSchema(fbb);
+  uint32_t blockVectors[2];
+  const std::vector<Block>* blocks[2] = {&Dictionaries, &Batches};
+  for (int i = 0; i < 2; i++) {
+    std::string bytes;
+    for (auto& block: *blocks[i]) {
+      putLE(bytes, block.Offset, 8);
+      putLE(bytes, block.MetadataLength, 4);
+      putLE(bytes, 0, 4);
+      putLE(bytes, block.BodyLength, 8);
+    }
+    blockVectors[i] = fbb.structs(bytes, blocks[i]->size(), 8);
+  }
+  fbb.startTable();
+  fbb.add<int16_t>(0, METADATA_V5);
+  fbb.addOffset(1, schema);
+  fbb.addOffset(2, blockVectors[0]);
+  fbb.addOffset(3, blockVectors[1]);
+  std::string footer(fbb.finish(fbb.endTable()));
+  std::string trailer;
+  putLE(trailer, footer.size(), 4);
+  write(footer + trailer + MAGIC);
+  Out.flush();
+}
+
+ArrowTables* ArrowTables::Active = NULL;
+
+ArrowTables::ArrowTables(const std::string& dir)
+  : UsnFile(dir + "/usn.arrow", std::ios::out | std::ios::binary | std::ios::trunc),
+    LogFile(dir + "/log.arrow", std::ios::out | std::ios::binary | std::ios::trunc),
+    EventFile(dir + "/events.arrow", std::ios::out | std::ios::binary | std::ios::trunc),
+    Usn(UsnFile, UsnColumns),
+    Log(LogFile, LogColumns),
+    Events(EventFile, EventColumns) {
+  if (!UsnFile || !LogFile || !EventFile)
+    std::cerr << "Unable to open Arrow output files in " << dir << std::endl;
+}
+
+// Columns as in the usn, log and event views, but with FILETIME timestamps
+
+const std::vector<ArrowWriter::Column> ArrowTables::UsnColumns = {
+  { "MFTRecord", ArrowWriter::INT64},
+  { "ParentMFTRecord", ArrowWriter::INT64},
+  { "USN", ArrowWriter::INT64},
+  { "Timestamp", ArrowWriter::INT64},
+  { "Reason", ArrowWriter::DICTIONARY},
+  { "FileName", ArrowWriter::UTF8},
+  { "FullPath", ArrowWriter::UTF8},
+  { "Folder", ArrowWriter::UTF8},
+  { "Offset", ArrowWriter::INT64},
+  { "Snapshot", ArrowWriter::DICTIONARY},
+  { "Volume", ArrowWriter::DICTIONARY}
+};
+
+const std::vector<ArrowWriter::Column> ArrowTables::LogColumns = {
+  { "CurrentLSN", ArrowWriter::INT64},
+  { "PrevLSN", ArrowWriter::INT64},
+  { "UndoLSN", ArrowWriter::INT64},
+  { "ClientID", ArrowWriter::INT64},
+  { "RecordType", ArrowWriter::INT64},
+  { "RedoOP", ArrowWriter::DICTIONARY},
+  { "UndoOP", ArrowWriter::DICTIONARY},
+  { "TargetAttribute", ArrowWriter::INT64},
+  { "MFTClusterIndex", ArrowWriter::INT64},
+  { "Offset", ArrowWriter::INT64},
+  { "Snapshot", ArrowWriter::DICTIONARY},
+  { "Volume", ArrowWriter::DICTIONARY}
+};
+
+const std::vector<ArrowWriter::Column> ArrowTables::EventColumns = {
+  { "Position", ArrowWriter::INT64},
+  { "Timestamp", ArrowWriter::INT64},
+  { "EventSource", ArrowWriter::DICTIONARY},
+  { "EventType", ArrowWriter::DICTIONARY},
+  { "FileName", ArrowWriter::UTF8},
+  { "Folder", ArrowWriter::UTF8},
+  { "FullPath", ArrowWriter::UTF8},
+  { "MFTRecord", ArrowWriter::INT64},
+  { "ParentMFTRecord", ArrowWriter::INT64},
+  { "USN_LSN", ArrowWriter::INT64},
+  { "OldFileName", ArrowWriter::UTF8},
+  { "OldFolder", ArrowWriter::UTF8},
+  { "OldParentRecord", ArrowWriter::INT64},
+  { "Offset", ArrowWriter::INT64},
+  { "Created", ArrowWriter::INT64},
+  { "Modified", ArrowWriter::INT64},
+  { "Comment", ArrowWriter::UTF8},
+  { "Snapshot", ArrowWriter::DICTIONARY},
+  { "Volume", ArrowWriter::DICTIONARY}
+};
@@ -0,0 +1,148 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "carve.h"
+#include "layout.h"
+#include "log.h"
+#include "trace.h"
+#include "util.h"
+
+unsigned int carveRecordLength(const char* buf, unsigned int avail) {
+  // A client record is a 0x30-byte header followed by at least the 0x28-byte operation header
+  if (avail < LogRecordHeader::SIZE + 0x28)
+    return 0;
+
+  LogRecordHeader header(buf);
+  uint64_t currentLsn          = header.currentLsn();
+  uint64_t previousLsn         = header.previousLsn();
+  uint64_t undoLsn             = header.undoLsn();
+  uint64_t clientDataLength    = header.clientDataLength();
+  unsigned int recordType      = header.recordType();
+  unsigned int flags           = header.flags();
+
+  // Only complete client records are of use; checkpoint records carry no operations
+  if (recordType != 1 || flags != 0)
+    return 0;
+  // Lsns only ever grow, and a record can only refer back to older ones
+  if (currentLsn == 0 || previousLsn >= currentLsn || undoLsn >= currentLsn)
+    return 0;
+  if (clientDataLength < 0x28 || clientDataLength % 8 != 0 || LogRecordHeader::SIZE + clientDataLength > avail)
+    return 0;
+
+  LogOperationHeader op(buf + LogRecordHeader::SIZE);
+  unsigned int redoOp     = op.redoOp();
+  unsigned int undoOp     = op.undoOp();
+  unsigned int redoOffset = op.redoOffset();
+  unsigned int redoLength = op.redoLength();
+  unsigned int undoOffset = op.undoOffset();
+  unsigned int undoLength = op.undoLength();
+  if (redoOp > LogOps::UPDATE_RECORD_DATA_ROOT || undoOp > LogOps::UPDATE_RECORD_DATA_ROOT)
+    return 0;
+  if ((redoLength && (redoOffset < 0x28 || redoOffset + redoLength > clientDataLength))
+      || (undoLength && (undoOffset < 0x28 || undoOffset + undoLength > clientDataLength)))
+    return 0;
+
+  return LogRecordHeader::SIZE + clientDataLength;
+}
+
+LogCarver::LogCarver() : Done(false), Worker(&LogCarver::run, this) {}
+
+LogCarver::~LogCarver() {
+  if (Worker.joinable())
+    finish();
+}
+
+void LogCarver::submit(const char* buffer, uint64_t pageOffset, unsigned int start, unsigned int end) {
+  // Records are 8-byte aligned within their page
+  start = 8 * ceilingDivide(start, 8);
+  if (start >= end)
+    return;
+
+  Region region;
+  region.Data.assign(buffer + start, buffer + end);
+  region.Offset = pageOffset + start;
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Queue.push_back(std::move(region));
+  }
+  Ready.notify_one();
+}
+
+std::vector<CarvedRecord>& LogCarver::finish() {
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Done = true;
+  }
+  Ready.notify_one();
+  if (Worker.joinable())
+    Worker.join();
+  return Records;
+}
+
+void LogCarver::run() {
+  TraceSpan span("$LogFile carve", "log");
+  uint64_t regions = 0;
+  while (true) {
+    Region region;
+    {
+      std::unique_lock<std::mutex> lock(Mutex);
+      Ready.wait(lock, [this]{ return Done || !Queue.empty(); });
+      if (Queue.empty()) {
+        span.arg("regions", regions);
+        span.arg("records", Records.size());
+        return;
+      }
+      region = std::move(Queue.front());
+      Queue.pop_front();
+    }
+    carve(region);
+    ++regions;
+  }
+}
+
+void LogCarver::carve(const Region& region) {
+  // Slide over the region 8 bytes at a time. Records in a page are written in Lsn order,
+  // so a candidate whose Lsn doesn't follow the last carved record is rejected.
+  const char* data = region.Data.data();
+  const unsigned int size = region.Data.size();
+  uint64_t lastLsn = 0;
+  unsigned int offset = 0;
+  while (offset + 0x58 <= size) {
+    unsigned int length = carveRecordLength(data + offset, size - offset);
+    uint64_t lsn = length ? LogRecordHeader(data + offset).currentLsn() : 0;
+    if (length && lsn > lastLsn) {
+      CarvedRecord rec;
+      rec.Offset = region.Offset + offset;
+      rec.Data.assign(data + offset, data + offset + length);
+      Records.push_back(std::move(rec));
+      lastLsn = lsn;
+      offset += length;
+    }
+    else {
+      offset += 8;
+    }
+  }
+}
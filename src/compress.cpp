@@ -0,0 +1,311 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "compress.h"
+#include "layout.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+/*
+Reads the seek table of a compressed report being appended to, and cuts it off the end so that
+the new frames follow the old ones. A missing or empty file has no frames yet.
+*/
+static bool dropSeekTable(const std::string& fileName, SeekTable& frames) {
+  uint64_t size, tableSize;
+  {
+    std::ifstream in(fileName, std::ios::binary);
+    if (!in)
+      return true;
+    in.seekg(0, std::ios::end);
+    size = in.tellg();
+    if (size == 0)
+      return true;
+    if (!ZstdFrameBuf::readSeekTable(in, frames, tableSize)) {
+      std::cerr << "Error: " << fileName << " has no zstd seek table to append to. Use --overwrite to replace it" << std::endl;
+      return false;
+    }
+  }
+  boost::system::error_code err;
+  boost::filesystem::resize_file(fileName, size - tableSize, err);
+  if (err) {
+    std::cerr << "Error: unable to remove the seek table of " << fileName << ": " << err.message() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void TextFile::open(const std::string& name, bool overwrite, Compression compression) {
+  std::ios_base::openmode mode = std::ios::out | std::ios::binary;
+  mode |= overwrite ? std::ios::trunc : std::ios::app;
+
+  std::string fileName(name);
+  if (compression == COMPRESS_ZSTD)
+    fileName += ".zst";
+  rdbuf(NULL);
+  bool zstd = compression == COMPRESS_ZSTD && isSupported(compression);
+  SeekTable frames;
+  if (zstd && !overwrite && !dropSeekTable(fileName, frames)) {
+    setstate(std::ios::badbit);
+    return;
+  }
+  if (!File.open(fileName, mode)) {
+    std::cerr << "Unable to open " << fileName << " for writing" << std::endl;
+    setstate(std::ios::badbit);
+    return;
+  }
+  if (zstd) {
+    Zstd.reset(new ZstdFrameBuf(&File));
+    Zstd->resume(frames);
+    rdbuf(Zstd.get());
+  }
+  else {
+    rdbuf(&File);
+  }
+}
+
+void TextFile::close() {
+  if (Zstd && !Zstd->close()) {
+    setstate(std::ios::badbit);
+  }
+  Zstd.reset();
+  rdbuf(NULL);
+  if (File.is_open())
+    File.close();
+}
+
+bool TextFile::isSupported(Compression compression) {
+#ifdef HAVE_LIBZSTD
+  return compression == COMPRESS_NONE || compression == COMPRESS_ZSTD;
+#else
+  return compression == COMPRESS_NONE;
+#endif
+}
+
+/*
+The seek table is a skippable frame: the frame sizes, then the number of frames, a descriptor
+(whether each entry also has a checksum) and the seekable magic number.
+See https://github.com/facebook/zstd/blob/dev/contrib/seekable_format/zstd_seekable_compression_format.md
+*/
+bool ZstdFrameBuf::readSeekTable(std::istream& in, SeekTable& frames, uint64_t& tableSize) {
+  in.seekg(0, std::ios::end);
+  uint64_t size = in.tellg();
+  char footer[9];
+  if (size < 8 + sizeof(footer))
+    return false;
+  in.seekg(size - sizeof(footer));
+  if (!in.read(footer, sizeof(footer)) || le<uint32_t>(footer + 5) != 0x8F92EAB1)
+    return false;
+  uint64_t numFrames = le<uint32_t>(footer);
+  unsigned int entrySize = footer[4] & 0x80 ? 12 : 8;
+  tableSize = 8 + numFrames * entrySize + sizeof(footer);
+  if (tableSize > size)
+    return false;
+
+  std::vector<char> table(tableSize);
+  in.seekg(size - tableSize);
+  if (!in.read(table.data(), table.size()) || le<uint32_t>(table.data()) != 0x184D2A5E
+      || le<uint32_t>(table.data() + 4) != tableSize - 8)
+    return false;
+  frames.clear();
+  for (uint64_t i = 0; i < numFrames; i++) {
+    const char* entry = table.data() + 8 + i * entrySize;
+    frames.push_back(std::make_pair(le<uint32_t>(entry), le<uint32_t>(entry + 4)));
+  }
+  return true;
+}
+
+void ZstdFrameBuf::resume(const SeekTable& frames) {
+  Written.insert(Written.begin(), frames.begin(), frames.end());
+}
+
+#ifdef HAVE_LIBZSTD
+
+ZstdFrameBuf::ZstdFrameBuf(std::streambuf* out, WorkerPool& pool, int level)
+  : Out(out), Pool(pool), Level(level), Closed(false), Failed(false) {
+  // Enough to keep every worker busy while the oldest frame is being written
+  MaxInFlight = 2 * Pool.size();
+}
+
+ZstdFrameBuf::~ZstdFrameBuf() {
+  close();
+}
+
+/*
+Each thread which compresses keeps a context, as they're costly to set up
+*/
+struct CompressionContext {
+  CompressionContext() : CCtx(ZSTD_createCCtx()) {}
+  ~CompressionContext() { ZSTD_freeCCtx(CCtx); }
+  ZSTD_CCtx* CCtx;
+};
+
+void ZstdFrameBuf::compress(Frame& frame) {
+  static thread_local CompressionContext context;
+  ZSTD_CCtx* cctx = context.CCtx;
+  ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, Level);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+
+  frame.Out.resize(ZSTD_compressBound(frame.In.size()));
+  size_t rtn = ZSTD_compress2(cctx, frame.Out.data(), frame.Out.size(), frame.In.data(), frame.In.size());
+
+  std::lock_guard<std::mutex> lock(Mutex);
+  if (ZSTD_isError(rtn)) {
+    std::cerr << "zstd compression failed: " << ZSTD_getErrorName(rtn) << std::endl;
+    frame.Failed = true;
+  }
+  else {
+    frame.OutSize = rtn;
+  }
+  frame.Done = true;
+  // While still holding the lock, as close() may return, and this be destroyed, once it's released
+  Finished.notify_all();
+}
+
+/*
+Queues the put area as the next frame. The next write allocates a new one
+*/
+void ZstdFrameBuf::submit() {
+  size_t used = pptr() - pbase();
+  if (used == 0)
+    return;
+  std::shared_ptr<Frame> frame(std::make_shared<Frame>());
+  Buffer.resize(used);
+  frame->In.swap(Buffer);
+  setp(NULL, NULL);
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Frames.push_back(frame);
+  }
+  Pool.submit([this, frame]() { compress(*frame); });
+}
+
+/*
+Writes out compressed frames from the front, in order. Waits for the rest if all is set, and
+otherwise only for as long as there are too many in flight
+*/
+bool ZstdFrameBuf::writeFinished(bool all) {
+  std::unique_lock<std::mutex> lock(Mutex);
+  while (!Frames.empty()) {
+    std::shared_ptr<Frame> frame(Frames.front());
+    if (!frame->Done) {
+      if (!all && Frames.size() <= MaxInFlight)
+        break;
+      Finished.wait(lock, [&frame]{ return frame->Done; });
+    }
+    Frames.pop_front();
+    lock.unlock();
+
+    if (frame->Failed
+        || Out->sputn(frame->Out.data(), frame->OutSize) != static_cast<std::streamsize>(frame->OutSize)) {
+      Failed = true;
+    }
+    Written.push_back(std::make_pair(static_cast<uint32_t>(frame->OutSize), static_cast<uint32_t>(frame->In.size())));
+
+    lock.lock();
+  }
+  return !Failed;
+}
+
+void putLE32(std::string& out, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    out += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+void ZstdFrameBuf::writeSeekTable() {
+  std::string table;
+  putLE32(table, 0x184D2A5E);
+  putLE32(table, Written.size() * 8 + 9);
+  for (auto& entry: Written) {
+    putLE32(table, entry.first);
+    putLE32(table, entry.second);
+  }
+  putLE32(table, Written.size());
+  table += '\0';
+  putLE32(table, 0x8F92EAB1);
+  if (Out->sputn(table.data(), table.size()) != static_cast<std::streamsize>(table.size()))
+    Failed = true;
+}
+
+ZstdFrameBuf::int_type ZstdFrameBuf::overflow(int_type c) {
+  if (Closed)
+    return traits_type::eof();
+  submit();
+  if (!writeFinished(false))
+    return traits_type::eof();
+  if (Buffer.size() != FrameSize) {
+    Buffer.resize(FrameSize);
+    setp(Buffer.data(), Buffer.data() + Buffer.size());
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+/*
+Frames are only cut when full, so this writes out what's been compressed so far but keeps the
+partial frame
+*/
+int ZstdFrameBuf::sync() {
+  if (Closed || !writeFinished(false))
+    return -1;
+  return Out->pubsync();
+}
+
+bool ZstdFrameBuf::close() {
+  if (Closed)
+    return !Failed;
+  submit();
+  writeFinished(true);
+  writeSeekTable();
+  Out->pubsync();
+  Closed = true;
+  return !Failed;
+}
+
+#else
+
+ZstdFrameBuf::ZstdFrameBuf(std::streambuf* out, WorkerPool& pool, int)
+  : Out(out), Pool(pool), Level(0), MaxInFlight(0), Closed(true), Failed(true) {}
+ZstdFrameBuf::~ZstdFrameBuf() {}
+bool ZstdFrameBuf::close() { return false; }
+ZstdFrameBuf::int_type ZstdFrameBuf::overflow(int_type) { return traits_type::eof(); }
+int ZstdFrameBuf::sync() { return -1; }
+
+#endif
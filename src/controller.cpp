@@ -25,16 +25,24 @@
  */
 
 #include "aggregate.h"
+#include "arrow.h"
 #include "controller.h"
 #include "file.h"
+#include "history.h"
 #include "log.h"
 #include "mft.h"
+#include "perf.h"
+#include "progress.h"
+#include "trace.h"
 #include "usn.h"
 #include "vss.h"
 #include "walkers.h"
 
 #include <boost/scoped_array.hpp>
+#include <algorithm>
+#include <functional>
 #include <sstream>
+#include <thread>
 
 SnapshotIO::SnapshotIO(Options& opts, VolumeIO* parent) : Parent(parent), Name(opts.input.string()), Good(false) {
   IMft.open((opts.input / fs::path("$MFT")).string(), std::ios::binary);
@@ -58,12 +66,13 @@ SnapshotIO::SnapshotIO(Options& opts, VolumeIO* parent) : Parent(parent), Name(o
   }
 
   fs::create_directories(opts.output);
-  prep_ofstream(OUsnJrnl, (opts.output / fs::path("usnjrnl.txt")).string(), opts.overwrite);
-  prep_ofstream(OLogFile, (opts.output / fs::path("logfile.txt")).string(), opts.overwrite);
+  OUsnJrnl.open((opts.output / fs::path("usnjrnl.txt")).string(), opts.overwrite, opts.compress);
+  OLogFile.open((opts.output / fs::path("logfile.txt")).string(), opts.overwrite, opts.compress);
   Good = true;
 }
 
-VolumeIO::VolumeIO(Options& opts, ImageIO* parent) : Parent(parent), Count(0), Name(opts.input.string()), Good(false)  {
+VolumeIO::VolumeIO(Options& opts, ImageIO* parent)
+  : Parent(parent), ShardName((opts.output / fs::path("shard.db")).string()), Status(&std::cout), Count(0), Name(opts.input.string()), Good(false)  {
   std::vector<fs::path> snapshots;
   std::copy(fs::directory_iterator(opts.input), fs::directory_iterator(), std::back_inserter(snapshots));
   std::sort(snapshots.begin(), snapshots.end());
@@ -91,7 +100,11 @@ VolumeIO::VolumeIO(Options& opts, ImageIO* parent) : Parent(parent), Count(0), N
       return;
     }
   }
-  prep_ofstream(Events, (opts.output / fs::path("events.txt")).string(), opts.overwrite);
+  Events.open((opts.output / fs::path("events.txt")).string(), opts.overwrite, opts.compress);
+}
+
+SQLiteHelper& VolumeIO::sqliteHelper() {
+  return Shard ? *Shard : Parent->SqliteHelper;
 }
 
 ImageIO::ImageIO(Options& opts) : Good(false) {
@@ -125,7 +138,9 @@ ImageIO::ImageIO(Options& opts) : Good(false) {
 
   std::cout << "Setting up DB Connection..." << std::endl;
   std::string dbName = (opts.output / fs::path("ntfs.db")).string();
-  SqliteHelper.init(dbName, opts.overwrite);
+  // The perf counters only see the work of this thread and the ones it's done with, so the
+  // rows are written here rather than on a writer thread of their own
+  SqliteHelper.init(dbName, opts.overwrite, !opts.perfCounters);
 }
 
 std::string ImageIO::getSummary() {
@@ -170,30 +185,203 @@ void copyAllFiles(Options& opts) {
   }
 }
 
-int processStep(SnapshotIO& snapshotIO, bool extra) {
+/*
+Returns the size of the stream, leaving it positioned at the start
+*/
+uint64_t streamSize(std::istream& input) {
+  input.clear();
+  input.seekg(0, std::ios::end);
+  uint64_t size = input.tellg();
+  input.seekg(0, std::ios::beg);
+  return size;
+}
+
+int processStep(SnapshotIO& snapshotIO, const Options& opts) {
   //Set up db connection
   std::vector<File> records;
-  SQLiteHelper& sqliteHelper = snapshotIO.Parent->Parent->SqliteHelper;
-  std::cout << "Parsing $MFT" << std::endl;
-  parseMFT(records, snapshotIO.IMft);
-
-  std::cout << "Parsing $UsnJrnl..." << std::endl;
-  parseUSN(records, sqliteHelper, snapshotIO.IUsnJrnl, snapshotIO.OUsnJrnl, VersionInfo(snapshotIO.Name, snapshotIO.Parent->Name), extra);
-  std::cout << "Parsing $LogFile..." << std::endl;
-  parseLog(records, sqliteHelper, snapshotIO.ILogFile, snapshotIO.OLogFile, VersionInfo(snapshotIO.Name, snapshotIO.Parent->Name), extra);
+  SQLiteHelper& sqliteHelper = snapshotIO.Parent->sqliteHelper();
+  std::ostream& status = *snapshotIO.Parent->Status;
+  const std::string& volumeName = snapshotIO.Parent->Name;
+  TraceSpan span(snapshotIO.Name, "snapshot");
+  {
+    PhaseScope phase(opts.observers, Phases::PHASE_MFT, volumeName, snapshotIO.Name);
+    status << "Parsing $MFT" << std::endl;
+    phase.Info.Bytes = streamSize(snapshotIO.IMft);
+    parseMFT(records, snapshotIO.IMft);
+    phase.Info.Records = records.size();
+  }
+  {
+    PhaseScope phase(opts.observers, Phases::PHASE_USN, volumeName, snapshotIO.Name);
+    status << "Parsing $UsnJrnl..." << std::endl;
+    phase.Info.Bytes = streamSize(snapshotIO.IUsnJrnl);
+    phase.Info.Records = parseUSN(records, sqliteHelper, snapshotIO.IUsnJrnl, snapshotIO.OUsnJrnl, VersionInfo(snapshotIO.Name, volumeName), opts.extra);
+  }
+  {
+    PhaseScope phase(opts.observers, Phases::PHASE_LOG, volumeName, snapshotIO.Name);
+    status << "Parsing $LogFile..." << std::endl;
+    phase.Info.Bytes = streamSize(snapshotIO.ILogFile);
+    phase.Info.Records = parseLog(records, sqliteHelper, snapshotIO.ILogFile, snapshotIO.OLogFile, VersionInfo(snapshotIO.Name, volumeName), opts.extra, opts.carve);
+  }
   return 0;
 }
 
-int processFinalize(SnapshotIO& snapshotIO) {
-  std::vector<File> records;
-  SQLiteHelper& sqliteHelper = snapshotIO.Parent->Parent->SqliteHelper;
-  VolumeIO& volumeIO = *snapshotIO.Parent;
+/*
+A snapshot being finalized on its own thread: it parses its $MFT and finds its events while the
+newer snapshots are still being written, running ahead by at most a couple of batches. The
+batches are written in turn, so positions come out as if the snapshots were done one at a time.
+*/
+struct SnapshotFinalize {
+  SnapshotFinalize(SnapshotIO& snapshotIO, size_t capacity)
+    : IO(snapshotIO), Version(snapshotIO.Name, snapshotIO.Parent->Name), Queue(capacity), MftBytes(0), Seed(NULL) {}
 
-  parseMFT(records, snapshotIO.IMft);
+  void run() {
+    MftBytes = streamSize(IO.IMft);
+    parseMFT(Records, IO.IMft);
+    if (Seed)
+      Seed->seed(Records);
+    findEvents(Records, IO.Parent->sqliteHelper(), Version, Queue);
+    Queue.close();
+  }
 
-  outputEvents(records, sqliteHelper, volumeIO, VersionInfo(snapshotIO.Name, volumeIO.Name));
+  SnapshotIO& IO;
+  VersionInfo Version;
+  std::vector<File> Records;
+  EventQueue Queue;
+  uint64_t MftBytes;
+  // The history to start from this snapshot's records, if it's the newest
+  RecordHistory* Seed;
+  std::thread Thread;
+};
 
-  return 0;
+/*
+Whether a phase observer has to see each phase's work done within it, on one thread at a time
+*/
+static bool hasSerialObservers(const Options& opts) {
+  return std::any_of(opts.observers.begin(), opts.observers.end(),
+                     [](const PhaseObserver* observer) { return !observer->isThreadSafe(); });
+}
+
+/*
+Writes the volume's events, newest snapshot first. Each snapshot's thread is started once the
+one before it has parsed its $MFT, so only one $MFT is being parsed at a time. The next
+snapshot's work then falls in this one's phase, which observers that aren't thread-safe, like the
+perf counters, would attribute wrongly. With those, with opts.serial, or if SQLite can't be used
+from several threads, each snapshot is done in turn on this one
+*/
+void processFinalize(VolumeIO& volumeIO, const Options& opts) {
+  SQLiteHelper& sqliteHelper = volumeIO.sqliteHelper();
+  bool threaded = !opts.serial && !hasSerialObservers(opts) && sqlite3_threadsafe() != 0;
+  RecordHistory history(sqliteHelper);
+  std::vector<RecordObserver*> observers(1, &history);
+  TsvWriter out(volumeIO.Events);
+
+  std::vector<std::unique_ptr<SnapshotFinalize>> snapshots;
+  std::vector<SnapshotIOPtr>::reverse_iterator rIt;
+  for (rIt = volumeIO.Snapshots.rbegin(); rIt != volumeIO.Snapshots.rend(); ++rIt) {
+    snapshots.emplace_back(new SnapshotFinalize(**rIt, threaded ? 2 : 0));
+    sqliteHelper.identify(snapshots.back()->Version);
+  }
+  snapshots.front()->Seed = &history;
+  if (threaded)
+    snapshots.front()->Thread = std::thread(&SnapshotFinalize::run, snapshots.front().get());
+
+  for (size_t i = 0; i < snapshots.size(); i++) {
+    SnapshotFinalize& snapshot = *snapshots[i];
+    *volumeIO.Status << "Processing events from snapshot: " << snapshot.IO.Name << std::endl;
+    TraceSpan span(snapshot.IO.Name, "snapshot");
+    PhaseScope phase(opts.observers, Phases::PHASE_FINALIZE, volumeIO.Name, snapshot.IO.Name);
+    unsigned int count = volumeIO.Count;
+
+    if (!threaded)
+      snapshot.run();
+    std::vector<Event> batch;
+    // The $MFT has been parsed by the time the first batch or the end arrives
+    bool more = snapshot.Queue.pop(batch);
+    if (threaded && i + 1 < snapshots.size())
+      snapshots[i + 1]->Thread = std::thread(&SnapshotFinalize::run, snapshots[i + 1].get());
+
+    phase.Info.Bytes = snapshot.MftBytes;
+    history.start(snapshot.Version, snapshot.Records.size());
+    for (; more; more = snapshot.Queue.pop(batch))
+      writeEvents(batch, sqliteHelper, out, volumeIO.Count, observers);
+    // Nothing else refers to the snapshot's paths, so the writer needn't keep their ids
+    sqliteHelper.forgetPaths(snapshot.Version.SnapshotId);
+    if (snapshot.Thread.joinable())
+      snapshot.Thread.join();
+    snapshots[i].reset();
+    phase.Info.Records = volumeIO.Count - count;
+  }
+  out.flush();
+  history.finish();
+}
+
+/*
+Commits the open transaction as its own phase
+*/
+void commit(VolumeIO& volumeIO, const Options& opts) {
+  PhaseScope phase(opts.observers, Phases::PHASE_COMMIT, volumeIO.Name, "");
+  volumeIO.sqliteHelper().endTransaction();
+}
+
+void processVolume(VolumeIO& volumeIO, const Options& opts) {
+  SQLiteHelper& sqliteHelper = volumeIO.sqliteHelper();
+  std::ostream& status = *volumeIO.Status;
+  TraceSpan span(volumeIO.Name, "volume");
+  status << "Finding events on Volume: " << volumeIO.Name << std::endl;
+
+  sqliteHelper.beginTransaction();
+  for (auto& snapshotIO: volumeIO.Snapshots) {
+    status << "Parsing input files for snapshot: " << snapshotIO->Name << std::endl;
+    processStep(*snapshotIO, opts);
+    status << std::endl;
+  }
+  commit(volumeIO, opts);
+  sqliteHelper.beginTransaction();
+
+  status << std::endl << "Generating unified events output..." << std::endl;
+  volumeIO.Events << Event::getColumnHeaders();
+  processFinalize(volumeIO, opts);
+
+  commit(volumeIO, opts);
+}
+
+/*
+Volumes share nothing but the database, so with several of them each is processed on its own
+thread into its own shard, and the shards are merged into the image's database in order after.
+Phase observers which aren't thread-safe, like the perf counters, and the Arrow tables see one
+volume at a time, so with those the volumes are processed in turn, as they are with opts.serial or
+if SQLite can't be used from several threads.
+*/
+void processVolumes(ImageIO& imageIO, const Options& opts) {
+  if (imageIO.Volumes.size() < 2 || opts.serial || hasSerialObservers(opts) || ArrowTables::Active || !sqlite3_threadsafe()) {
+    for (auto& volumeIO: imageIO.Volumes)
+      processVolume(*volumeIO, opts);
+    return;
+  }
+
+  // Progress bars of several parses would be drawn over each other
+  bool visible = ProgressBar::Visible;
+  ProgressBar::Visible = false;
+  std::vector<std::thread> workers;
+  for (auto& volumeIO: imageIO.Volumes) {
+    volumeIO->Shard.reset(new SQLiteHelper());
+    volumeIO->Shard->init(volumeIO->ShardName, true);
+    volumeIO->Status = &volumeIO->HeldStatus;
+    workers.push_back(std::thread(processVolume, std::ref(*volumeIO), std::cref(opts)));
+  }
+  for (auto& worker: workers)
+    worker.join();
+  ProgressBar::Visible = visible;
+
+  for (auto& volumeIO: imageIO.Volumes) {
+    std::cout << volumeIO->HeldStatus.str();
+    volumeIO->Status = &std::cout;
+    volumeIO->Shard->close();
+    volumeIO->Shard.reset();
+    std::cout << "Merging the database of Volume: " << volumeIO->Name << std::endl;
+    imageIO.SqliteHelper.merge(volumeIO->ShardName);
+    fs::remove(volumeIO->ShardName);
+  }
 }
 
 void run(Options& opts) {
@@ -205,29 +393,25 @@ void run(Options& opts) {
     exit(1);
   }
 
-  for (auto& volumeIO: imageIO.Volumes) {
-    std::cout << "Finding events on Volume: " << volumeIO->Name << std::endl;
-
-    imageIO.SqliteHelper.beginTransaction();
-    for (auto& snapshotIO: volumeIO->Snapshots) {
-      std::cout << "Parsing input files for snapshot: " << snapshotIO->Name << std::endl;
-      processStep(*snapshotIO, opts.extra);
-      std::cout << std::endl;
-    }
-    imageIO.SqliteHelper.endTransaction();
-    imageIO.SqliteHelper.beginTransaction();
-
-    std::cout << std::endl << "Generating unified events output..." << std::endl;
-    volumeIO->Events << Event::getColumnHeaders();
-    std::vector<SnapshotIOPtr>::reverse_iterator rIt;
-    for (rIt = volumeIO->Snapshots.rbegin(); rIt != volumeIO->Snapshots.rend(); ++rIt) {
-      std::cout << "Processing events from snapshot: " << (*rIt)->Name << std::endl;
-      processFinalize(**rIt);
-    }
+  std::unique_ptr<ArrowTables> arrowTables;
+  if (opts.arrow) {
+    arrowTables.reset(new ArrowTables(opts.output.string()));
+    ArrowTables::Active = arrowTables.get();
+  }
 
-    imageIO.SqliteHelper.endTransaction();
+  std::unique_ptr<PerfCounters> perf;
+  if (opts.perfCounters) {
+    perf.reset(new PerfCounters(imageIO.SqliteHelper));
+    if (perf->good())
+      opts.observers.push_back(perf.get());
   }
+
+  processVolumes(imageIO, opts);
+  if (perf)
+    opts.observers.erase(std::remove(opts.observers.begin(), opts.observers.end(), perf.get()), opts.observers.end());
   imageIO.SqliteHelper.close();
+  ArrowTables::Active = NULL;
+  arrowTables.reset();
   std::cout << std::endl;
   std::cout << imageIO.getSummary() << std::endl;
   std::cout << "Process complete." << std::endl;
@@ -0,0 +1,124 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "diagnostics.h"
+
+#include <sstream>
+
+// Every anomaly is sampled until this many of a kind have been seen
+const uint64_t ALWAYS_SAMPLED = 16;
+// Anomalies between looks at the clock
+const uint64_t REPORT_STRIDE = 1024;
+
+std::chrono::steady_clock::duration Diagnostics::ReportInterval = std::chrono::seconds(5);
+
+std::string toString(AnomalyKinds kind) {
+  switch(kind) {
+    case AnomalyKinds::ANOMALY_LOG_INVALID_RECORD_TYPE:
+      return "Invalid $LogFile record type";
+    case AnomalyKinds::ANOMALY_LOG_INVALID_OP_CODE:
+      return "Invalid $LogFile op code";
+    case AnomalyKinds::ANOMALY_USN_BAD_RECORD:
+      return "Bad $UsnJrnl record";
+    case AnomalyKinds::ANOMALY_USN_RECOVERED:
+      return "$UsnJrnl recovery";
+    case AnomalyKinds::ANOMALY_USN_RECOVERY_FAILED:
+      return "Failed $UsnJrnl recovery";
+    case AnomalyKinds::ANOMALY_USN_INCONSISTENT_USN:
+      return "Inconsistent Usn value";
+    default:
+      return "N/A";
+  }
+}
+
+Diagnostics::Diagnostics(const VersionInfo& version, const std::string& fileName)
+  : Version(&version), FileName(fileName), Total(0), LastReported(0), LastReport(std::chrono::steady_clock::now()) {
+  for (unsigned int i = 0; i < NUM_ANOMALY_KINDS; i++)
+    Counts[i] = 0;
+}
+
+bool Diagnostics::isSampled(uint64_t n) {
+  return n <= ALWAYS_SAMPLED || (n & (n - 1)) == 0;
+}
+
+void Diagnostics::record(AnomalyKinds kind, uint64_t offset, uint64_t value) {
+  uint64_t n = ++Counts[kind];
+  if (isSampled(n)) {
+    Sample sample = {kind, offset, value};
+    Samples.push_back(sample);
+  }
+
+  // The clock is read on a fixed stride, so the check is cheap on badly damaged files, yet
+  // still happens when the samples thin out
+  if (++Total % REPORT_STRIDE)
+    return;
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (now - LastReport >= ReportInterval) {
+    std::cerr << "\r" << FileName << " in snapshot " << Version->Snapshot << ": "
+              << Total - LastReported << " more anomalies (" << Total << " total)" << std::endl;
+    LastReported = Total;
+    LastReport = now;
+  }
+}
+
+void Diagnostics::insert(SQLiteHelper& sqliteHelper) const {
+  for (unsigned int i = 0; i < NUM_ANOMALY_KINDS; i++) {
+    if (!Counts[i])
+      continue;
+    SQLiteRow(sqliteHelper, INSERT_DIAGNOSTIC)
+      .text(toString(static_cast<AnomalyKinds>(i)))
+      .integer(Counts[i])
+      .text(Version->Snapshot)
+      .text(Version->Volume);
+  }
+
+  for (const Sample& sample: Samples) {
+    SQLiteRow(sqliteHelper, INSERT_DIAGNOSTIC_SAMPLE)
+      .text(toString(sample.Kind))
+      .integer(sample.Offset)
+      .integer(sample.Value)
+      .text(Version->Snapshot)
+      .text(Version->Volume);
+  }
+}
+
+void Diagnostics::printSummary(std::ostream& out) const {
+  if (!total())
+    return;
+  std::stringstream ss;
+  ss << "Anomalies in " << FileName << " of snapshot " << Version->Snapshot << ": ";
+  bool first = true;
+  for (unsigned int i = 0; i < NUM_ANOMALY_KINDS; i++) {
+    if (!Counts[i])
+      continue;
+    if (!first)
+      ss << ", ";
+    ss << toString(static_cast<AnomalyKinds>(i)) << ": " << Counts[i];
+    first = false;
+  }
+  ss << ". See the diagnostics tables in the database for details.";
+  out << ss.str() << std::endl;
+}
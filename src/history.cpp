@@ -0,0 +1,210 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "history.h"
+#include "aggregate.h"
+
+#include <algorithm>
+#include <iostream>
+
+void RecordHistory::seed(const std::vector<File>& records) {
+  Seeded = true;
+  Versions.resize(records.size());
+  for (unsigned int i = 0; i < records.size(); i++) {
+    if (!records[i].Valid)
+      continue;
+    Versions[i].Name = records[i].Name;
+    Versions[i].Parent = records[i].Parent;
+    Versions[i].Exists = true;
+  }
+}
+
+void RecordHistory::start(const VersionInfo& version, size_t numRecords) {
+  SqliteHelper.identify(version);
+  VolumeId = version.VolumeId;
+  NumRecords = numRecords;
+}
+
+RecordHistory::Version& RecordHistory::at(int64_t record) {
+  if (static_cast<uint64_t>(record) >= Versions.size())
+    Versions.resize(record + 1);
+  return Versions[record];
+}
+
+/*
+The version of the record after the event ends at the event; the one before it, if any,
+takes its place as the oldest seen. Like Event::updateRecords, records outside the $MFT are
+skipped
+*/
+void RecordHistory::event(const Event& event) {
+  if (!Seeded || event.Record < 0 || static_cast<uint64_t>(event.Record) >= NumRecords || event.IsEmbedded)
+    return;
+  // Times only go back along the timeline, even where snapshots overlap
+  if ((event.IsAnchor || LastTimestamp.empty()) && (LastTimestamp.empty() || event.Timestamp < LastTimestamp))
+    LastTimestamp = event.Timestamp;
+  if (LastTimestamp.empty())
+    return;
+
+  Version& current = at(event.Record);
+  Version after(current);
+  if (!after.Exists) {
+    // A file the newest snapshot doesn't have, or one which was later deleted
+    after.Name = event.Name;
+    after.Parent = event.Parent;
+  }
+
+  Version before;
+  before.ValidTo = LastTimestamp;
+  before.ToPosition = event.Order;
+  switch(event.Type) {
+    case EventTypes::TYPE_CREATE:
+      break;
+    case EventTypes::TYPE_DELETE:
+      before.Name = event.Name;
+      before.Parent = event.Parent;
+      before.Exists = true;
+      if (!current.Exists || (current.Name == event.Name && current.Parent == event.Parent)) {
+        // Nothing had the record after it was deleted; the $MFT keeps the names of deleted files
+        current = before;
+        return;
+      }
+      break;
+    case EventTypes::TYPE_MOVE:
+      if (event.PreviousParent == -1)
+        return;
+      before.Name = after.Name;
+      before.Parent = event.PreviousParent;
+      before.Exists = true;
+      break;
+    case EventTypes::TYPE_RENAME:
+      if (event.PreviousName.empty())
+        return;
+      before.Name = event.PreviousName;
+      before.Parent = after.Parent;
+      before.Exists = true;
+      break;
+    default:
+      return;
+  }
+  write(event.Record, after, LastTimestamp, event.Order);
+  current = before;
+}
+
+void RecordHistory::finish() {
+  for (unsigned int i = 0; i < Versions.size(); i++) {
+    if (Versions[i].Exists)
+      write(i, Versions[i], "", -1);
+  }
+  Versions.clear();
+}
+
+void RecordHistory::write(int64_t record, const Version& version, const std::string& validFrom, int64_t fromPosition) {
+  SQLiteRow row(SqliteHelper, INSERT_HISTORY);
+  row.integer(VolumeId)
+     .integer(record)
+     .text(version.Name)
+     .integer(version.Parent)
+     .text(validFrom)
+     .text(version.ValidTo);
+  if (fromPosition < 0)
+    row.null();
+  else
+    row.integer(fromPosition);
+  if (version.ToPosition < 0)
+    row.null();
+  else
+    row.integer(version.ToPosition);
+}
+
+PathHistory::PathHistory(const std::string& dbName) : Db(NULL), Select(NULL) {
+  if (sqlite3_open_v2(dbName.c_str(), &Db, SQLITE_OPEN_READONLY, NULL)) {
+    std::cerr << "Error opening database " << dbName << std::endl;
+    return;
+  }
+  // Of the versions which had begun by then, the newest, unless it had already ended
+  const char* sql = "select FileName, ParentMFTRecord from record_history "
+                    "where VolumeID = ? and MFTRecord = ? and ValidFrom <= ? and (ValidTo = '' or ValidTo > ?) "
+                    "order by ValidFrom desc, FromPosition limit 1;";
+  if (sqlite3_prepare_v2(Db, sql, -1, &Select, NULL)) {
+    std::cerr << "The database has no record history. Run this version of ntfs-linker with --overwrite to add it." << std::endl;
+    Select = NULL;
+  }
+}
+
+PathHistory::~PathHistory() {
+  sqlite3_finalize(Select);
+  sqlite3_close(Db);
+}
+
+std::vector<std::pair<std::string, int64_t>> PathHistory::volumes() {
+  std::vector<std::pair<std::string, int64_t>> volumes;
+  sqlite3_stmt* stmt = NULL;
+  if (sqlite3_prepare_v2(Db, "select Name, VolumeID from volumes order by VolumeID;", -1, &stmt, NULL) == SQLITE_OK) {
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      volumes.emplace_back(textToString(sqlite3_column_text(stmt, 0)), sqlite3_column_int64(stmt, 1));
+  }
+  sqlite3_finalize(stmt);
+  return volumes;
+}
+
+bool PathHistory::lookup(int64_t volumeId, int64_t record, const std::string& time, std::string& name, int64_t& parent) {
+  int i = 0;
+  sqlite3_bind_int64(Select, ++i, volumeId);
+  sqlite3_bind_int64(Select, ++i, record);
+  sqlite3_bind_text (Select, ++i, time.c_str(), -1, SQLITE_STATIC);
+  sqlite3_bind_text (Select, ++i, time.c_str(), -1, SQLITE_STATIC);
+  bool found = sqlite3_step(Select) == SQLITE_ROW;
+  if (found) {
+    name = textToString(sqlite3_column_text(Select, 0));
+    parent = sqlite3_column_int64(Select, 1);
+  }
+  sqlite3_reset(Select);
+  return found;
+}
+
+/*
+Walks up the parents as they were at time, like getFullPath does with the records of a snapshot
+*/
+bool PathHistory::pathAt(int64_t volumeId, int64_t record, const std::string& time, std::string& path) {
+  std::string name;
+  int64_t parent;
+  std::vector<int64_t> stack;
+  path.clear();
+  if (!lookup(volumeId, record, time, name, parent))
+    return false;
+  while (record != parent) {
+    if (std::find(stack.begin(), stack.end(), record) != stack.end()) {
+      path = "CYCLICAL_HARD_LINK" + path;
+      break;
+    }
+    stack.push_back(record);
+    path = "\\" + name + path;
+    record = parent;
+    if (!lookup(volumeId, record, time, name, parent))
+      break;
+  }
+  return true;
+}
@@ -25,20 +25,24 @@
  */
 
 #include "log.h"
+#include "carve.h"
+#include "diagnostics.h"
+#include "layout.h"
 #include "util.h"
 #include "mft.h"
 #include "progress.h"
 #include "sqlite_util.h"
 #include "usn.h"
 
+#include <algorithm>
 #include <cstring>
-#include <iomanip>
+#include <memory>
 #include <sstream>
 
 /*
 Decodes the LogFile Op code
 */
-std::string decodeLogFileOpCode(int op) {
+const char* decodeLogFileOpCode(int op) {
   switch(op) {
     case LogOps::NOOP                               : return "Noop";
     case LogOps::COMPENSATION_LOG_RECORD            : return "CompensationLogRecord";
@@ -77,13 +81,17 @@ std::string decodeLogFileOpCode(int op) {
 Parses the $LogFile
 outputs to the various streams
 */
-void parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std::istream& input, std::ostream& output, const VersionInfo& version, bool extra) {
+uint64_t parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std::istream& input, std::ostream& output, const VersionInfo& version, bool extra, bool carve,
+                  const std::vector<RecordObserver*>& observers) {
   unsigned int buffer_size = 4096;
-  char* buffer = new char[buffer_size];
+  // Page buffers are reused for the whole file; they only grow when a record spans several pages
+  std::vector<char> pageBuf(buffer_size), spillBuf, nextPage(4096);
+  char* buffer = pageBuf.data();
   bool split_record = false;
   bool done = false;
   bool parseError = true;
   int records_processed = 3;
+  uint64_t log_records = 0;
   int adjust = 0;
   bool prev_has_next = true;
 
@@ -95,23 +103,33 @@ void parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std:
   input.clear();
   input.seekg(0, std::ios::end);
   uint64_t end = input.tellg();
-  ProgressBar status(end);
+  ProgressBar status(end, "$LogFile");
   uint64_t start = 0x4000;
   input.seekg(start, std::ios::beg);
   input.read(buffer, 4096);
   doFixup(buffer, 4096, 512);
 
   output << LogRecord::getColumnHeaders();
+  TsvWriter tsv(output);
 
+  sqliteHelper.identify(version);
   LogData transactions(version);
+  transactions.Observers = observers;
   transactions.clearFields();
+  LogRecord rec(version);
+  Diagnostics diagnostics(version, "$LogFile");
+  std::unique_ptr<LogCarver> carver(carve ? new LogCarver() : nullptr);
 
   //scan through the $LogFile one  page at a time. Each record is 4096 bytes.
-  while(!input.eof() && !done) {
+  while(input && !done) {
 
-    status.setDone((uint64_t) input.tellg() - start);
+    status.setDone((uint64_t) input.tellg() - start, log_records);
     //check log record header
-    if(hex_to_long(buffer, 4) != 0x44524352) {
+    RcrdPageHeader page(buffer);
+    if(page.magic() != RCRD_MAGIC) {
+      // Stale or damaged page; it may still hold records
+      if (carver && buffer_size == 4096)
+        carver->submit(buffer, static_cast<uint64_t>(input.tellg()) - 4096, 0, 4096);
       input.read(buffer, 4096);
       if (input.eof())
         break;
@@ -121,13 +139,14 @@ void parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std:
       continue;
     }
     records_processed++;
-    unsigned int update_seq_offset, update_seq_count, offset, next_record_offset;
+    unsigned int offset, next_record_offset;
     unsigned int length = 0;
-    update_seq_offset = hex_to_long(buffer + 0x4, 2);
-    update_seq_count = hex_to_long(buffer + 0x6, 2);
-    offset = update_seq_offset + ceilingDivide(update_seq_count, 4) * 8;
-    next_record_offset = hex_to_long(buffer + 0x18, 2);
+    offset = page.dataOffset();
+    next_record_offset = page.nextRecordOffset();
     if(parseError) { //initialize the offset on the "first" record processed
+      // The tail of a record we couldn't follow across the page boundary
+      if (carver && buffer_size == 4096 && next_record_offset > offset && next_record_offset <= buffer_size)
+        carver->submit(buffer, static_cast<uint64_t>(input.tellg()) - 4096, offset, next_record_offset);
       offset = next_record_offset;
       parseError = false;
       transactions.clearFields();
@@ -138,8 +157,8 @@ void parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std:
       int64_t cur_offset = static_cast<long int>(input.tellg()) - buffer_size + offset - adjust;
       if (transactions.Offset == -1)
         transactions.Offset = cur_offset;
-      LogRecord rec(version);
-      int rtnVal = rec.init(buffer + offset, cur_offset, prev_has_next);
+      bool expect_record = prev_has_next;
+      int rtnVal = rec.init(buffer + offset, buffer_size - offset, cur_offset);
       prev_has_next = rec.LcnsToFollow;
       if(rtnVal == -1) {
         split_record = true;
@@ -148,32 +167,29 @@ void parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std:
       } else if(rtnVal < 0) {
         length = rec.ClientDataLength + 0x30;
         parseError = true;
+        if (rtnVal == -3)
+          diagnostics.record(AnomalyKinds::ANOMALY_LOG_INVALID_OP_CODE, cur_offset, (rec.RedoOp << 16) | rec.UndoOp);
+        else if (expect_record)
+          diagnostics.record(AnomalyKinds::ANOMALY_LOG_INVALID_RECORD_TYPE, cur_offset, rec.RecordType);
+        // Slack space at the end of the page
+        if (carver && buffer_size == 4096)
+          carver->submit(buffer, static_cast<uint64_t>(input.tellg()) - 4096, offset, buffer_size);
         break;
       } else {
         length = rtnVal;
       }
+      log_records++;
 
       if (extra) {
-        output << rec;
-        rec.insert(sqliteHelper.LogInsert);
+        rec.write(tsv);
+        rec.insert(sqliteHelper);
+        if (ArrowTables::Active)
+          rec.write(ArrowTables::Active->Log);
       }
+      for (auto observer: observers)
+        observer->logRecord(rec);
 
-      transactions.processLogRecord(records, rec, sqliteHelper, cur_offset);
-      if(transactions.isTransactionOver()) {
-        if(transactions.isCreateEvent()) {
-          transactions.insertEvent(EventTypes::TYPE_CREATE, sqliteHelper.EventInsert);
-        }
-        if(transactions.isDeleteEvent()) {
-          transactions.insertEvent(EventTypes::TYPE_DELETE, sqliteHelper.EventInsert);
-        }
-        if(transactions.isRenameEvent()) {
-          transactions.insertEvent(EventTypes::TYPE_RENAME, sqliteHelper.EventInsert);
-        }
-        if(transactions.isMoveEvent()) {
-          transactions.insertEvent(EventTypes::TYPE_MOVE, sqliteHelper.EventInsert);
-        }
-        transactions.clearFields();
-      }
+      transactions.addRecord(records, rec, sqliteHelper, cur_offset);
       offset += length;
     }
 
@@ -186,23 +202,22 @@ void parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std:
     */
     if(split_record) {
       unsigned int new_size = ceilingDivide(length - buffer_size + offset, 4032) * 4096 + buffer_size - offset;
-      char* temp = new char[new_size];
+      if (spillBuf.size() < std::max(new_size, 4096u))
+        spillBuf.resize(std::max(new_size, 4096u));
+      char* temp = spillBuf.data();
       adjust = buffer_size - offset;
       input.read(temp + buffer_size - offset, 4096);
       if(input.eof()) {
         done = true;
-        delete[] temp;
         break;
       }
       doFixup(temp + buffer_size - offset, 4096, 512);
 
-      update_seq_offset = hex_to_long(temp + buffer_size - offset + 0x4, 2);
-      update_seq_count = hex_to_long(temp + buffer_size - offset + 0x6, 2);
-      unsigned int header_length = update_seq_offset + ceilingDivide(update_seq_count, 4) * 8;
+      unsigned int header_length = RcrdPageHeader(temp + buffer_size - offset).dataOffset();
       memmove(temp, temp + buffer_size - offset, header_length);
       memcpy(temp + header_length, buffer + offset, buffer_size - offset);
-      delete[] buffer;
-      buffer = temp;
+      pageBuf.swap(spillBuf);
+      buffer = pageBuf.data();
       // Flag the record as not crossing the current page
       buffer[header_length + 0x28] = 0;
       buffer[header_length + 0x29] = 0;
@@ -220,23 +235,19 @@ void parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std:
       AFTER : RCRD header | record pt1 | record pt2 | record pt3 | ...
       */
       for(unsigned int i = 1; write_offset < new_size; i++) {
-        temp = new char[4096];
+        temp = nextPage.data();
         input.read(temp, 4096);
         if(input.eof()) {
           done = true;
-          delete[] temp;
           break;
         }
         doFixup(temp, 4096, 512);
 
-        update_seq_offset = hex_to_long(temp + 0x4, 2);
-        update_seq_count = hex_to_long(temp + 0x6, 2);
-        header_length = update_seq_offset + ceilingDivide(update_seq_count, 4) * 8;
+        header_length = RcrdPageHeader(temp).dataOffset();
         memcpy(buffer + write_offset, temp + header_length, 4096 - header_length);
         write_offset += 4096 - header_length;
         records_processed++;
         new_size -= header_length;
-        delete[] temp;
       }
       buffer_size = new_size;
       split_record = false;
@@ -261,40 +272,71 @@ void parseLog(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std:
   }
 
   if (transactions.PrevUsnRecord.Usn != 0) {
-    transactions.PrevUsnRecord.checkTypeAndInsert(sqliteHelper.EventInsert);
+    transactions.PrevUsnRecord.checkTypeAndInsert(sqliteHelper);
   }
   status.finish();
-  delete [] buffer;
+  diagnostics.insert(sqliteHelper);
+  diagnostics.printSummary(std::cerr);
+
+  if (carver) {
+    /*
+    Carved records are replayed through their own transaction run. A transaction is only
+    followed across records which sit back to back, since anything else is unrelated.
+    */
+    std::vector<CarvedRecord>& carved = carver->finish();
+    LogData carvedTransactions(version);
+    carvedTransactions.Source = EventSources::SOURCE_LOG_CARVED;
+    carvedTransactions.clearFields();
+    uint64_t expected = 0, parsed = 0;
+    for (CarvedRecord& carvedRec : carved) {
+      if (carvedRec.Offset != expected)
+        carvedTransactions.clearFields();
+      expected = carvedRec.Offset + carvedRec.Data.size();
+      if (carvedTransactions.Offset == -1)
+        carvedTransactions.Offset = carvedRec.Offset;
+      if (rec.init(carvedRec.Data.data(), carvedRec.Data.size(), carvedRec.Offset) < 0) {
+        carvedTransactions.clearFields();
+        continue;
+      }
+      carvedTransactions.addRecord(records, rec, sqliteHelper, carvedRec.Offset);
+      ++parsed;
+    }
+    // With the anomaly summary, off stdout, which may be carrying --stream's events
+    std::cerr << "Carved " << pluralize("record", parsed) << " from $LogFile slack space" << std::endl;
+  }
+  return log_records;
+}
+
+void LogRecord::clearFields() {
+  CurrentLsn = PreviousLsn = UndoLsn = Offset = 0;
+  ClientId = RecordType = Flags = RedoOp = UndoOp = RedoOffset = RedoLength = UndoOffset = UndoLength = 0;
+  TargetAttribute = LcnsToFollow = RecordOffset = AttributeOffset = MftClusterIndex = TargetVcn = TargetLcn = 0;
+  ClientDataLength = AvailableLength = 0;
+  Data = NULL;
 }
 
-int LogRecord::init(char* buffer, uint64_t offset, bool prev_has_next) {
+int LogRecord::init(char* buffer, unsigned int size, uint64_t offset) {
+  clearFields();
   Data = buffer;
   Offset = offset;
-  CurrentLsn = hex_to_long(buffer, 8);
-  PreviousLsn = hex_to_long(buffer + 0x8, 8);
-  UndoLsn = hex_to_long(buffer + 0x10, 8);
+  LogRecordHeader header(buffer);
+  CurrentLsn = header.currentLsn();
+  PreviousLsn = header.previousLsn();
+  UndoLsn = header.undoLsn();
 
-  ClientDataLength = hex_to_long(buffer + 0x18, 4);
+  ClientDataLength = header.clientDataLength();
 
-  ClientId = hex_to_long(buffer + 0x1C, 4);
-  RecordType = hex_to_long(buffer + 0x20, 4);
+  ClientId = header.clientId();
+  RecordType = header.recordType();
 
   /*
   Not particularly a concern. Sometimes there is extra slack space at the end of a page.
-  In which case, we read that the record type is 0 and print an error message
-  (since 0 is not a valid record type).
-  If these error messages are spamming error output, however, then something probably went
-  horribly wrong. Most likely cause is that the parser offset became misplaced and tried to
-  parse the wrong bits of the records.
+  In which case, we read that the record type is 0 (since 0 is not a valid record type).
+  If the caller was expecting a record here and this happens a lot, however, then something
+  probably went horribly wrong. Most likely cause is that the parser offset became misplaced
+  and tried to parse the wrong bits of the records.
   */
   if(RecordType == 0) {
-    if (prev_has_next) {
-      std::cerr << std::setw(60) << std::left << std::setfill(' ') << "\r";
-      std::cerr << "Invalid record type: 0x" << std::hex << RecordType
-                << " where valid record expected at offset 0x" << std::hex << offset
-                << " in snapshot: " << Snapshot
-                << " . Skipping to next page." << std::endl;
-    }
     return -2;
   }
 
@@ -302,41 +344,44 @@ int LogRecord::init(char* buffer, uint64_t offset, bool prev_has_next) {
   A flag on a record means that at least part of the record is on the next page.
   We do some fancy switcheroo stuff at the bottom of the loop to compensate.
   */
-  Flags = hex_to_long(buffer + 0x28, 2);
+  Flags = header.flags();
   if(Flags == 1) {
     return -1;
   }
 
-  RedoOp = hex_to_long(buffer + 0x30, 2);
-  UndoOp = hex_to_long(buffer + 0x32, 2);
+  // Damaged or cut off by the end of the page
+  if(size < LogRecordHeader::SIZE + LogOperationHeader::SIZE) {
+    return -2;
+  }
+  AvailableLength = std::min(ClientDataLength, size - LogRecordHeader::SIZE);
+
+  LogOperationHeader op(buffer + LogRecordHeader::SIZE);
+  RedoOp = op.redoOp();
+  UndoOp = op.undoOp();
 
   // We've run into some junk data
   if(RedoOp > 0x21 || UndoOp > 0x21) {
-    std::cerr << std::setw(60) << std::left << std::setfill(' ') << "\r";
-    std::cerr << "\rInvalid $LogFile op code: 0x" << std::hex << RedoOp << " 0x" << UndoOp
-              << " at offset 0x" << offset << " in snapshot: " << Snapshot
-              << ". Skipping to next page. " << std::endl;
-    return -2;
+    return -3;
   }
-  RedoOffset = hex_to_long(buffer + 0x34, 2);
-  RedoLength = hex_to_long(buffer + 0x36, 2);
-  UndoOffset = hex_to_long(buffer + 0x38, 2);
-  UndoLength = hex_to_long(buffer + 0x3a, 2);
-  TargetAttribute = hex_to_long(buffer + 0x3c, 2);
-  LcnsToFollow = hex_to_long(buffer + 0x3e, 2);
+  RedoOffset = op.redoOffset();
+  RedoLength = op.redoLength();
+  UndoOffset = op.undoOffset();
+  UndoLength = op.undoLength();
+  TargetAttribute = op.targetAttribute();
+  LcnsToFollow = op.lcnsToFollow();
 
-  RecordOffset = hex_to_long(buffer + 0x40, 2);
-  AttributeOffset = hex_to_long(buffer + 0x42, 2);
-  MftClusterIndex = hex_to_long(buffer + 0x44, 2);
-  TargetVcn = hex_to_long(buffer + 0x48, 4);
+  RecordOffset = op.recordOffset();
+  AttributeOffset = op.attributeOffset();
+  MftClusterIndex = op.mftClusterIndex();
+  TargetVcn = op.targetVcn();
 
-  TargetLcn = hex_to_long(buffer + 0x50, 4);
+  TargetLcn = op.targetLcn();
 
   /*
   The length given by ClientDataLength is actually 0x30 less than the length of the record.
   */
 
-  return 0x30 + ClientDataLength;
+  return LogRecordHeader::SIZE + ClientDataLength;
 
 }
 
@@ -347,91 +392,104 @@ void LogData::processLogRecord(const std::vector<File>& records, LogRecord& rec,
   RedoOps.push_back(rec.RedoOp);
   UndoOps.push_back(rec.UndoOp);
 
-  char *redo_data = rec.Data + 0x30 + rec.RedoOffset;
-  char *undo_data = rec.Data + 0x30 + rec.UndoOffset;
+  // A damaged record can point its redo or undo data past its end, or claim to be longer than
+  // what's left of the buffer. An op whose data would be read from there matches none of the
+  // cases below; a no-op has no data, so it's kept.
+  int redoOp = rec.RedoOp, undoOp = rec.UndoOp;
+  if (static_cast<uint64_t>(rec.RedoOffset) + rec.RedoLength > rec.AvailableLength && redoOp != LogOps::NOOP)
+    redoOp = -1;
+  if (static_cast<uint64_t>(rec.UndoOffset) + rec.UndoLength > rec.AvailableLength && undoOp != LogOps::NOOP)
+    undoOp = -1;
+
+  char *redo_data = rec.Data + LogRecordHeader::SIZE + rec.RedoOffset;
+  char *undo_data = rec.Data + LogRecordHeader::SIZE + rec.UndoOffset;
   //pull data from necessary opcodes to save for transaction runs
-  if(rec.RedoOp == LogOps::SET_BITS_IN_NONRESIDENT_BIT_MAP && rec.UndoOp == LogOps::CLEAR_BITS_IN_NONRESIDENT_BIT_MAP) {
+  if(redoOp == LogOps::SET_BITS_IN_NONRESIDENT_BIT_MAP && undoOp == LogOps::CLEAR_BITS_IN_NONRESIDENT_BIT_MAP) {
     if(rec.RedoLength >= 4)
-      Record = hex_to_long(redo_data, 4);
+      Record = le<uint32_t>(redo_data);
   }
-  else if(rec.RedoOp == LogOps::INITIALIZE_FILE_RECORD_SEGMENT && rec.UndoOp == LogOps::NOOP) {
+  else if(redoOp == LogOps::INITIALIZE_FILE_RECORD_SEGMENT && undoOp == LogOps::NOOP) {
     //parse MFT record from redo op for create time, file name, parent dir
     //need to check for possible second MFT attribute header
-    MFTRecord mftRec(redo_data, rec.RedoLength);
+    ScratchMft.init(redo_data, rec.RedoLength);
+    const MFTRecord& mftRec(ScratchMft);
     // Modified timestamp!
     // In case of file system tunneling (i.e., this event is really a write),
     // the Creation time is not the event time - it's the time the file was _originally_ created
     // https://support.microsoft.com/en-us/kb/299648
-    Timestamp = filetime_to_iso_8601(mftRec.Sia.Modified);
-
-    Created = filetime_to_iso_8601(mftRec.Sia.Created);
-    Modified = filetime_to_iso_8601(mftRec.Sia.Modified);
-    std::stringstream commentSS;
-    if (Created != filetime_to_iso_8601(mftRec.Fna.Created))
-      commentSS << "Creates don't match, ";
-    if (Modified != filetime_to_iso_8601(mftRec.Fna.Modified))
-      commentSS << "Modifies don't match";
-    Comment = commentSS.str();
+    char created[ISO_8601_LENGTH], modified[ISO_8601_LENGTH], fnTime[ISO_8601_LENGTH];
+    size_t createdLen = filetime_to_iso_8601(mftRec.Sia.Created, created);
+    size_t modifiedLen = filetime_to_iso_8601(mftRec.Sia.Modified, modified);
+    Timestamp.assign(modified, modifiedLen);
+    Created.assign(created, createdLen);
+    Modified.assign(modified, modifiedLen);
+
+    Comment.clear();
+    size_t fnTimeLen = filetime_to_iso_8601(mftRec.Fna.Created, fnTime);
+    if (createdLen != fnTimeLen || memcmp(created, fnTime, createdLen) != 0)
+      Comment += "Creates don't match, ";
+    fnTimeLen = filetime_to_iso_8601(mftRec.Fna.Modified, fnTime);
+    if (modifiedLen != fnTimeLen || memcmp(modified, fnTime, modifiedLen) != 0)
+      Comment += "Modifies don't match";
 
     if (Fna < mftRec.Fna)
       Fna = mftRec.Fna;
   }
-  else if(rec.RedoOp == LogOps::DELETE_ATTRIBUTE && rec.UndoOp == LogOps::CREATE_ATTRIBUTE) {
+  else if(redoOp == LogOps::DELETE_ATTRIBUTE && undoOp == LogOps::CREATE_ATTRIBUTE) {
     //get the name before
     //from file attribute with header, undo op
-    uint64_t type_id = hex_to_long(undo_data, 4);
-    uint64_t content_offset = hex_to_long(undo_data + 0x14, 2);
-    if (type_id == 0x30) {
-      FNAttribute fna(undo_data + content_offset);
-
-      if (PreviousFna < fna)
-        PreviousFna = fna;
+    AttributeHeader attribute(undo_data);
+    if (rec.UndoLength >= 0x16 && attribute.type() == 0x30 && attribute.contentOffset() <= rec.UndoLength &&
+        ScratchFna.init(undo_data + attribute.contentOffset(), rec.UndoLength - attribute.contentOffset())) {
+      if (PreviousFna < ScratchFna)
+        PreviousFna = ScratchFna;
     }
   }
-  else if(rec.RedoOp == LogOps::CREATE_ATTRIBUTE && rec.UndoOp == LogOps::DELETE_ATTRIBUTE) {
+  else if(redoOp == LogOps::CREATE_ATTRIBUTE && undoOp == LogOps::DELETE_ATTRIBUTE) {
     //get the name after
     //from file attribute with header, redo op
     //prev_name =
 
-    uint64_t type_id = hex_to_long(redo_data, 4);
-    uint64_t content_offset = hex_to_long(redo_data + 0x14, 2);
-    if (type_id == 0x30) {
-      FNAttribute fna(redo_data + content_offset);
-
-      if (Fna < fna)
-        Fna = fna;
+    AttributeHeader attribute(redo_data);
+    if (rec.RedoLength >= 0x16 && attribute.type() == 0x30 && attribute.contentOffset() <= rec.RedoLength &&
+        ScratchFna.init(redo_data + attribute.contentOffset(), rec.RedoLength - attribute.contentOffset())) {
+      if (Fna < ScratchFna)
+        Fna = ScratchFna;
     }
   }
-  else if((rec.RedoOp == LogOps::DELETE_INDEX_ENTRY_ALLOCATION && rec.UndoOp == LogOps::ADD_INDEX_ENTRY_ALLOCATION) || (rec.RedoOp == LogOps::DELETE_INDEX_ENTRY_ROOT && rec.UndoOp == LogOps::ADD_INDEX_ENTRY_ROOT)) {
-    if(rec.UndoLength > 0x42) {
+  else if((redoOp == LogOps::DELETE_INDEX_ENTRY_ALLOCATION && undoOp == LogOps::ADD_INDEX_ENTRY_ALLOCATION) || (redoOp == LogOps::DELETE_INDEX_ENTRY_ROOT && undoOp == LogOps::ADD_INDEX_ENTRY_ROOT)) {
+    if(rec.UndoLength > 0x42 && ScratchFna.init(undo_data + 0x10, rec.UndoLength - 0x10)) {
       // Delete or rename
-      FNAttribute fna(undo_data + 0x10);
-
-      if (Fna < fna)
-        Fna = fna;
+      if (Fna < ScratchFna)
+        Fna = ScratchFna;
     }
 
   }
-  else if ((rec.RedoOp == LogOps::ADD_INDEX_ENTRY_ALLOCATION && rec.UndoOp == LogOps::DELETE_INDEX_ENTRY_ALLOCATION) || (rec.RedoOp == LogOps::ADD_INDEX_ENTRY_ROOT && rec.UndoOp == LogOps::DELETE_INDEX_ENTRY_ROOT)) {
+  else if ((redoOp == LogOps::ADD_INDEX_ENTRY_ALLOCATION && undoOp == LogOps::DELETE_INDEX_ENTRY_ALLOCATION) || (redoOp == LogOps::ADD_INDEX_ENTRY_ROOT && undoOp == LogOps::DELETE_INDEX_ENTRY_ROOT)) {
     // Add index entry root/AddIndexEntryAllocation operation
     // See https://flatcap.org/linux-ntfs/ntfs/concepts/index_record.html
     // for additional info about Index Record structure ("The header part")
     // TODO REFACTOR MAKE THIS ITS OWN CLASS
-    if (rec.RedoLength > 0x52) {
-      Record = hex_to_long(redo_data, 6);
-      FNAttribute fna(redo_data + 0x10);
-      Timestamp = filetime_to_iso_8601(fna.Created);
+    if (rec.RedoLength > 0x52 && ScratchFna.init(redo_data + 0x10, rec.RedoLength - 0x10)) {
+      Record = le48(redo_data);
+      char timestamp[ISO_8601_LENGTH];
+      Timestamp.assign(timestamp, filetime_to_iso_8601(ScratchFna.Created, timestamp));
 
-      if (Fna < fna)
-        Fna = fna;
+      if (Fna < ScratchFna)
+        Fna = ScratchFna;
     }
   }
-  else if (rec.RedoOp == LogOps::UPDATE_NONRESIDENT_VALUE && rec.UndoOp == LogOps::NOOP) {
-    // Embedded $UsnJrnl/$J record
-    UsnRecord usnRecord(redo_data, fileOffset + 0x30 + rec.RedoOffset, VersionInfo(Snapshot, Volume), rec.RedoLength, true);
-    usnRecord.insert(sqliteHelper.UsnInsert, records);
+  else if (redoOp == LogOps::UPDATE_NONRESIDENT_VALUE && undoOp == LogOps::NOOP && Source == EventSources::SOURCE_LOG) {
+    // Embedded $UsnJrnl/$J record. Carved records are only used for their transactions
+    UsnRecord& usnRecord(ScratchUsnRecord);
+    usnRecord.init(redo_data, fileOffset + LogRecordHeader::SIZE + rec.RedoOffset, rec.RedoLength);
+    usnRecord.insert(sqliteHelper, records);
+    if (ArrowTables::Active)
+      usnRecord.write(ArrowTables::Active->Usn, records);
+    for (auto observer: Observers)
+      observer->usnRecord(usnRecord, records);
     if (PrevUsnRecord.Record != usnRecord.Record || PrevUsnRecord.Reason & UsnReasons::USN_CLOSE) {
-      PrevUsnRecord.checkTypeAndInsert(sqliteHelper.EventInsert, false);
+      PrevUsnRecord.checkTypeAndInsert(sqliteHelper, false);
       PrevUsnRecord.clearFields();
     }
     if (PrevUsnRecord.Usn == 0)
@@ -441,18 +499,37 @@ void LogData::processLogRecord(const std::vector<File>& records, LogRecord& rec,
   }
 }
 
+void LogData::addRecord(const std::vector<File>& records, LogRecord& rec, SQLiteHelper& sqliteHelper, uint64_t fileOffset) {
+  processLogRecord(records, rec, sqliteHelper, fileOffset);
+  if(isTransactionOver()) {
+    if(isCreateEvent()) {
+      insertEvent(EventTypes::TYPE_CREATE, sqliteHelper);
+    }
+    if(isDeleteEvent()) {
+      insertEvent(EventTypes::TYPE_DELETE, sqliteHelper);
+    }
+    if(isRenameEvent()) {
+      insertEvent(EventTypes::TYPE_RENAME, sqliteHelper);
+    }
+    if(isMoveEvent()) {
+      insertEvent(EventTypes::TYPE_MOVE, sqliteHelper);
+    }
+    clearFields();
+  }
+}
+
 void LogData::clearFields() {
   RedoOps.clear();
   UndoOps.clear();
   Record = -1;
-  Timestamp = "";
+  Timestamp.clear();
   Lsn = 0;
-  Fna = FNAttribute();
-  PreviousFna = FNAttribute();
+  Fna.clear();
+  PreviousFna.clear();
   Offset = -1;
-  Created = "";
-  Modified = "";
-  Comment = "";
+  Created.clear();
+  Modified.clear();
+  Comment.clear();
 }
 
 /*
@@ -461,21 +538,26 @@ given transaction run pattern. Will attempt to find a matching entry in redo1, u
 in redo2, undo2 (in the same order)
 if interchange is true then ADD_INDEX_ENTRY_ROOT=ADD_INDEX_ENTRY_ALLOCATION and DELETE_INDEX_ENTRY_ROOT=DELETE_INDEX_ENTRY_ALLOCATION
 */
+static inline int interchangeOp(int op) {
+  if(op == LogOps::ADD_INDEX_ENTRY_ROOT)    return LogOps::ADD_INDEX_ENTRY_ALLOCATION;
+  if(op == LogOps::DELETE_INDEX_ENTRY_ROOT) return LogOps::DELETE_INDEX_ENTRY_ALLOCATION;
+  return op;
+}
+
 bool LogData::transactionRunMatch(const std::vector<int>& redo2, const std::vector<int>& undo2, bool interchange) {
   unsigned int j = 0;
-  std::vector<int> redo1(RedoOps);
-  std::vector<int> undo1(UndoOps);
+  const std::vector<int>& redo1(RedoOps);
+  const std::vector<int>& undo1(UndoOps);
   for(unsigned int i = 0; i < redo2.size(); i++) {
     bool top = false;
     for(; j < redo1.size() && !top; j++) {
-
+      int redo = redo1[j];
+      int undo = undo1[j];
       if(interchange) {
-        if(redo1[j] == LogOps::ADD_INDEX_ENTRY_ROOT)    redo1[j] = LogOps::ADD_INDEX_ENTRY_ALLOCATION;
-        if(redo1[j] == LogOps::DELETE_INDEX_ENTRY_ROOT) redo1[j] = LogOps::DELETE_INDEX_ENTRY_ALLOCATION;
-        if(undo1[j] == LogOps::ADD_INDEX_ENTRY_ROOT)    undo1[j] = LogOps::ADD_INDEX_ENTRY_ALLOCATION;
-        if(undo1[j] == LogOps::DELETE_INDEX_ENTRY_ROOT) undo1[j] = LogOps::DELETE_INDEX_ENTRY_ALLOCATION;
+        redo = interchangeOp(redo);
+        undo = interchangeOp(undo);
       }
-      if(redo2[i] == redo1[j] && undo2[i] == undo1[j])
+      if(redo2[i] == redo && undo2[i] == undo)
         top = true;
     }
     if(!top)
@@ -484,46 +566,40 @@ bool LogData::transactionRunMatch(const std::vector<int>& redo2, const std::vect
   return true;
 }
 
-void LogData::insertEvent(unsigned int type, sqlite3_stmt* stmt) {
-  int i = 0;
-  sqlite3_bind_int64(stmt, ++i, Record);
-  sqlite3_bind_int64(stmt, ++i, Fna.Parent);
-  sqlite3_bind_int64(stmt, ++i, PreviousFna.Parent);
-  sqlite3_bind_int64(stmt, ++i, Lsn);
-  sqlite3_bind_text (stmt, ++i, Timestamp.c_str()   , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Fna.Name.c_str()        , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, PreviousFna.Name.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(stmt, ++i, type);
-  sqlite3_bind_int64(stmt, ++i, EventSources::SOURCE_LOG);
-  sqlite3_bind_int64(stmt, ++i, 0);  // Not embedded
-  sqlite3_bind_int64(stmt, ++i, Offset);
-  sqlite3_bind_text (stmt, ++i, Created.c_str()     , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Modified.c_str()    , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Comment.c_str()     , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Snapshot.c_str()    , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Volume.c_str()      , -1, SQLITE_TRANSIENT);
-
-  sqlite3_step(stmt);
-  sqlite3_reset(stmt);
+void LogData::insertEvent(unsigned int type, SQLiteHelper& sqliteHelper) {
+  SQLiteRow(sqliteHelper, INSERT_EVENT_TEMP)
+    .integer(Record)
+    .integer(Fna.Parent)
+    .integer(PreviousFna.Parent)
+    .integer(Lsn)
+    .text(Timestamp)
+    .text(Fna.Name)
+    .text(PreviousFna.Name)
+    .integer(type)
+    .integer(Source)
+    .integer(0)  // Not embedded
+    .integer(Offset)
+    .text(Created)
+    .text(Modified)
+    .text(Comment)
+    .integer(Version->SnapshotId)
+    .integer(Version->VolumeId);
 }
 
-void LogRecord::insert(sqlite3_stmt* stmt) {
-  int i = 0;
-  sqlite3_bind_int64(stmt, ++i, CurrentLsn);
-  sqlite3_bind_int64(stmt, ++i, PreviousLsn);
-  sqlite3_bind_int64(stmt, ++i, UndoLsn);
-  sqlite3_bind_int  (stmt, ++i, ClientId);
-  sqlite3_bind_int  (stmt, ++i, RecordType);
-  sqlite3_bind_text (stmt, ++i, decodeLogFileOpCode(RedoOp).c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, decodeLogFileOpCode(UndoOp).c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int  (stmt, ++i, TargetAttribute);
-  sqlite3_bind_int  (stmt, ++i, MftClusterIndex);
-  sqlite3_bind_int64(stmt, ++i, Offset);
-  sqlite3_bind_text (stmt, ++i, Snapshot.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Volume.c_str()  , -1, SQLITE_TRANSIENT);
-
-  sqlite3_step(stmt);
-  sqlite3_reset(stmt);
+void LogRecord::insert(SQLiteHelper& sqliteHelper) {
+  // The small fields have always been stored as 32 bit ints
+  SQLiteRow(sqliteHelper, INSERT_LOG)
+    .integer(CurrentLsn)
+    .integer(PreviousLsn)
+    .integer(UndoLsn)
+    .integer(static_cast<int>(ClientId))
+    .integer(static_cast<int>(RecordType))
+    .integer(static_cast<int>(RedoOp))
+    .integer(static_cast<int>(UndoOp))
+    .integer(static_cast<int>(TargetAttribute))
+    .integer(static_cast<int>(MftClusterIndex))
+    .integer(Offset)
+    .integer(Version->SnapshotId);
 }
 
 std::string LogRecord::getColumnHeaders() {
@@ -545,22 +621,38 @@ std::string LogRecord::getColumnHeaders() {
   return ss.str();
 }
 
-std::ostream& operator<<(std::ostream& out, const LogRecord& rec) {
-  out << rec.CurrentLsn                  << "\t"
-      << rec.PreviousLsn                 << "\t"
-      << rec.UndoLsn                     << "\t"
-      << rec.ClientId                    << "\t"
-      << rec.RecordType                  << "\t"
-      << decodeLogFileOpCode(rec.RedoOp) << "\t"
-      << decodeLogFileOpCode(rec.UndoOp) << "\t"
-      << rec.TargetAttribute             << "\t"
-      << rec.MftClusterIndex             << "\t"
-      << rec.TargetVcn                   << "\t"
-      << rec.TargetLcn                   << "\t"
-      << rec.Offset                      << "\t"
-      << rec.Snapshot                    << "\t"
-      << rec.Volume                      << std::endl;
-  return out;
+void LogRecord::write(TsvWriter& out) const {
+  out.field(CurrentLsn)
+     .field(PreviousLsn)
+     .field(UndoLsn)
+     .field(ClientId)
+     .field(RecordType)
+     .field(decodeLogFileOpCode(RedoOp))
+     .field(decodeLogFileOpCode(UndoOp))
+     .field(TargetAttribute)
+     .field(MftClusterIndex)
+     .field(TargetVcn)
+     .field(TargetLcn)
+     .field(Offset)
+     .field(Version->Snapshot)
+     .field(Version->Volume)
+     .endRow();
+}
+
+void LogRecord::write(ArrowWriter& out) const {
+  out.field(CurrentLsn)
+     .field(PreviousLsn)
+     .field(UndoLsn)
+     .field(ClientId)
+     .field(RecordType)
+     .field(decodeLogFileOpCode(RedoOp))
+     .field(decodeLogFileOpCode(UndoOp))
+     .field(TargetAttribute)
+     .field(MftClusterIndex)
+     .field(Offset)
+     .field(Version->Snapshot)
+     .field(Version->Volume)
+     .endRow();
 }
 
 bool LogData::isCreateEvent() {
@@ -24,26 +24,42 @@
  * info@strozfriedberg.com
  */
 
+#include <algorithm>
 #include <sstream>
 
 #include "util.h"
+#include "layout.h"
 #include "mft.h"
+#include "pool.h"
 #include "file.h"
 #include "progress.h"
 #include "sqlite_util.h"
+#include "trace.h"
 
 MFTRecord::MFTRecord(char* buffer, unsigned int len) {
+  init(buffer, len);
+}
+
+bool MFTRecord::init(char* buffer, unsigned int len) {
+  Sia = SIAttribute();
+  Fna.clear();
+  Record = BaseRecord = 0;
+  DataSize = 0;
+  HasData = DataResident = false;
+
   // MFT entries must begin with FILE
-  if(hex_to_long(buffer, 4) != 0x454C4946) {
-    return;
+  FileRecordHeader header(buffer);
+  if(len < FileRecordHeader::SIZE || header.magic() != FILE_MAGIC) {
+    return false;
   }
 
   // Parse basic information from file record segment header
-  Lsn                          = hex_to_long(buffer + 8,    8);
-  Record                       = hex_to_long(buffer + 0x2c, 4);
-  uint64_t allocation_flag     = hex_to_long(buffer + 0x16, 2);
-  uint64_t mft_space_allocated = hex_to_long(buffer + 0x18, 4);
-  uint64_t offset              = hex_to_long(buffer + 0x14, 2);
+  Lsn                          = header.lsn();
+  Record                       = header.record();
+  BaseRecord                   = header.baseRecord();
+  uint64_t allocation_flag     = header.flags();
+  uint64_t mft_space_allocated = header.usedSize();
+  uint64_t offset              = header.attributeOffset();
 
   isAllocated                  = allocation_flag & 0x1;
   isDir                        = allocation_flag & 0x2;
@@ -51,23 +67,42 @@ MFTRecord::MFTRecord(char* buffer, unsigned int len) {
   // Parse the attributes
   while(offset + 0x16 <= len && offset + 0x16 <= mft_space_allocated) {
 
-    uint64_t type_id          = hex_to_long(buffer + offset,        4);
-    uint64_t attribute_length = hex_to_long(buffer + offset + 4,    4);
-    uint64_t content_offset   = hex_to_long(buffer + offset + 0x14, 2);
-    char* attribute_data      = buffer + offset + content_offset;
+    AttributeHeader attribute(buffer + offset);
+    uint64_t type_id          = attribute.type();
+    uint64_t attribute_length = attribute.length();
+    uint64_t content_offset   = offset + attribute.contentOffset();
+    char* attribute_data      = buffer + content_offset;
+    // $STANDARD_INFORMATION and $FILE_NAME are always resident, their content within the attribute
+    bool content_valid        = static_cast<uint64_t>(attribute.contentOffset()) + attribute.contentSize() <= attribute_length;
 
     switch(type_id) {
       case 0x10:
-        Sia = SIAttribute(attribute_data);
+        if (content_valid && content_offset + SIAttribute::SIZE <= len)
+          Sia = SIAttribute(attribute_data);
         break;
       case 0x30:
         // Use the fna which is "largest" (based on ASCII-ness and size)
-        FNAttribute fna2(attribute_data);
+        if (!content_valid || content_offset > len || !Candidate.init(attribute_data, len - content_offset))
+          break;
         if (!Fna.Valid)
-          Fna = fna2;
+          Fna = Candidate;
 
-        if (Fna < fna2) {
-          Fna = fna2;
+        if (Fna < Candidate) {
+          Fna = Candidate;
+        }
+        break;
+      case 0x80:
+        // Only the unnamed stream, and for non-resident data only the first extent holds the sizes
+        if (offset + 0x38 <= len && attribute.nameLength() == 0) {
+          if (!attribute.nonResident()) {
+            DataSize = attribute.contentSize();
+            HasData = DataResident = true;
+          }
+          else if (attribute.startingVcn() == 0) {
+            DataSize = attribute.dataSize();
+            HasData = true;
+            DataResident = false;
+          }
         }
         break;
     }
@@ -79,29 +114,48 @@ MFTRecord::MFTRecord(char* buffer, unsigned int len) {
       break;
     }
   }
+  return true;
 }
 
 SIAttribute::SIAttribute(char* buffer) {
-  Created     = hex_to_long(buffer + 0x0,  8);
-  Modified    = hex_to_long(buffer + 0x8,  8);
-  MFTModified = hex_to_long(buffer + 0x10, 8);
-  Accessed    = hex_to_long(buffer + 0x18, 8);
-  Usn         = hex_to_long(buffer + 0x40, 8);
+  Created     = le<uint64_t>(buffer + 0x0);
+  Modified    = le<uint64_t>(buffer + 0x8);
+  MFTModified = le<uint64_t>(buffer + 0x10);
+  Accessed    = le<uint64_t>(buffer + 0x18);
+  Usn         = le<uint64_t>(buffer + 0x40);
   Valid       = true;
 }
 
-FNAttribute::FNAttribute(char* buffer) {
-  Parent                = hex_to_long(buffer,        6);
-  Created               = hex_to_long(buffer + 0x08, 8);
-  Modified              = hex_to_long(buffer + 0x10, 8);
-  MFTModified           = hex_to_long(buffer + 0x18, 8);
-  Accessed              = hex_to_long(buffer + 0x20, 8);
-  LogicalSize           = hex_to_long(buffer + 0x28, 8);
-  PhysicalSize          = hex_to_long(buffer + 0x30, 8);
-  unsigned int name_len = hex_to_long(buffer + 0x40, 1);
-  NameType              = hex_to_long(buffer + 0x41, 1);
-  Name                  = mbcatos    (buffer + 0x42, 2*name_len);
+FNAttribute::FNAttribute(char* buffer, size_t len) {
+  init(buffer, len);
+}
+
+bool FNAttribute::init(char* buffer, size_t len) {
+  if (len < NAME_OFFSET || NAME_OFFSET + 2 * le<uint8_t>(buffer + 0x40) > len) {
+    clear();
+    return false;
+  }
+  Parent                = le48(buffer);
+  Created               = le<uint64_t>(buffer + 0x08);
+  Modified              = le<uint64_t>(buffer + 0x10);
+  MFTModified           = le<uint64_t>(buffer + 0x18);
+  Accessed              = le<uint64_t>(buffer + 0x20);
+  LogicalSize           = le<uint64_t>(buffer + 0x28);
+  PhysicalSize          = le<uint64_t>(buffer + 0x30);
+  unsigned int name_len = le<uint8_t>(buffer + 0x40);
+  NameType              = le<uint8_t>(buffer + 0x41);
+  mbcatos(buffer + NAME_OFFSET, 2*name_len, Name);
   Valid                 = true;
+  return true;
+}
+
+void FNAttribute::clear() {
+  Parent = 0;
+  Created = Modified = MFTModified = Accessed = 0;
+  LogicalSize = PhysicalSize = 0;
+  Name.clear();
+  Valid = false;
+  NameType = 0;
 }
 
 bool compareNameTypes(int a, int b) {
@@ -128,31 +182,175 @@ bool FNAttribute::operator<(const FNAttribute& other) const {
 }
 
 File MFTRecord::asFile() {
-  return File(Fna.Name, Record, Fna.Parent, filetime_to_iso_8601(Sia.MFTModified));
+  File file(Fna.Name, Record, Fna.Parent, filetime_to_iso_8601(Sia.MFTModified));
+  file.DataSize = DataSize;
+  file.HasData = HasData;
+  file.DataResident = DataResident;
+  return file;
+}
+
+/*
+The attributes of an extension record which may belong to its base record
+*/
+struct MFTExtension {
+  unsigned int BaseRecord;
+  FNAttribute Fna;
+  uint64_t DataSize;
+  bool HasData, DataResident;
+};
+
+/*
+When a file has too many attributes for one record, some are moved to extension records
+and listed in the base record's $ATTRIBUTE_LIST. Extension records point back to their base record,
+so rather than reading the $ATTRIBUTE_LIST (which may itself be non-resident), the extensions
+are gathered during the scan and resolved afterwards in one pass ordered by base record.
+The base record's own $FILE_NAME and $DATA are preferred when it has them.
+*/
+static void resolveExtensions(std::vector<File>& records, std::vector<MFTExtension>& extensions) {
+  std::stable_sort(extensions.begin(), extensions.end(),
+                   [](const MFTExtension& a, const MFTExtension& b) { return a.BaseRecord < b.BaseRecord; });
+
+  for (unsigned int i = 0; i < extensions.size();) {
+    unsigned int base = extensions[i].BaseRecord;
+    const FNAttribute* fna = NULL;
+    const MFTExtension* data = NULL;
+    for (; i < extensions.size() && extensions[i].BaseRecord == base; i++) {
+      const MFTExtension& ext = extensions[i];
+      if (ext.Fna.Valid && (!fna || *fna < ext.Fna))
+        fna = &ext.Fna;
+      if (ext.HasData && !data)
+        data = &ext;
+    }
+    if (base >= records.size() || !records[base].Valid)
+      continue;
+
+    File& file = records[base];
+    if (fna && file.Name.empty()) {
+      file.Name = fna->Name;
+      file.Parent = fna->Parent;
+    }
+    if (data && !file.HasData) {
+      file.DataSize = data->DataSize;
+      file.HasData = true;
+      file.DataResident = data->DataResident;
+    }
+  }
 }
 
-void parseMFT(std::vector<File>& records, std::istream& input) {
-  char buffer[1024];
+/*
+Parses count records of the $MFT, starting with record number first, from buffer into the record table.
+Each shard writes only its own slots of the table, so shards can be parsed concurrently.
+*/
+static void parseShard(std::vector<File>& records, std::vector<MFTExtension>& extensions, char* buffer,
+                       uint64_t first, uint64_t count, unsigned int recordSize, unsigned int sectorSize) {
+  TraceSpan span("$MFT shard", "mft");
+  span.arg("first", first);
+  span.arg("records", count);
+  MFTRecord record;
+  extensions.clear();
+  for (uint64_t i = 0; i < count; i++) {
+    char* recordBuffer = buffer + i * recordSize;
+    doFixup(recordBuffer, recordSize, sectorSize);
+    if (!record.init(recordBuffer, recordSize))
+      continue;
+    // The record's position in the $MFT is its record number
+    record.Record = first + i;
+    records[first + i] = record.asFile();
+
+    if (record.BaseRecord && (record.Fna.Valid || record.HasData)) {
+      MFTExtension ext = {record.BaseRecord, record.Fna, record.DataSize, record.HasData, record.DataResident};
+      extensions.push_back(ext);
+    }
+  }
+}
 
-  int records_processed = 0;
+/*
+Reads the record size and sector size from the first record's header.
+Records are 1024 bytes on 512-byte sector disks, but 4096 bytes on 4Kn disks.
+*/
+static void getRecordSize(std::istream& input, unsigned int& recordSize, unsigned int& sectorSize) {
+  char header[0x20];
+  recordSize = 1024;
+  sectorSize = 512;
+  input.read(header, sizeof(header));
+  FileRecordHeader fileHeader(header);
+  if (input.gcount() == sizeof(header) && fileHeader.magic() == FILE_MAGIC) {
+    unsigned int size = fileHeader.allocatedSize();
+    unsigned int sectors = fileHeader.usaCount() - 1;
+    if ((size == 1024 || size == 4096) && sectors > 0 && size % sectors == 0) {
+      recordSize = size;
+      sectorSize = size / sectors;
+    }
+  }
+  input.clear();
+  input.seekg(0, std::ios::beg);
+}
 
+void parseMFT(std::vector<File>& records, std::istream& input, WorkerPool& pool, uint64_t maxBytesInFlight) {
   input.clear();
   input.seekg(0, std::ios::end);
   uint64_t end = input.tellg();
   input.seekg(0, std::ios::beg);
-  ProgressBar status(end);
-
-  //scan through the $MFT one record at a time. Each record is 1024 bytes.
-  while(!input.eof()) {
-    status.setDone((uint64_t) input.tellg());
-    records_processed++;
-    input.read(buffer, 1024);
-    doFixup(buffer, 1024, 512);
-    MFTRecord record(buffer);
-    for(int i = record.Record - records.size(); i >= 0; i--)
-      records.push_back(File());
-    records[record.Record] = record.asFile();
+  ProgressBar status(end, "$MFT");
+
+  unsigned int recordSize, sectorSize;
+  getRecordSize(input, recordSize, sectorSize);
+  uint64_t numRecords = end / recordSize;
+  records.assign(numRecords, File());
+
+  /*
+  The $MFT is read in rounds of one shard per worker. While the workers parse one round, the
+  next round is read into the other set of buffers. Shards get smaller with more workers, so
+  that no more than maxBytesInFlight is held however many cores there are.
+  */
+  unsigned int shardsPerRound = pool.size();
+  uint64_t shardRecords = std::min<uint64_t>(MFT_SHARD_BYTES, maxBytesInFlight / 2 / shardsPerRound) / recordSize;
+  shardRecords = std::max<uint64_t>(shardRecords, 1);
+  std::vector<std::vector<char>> buffers[2];
+  std::vector<std::vector<MFTExtension>> shardExtensions(shardsPerRound);
+  std::vector<MFTExtension> extensions;
+
+  auto readRound = [&](std::vector<std::vector<char>>& roundBuffers, uint64_t first) {
+    TraceSpan span("$MFT read", "mft");
+    uint64_t count = std::min<uint64_t>(numRecords - first, shardRecords * shardsPerRound);
+    span.arg("bytes", count * recordSize);
+    roundBuffers.resize(ceilingDivide(count, shardRecords));
+    for (auto& buffer: roundBuffers) {
+      uint64_t shardCount = std::min<uint64_t>(count, shardRecords);
+      buffer.resize(shardCount * recordSize);
+      input.read(buffer.data(), buffer.size());
+      count -= shardCount;
+    }
+  };
+
+  uint64_t first = 0;
+  int current = 0;
+  readRound(buffers[current], first);
+  while (first < numRecords) {
+    std::vector<std::vector<char>>& roundBuffers = buffers[current];
+    uint64_t shardFirst = first;
+    TaskGroup round(pool);
+    for (unsigned int i = 0; i < roundBuffers.size(); i++) {
+      uint64_t shardCount = roundBuffers[i].size() / recordSize;
+      char* buffer = roundBuffers[i].data();
+      std::vector<MFTExtension>* shardExts = &shardExtensions[i];
+      round.run([&records, shardExts, buffer, shardFirst, shardCount, recordSize, sectorSize]() {
+        parseShard(records, *shardExts, buffer, shardFirst, shardCount, recordSize, sectorSize);
+      });
+      shardFirst += shardCount;
+    }
+
+    current ^= 1;
+    if (shardFirst < numRecords)
+      readRound(buffers[current], shardFirst);
+
+    round.wait();
+    for (unsigned int i = 0; i < roundBuffers.size(); i++)
+      extensions.insert(extensions.end(), shardExtensions[i].begin(), shardExtensions[i].end());
+    first = shardFirst;
+    status.setDone(first * recordSize, first);
   }
+  resolveExtensions(records, extensions);
 
   status.finish();
 }
@@ -24,11 +24,19 @@
  * info@strozfriedberg.com
  */
 
+#include "aggregate.h"
 #include "controller.h"
+#include "history.h"
+#include "progress.h"
+#include "trace.h"
+#include "tsv.h"
 #include "util.h"
 
 #include <boost/program_options.hpp>
 
+#include <csignal>
+#include <stdexcept>
+
 namespace po = boost::program_options;
 
 void printHelp(const po::options_description& desc, const po::positional_options_description& posOpts) {
@@ -48,6 +56,27 @@ void printHelp(const po::options_description& desc, const po::positional_options
   std::cout << desc << std::endl;
 }
 
+/*
+Prints the path the record had at the time, on each volume in the database, from the
+record_history table. Returns whether it was found on any
+*/
+bool printPathAt(const fs::path& output, int64_t record, const std::string& time, const std::string& volume) {
+  PathHistory history((output / fs::path("ntfs.db")).string());
+  if (!history.good())
+    return false;
+  bool found = false;
+  for (auto& vol: history.volumes()) {
+    std::string path;
+    if ((volume.empty() || vol.first == volume) && history.pathAt(vol.second, record, time, path)) {
+      std::cout << vol.first << "\t" << path << std::endl;
+      found = true;
+    }
+  }
+  if (!found)
+    std::cerr << "Record " << record << " isn't known at " << time << std::endl;
+  return found;
+}
+
 int main(int argc, char** argv) {
   Options opts;
 
@@ -61,6 +90,17 @@ int main(int argc, char** argv) {
     ("image", po::value<std::vector<std::string>>(), "Path to image file(s)")
     ("overwrite", "overwrite files in the output directory. Default: append")
     ("extra", "Outputs supplemental lower-level parsed data from $UsnJrnl and $LogFile")
+    ("arrow", "Also writes the usn, log and event tables as Arrow IPC files, usn.arrow, log.arrow and events.arrow")
+    ("carve", "Carves older records out of $LogFile slack space and stale pages")
+    ("compress", po::value<std::string>(), "Compresses events.txt, usnjrnl.txt and logfile.txt: none or zstd. zstd files are seekable, in independent frames compressed on all cores")
+    ("perf-counters", "Records cycles, instructions, cache misses and branch misses for each phase in the perf_stats table (Linux only)")
+    ("progress-fd", po::value<int>(), "Writes progress as JSON lines to this file descriptor, e.g. 3 with 3>progress.jsonl")
+    ("stream", "Writes each event to stdout as a JSON line as soon as it's found. Other output goes to stderr")
+    ("text-thread", "Writes events.txt, usnjrnl.txt and logfile.txt from a separate thread")
+    ("trace", po::value<std::string>(), "Writes the time spent in each volume, snapshot and phase to this file in Chrome trace format, for Perfetto")
+    ("path-of", po::value<int64_t>(), "Prints the path MFT record had at the --at time, from the database in output, and exits")
+    ("at", po::value<std::string>(), "Time for --path-of, as in events.txt, e.g. \"2012-12-14 23:13:26\"")
+    ("volume", po::value<std::string>(), "Volume for --path-of. Default: every volume")
     ("help", "display help and exit")
     ("version", "display version number and exit");
 
@@ -71,6 +111,27 @@ int main(int argc, char** argv) {
 
     opts.overwrite = vm.count("overwrite");
     opts.extra = vm.count("extra");
+    opts.carve = vm.count("carve");
+    opts.arrow = vm.count("arrow");
+    opts.perfCounters = vm.count("perf-counters");
+    TsvWriter::Threaded = vm.count("text-thread");
+    ProgressBar::Visible = true;
+    if (vm.count("compress")) {
+      std::string compress(vm["compress"].as<std::string>());
+      if (compress == "zstd")
+        opts.compress = COMPRESS_ZSTD;
+      else if (compress != "none")
+        throw std::invalid_argument("unknown compression: " + compress);
+      if (!TextFile::isSupported(opts.compress))
+        throw std::invalid_argument("built without support for compression: " + compress);
+    }
+    if (vm.count("progress-fd")) {
+      ProgressBar::JSONFd = vm["progress-fd"].as<int>();
+#ifndef _WIN32
+      // A reader closing the pipe shouldn't end the run
+      signal(SIGPIPE, SIG_IGN);
+#endif
+    }
 
     if (vm.count("help")) {
       printHelp(desc, posOpts);
@@ -78,6 +139,15 @@ int main(int argc, char** argv) {
     else if (vm.count("version")) {
         std::cout << "ntfs_linker version: " << VERSION << std::endl;
     }
+    else if (vm.count("path-of")) {
+      if (!vm.count("output") || !vm.count("at"))
+        throw std::invalid_argument("--path-of needs --output and --at");
+      std::string at(complete_iso_8601(vm["at"].as<std::string>()));
+      if (at.empty())
+        throw std::invalid_argument("--at needs a time like \"2012-12-14 23:13:26\", not \"" + vm["at"].as<std::string>() + "\"");
+      std::string volume(vm.count("volume") ? vm["volume"].as<std::string>() : "");
+      return printPathAt(fs::path(vm["output"].as<std::string>()), vm["path-of"].as<int64_t>(), at, volume) ? 0 : 1;
+    }
     else if (vm.count("ntfs-dir") && vm.count("output")) {
       // Run
       opts.input = fs::path(vm["ntfs-dir"].as<std::string>());
@@ -85,7 +155,29 @@ int main(int argc, char** argv) {
       if (vm.count("image")) {
         opts.imgSegs = vm["image"].as<std::vector<std::string>>();
       }
+      std::streambuf* coutBuf = std::cout.rdbuf();
+      if (vm.count("stream")) {
+        // stdout is only for events, so everything else printed goes to stderr
+        std::cout.rdbuf(std::cerr.rdbuf());
+        Event::StreamFd = 1;
+#ifndef _WIN32
+        signal(SIGPIPE, SIG_IGN);
+#endif
+      }
+      TraceLog traceLog;
+      PhaseTracer phaseTracer(traceLog);
+      if (vm.count("trace")) {
+        TraceLog::Active = &traceLog;
+        traceLog.threadId("main");
+        opts.observers.push_back(&phaseTracer);
+      }
       run(opts);
+      if (TraceLog::Active) {
+        TraceLog::Active = NULL;
+        if (!traceLog.write(vm["trace"].as<std::string>()))
+          std::cerr << "Error: unable to write trace to " << vm["trace"].as<std::string>() << std::endl;
+      }
+      std::cout.rdbuf(coutBuf);
     }
     else {
       printHelp(desc, posOpts);
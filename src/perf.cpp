@@ -0,0 +1,140 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "perf.h"
+#include "pool.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const uint64_t PerfConfigs[NUM_PERF_COUNTERS] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES
+};
+
+/*
+Opens a counter of user-space events for this thread and any threads it starts
+*/
+static int openCounter(uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+PerfCounters::PerfCounters(SQLiteHelper& sqliteHelper) : SqliteHelper(sqliteHelper) {
+  for (unsigned int i = 0; i < NUM_PERF_COUNTERS; i++)
+    Fds[i] = -1;
+#ifdef __linux__
+  int err = 0;
+  for (unsigned int i = 0; i < NUM_PERF_COUNTERS; i++) {
+    Fds[i] = openCounter(PerfConfigs[i]);
+    if (Fds[i] < 0)
+      err = errno;
+  }
+  if (!good())
+    std::cerr << "Unable to open hardware performance counters: " << strerror(err)
+              << ". They may be restricted by /proc/sys/kernel/perf_event_paranoid,"
+              << " or not exposed by the CPU or hypervisor." << std::endl;
+#else
+  std::cerr << "Hardware performance counters are only supported on Linux" << std::endl;
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+  for (unsigned int i = 0; i < NUM_PERF_COUNTERS; i++) {
+    if (Fds[i] >= 0)
+      close(Fds[i]);
+  }
+#endif
+}
+
+bool PerfCounters::good() const {
+  for (unsigned int i = 0; i < NUM_PERF_COUNTERS; i++) {
+    if (Fds[i] >= 0)
+      return true;
+  }
+  return false;
+}
+
+PerfValues PerfCounters::read() const {
+  PerfValues values;
+  values.fill(-1);
+#ifdef __linux__
+  for (unsigned int i = 0; i < NUM_PERF_COUNTERS; i++) {
+    // value, time enabled, time running
+    uint64_t buf[3];
+    if (Fds[i] < 0 || ::read(Fds[i], buf, sizeof(buf)) != sizeof(buf))
+      continue;
+    // The kernel multiplexes counters when there are more than the PMU has, so scale up
+    // by the fraction of the time this one was actually counting
+    values[i] = buf[2] ? static_cast<int64_t>(static_cast<double>(buf[0]) * buf[1] / buf[2]) : 0;
+  }
+#endif
+  return values;
+}
+
+void PerfCounters::beginPhase(const PhaseInfo&) {
+  Open.push_back(read());
+}
+
+void PerfCounters::endPhase(const PhaseInfo& info) {
+  // The pool's workers are only counted once they've exited, and the phase's rows once they're written
+  WorkerPool::shared().retire();
+  SqliteHelper.drain();
+  PerfValues end = read();
+  PerfValues start = Open.back();
+  Open.pop_back();
+
+  SQLiteRow row(SqliteHelper, INSERT_PERF);
+  row.text(toString(info.Phase));
+  for (unsigned int i = 0; i < NUM_PERF_COUNTERS; i++) {
+    if (start[i] < 0 || end[i] < 0)
+      row.null();
+    else
+      row.integer(end[i] - start[i]);
+  }
+  row.integer(info.Records)
+     .integer(info.Bytes)
+     .text(info.Snapshot)
+     .text(info.Volume);
+}
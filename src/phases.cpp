@@ -0,0 +1,55 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "phases.h"
+
+std::string toString(Phases phase) {
+  switch(phase) {
+    case Phases::PHASE_MFT:
+      return "$MFT";
+    case Phases::PHASE_USN:
+      return "$UsnJrnl";
+    case Phases::PHASE_LOG:
+      return "$LogFile";
+    case Phases::PHASE_FINALIZE:
+      return "Finalize";
+    case Phases::PHASE_COMMIT:
+      return "SQLite commit";
+    default:
+      return "N/A";
+  }
+}
+
+PhaseScope::PhaseScope(const std::vector<PhaseObserver*>& observers, Phases phase, const std::string& volume, const std::string& snapshot)
+  : Info(phase, volume, snapshot), Observers(observers) {
+  for (PhaseObserver* observer: Observers)
+    observer->beginPhase(Info);
+}
+
+PhaseScope::~PhaseScope() {
+  for (PhaseObserver* observer: Observers)
+    observer->endPhase(Info);
+}
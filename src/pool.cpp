@@ -0,0 +1,121 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "pool.h"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(unsigned int threads) : Size(threads), Generation(0) {
+  if (Size == 0)
+    Size = std::max(1u, std::thread::hardware_concurrency());
+}
+
+WorkerPool::~WorkerPool() {
+  retire();
+}
+
+WorkerPool& WorkerPool::shared() {
+  static WorkerPool pool;
+  return pool;
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Queue.push_back(std::move(task));
+    if (Workers.empty()) {
+      for (unsigned int i = 0; i < Size; i++)
+        Workers.push_back(std::thread(&WorkerPool::work, this, Generation));
+    }
+  }
+  Ready.notify_one();
+}
+
+bool WorkerPool::runOne() {
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (Queue.empty())
+      return false;
+    task = std::move(Queue.front());
+    Queue.pop_front();
+  }
+  task();
+  return true;
+}
+
+void WorkerPool::work(uint64_t generation) {
+  std::unique_lock<std::mutex> lock(Mutex);
+  while (true) {
+    Ready.wait(lock, [this, generation]{ return !Queue.empty() || Generation != generation; });
+    if (Queue.empty())
+      break;
+    std::function<void()> task(std::move(Queue.front()));
+    Queue.pop_front();
+    lock.unlock();
+
+    task();
+
+    lock.lock();
+  }
+}
+
+void WorkerPool::retire() {
+  std::vector<std::thread> workers;
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    ++Generation;
+    workers.swap(Workers);
+  }
+  Ready.notify_all();
+  for (auto& worker: workers)
+    worker.join();
+}
+
+void TaskGroup::run(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    ++Pending;
+  }
+  Pool.submit([this, task]() {
+    task();
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (--Pending == 0)
+      Done.notify_all();
+  });
+}
+
+void TaskGroup::wait() {
+  std::unique_lock<std::mutex> lock(Mutex);
+  while (Pending > 0) {
+    lock.unlock();
+    bool ran = Pool.runOne();
+    lock.lock();
+    // Otherwise the rest of the group is already running on the workers
+    if (!ran)
+      Done.wait(lock, [this]{ return Pending == 0; });
+  }
+}
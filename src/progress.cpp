@@ -25,60 +25,122 @@
  */
 
 #include "progress.h"
+#include "util.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 
-void ProgressBar::addToDo(uint64_t x) {
-  toDo += x;
+std::atomic<bool> ProgressBar::Visible(false);
+int ProgressBar::JSONFd = -1;
+std::chrono::milliseconds ProgressBar::Interval(500);
+
+ProgressBar::ProgressBar(uint64_t toDo, const std::string& label)
+  : Label(label), ToDo(toDo), Done(0), Records(0), Start(std::chrono::steady_clock::now()), Stopped(false) {
+  if (!Visible && JSONFd < 0)
+    return;
+  render(false);
+  Renderer = std::thread(&ProgressBar::run, this);
 }
 
-void ProgressBar::addDone(uint64_t x) {
-  done += x;
-  printProgress();
+ProgressBar::~ProgressBar() {
+  stop();
 }
 
-void ProgressBar::setDone(uint64_t x) {
-  done = x;
-  printProgress();
+void ProgressBar::addToDo(uint64_t bytes) {
+  ToDo.fetch_add(bytes, std::memory_order_relaxed);
 }
 
-void ProgressBar::printProgress() {
-  long double percent = (long double) done / toDo;
-  const int width = 50;
-  if((int) (width * percent) > last) {
-    std::stringstream ss;
-    ss << "\r[";
-    int i;
-    for(i = 0; i < (int) (width * percent); i++)
-      ss << "=";
-    for(; i < width; i++)
-      ss << " ";
-    ss << "] ";
-    ss << (int) (percent * 100);
-    ss << "%";
-    std::cout << ss.str();
-    std::cout.flush();
-    last = (int) (width * percent);
+void ProgressBar::addDone(uint64_t bytes, uint64_t records) {
+  Done.fetch_add(bytes, std::memory_order_relaxed);
+  Records.fetch_add(records, std::memory_order_relaxed);
+}
+
+void ProgressBar::setDone(uint64_t bytes, uint64_t records) {
+  Done.store(bytes, std::memory_order_relaxed);
+  Records.store(records, std::memory_order_relaxed);
+}
+
+void ProgressBar::setDone(uint64_t bytes) {
+  Done.store(bytes, std::memory_order_relaxed);
+}
+
+void ProgressBar::run() {
+  std::unique_lock<std::mutex> lock(Mutex);
+  while (!Wake.wait_for(lock, Interval, [this]{ return Stopped; })) {
+    lock.unlock();
+    render(false);
+    lock.lock();
   }
 }
 
-ProgressBar::ProgressBar(uint64_t x) {
-  toDo = x;
-  done = 0;
-  last = -1;
-  printProgress();
+void ProgressBar::stop() {
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Stopped = true;
+  }
+  Wake.notify_one();
+  if (Renderer.joinable())
+    Renderer.join();
 }
 
 void ProgressBar::finish() {
-  done = toDo;
-  printProgress();
+  stop();
+  Done.store(std::max(Done.load(), ToDo.load()));
+  render(true);
   clear();
 }
 
+void ProgressBar::render(bool finished) {
+  uint64_t toDo = ToDo.load(std::memory_order_relaxed);
+  uint64_t done = std::min(Done.load(std::memory_order_relaxed), toDo);
+  uint64_t records = Records.load(std::memory_order_relaxed);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+  double fraction = toDo ? static_cast<double>(done) / toDo : 1;
+  double bytesPerSec = seconds > 0 ? done / seconds : 0;
+  double recordsPerSec = seconds > 0 ? records / seconds : 0;
+  // Unknown until some progress has been made
+  double eta = bytesPerSec > 0 ? (toDo - done) / bytesPerSec : -1;
+
+  const int width = 50;
+  int filled = width * fraction;
+  std::stringstream ss;
+  ss << "\r[" << std::string(filled, '=') << std::string(width - filled, ' ') << "] "
+     << static_cast<int>(fraction * 100) << "% "
+     << std::fixed << std::setprecision(1) << bytesPerSec / (1024 * 1024) << " MB/s";
+  if (records)
+    ss << " " << static_cast<uint64_t>(recordsPerSec) << " rec/s";
+  if (eta >= 0 && !finished)
+    ss << " ETA " << static_cast<uint64_t>(eta) / 60 << ":" << std::setw(2) << std::setfill('0') << static_cast<uint64_t>(eta) % 60;
+  ss << "   ";
+  if (Visible) {
+    std::cout << ss.str();
+    std::cout.flush();
+  }
+
+  if (JSONFd >= 0) {
+    std::stringstream json;
+    json << std::fixed << std::setprecision(3)
+         << "{\"phase\": " << jsonString(Label)
+         << ", \"bytes_done\": " << done << ", \"bytes_total\": " << toDo
+         << ", \"records\": " << records
+         << ", \"mb_per_sec\": " << bytesPerSec / (1024 * 1024)
+         << ", \"records_per_sec\": " << recordsPerSec
+         << ", \"elapsed_seconds\": " << seconds
+         << ", \"eta_seconds\": " << eta
+         << ", \"finished\": " << (finished ? "true" : "false") << "}\n";
+    // One write per line, so that lines from concurrent parses don't interleave
+    std::string line = json.str();
+    if (writeFd(JSONFd, line.data(), line.size()) < 0) {
+      // Progress is best effort, and the reader may have gone away
+    }
+  }
+}
+
 void ProgressBar::clear() {
-  std::cout << std::setw(70) << std::left << std::setfill(' ') << "\r";
-  std::cout << "\r";
+  if (!Visible)
+    return;
+  std::cout << "\r" << std::string(100, ' ') << "\r";
   std::cout.flush();
 }
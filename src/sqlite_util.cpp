@@ -25,8 +25,11 @@
  */
 
 #include "aggregate.h"
+#include "log.h"
 #include "sqlite_util.h"
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -67,7 +70,7 @@ std::string getColList(const std::vector<std::vector<std::string>>& cols, int ty
   return ss.str();
 }
 
-void SQLiteHelper::init(std::string dbName, bool overwrite) {
+void SQLiteHelper::init(std::string dbName, bool overwrite, bool writerThread) {
   int rc = 0;
 
   /*
@@ -79,7 +82,7 @@ void SQLiteHelper::init(std::string dbName, bool overwrite) {
     std::ofstream file(dbName.c_str(), std::ios::trunc);
     file.close();
   }
-  rc = sqlite3_open_v2(dbName.c_str(), &Db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+  rc = sqlite3_open_v2(dbName.c_str(), &Db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, NULL);
   if(rc) {
     std::cerr << "Error opening database" << std::endl;
     exit(1);
@@ -89,34 +92,299 @@ void SQLiteHelper::init(std::string dbName, bool overwrite) {
   beginTransaction();
 
   if(overwrite) {
-    rc |= sqlite3_exec(Db, "drop table if exists log;", 0, 0, 0);
-    rc |= sqlite3_exec(Db, "drop table if exists usn;", 0, 0, 0);
-    rc |= sqlite3_exec(Db, "drop table if exists event;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop view if exists log;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop view if exists usn;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop view if exists event;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists log_records;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists usn_records;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists event_records;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists paths;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists snapshots;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists volumes;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists event_sources;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists event_types;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists log_ops;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists diagnostics;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists diagnostic_samples;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists perf_stats;", 0, 0, 0);
+    rc |= sqlite3_exec(Db, "drop table if exists record_history;", 0, 0, 0);
   }
-  rc |= sqlite3_exec(Db, std::string("create table if not exists log "
+  else {
+    checkLayout();
+  }
+  // Dimension tables: the record tables refer to them by integer key
+  rc |= sqlite3_exec(Db, "create table if not exists volumes "
+                         "(VolumeID integer primary key, Name text unique);", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "create table if not exists snapshots "
+                         "(SnapshotID integer primary key, Name text, VolumeID int, "
+                         "UNIQUE(Name, VolumeID));", 0, 0, 0);
+  // Each distinct path is stored once per snapshot. The unique index also serves prefix range queries.
+  rc |= sqlite3_exec(Db, "create table if not exists paths "
+                         "(PathID integer primary key, SnapshotID int, Path text, "
+                         "UNIQUE(SnapshotID, Path));", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "create table if not exists event_sources "
+                         "(SourceID integer primary key, Name text);", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "create table if not exists event_types "
+                         "(TypeID integer primary key, Name text);", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "create table if not exists log_ops "
+                         "(OpID integer primary key, Name text);", 0, 0, 0);
+
+  rc |= sqlite3_exec(Db, std::string("create table if not exists log_records "
                                      "(" + getColList(LogColumns, 0) + ");").c_str(),
                      0, 0, 0);
-  rc |= sqlite3_exec(Db, std::string("create table if not exists usn "
+  rc |= sqlite3_exec(Db, std::string("create table if not exists usn_records "
                                     "(" + getColList(UsnColumns, 0) + ");").c_str(),
                      0, 0, 0);
+  rc |= sqlite3_exec(Db, "create index if not exists usn_records_path on usn_records (FullPathID);", 0, 0, 0);
   rc |= sqlite3_exec(Db, std::string("create temporary table event_temp "
                                      "(" + getColList(EventTempColumns, 0) + ", "
-                                     "UNIQUE(USN_LSN, EventSource, Volume));").c_str(),
+                                     "UNIQUE(USN_LSN, EventSource, VolumeID));").c_str(),
                      0, 0, 0);
-  rc |= sqlite3_exec(Db, std::string("create table if not exists event "
+  rc |= sqlite3_exec(Db, std::string("create table if not exists event_records "
                                      "(" + getColList(EventColumns, 0) + ");").c_str(),
                      0, 0, 0);
+  rc |= sqlite3_exec(Db, "create index if not exists event_records_path on event_records (FullPathID);", 0, 0, 0);
+
+  // Views with the names and columns of the tables written by earlier versions, so existing queries keep working
+  rc |= sqlite3_exec(Db, "create view if not exists log as select "
+                         "l.CurrentLSN, l.PrevLSN, l.UndoLSN, l.ClientID, l.RecordType, "
+                         "redo.Name as RedoOP, undo.Name as UndoOP, "
+                         "l.TargetAttribute, l.MFTClusterIndex, l.Offset, "
+                         "s.Name as Snapshot, v.Name as Volume "
+                         "from log_records l "
+                         "left join log_ops redo on redo.OpID = l.RedoOP "
+                         "left join log_ops undo on undo.OpID = l.UndoOP "
+                         "left join snapshots s on s.SnapshotID = l.SnapshotID "
+                         "left join volumes v on v.VolumeID = s.VolumeID;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "create view if not exists usn as select "
+                         "u.MFTRecord, u.ParentMFTRecord, u.USN, u.Timestamp, u.Reason, "
+                         "u.FileName, fp.Path as FullPath, fo.Path as Folder, u.Offset, "
+                         "s.Name as Snapshot, v.Name as Volume "
+                         "from usn_records u "
+                         "left join paths fp on fp.PathID = u.FullPathID "
+                         "left join paths fo on fo.PathID = u.FolderID "
+                         "left join snapshots s on s.SnapshotID = u.SnapshotID "
+                         "left join volumes v on v.VolumeID = s.VolumeID;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "create view if not exists event as select "
+                         "e.Position, e.Timestamp, src.Name as EventSource, t.Name as EventType, "
+                         "e.FileName, fo.Path as Folder, fp.Path as FullPath, e.MFTRecord, e.ParentMFTRecord, e.USN_LSN, "
+                         "e.OldFileName, ofo.Path as OldFolder, e.OldParentRecord, e.Offset, "
+                         "e.Created, e.Modified, e.Comment, "
+                         "s.Name as Snapshot, v.Name as Volume "
+                         "from event_records e "
+                         "left join event_sources src on src.SourceID = e.EventSource "
+                         "left join event_types t on t.TypeID = e.EventType "
+                         "left join paths fo on fo.PathID = e.FolderID "
+                         "left join paths fp on fp.PathID = e.FullPathID "
+                         "left join paths ofo on ofo.PathID = e.OldFolderID "
+                         "left join snapshots s on s.SnapshotID = e.SnapshotID "
+                         "left join volumes v on v.VolumeID = s.VolumeID;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, std::string("create table if not exists diagnostics "
+                                     "(" + getColList(DiagnosticColumns, 0) + ");").c_str(),
+                     0, 0, 0);
+  rc |= sqlite3_exec(Db, std::string("create table if not exists diagnostic_samples "
+                                     "(" + getColList(DiagnosticSampleColumns, 0) + ");").c_str(),
+                     0, 0, 0);
+  rc |= sqlite3_exec(Db, std::string("create table if not exists perf_stats "
+                                     "(" + getColList(PerfColumns, 0) + ");").c_str(),
+                     0, 0, 0);
+  // The name and parent of each record over time; see history.h
+  rc |= sqlite3_exec(Db, std::string("create table if not exists record_history "
+                                     "(" + getColList(HistoryColumns, 0) + ");").c_str(),
+                     0, 0, 0);
+  rc |= sqlite3_exec(Db, "create index if not exists record_history_lookup on record_history (VolumeID, MFTRecord, ValidFrom);", 0, 0, 0);
   if(rc) {
     std::cerr << "SQL Error " << rc << " at " << __FILE__ << ":" << __LINE__ << std::endl;
     std::cerr << sqlite3_errmsg(Db) << std::endl;
     sqlite3_close(Db);
     exit(1);
   }
+  fillDimensions();
   prepareStatements();
   endTransaction();
+  if (writerThread)
+    Writer = std::thread(&SQLiteHelper::writerLoop, this);
+}
+
+/*
+Databases written before the record tables were normalized have plain tables where the
+compatibility views go. Appending to them would mix the two layouts, so refuse.
+*/
+void SQLiteHelper::checkLayout() {
+  sqlite3_stmt* stmt = NULL;
+  std::string sql = "select name from sqlite_master where type='table' and name in ('log', 'usn', 'event');";
+  if (prepareStatement(&stmt, sql) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+    std::cerr << "The existing database has the table layout of an older version of ntfs-linker." << std::endl;
+    std::cerr << "Use --overwrite or a different output directory." << std::endl;
+    sqlite3_finalize(stmt);
+    sqlite3_close(Db);
+    exit(1);
+  }
+  sqlite3_finalize(stmt);
+}
+
+/*
+Populates the fixed dimension tables: event sources, event types and $LogFile op codes
+*/
+void SQLiteHelper::fillDimensions() {
+  int rc = 0;
+  sqlite3_stmt *source = NULL, *type = NULL, *op = NULL;
+  std::string sourceInsert = "insert or ignore into event_sources (SourceID, Name) values (?, ?);";
+  std::string typeInsert = "insert or ignore into event_types (TypeID, Name) values (?, ?);";
+  std::string opInsert = "insert or ignore into log_ops (OpID, Name) values (?, ?);";
+  rc |= prepareStatement(&source, sourceInsert);
+  rc |= prepareStatement(&type, typeInsert);
+  rc |= prepareStatement(&op, opInsert);
+  if (rc) {
+    std::cerr << "SQL Error " << rc << " at " << __FILE__ << ":" << __LINE__ << std::endl;
+    std::cerr << sqlite3_errmsg(Db) << std::endl;
+    sqlite3_close(Db);
+    exit(1);
+  }
+
+  for (unsigned int i = EventSources::SOURCE_USN; i <= EventSources::SOURCE_LOG_CARVED; i++) {
+    sqlite3_bind_int64(source, 1, i);
+    sqlite3_bind_text (source, 2, toString(static_cast<EventSources>(i)).c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_step(source);
+    sqlite3_reset(source);
+  }
+  for (unsigned int i = EventTypes::TYPE_CREATE; i <= EventTypes::TYPE_MOVE; i++) {
+    sqlite3_bind_int64(type, 1, i);
+    sqlite3_bind_text (type, 2, toString(static_cast<EventTypes>(i)).c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_step(type);
+    sqlite3_reset(type);
+  }
+  for (int i = 0; i <= 0x21; i++) {
+    sqlite3_bind_int64(op, 1, i);
+    sqlite3_bind_text (op, 2, decodeLogFileOpCode(i), -1, SQLITE_STATIC);
+    sqlite3_step(op);
+    sqlite3_reset(op);
+  }
+  sqlite3_finalize(source);
+  sqlite3_finalize(type);
+  sqlite3_finalize(op);
+}
+
+/*
+Inserts name (under parent, if it isn't -1) unless it's already present, and returns its key
+*/
+int64_t SQLiteHelper::lookupId(const std::string& insertSql, const std::string& selectSql, const std::string& name, int64_t parent) {
+  int64_t id = -1;
+  for (std::string sql: {insertSql, selectSql}) {
+    sqlite3_stmt* stmt = NULL;
+    if (prepareStatement(&stmt, sql) != SQLITE_OK) {
+      std::cerr << "SQL Error at " << __FILE__ << ":" << __LINE__ << std::endl;
+      std::cerr << sqlite3_errmsg(Db) << std::endl;
+      sqlite3_close(Db);
+      exit(1);
+    }
+    sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+    if (parent != -1)
+      sqlite3_bind_int64(stmt, 2, parent);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+      id = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+  return id;
+}
+
+/*
+Looks up the keys of the version's volume and snapshot, adding them if this is the first
+time they're seen. Each parser calls this on entry; the lookups happen only once per version.
+*/
+void SQLiteHelper::identify(const VersionInfo& version) {
+  if (version.SnapshotId != -1)
+    return;
+  version.VolumeId = lookupId("insert or ignore into volumes (Name) values (?);",
+                              "select VolumeID from volumes where Name = ?;",
+                              version.Volume, -1);
+  version.SnapshotId = lookupId("insert or ignore into snapshots (Name, VolumeID) values (?, ?);",
+                                "select SnapshotID from snapshots where Name = ? and VolumeID = ?;",
+                                version.Snapshot, version.VolumeId);
+}
+
+/*
+The insert copying a table of the attached shard, in its order, with each key column looked up
+in the map of old keys to new ones
+*/
+std::string SQLiteHelper::mergeRows(const std::string& table, const std::vector<std::vector<std::string>>& cols) {
+  std::stringstream ss;
+  ss << "insert into main." << table << " (" << getColList(cols, 1) << ") select ";
+  for (unsigned int i = 0; i < cols.size(); i++) {
+    const std::string& col = cols[i][0];
+    std::string map = col == "VolumeID" ? "volume_map"
+                    : col == "SnapshotID" ? "snapshot_map"
+                    : col == "FolderID" || col == "FullPathID" || col == "OldFolderID" ? "path_map"
+                    : "";
+    if (i > 0)
+      ss << ", ";
+    if (map.empty())
+      ss << "t." << col;
+    else
+      ss << "(select New from " << map << " where Old = t." << col << ")";
+  }
+  ss << " from shard." << table << " t order by t.rowid;";
+  return ss.str();
+}
+
+void SQLiteHelper::merge(const std::string& shardName) {
+  drain();
+  int rc = 0;
+  sqlite3_stmt* attach = NULL;
+  std::string attachSql = "attach database ? as shard;";
+  rc |= prepareStatement(&attach, attachSql);
+  sqlite3_bind_text(attach, 1, shardName.c_str(), -1, SQLITE_TRANSIENT);
+  if (sqlite3_step(attach) != SQLITE_DONE)
+    rc |= 1;
+  sqlite3_finalize(attach);
+  if (rc) {
+    std::cerr << "Unable to attach " << shardName << ": " << sqlite3_errmsg(Db) << std::endl;
+    sqlite3_close(Db);
+    exit(1);
+  }
+
+  beginTransaction();
+  // Rows are added in the shard's order, so keys come out as they would have been written here
+  rc |= sqlite3_exec(Db, "insert or ignore into main.volumes (Name) select Name from shard.volumes order by VolumeID;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "create temp table volume_map (Old integer primary key, New int);", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "insert into volume_map select o.VolumeID, n.VolumeID from shard.volumes o "
+                         "join main.volumes n on n.Name = o.Name;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "insert or ignore into main.snapshots (Name, VolumeID) select s.Name, m.New from shard.snapshots s "
+                         "join volume_map m on m.Old = s.VolumeID order by s.SnapshotID;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "create temp table snapshot_map (Old integer primary key, New int);", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "insert into snapshot_map select o.SnapshotID, n.SnapshotID from shard.snapshots o "
+                         "join volume_map m on m.Old = o.VolumeID "
+                         "join main.snapshots n on n.Name = o.Name and n.VolumeID = m.New;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "insert or ignore into main.paths (SnapshotID, Path) select m.New, p.Path from shard.paths p "
+                         "join snapshot_map m on m.Old = p.SnapshotID order by p.PathID;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "create temp table path_map (Old integer primary key, New int);", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "insert into path_map select o.PathID, n.PathID from shard.paths o "
+                         "join snapshot_map m on m.Old = o.SnapshotID "
+                         "join main.paths n on n.SnapshotID = m.New and n.Path = o.Path;", 0, 0, 0);
+
+  rc |= sqlite3_exec(Db, mergeRows("usn_records", UsnColumns).c_str(), 0, 0, 0);
+  rc |= sqlite3_exec(Db, mergeRows("log_records", LogColumns).c_str(), 0, 0, 0);
+  rc |= sqlite3_exec(Db, mergeRows("event_records", EventColumns).c_str(), 0, 0, 0);
+  rc |= sqlite3_exec(Db, mergeRows("diagnostics", DiagnosticColumns).c_str(), 0, 0, 0);
+  rc |= sqlite3_exec(Db, mergeRows("diagnostic_samples", DiagnosticSampleColumns).c_str(), 0, 0, 0);
+  rc |= sqlite3_exec(Db, mergeRows("perf_stats", PerfColumns).c_str(), 0, 0, 0);
+  rc |= sqlite3_exec(Db, mergeRows("record_history", HistoryColumns).c_str(), 0, 0, 0);
+
+  rc |= sqlite3_exec(Db, "drop table volume_map;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "drop table snapshot_map;", 0, 0, 0);
+  rc |= sqlite3_exec(Db, "drop table path_map;", 0, 0, 0);
+  if (rc) {
+    std::cerr << "SQL Error " << rc << " at " << __FILE__ << ":" << __LINE__ << std::endl;
+    std::cerr << sqlite3_errmsg(Db) << std::endl;
+    sqlite3_close(Db);
+    exit(1);
+  }
+  endTransaction();
+  sqlite3_exec(Db, "detach database shard;", 0, 0, 0);
 }
 
 void SQLiteHelper::beginTransaction() {
+  drain();
   int rc = sqlite3_exec(Db, "BEGIN TRANSACTION", 0, 0, 0);
   if(rc) {
     std::cerr << "SQL Error " << rc << " at " << __FILE__ << ":" << __LINE__ << std::endl;
@@ -127,6 +395,7 @@ void SQLiteHelper::beginTransaction() {
 }
 
 void SQLiteHelper::endTransaction() {
+  drain();
   int rc = sqlite3_exec(Db, "END TRANSACTION", 0, 0, 0);
   if(rc) {
     std::cerr << "SQL Error " << rc << " at " << __FILE__ << ":" << __LINE__ << std::endl;
@@ -137,6 +406,7 @@ void SQLiteHelper::endTransaction() {
 }
 
 void SQLiteHelper::close() {
+  stopWriter();
   finalizeStatements();
   sqlite3_close(Db);
 }
@@ -145,44 +415,105 @@ int SQLiteHelper::prepareStatement(sqlite3_stmt **stmt, std::string& sql) {
   return sqlite3_prepare_v2(Db, sql.c_str(), sql.length() + 1, stmt, NULL);
 }
 
-void SQLiteHelper::bindForSelect(const VersionInfo& version) {
-  sqlite3_bind_int64(EventUsnSelect, 1, EventSources::SOURCE_USN);
-  sqlite3_bind_int64(EventLogSelect, 1, EventSources::SOURCE_LOG);
+/*
+Returns the id of path in the paths table of the snapshot, adding it if need be. Ids are cached
+per snapshot, so rows of snapshots finalized at the same time can be interleaved.
+*/
+int64_t SQLiteHelper::pathId(int64_t snapshotId, const std::string& path) {
+  auto& ids = PathIds[snapshotId];
+  auto it = ids.find(path);
+  if (it != ids.end())
+    return it->second;
 
-  sqlite3_bind_text(EventUsnSelect, 2, version.Snapshot.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(EventLogSelect, 2, version.Snapshot.c_str(), -1, SQLITE_TRANSIENT);
+  int64_t id = -1;
+  sqlite3_bind_int64(PathInsert, 1, snapshotId);
+  sqlite3_bind_text (PathInsert, 2, path.c_str(), -1, SQLITE_STATIC);
+  // The connection is shared with other threads, which mustn't insert in between
+  sqlite3_mutex_enter(sqlite3_db_mutex(Db));
+  bool inserted = sqlite3_step(PathInsert) == SQLITE_DONE && sqlite3_changes(Db) > 0;
+  if (inserted)
+    id = sqlite3_last_insert_rowid(Db);
+  sqlite3_mutex_leave(sqlite3_db_mutex(Db));
+  if (!inserted) {
+    // Appending to a snapshot seen by an earlier run
+    sqlite3_bind_int64(PathSelect, 1, snapshotId);
+    sqlite3_bind_text (PathSelect, 2, path.c_str(), -1, SQLITE_STATIC);
+    if (sqlite3_step(PathSelect) == SQLITE_ROW)
+      id = sqlite3_column_int64(PathSelect, 0);
+    sqlite3_reset(PathSelect);
+  }
+  sqlite3_reset(PathInsert);
+  if (id != -1)
+    ids.emplace(path, id);
+  return id;
+}
 
-  sqlite3_bind_text(EventUsnSelect, 3, version.Volume.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(EventLogSelect, 3, version.Volume.c_str(), -1, SQLITE_TRANSIENT);
+void SQLiteHelper::forgetPaths(int64_t snapshotId) {
+  std::lock_guard<std::mutex> lock(WriterMutex);
+  Pending.Forget.push_back(snapshotId);
 }
 
-void SQLiteHelper::resetSelect() {
-  sqlite3_reset(EventUsnSelect);
-  sqlite3_reset(EventLogSelect);
+void SQLiteHelper::prepareSelect(const VersionInfo& version, sqlite3_stmt** usnSelect, sqlite3_stmt** logSelect) {
+  drain();
+  std::string eventSelect = "select " + getColList(EventTempColumns, 1) + " from event_temp where EventSource in (?, ?) and SnapshotID=? order by USN_LSN desc;";
+  int rc = prepareStatement(usnSelect, eventSelect);
+  rc |= prepareStatement(logSelect, eventSelect);
+  if (rc) {
+    std::cerr << "SQL Error " << rc << " at " << __FILE__ << ":" << __LINE__ << std::endl;
+    std::cerr << sqlite3_errmsg(Db) << std::endl;
+    exit(1);
+  }
+
+  // The $LogFile stream includes events from carved records, which interleave by Lsn
+  sqlite3_bind_int64(*usnSelect, 1, EventSources::SOURCE_USN);
+  sqlite3_bind_int64(*logSelect, 1, EventSources::SOURCE_LOG);
+
+  sqlite3_bind_int64(*usnSelect, 2, EventSources::SOURCE_USN);
+  sqlite3_bind_int64(*logSelect, 2, EventSources::SOURCE_LOG_CARVED);
+
+  sqlite3_bind_int64(*usnSelect, 3, version.SnapshotId);
+  sqlite3_bind_int64(*logSelect, 3, version.SnapshotId);
 }
 
 void SQLiteHelper::prepareStatements() {
   int rc = 0;
-  std::string usnInsert = "insert into usn (" + getColList(UsnColumns, 1) + ") "
+  std::string usnInsert = "insert into usn_records (" + getColList(UsnColumns, 1) + ") "
                                    "values (" + getColList(UsnColumns, 2) + ");";
-  std::string logInsert = "insert into log (" + getColList(LogColumns, 1) + ") "
+  std::string logInsert = "insert into log_records (" + getColList(LogColumns, 1) + ") "
                                    "values (" + getColList(LogColumns, 2) + ");";
   // Events are processed from the oldest to the newest, so when an event with a conflicting (USN_LSN, EventSource)
   // comes into play, it should be ignored
   std::string eventInsert = "insert or ignore into event_temp "
                             "(" + getColList(EventTempColumns, 1) + ") "
                             + "values (" + getColList(EventTempColumns, 2) + ");";
-  std::string eventFinalInsert = "insert into event "
+  std::string eventFinalInsert = "insert into event_records "
                             "(" + getColList(EventColumns, 1) + ") "
                             + "values (" + getColList(EventColumns, 2) + ");";
-  std::string eventSelect = "select " + getColList(EventTempColumns, 1) + " from event_temp where EventSource=? and Snapshot=? and Volume=? order by USN_LSN desc;";
+  std::string diagnosticInsert = "insert into diagnostics (" + getColList(DiagnosticColumns, 1) + ") "
+                                   "values (" + getColList(DiagnosticColumns, 2) + ");";
+  std::string diagnosticSampleInsert = "insert into diagnostic_samples (" + getColList(DiagnosticSampleColumns, 1) + ") "
+                                   "values (" + getColList(DiagnosticSampleColumns, 2) + ");";
+  std::string perfInsert = "insert into perf_stats (" + getColList(PerfColumns, 1) + ") "
+                                   "values (" + getColList(PerfColumns, 2) + ");";
+  std::string historyInsert = "insert into record_history (" + getColList(HistoryColumns, 1) + ") "
+                                   "values (" + getColList(HistoryColumns, 2) + ");";
+  std::string pathInsert = "insert or ignore into paths (SnapshotID, Path) values (?, ?);";
+  std::string pathSelect = "select PathID from paths where SnapshotID = ? and Path = ?;";
 
-  rc |= prepareStatement(&UsnInsert, usnInsert);
-  rc |= prepareStatement(&LogInsert, logInsert);
-  rc |= prepareStatement(&EventInsert, eventInsert);
-  rc |= prepareStatement(&EventFinalInsert, eventFinalInsert);
-  rc |= prepareStatement(&EventUsnSelect, eventSelect);
-  rc |= prepareStatement(&EventLogSelect, eventSelect);
+  rc |= prepareStatement(&Statements[INSERT_USN], usnInsert);
+  rc |= prepareStatement(&Statements[INSERT_LOG], logInsert);
+  rc |= prepareStatement(&Statements[INSERT_EVENT_TEMP], eventInsert);
+  rc |= prepareStatement(&Statements[INSERT_EVENT], eventFinalInsert);
+  rc |= prepareStatement(&Statements[INSERT_DIAGNOSTIC], diagnosticInsert);
+  rc |= prepareStatement(&Statements[INSERT_DIAGNOSTIC_SAMPLE], diagnosticSampleInsert);
+  rc |= prepareStatement(&Statements[INSERT_PERF], perfInsert);
+  rc |= prepareStatement(&Statements[INSERT_HISTORY], historyInsert);
+  rc |= prepareStatement(&PathInsert, pathInsert);
+  rc |= prepareStatement(&PathSelect, pathSelect);
+  for (unsigned int i = 0; i < NUM_INSERTS && !rc; i++) {
+    if (sqlite3_bind_parameter_count(Statements[i]) > static_cast<int>(MaxRowValues))
+      rc = SQLITE_RANGE;
+  }
 
   if (rc) {
     std::cerr << "SQL Error " << rc << " at " << __FILE__ << ":" << __LINE__ << std::endl;
@@ -193,34 +524,217 @@ void SQLiteHelper::prepareStatements() {
 }
 
 void SQLiteHelper::finalizeStatements() {
-  sqlite3_finalize(UsnInsert);
-  sqlite3_finalize(LogInsert);
-  sqlite3_finalize(EventInsert);
-  sqlite3_finalize(EventFinalInsert);
-  sqlite3_finalize(EventUsnSelect);
-  sqlite3_finalize(EventLogSelect);
+  for (unsigned int i = 0; i < NUM_INSERTS; i++) {
+    sqlite3_finalize(Statements[i]);
+    Statements[i] = NULL;
+  }
+  sqlite3_finalize(PathInsert);
+  sqlite3_finalize(PathSelect);
+  PathInsert = PathSelect = NULL;
+}
+
+SQLiteHelper::~SQLiteHelper() {
+  stopWriter();
+}
+
+SQLiteRow::~SQLiteRow() {
+  SqliteHelper.addRow(*this);
+}
+
+SQLiteRow& SQLiteRow::integer(int64_t value) {
+  add(SQLiteHelper::Value::INTEGER, value);
+  return *this;
+}
+
+SQLiteRow& SQLiteRow::integerOrNull(int64_t value) {
+  return value == -1 ? null() : integer(value);
+}
+
+SQLiteRow& SQLiteRow::text(const char* value) {
+  add(SQLiteHelper::Value::TEXT, 0, value, std::char_traits<char>::length(value));
+  return *this;
+}
+
+SQLiteRow& SQLiteRow::null() {
+  add(SQLiteHelper::Value::NUL, 0);
+  return *this;
+}
+
+SQLiteRow& SQLiteRow::path(int64_t snapshotId, const std::string& path) {
+  add(SQLiteHelper::Value::PATH, snapshotId, path.data(), path.size());
+  return *this;
+}
+
+void SQLiteRow::add(SQLiteHelper::Value::Kinds kind, int64_t integer, const char* text, size_t length) {
+  // No insert takes this many, and SQLite wouldn't bind the extra ones anyway
+  if (NumValues == SQLiteHelper::MaxRowValues)
+    return;
+  SQLiteHelper::Value& value = Values[NumValues++];
+  value.Kind = kind;
+  value.Integer = integer;
+  value.Offset = Text.size();
+  value.Length = length;
+  Text.append(text, length);
+}
+
+/*
+Appends a finished row to the pending batch, handing the batch to the writer once it's full
+*/
+void SQLiteHelper::addRow(const SQLiteRow& row) {
+  std::unique_lock<std::mutex> lock(WriterMutex);
+  size_t textOffset = Pending.Text.size();
+  Pending.Rows.emplace_back(row.Insert, row.NumValues);
+  for (unsigned int i = 0; i < row.NumValues; i++) {
+    Pending.Values.push_back(row.Values[i]);
+    Pending.Values.back().Offset += textOffset;
+  }
+  Pending.Text += row.Text;
+  if (Pending.Rows.size() >= BatchRows)
+    submit(lock);
+}
+
+/*
+Queues the pending batch for the writer, waiting for room if the queue is full. Without the
+writer, writes it here instead, with the lock still held so that no other thread writes at once
+*/
+void SQLiteHelper::submit(std::unique_lock<std::mutex>& lock) {
+  if (Pending.Rows.empty() && Pending.Forget.empty())
+    return;
+  if (!Writer.joinable()) {
+    Batch batch(std::move(Pending));
+    Pending = Batch();
+    ++Submitted;
+    std::string error;
+    uint64_t errors = write(batch, error);
+    written(batch, errors, error);
+    return;
+  }
+  if (Queue.size() >= MaxQueuedBatches) {
+    auto start = std::chrono::steady_clock::now();
+    Room.wait(lock, [this]{ return Queue.size() < MaxQueuedBatches; });
+    ++Stats.Stalls;
+    Stats.StallNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+  Queue.push_back(std::move(Pending));
+  Pending = Batch();
+  ++Submitted;
+  Stats.MaxDepth = std::max(Stats.MaxDepth, Queue.size());
+  Ready.notify_one();
+}
+
+void SQLiteHelper::drain() {
+  std::unique_lock<std::mutex> lock(WriterMutex);
+  submit(lock);
+  uint64_t target = Submitted;
+  Written.wait(lock, [this, target]{ return Stats.Batches >= target; });
+  if (Stats.Errors > ReportedErrors) {
+    std::cerr << "Error: " << Stats.Errors - ReportedErrors << " rows couldn't be written to the database: "
+              << WriteError << std::endl;
+    ReportedErrors = Stats.Errors;
+    WriteError.clear();
+  }
+}
+
+WriterStats SQLiteHelper::writerStats() {
+  std::lock_guard<std::mutex> lock(WriterMutex);
+  WriterStats stats(Stats);
+  stats.Depth = Queue.size();
+  return stats;
+}
+
+uint64_t SQLiteHelper::write(Batch& batch, std::string& error) {
+  uint64_t errors = 0;
+  std::string path;
+  const Value* value = batch.Values.data();
+  for (auto& row: batch.Rows) {
+    sqlite3_stmt* stmt = Statements[row.first];
+    for (unsigned int i = 1; i <= row.second; i++, value++) {
+      switch (value->Kind) {
+        case Value::INTEGER:
+          sqlite3_bind_int64(stmt, i, value->Integer);
+          break;
+        case Value::TEXT:
+          sqlite3_bind_text(stmt, i, batch.Text.data() + value->Offset, value->Length, SQLITE_STATIC);
+          break;
+        case Value::NUL:
+          sqlite3_bind_null(stmt, i);
+          break;
+        case Value::PATH:
+          path.assign(batch.Text, value->Offset, value->Length);
+          sqlite3_bind_int64(stmt, i, pathId(value->Integer, path));
+          break;
+      }
+    }
+    if (sqlite3_step(stmt) != SQLITE_DONE && errors++ == 0)
+      error = sqlite3_errmsg(Db);
+    sqlite3_reset(stmt);
+  }
+  for (int64_t snapshotId: batch.Forget)
+    PathIds.erase(snapshotId);
+  return errors;
+}
+
+void SQLiteHelper::writerLoop() {
+  std::unique_lock<std::mutex> lock(WriterMutex);
+  while (true) {
+    Ready.wait(lock, [this]{ return !Queue.empty() || Stopping; });
+    if (Queue.empty())
+      break;
+    Batch batch(std::move(Queue.front()));
+    Queue.pop_front();
+    Room.notify_all();
+    lock.unlock();
+
+    std::string error;
+    uint64_t errors = write(batch, error);
+
+    lock.lock();
+    written(batch, errors, error);
+  }
+}
+
+// Counts a batch as written, under WriterMutex
+void SQLiteHelper::written(const Batch& batch, uint64_t errors, const std::string& error) {
+  Stats.Rows += batch.Rows.size();
+  Stats.Errors += errors;
+  ++Stats.Batches;
+  if (errors && WriteError.empty())
+    WriteError = error;
+  Written.notify_all();
+}
+
+void SQLiteHelper::stopWriter() {
+  drain();
+  if (!Writer.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(WriterMutex);
+    Stopping = true;
+    Ready.notify_one();
+  }
+  Writer.join();
+  Stopping = false;
 }
 
 const std::vector<std::vector<std::string>> SQLiteHelper::EventColumns = {
   { "Position", "int"},
   { "Timestamp", "text"},
-  { "EventSource", "text"},
-  { "EventType", "text"},
+  { "EventSource", "int"},
+  { "EventType", "int"},
   { "FileName", "text"},
-  { "Folder", "text"},
-  { "FullPath", "text"},
+  { "FolderID", "int"},
+  { "FullPathID", "int"},
   { "MFTRecord", "int"},
   { "ParentMFTRecord", "int"},
   { "USN_LSN", "int"},
   { "OldFileName", "text"},
-  { "OldFolder", "text"},
+  { "OldFolderID", "int"},
   { "OldParentRecord", "int"},
   { "Offset", "int"},
   { "Created", "text"},
   { "Modified", "text"},
   { "Comment", "text"},
-  { "Snapshot", "text"},
-  { "Volume", "text"}
+  { "SnapshotID", "int"}
 };
 
 const std::vector<std::vector<std::string>> SQLiteHelper::EventTempColumns = {
@@ -238,8 +752,8 @@ const std::vector<std::vector<std::string>> SQLiteHelper::EventTempColumns = {
   { "Created", "text"},
   { "Modified", "text"},
   { "Comment", "text"},
-  { "Snapshot", "text"},
-  { "Volume", "text"}
+  { "SnapshotID", "int"},
+  { "VolumeID", "int"}
 };
 
 const std::vector<std::vector<std::string>> SQLiteHelper::LogColumns = {
@@ -248,13 +762,12 @@ const std::vector<std::vector<std::string>> SQLiteHelper::LogColumns = {
   { "UndoLSN", "int"},
   { "ClientID", "int"},
   { "RecordType", "int"},
-  { "RedoOP", "text"},
-  { "UndoOP", "text"},
+  { "RedoOP", "int"},
+  { "UndoOP", "int"},
   { "TargetAttribute", "int"},
   { "MFTClusterIndex", "int"},
   { "Offset", "int"},
-  { "Snapshot", "text"},
-  { "Volume", "text"}
+  { "SnapshotID", "int"}
 };
 
 const std::vector<std::vector<std::string>> SQLiteHelper::UsnColumns = {
@@ -264,9 +777,46 @@ const std::vector<std::vector<std::string>> SQLiteHelper::UsnColumns = {
   { "Timestamp", "text"},
   { "Reason", "text"},
   { "FileName", "text"},
-  { "FullPath", "text"},
-  { "Folder", "text"},
+  { "FullPathID", "int"},
+  { "FolderID", "int"},
   { "Offset", "int"},
+  { "SnapshotID", "int"}
+};
+
+const std::vector<std::vector<std::string>> SQLiteHelper::DiagnosticColumns = {
+  { "Kind", "text"},
+  { "Count", "int"},
   { "Snapshot", "text"},
-  { "Volume", "text" }
+  { "Volume", "text"}
+};
+
+const std::vector<std::vector<std::string>> SQLiteHelper::DiagnosticSampleColumns = {
+  { "Kind", "text"},
+  { "Offset", "int"},
+  { "Value", "int"},
+  { "Snapshot", "text"},
+  { "Volume", "text"}
+};
+
+const std::vector<std::vector<std::string>> SQLiteHelper::PerfColumns = {
+  { "Phase", "text"},
+  { "Cycles", "int"},
+  { "Instructions", "int"},
+  { "CacheMisses", "int"},
+  { "BranchMisses", "int"},
+  { "Records", "int"},
+  { "Bytes", "int"},
+  { "Snapshot", "text"},
+  { "Volume", "text"}
+};
+
+const std::vector<std::vector<std::string>> SQLiteHelper::HistoryColumns = {
+  { "VolumeID", "int"},
+  { "MFTRecord", "int"},
+  { "FileName", "text"},
+  { "ParentMFTRecord", "int"},
+  { "ValidFrom", "text"},
+  { "ValidTo", "text"},
+  { "FromPosition", "int"},
+  { "ToPosition", "int"}
 };
@@ -0,0 +1,127 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "trace.h"
+#include "util.h"
+
+#include <fstream>
+
+TraceLog* TraceLog::Active = NULL;
+
+TraceLog::TraceLog() : Epoch(std::chrono::steady_clock::now()) {}
+
+uint64_t TraceLog::now() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Epoch).count();
+}
+
+void TraceLog::add(TraceEvent& event) {
+  std::lock_guard<std::mutex> lock(Mutex);
+  Events.push_back(std::move(event));
+}
+
+unsigned int TraceLog::threadId(const std::string& name) {
+  std::lock_guard<std::mutex> lock(Mutex);
+  auto it = Threads.find(std::this_thread::get_id());
+  if (it != Threads.end())
+    return it->second;
+  unsigned int id = ThreadNames.size() + 1;
+  Threads[std::this_thread::get_id()] = id;
+  ThreadNames.push_back(name.empty() ? (id == 1 ? "main" : "worker " + std::to_string(id)) : name);
+  return id;
+}
+
+bool TraceLog::write(const std::string& fileName) const {
+  std::lock_guard<std::mutex> lock(Mutex);
+  std::ofstream out(fileName, std::ios::out | std::ios::trunc);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+      << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"ntfs_linker\"}}";
+  for (unsigned int i = 0; i < ThreadNames.size(); ++i) {
+    out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i + 1
+        << ", \"args\": {\"name\": " << jsonString(ThreadNames[i]) << "}}";
+  }
+  for (auto& event: Events) {
+    out << ",\n{\"name\": " << jsonString(event.Name) << ", \"cat\": " << jsonString(event.Category)
+        << ", \"ph\": \"X\", \"ts\": " << event.Start << ", \"dur\": " << event.Duration
+        << ", \"pid\": 1, \"tid\": " << event.Thread << ", \"args\": {";
+    for (unsigned int i = 0; i < event.Args.size(); ++i) {
+      out << (i ? ", " : "") << jsonString(event.Args[i].first) << ": " << event.Args[i].second;
+    }
+    out << "}}";
+  }
+  out << "\n]}\n";
+  return static_cast<bool>(out);
+}
+
+TraceSpan::TraceSpan(const std::string& name, const char* category) : Log(TraceLog::Active) {
+  if (!Log)
+    return;
+  Event.Name = name;
+  Event.Category = category;
+  Event.Thread = Log->threadId();
+  Event.Start = Log->now();
+}
+
+TraceSpan::~TraceSpan() {
+  if (!Log)
+    return;
+  Event.Duration = Log->now() - Event.Start;
+  Log->add(Event);
+}
+
+void TraceSpan::arg(const std::string& key, uint64_t value) {
+  if (Log)
+    Event.Args.push_back(std::make_pair(key, std::to_string(value)));
+}
+
+void TraceSpan::arg(const std::string& key, const std::string& value) {
+  if (Log)
+    Event.Args.push_back(std::make_pair(key, jsonString(value)));
+}
+
+void PhaseTracer::beginPhase(const PhaseInfo&) {
+  uint64_t start = Log.now();
+  std::lock_guard<std::mutex> lock(Mutex);
+  Open[std::this_thread::get_id()].push_back(start);
+}
+
+void PhaseTracer::endPhase(const PhaseInfo& info) {
+  TraceEvent event;
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    std::vector<uint64_t>& starts = Open[std::this_thread::get_id()];
+    event.Start = starts.back();
+    starts.pop_back();
+  }
+  event.Duration = Log.now() - event.Start;
+  event.Name = toString(info.Phase);
+  event.Category = "phase";
+  event.Thread = Log.threadId();
+  event.Args.push_back(std::make_pair("volume", jsonString(info.Volume)));
+  event.Args.push_back(std::make_pair("snapshot", jsonString(info.Snapshot)));
+  event.Args.push_back(std::make_pair("records", std::to_string(info.Records)));
+  event.Args.push_back(std::make_pair("bytes", std::to_string(info.Bytes)));
+  Log.add(event);
+}
@@ -0,0 +1,179 @@
+/*
+ * ntfs-linker
+ * Copyright 2015 Stroz Friedberg, LLC
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A copy of the GNU Lesser General Public License is available at
+ * <http://www.gnu.org/licenses/>.
+ *
+ * You can contact Stroz Friedberg by electronic and paper mail as follows:
+ *
+ * Stroz Friedberg, LLC
+ * 32 Avenue of the Americas
+ * 4th Floor
+ * New York, NY, 10013
+ * info@strozfriedberg.com
+ */
+
+#include "tsv.h"
+
+#include <cstring>
+
+bool TsvWriter::Threaded = false;
+
+TsvWriter::TsvWriter(std::ostream& out, size_t capacity)
+  : Out(out), Buffer(capacity), Used(0), PendingUsed(0), RowStarted(false), Done(false) {
+  if (Threaded) {
+    Pending.resize(capacity);
+    Writer = std::thread(&TsvWriter::writerLoop, this);
+  }
+}
+
+TsvWriter::~TsvWriter() {
+  flush();
+  if (Writer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Done = true;
+    }
+    Ready.notify_one();
+    Writer.join();
+  }
+}
+
+/*
+Two digits at a time, from a table of 00-99
+*/
+char* TsvWriter::formatUnsigned(uint64_t value, char* end) {
+  static const char pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+  char* p = end;
+  while (value >= 100) {
+    unsigned int i = (value % 100) * 2;
+    value /= 100;
+    *--p = pairs[i + 1];
+    *--p = pairs[i];
+  }
+  if (value >= 10) {
+    unsigned int i = value * 2;
+    *--p = pairs[i + 1];
+    *--p = pairs[i];
+  }
+  else {
+    *--p = static_cast<char>('0' + value);
+  }
+  return p;
+}
+
+void TsvWriter::separate() {
+  if (RowStarted)
+    Buffer[Used++] = '\t';
+  RowStarted = true;
+}
+
+/*
+Makes room for len more bytes, plus a separator
+*/
+void TsvWriter::reserve(size_t len) {
+  if (Used + len + 1 > Buffer.size())
+    writeBuffer();
+}
+
+TsvWriter& TsvWriter::fieldUnsigned(uint64_t value) {
+  char digits[20];
+  char* end = digits + sizeof(digits);
+  char* start = formatUnsigned(value, end);
+  return field(start, end - start);
+}
+
+TsvWriter& TsvWriter::fieldSigned(int64_t value) {
+  char digits[21];
+  char* end = digits + sizeof(digits);
+  // Negate as unsigned, so INT64_MIN works
+  char* start = formatUnsigned(value < 0 ? 0 - static_cast<uint64_t>(value) : value, end);
+  if (value < 0)
+    *--start = '-';
+  return field(start, end - start);
+}
+
+TsvWriter& TsvWriter::field(const char* value, size_t len) {
+  reserve(len);
+  separate();
+  if (len >= Buffer.size()) {
+    // Longer than the whole buffer; don't bother copying it
+    drain();
+    Out.write(value, len);
+  }
+  else {
+    std::memcpy(&Buffer[Used], value, len);
+    Used += len;
+  }
+  return *this;
+}
+
+void TsvWriter::endRow() {
+  reserve(0);
+  Buffer[Used++] = '\n';
+  RowStarted = false;
+}
+
+/*
+Writes out the buffer, or passes it to the writer thread and carries on in the other one
+*/
+void TsvWriter::writeBuffer() {
+  if (!Writer.joinable()) {
+    Out.write(Buffer.data(), Used);
+    Used = 0;
+    return;
+  }
+  std::unique_lock<std::mutex> lock(Mutex);
+  Written.wait(lock, [this]{ return PendingUsed == 0; });
+  Buffer.swap(Pending);
+  PendingUsed = Used;
+  Used = 0;
+  lock.unlock();
+  Ready.notify_one();
+}
+
+void TsvWriter::writerLoop() {
+  std::unique_lock<std::mutex> lock(Mutex);
+  while (true) {
+    Ready.wait(lock, [this]{ return PendingUsed > 0 || Done; });
+    if (PendingUsed == 0)
+      return;
+    // The caller doesn't touch Pending until PendingUsed is back to 0
+    lock.unlock();
+    Out.write(Pending.data(), PendingUsed);
+    lock.lock();
+    PendingUsed = 0;
+    Written.notify_one();
+  }
+}
+
+/*
+Returns once everything buffered has been written to the stream
+*/
+void TsvWriter::drain() {
+  if (Used > 0)
+    writeBuffer();
+  if (Writer.joinable()) {
+    std::unique_lock<std::mutex> lock(Mutex);
+    Written.wait(lock, [this]{ return PendingUsed == 0; });
+  }
+}
+
+void TsvWriter::flush() {
+  drain();
+  Out.flush();
+}
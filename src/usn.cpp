@@ -25,6 +25,8 @@
  */
 
 #include "util.h"
+#include "diagnostics.h"
+#include "layout.h"
 #include "progress.h"
 #include "usn.h"
 
@@ -57,31 +59,56 @@ Decodes the Usn reason code
 Usn uses a bit packing scheme to store reason codes.
 Typically, as operations are performed on a file these reason codes are combined (|)
 */
-std::string UsnRecord::getReasonString() {
-  std::stringstream ss;
-  ss << "USN";
-  if (Reason & UsnReasons::USN_BASIC_INFO_CHANGE)         ss << "|BASIC_INFO_CHANGE";
-  if (Reason & UsnReasons::USN_CLOSE)                     ss << "|CLOSE";
-  if (Reason & UsnReasons::USN_COMPRESSION_CHANGE)        ss << "|COMPRESSION_CHANGE";
-  if (Reason & UsnReasons::USN_DATA_EXTEND)               ss << "|DATA_EXTEND";
-  if (Reason & UsnReasons::USN_DATA_OVERWRITE)            ss << "|DATA_OVERWRITE";
-  if (Reason & UsnReasons::USN_DATA_TRUNCATION)           ss << "|DATA_TRUNCATION";
-  if (Reason & UsnReasons::USN_EXTENDED_ATTRIBUTE_CHANGE) ss << "|EXTENDED_ATTRIBUTE_CHANGE";
-  if (Reason & UsnReasons::USN_ENCRYPTION_CHANGE)         ss << "|ENCRYPTION_CHANGE";
-  if (Reason & UsnReasons::USN_FILE_CREATE)               ss << "|FILE_CREATE";
-  if (Reason & UsnReasons::USN_FILE_DELETE)               ss << "|FILE_DELETE";
-  if (Reason & UsnReasons::USN_HARD_LINK_CHANGE)          ss << "|HARD_LINK_CHANGE";
-  if (Reason & UsnReasons::USN_INDEXABLE_CHANGE)          ss << "|INDEXABLE_CHANGE";
-  if (Reason & UsnReasons::USN_NAMED_DATA_EXTEND)         ss << "|NAMED_DATA_EXTEND";
-  if (Reason & UsnReasons::USN_NAMED_DATA_OVERWRITE)      ss << "|NAMED_DATA_OVERWRITE";
-  if (Reason & UsnReasons::USN_NAMED_DATA_TRUNCATION)     ss << "|NAMED_DATA_TRUNCATION";
-  if (Reason & UsnReasons::USN_OBJECT_ID_CHANGE)          ss << "|OBJECT_ID_CHANGE";
-  if (Reason & UsnReasons::USN_RENAME_NEW_NAME)           ss << "|RENAME_NEW_NAME";
-  if (Reason & UsnReasons::USN_RENAME_OLD_NAME)           ss << "|RENAME_OLD_NAME";
-  if (Reason & UsnReasons::USN_REPARSE_POINT_CHANGE)      ss << "|REPARSE_POINT_CHANGE";
-  if (Reason & UsnReasons::USN_SECURITY_CHANGE)           ss << "|SECURITY_CHANGE";
-  if (Reason & UsnReasons::USN_STREAM_CHANGE)             ss << "|STREAM_CHANGE";
-  return ss.str();
+static void renderReason(unsigned int reason, std::string& out) {
+  out = "USN";
+  if (reason & UsnReasons::USN_BASIC_INFO_CHANGE)         out += "|BASIC_INFO_CHANGE";
+  if (reason & UsnReasons::USN_CLOSE)                     out += "|CLOSE";
+  if (reason & UsnReasons::USN_COMPRESSION_CHANGE)        out += "|COMPRESSION_CHANGE";
+  if (reason & UsnReasons::USN_DATA_EXTEND)               out += "|DATA_EXTEND";
+  if (reason & UsnReasons::USN_DATA_OVERWRITE)            out += "|DATA_OVERWRITE";
+  if (reason & UsnReasons::USN_DATA_TRUNCATION)           out += "|DATA_TRUNCATION";
+  if (reason & UsnReasons::USN_EXTENDED_ATTRIBUTE_CHANGE) out += "|EXTENDED_ATTRIBUTE_CHANGE";
+  if (reason & UsnReasons::USN_ENCRYPTION_CHANGE)         out += "|ENCRYPTION_CHANGE";
+  if (reason & UsnReasons::USN_FILE_CREATE)               out += "|FILE_CREATE";
+  if (reason & UsnReasons::USN_FILE_DELETE)               out += "|FILE_DELETE";
+  if (reason & UsnReasons::USN_HARD_LINK_CHANGE)          out += "|HARD_LINK_CHANGE";
+  if (reason & UsnReasons::USN_INDEXABLE_CHANGE)          out += "|INDEXABLE_CHANGE";
+  if (reason & UsnReasons::USN_NAMED_DATA_EXTEND)         out += "|NAMED_DATA_EXTEND";
+  if (reason & UsnReasons::USN_NAMED_DATA_OVERWRITE)      out += "|NAMED_DATA_OVERWRITE";
+  if (reason & UsnReasons::USN_NAMED_DATA_TRUNCATION)     out += "|NAMED_DATA_TRUNCATION";
+  if (reason & UsnReasons::USN_OBJECT_ID_CHANGE)          out += "|OBJECT_ID_CHANGE";
+  if (reason & UsnReasons::USN_RENAME_NEW_NAME)           out += "|RENAME_NEW_NAME";
+  if (reason & UsnReasons::USN_RENAME_OLD_NAME)           out += "|RENAME_OLD_NAME";
+  if (reason & UsnReasons::USN_REPARSE_POINT_CHANGE)      out += "|REPARSE_POINT_CHANGE";
+  if (reason & UsnReasons::USN_SECURITY_CHANGE)           out += "|SECURITY_CHANGE";
+  if (reason & UsnReasons::USN_STREAM_CHANGE)             out += "|STREAM_CHANGE";
+}
+
+const std::string& ReasonCache::get(unsigned int reason) {
+  // Fibonacci hashing spreads the few bits set in a mask over the table
+  unsigned int slot = (reason * 2654435769u) >> (32 - SLOT_BITS);
+  for (unsigned int probe = 0; probe < MAX_PROBES; probe++, slot = (slot + 1) & (SLOTS - 1)) {
+    if (!Used[slot]) {
+      if (Count >= SLOTS * 3 / 4)
+        break;
+      Used[slot] = true;
+      Masks[slot] = reason;
+      renderReason(reason, Strings[slot]);
+      ++Count;
+      return Strings[slot];
+    }
+    if (Masks[slot] == reason)
+      return Strings[slot];
+  }
+  // The table is full of masks from damaged records, so render this one each time
+  renderReason(reason, Uncached);
+  return Uncached;
+}
+
+const std::string& UsnRecord::getReasonString() const {
+  // One cache per thread, so that parsers on different threads don't contend
+  static thread_local ReasonCache cache;
+  return cache.get(Reason);
 }
 
 std::streampos advanceStream(std::istream& stream, char* buffer, bool sparse) {
@@ -125,18 +152,23 @@ std::streampos advanceStream(std::istream& stream, char* buffer, bool sparse) {
 Parses all records found in the USN file represented by input. Uses the records map to recreate file paths
 Outputs the results to several streams.
 */
-void parseUSN(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std::istream& input, std::ostream& output, const VersionInfo& version, bool extra) {
+uint64_t parseUSN(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std::istream& input, std::ostream& output, const VersionInfo& version, bool extra,
+                  const std::vector<RecordObserver*>& observers) {
   std::unique_ptr<char[]> bufPtr(new char[USN_BUFFER_SIZE]);
   char* buffer = bufPtr.get();
 
-  int records_processed = -1;
+  uint64_t records_processed = 0;
+  sqliteHelper.identify(version);
 
   std::streampos end = advanceStream(input, buffer, true);
   std::streampos start = input.tellg();
-  ProgressBar status(end - start);
+  ProgressBar status(end - start, "$UsnJrnl");
 
   UsnRecord prevRec(version);
+  UsnRecord rec(version);
+  Diagnostics diagnostics(version, "$UsnJrnl");
   output << getUSNColumnHeaders();
+  TsvWriter tsv(output);
 
   unsigned int offset = 0;
   unsigned int totalOffset = 0;
@@ -145,73 +177,77 @@ void parseUSN(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std:
   //scan through the $USNJrnl one record at a time. Each record is variable length.
   bool done = false;
   while (!input.eof() && !done) {
-    status.setDone((uint64_t) input.tellg() - USN_BUFFER_SIZE + offset - start);
+    status.setDone((uint64_t) input.tellg() - USN_BUFFER_SIZE + offset - start, records_processed);
 
-    if (offset + 4 > USN_BUFFER_SIZE || hex_to_long(buffer + offset, 4) + offset > USN_BUFFER_SIZE) {
+    if (offset + 4 > USN_BUFFER_SIZE || le<uint32_t>(buffer + offset) + offset > USN_BUFFER_SIZE) {
       // We've reached the end of the buffer. Move the record to the front,
       // then read to fill out the rest of the buffer
       memmove(buffer, buffer + offset, USN_BUFFER_SIZE - offset);
       input.read(buffer + USN_BUFFER_SIZE - offset, offset);
+      // Past the end of the stream, don't parse what's left over from the last block again
+      std::fill(buffer + USN_BUFFER_SIZE - offset + input.gcount(), buffer + USN_BUFFER_SIZE, 0);
       totalOffset += offset;
       offset = 0;
     }
 
-    uint64_t record_length = hex_to_long(buffer + offset, 4);
+    uint64_t record_length = le<uint32_t>(buffer + offset);
 
     if (record_length == 0) {
       offset += 8;
       continue;
     }
     if (record_length > USN_BUFFER_SIZE) {
-      status.clear();
-      std::cerr << "Encountered bad record at 0x"
-                << std::hex << static_cast<int>(input.tellg()) - USN_BUFFER_SIZE + offset
-                << " in snapshot: " << version.Snapshot << ".";
+      uint64_t bad_offset = static_cast<int>(input.tellg()) - USN_BUFFER_SIZE + offset;
+      diagnostics.record(AnomalyKinds::ANOMALY_USN_BAD_RECORD, bad_offset, record_length);
       int new_offset = recoverPosition(buffer, offset, usn_offset + (static_cast<int>(input.tellg()) - USN_BUFFER_SIZE + offset));
       if (new_offset >= 0) {
-        std::cerr << " Recovery successful with 0x" << std::hex << new_offset - offset << " bytes skipped" << std::endl;
+        diagnostics.record(AnomalyKinds::ANOMALY_USN_RECOVERED, bad_offset, new_offset - offset);
         offset = new_offset;
         continue;
       }
       else {
         // Try once to read another page, but no more
+        unsigned int skipped = USN_BUFFER_SIZE - offset;
         input.read(buffer, USN_BUFFER_SIZE);
         totalOffset += USN_BUFFER_SIZE;
         offset = 0;
         int new_offset = recoverPosition(buffer, offset, usn_offset);
         if (new_offset >= 0) {
-          std::cerr << " Recovery successful with 0x" << std::hex << new_offset - offset + USN_BUFFER_SIZE
-                    << " bytes skipped" << std::endl;
+          diagnostics.record(AnomalyKinds::ANOMALY_USN_RECOVERED, bad_offset, new_offset + skipped);
           offset = new_offset;
           continue;
         }
         else {
-          std::cerr << " Recovery failed. Cannot continue parsing this $UsnJrnl file." << std::endl;
+          // Cannot continue parsing this $UsnJrnl file
+          diagnostics.record(AnomalyKinds::ANOMALY_USN_RECOVERY_FAILED, bad_offset);
           break;
         }
       }
     }
     records_processed++;
 
-    UsnRecord rec(buffer + offset, offset + totalOffset, version);
+    rec.init(buffer + offset, offset + totalOffset);
 
     if (usn_offset == UINT64_MAX) {
       usn_offset = rec.Usn - (static_cast<int>(input.tellg()) - USN_BUFFER_SIZE + offset);
     }
     else if (usn_offset != rec.Usn - (static_cast<int>(input.tellg()) - USN_BUFFER_SIZE + offset) && !input.eof()) {
-      std::cerr << "Inconsistent Usn value found at 0x" << std::hex << static_cast<int>(input.tellg()) - offset
-                << " in snapshot << " << version.Snapshot
-                << ". Update sequence number does not match the offset of the record in the file" << std::endl;
+      // Update sequence number does not match the offset of the record in the file
+      diagnostics.record(AnomalyKinds::ANOMALY_USN_INCONSISTENT_USN, static_cast<int>(input.tellg()) - USN_BUFFER_SIZE + offset, rec.Usn);
       usn_offset = rec.Usn - (static_cast<int>(input.tellg()) - USN_BUFFER_SIZE + offset);
     }
 
     if (extra) {
-      output << rec.toString(records);
-      rec.insert(sqliteHelper.UsnInsert, records);
+      rec.write(tsv, records);
+      rec.insert(sqliteHelper, records);
+      if (ArrowTables::Active)
+        rec.write(ArrowTables::Active->Usn, records);
     }
+    for (auto observer: observers)
+      observer->usnRecord(rec, records);
 
     if (prevRec.Record != rec.Record || prevRec.Reason & UsnReasons::USN_CLOSE) {
-      prevRec.checkTypeAndInsert(sqliteHelper.EventInsert);
+      prevRec.checkTypeAndInsert(sqliteHelper);
       prevRec.clearFields();
     }
     if (prevRec.Usn == 0)
@@ -221,9 +257,12 @@ void parseUSN(const std::vector<File>& records, SQLiteHelper& sqliteHelper, std:
     offset += record_length;
   }
   if (prevRec.Usn != 0) {
-    prevRec.checkTypeAndInsert(sqliteHelper.EventInsert);
+    prevRec.checkTypeAndInsert(sqliteHelper);
   }
   status.finish();
+  diagnostics.insert(sqliteHelper);
+  diagnostics.printSummary(std::cerr);
+  return records_processed;
 }
 
 int recoverPosition(const char* buffer, unsigned int offset, unsigned int usn_offset) {
@@ -241,7 +280,7 @@ int recoverPosition(const char* buffer, unsigned int offset, unsigned int usn_of
   offset = 8 * ceilingDivide(offset, 8);
   bool found = false;
   while (offset < USN_BUFFER_SIZE) {
-    uint64_t value = hex_to_long(buffer + offset, 8);
+    uint64_t value = le<uint64_t>(buffer + offset);
     if (value == offset + usn_offset - 0x18) {
      if (found)
         return offset - 0x18;
@@ -252,7 +291,7 @@ int recoverPosition(const char* buffer, unsigned int offset, unsigned int usn_of
   return -1;
 }
 
-void UsnRecord::update(UsnRecord rec) {
+void UsnRecord::update(const UsnRecord& rec) {
     Reason |= rec.Reason;
 
     if (rec.Reason & UsnReasons::USN_RENAME_OLD_NAME) {
@@ -267,26 +306,32 @@ void UsnRecord::update(UsnRecord rec) {
 }
 
 UsnRecord::UsnRecord(const char* buffer, uint64_t fileOffset, const VersionInfo& version, int len, bool isEmbedded) :
-  FileOffset(fileOffset),
-  Snapshot(version.Snapshot),
-  Volume(version.Volume),
+  Version(&version),
   IsEmbedded(isEmbedded) {
+  init(buffer, fileOffset, len);
+}
+
+void UsnRecord::init(const char* buffer, uint64_t fileOffset, int len) {
+  FileOffset = fileOffset;
   if (len < 0 || (unsigned) len >= 0x3C) {
-    PreviousName                     = "";
+    PreviousName.clear();
     PreviousParent                   = -1;
-    uint64_t record_length           = hex_to_long(buffer, 4);
-    Record                           = hex_to_long(buffer + 0x8, 6);
-    Reference                        = hex_to_long(buffer + 0x8, 8);
-    Parent                           = hex_to_long(buffer + 0x10, 6);
-    ParentReference                  = hex_to_long(buffer + 0x10, 8);
-    Usn                              = hex_to_long(buffer + 0x18, 8);
-    Timestamp                        = filetime_to_iso_8601(hex_to_long(buffer + 0x20, 8));
-    Reason                           = hex_to_long(buffer + 0x28, 4);
-    unsigned int name_len            = hex_to_long(buffer + 0x38, 2);
-    unsigned int name_offset         = hex_to_long(buffer + 0x3A, 2);
-
-    if (len < 0 || (unsigned) len >= record_length) {
-      Name = mbcatos(buffer + name_offset, name_len);
+    UsnRecordV2 usnRecord(buffer);
+    uint64_t record_length           = usnRecord.length();
+    Record                           = usnRecord.record();
+    Reference                        = usnRecord.reference();
+    Parent                           = usnRecord.parent();
+    ParentReference                  = usnRecord.parentReference();
+    Usn                              = usnRecord.usn();
+    char timestamp[ISO_8601_LENGTH];
+    Timestamp.assign(timestamp, filetime_to_iso_8601(usnRecord.timestamp(), timestamp));
+    Reason                           = usnRecord.reason();
+    unsigned int name_len            = usnRecord.nameLength();
+    unsigned int name_offset         = usnRecord.nameOffset();
+
+    // A damaged record can claim a name that runs past the data it came in
+    if (len < 0 || ((unsigned) len >= record_length && (unsigned) len >= static_cast<uint64_t>(name_offset) + name_len)) {
+      mbcatos(buffer + name_offset, name_len, Name);
       return;
     }
   }
@@ -296,92 +341,100 @@ UsnRecord::UsnRecord(const char* buffer, uint64_t fileOffset, const VersionInfo&
 
 void UsnRecord::clearFields() {
 
-  Name            = "";
+  Name.clear();
   Reference       = 0;
   Record          = -1;
   ParentReference = 0;
   Parent          = -1;
-  PreviousName    = "";
+  PreviousName.clear();
   PreviousParent  = -1;
   Reason          = 0;
-  Timestamp       = "";
+  Timestamp.clear();
   Usn             = 0;
   FileOffset      = 0;
 }
 
-UsnRecord::UsnRecord(const VersionInfo& version, bool isEmbedded) : Snapshot(version.Snapshot), Volume(version.Volume), IsEmbedded(isEmbedded) {
+UsnRecord::UsnRecord(const VersionInfo& version, bool isEmbedded) : Version(&version), IsEmbedded(isEmbedded) {
   IsEmbedded = false;
   clearFields();
 }
 
-std::string UsnRecord::toString(const std::vector<File>& records) {
-  std::stringstream ss;
-  ss << Record                       << "\t"
-     << Parent                       << "\t"
-     << Usn                          << "\t"
-     << Timestamp                    << "\t"
-     << getReasonString()            << "\t"
-     << Name                         << "\t"
-     << getFullPath(records, Record) << "\t"
-     << getFullPath(records, Parent) << "\t"
-     << FileOffset                   << "\t"
-     << Snapshot                     << "\t"
-     << Volume                       << std::endl;
-  return ss.str();
+void UsnRecord::write(TsvWriter& out, const std::vector<File>& records) {
+  out.field(Record)
+     .field(Parent)
+     .field(Usn)
+     .field(Timestamp)
+     .field(getReasonString())
+     .field(Name)
+     .field(getFullPath(records, Record))
+     .field(getFullPath(records, Parent))
+     .field(FileOffset)
+     .field(Version->Snapshot)
+     .field(Version->Volume)
+     .endRow();
+}
+
+void UsnRecord::write(ArrowWriter& out, const std::vector<File>& records) {
+  int64_t timestamp = iso_8601_to_filetime(Timestamp);
+  out.field(Record)
+     .field(Parent)
+     .field(Usn);
+  timestamp == -1 ? out.null() : out.field(timestamp);
+  out.field(getReasonString())
+     .field(Name)
+     .field(getFullPath(records, Record))
+     .field(getFullPath(records, Parent))
+     .field(FileOffset)
+     .field(Version->Snapshot)
+     .field(Version->Volume)
+     .endRow();
 }
 
-void UsnRecord::insertEvent(unsigned int type, sqlite3_stmt* stmt) {
-  unsigned int i = 0;
-  sqlite3_bind_int64(stmt, ++i, Record);
-  sqlite3_bind_int64(stmt, ++i, Parent);
-  sqlite3_bind_int64(stmt, ++i, PreviousParent);
-  sqlite3_bind_int64(stmt, ++i, Usn);
-  sqlite3_bind_text(stmt , ++i, Timestamp.c_str()   , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(stmt , ++i, Name.c_str()        , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text(stmt , ++i, PreviousName.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(stmt, ++i, type);
-  sqlite3_bind_int64(stmt, ++i, EventSources::SOURCE_USN);
-  sqlite3_bind_int  (stmt, ++i, IsEmbedded);
-  sqlite3_bind_int64(stmt, ++i, FileOffset);
-  sqlite3_bind_text (stmt, ++i, "", -1, SQLITE_TRANSIENT);  // Created
-  sqlite3_bind_text (stmt, ++i, "", -1, SQLITE_TRANSIENT);  // Modified
-  sqlite3_bind_text (stmt, ++i, "", -1, SQLITE_TRANSIENT);  // Comment
-  sqlite3_bind_text (stmt, ++i, Snapshot.c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Volume.c_str(), -1, SQLITE_TRANSIENT);
-
-  sqlite3_step(stmt);
-  sqlite3_reset(stmt);
+void UsnRecord::insertEvent(unsigned int type, SQLiteHelper& sqliteHelper) {
+  SQLiteRow(sqliteHelper, INSERT_EVENT_TEMP)
+    .integer(Record)
+    .integer(Parent)
+    .integer(PreviousParent)
+    .integer(Usn)
+    .text(Timestamp)
+    .text(Name)
+    .text(PreviousName)
+    .integer(type)
+    .integer(EventSources::SOURCE_USN)
+    .integer(IsEmbedded)
+    .integer(FileOffset)
+    .text("")  // Created
+    .text("")  // Modified
+    .text("")  // Comment
+    .integer(Version->SnapshotId)
+    .integer(Version->VolumeId);
 }
 
-void UsnRecord::insert(sqlite3_stmt* stmt, const std::vector<File>& records) {
-  unsigned int i = 0;
-  sqlite3_bind_int64(stmt, ++i, Record);
-  sqlite3_bind_int64(stmt, ++i, Parent);
-  sqlite3_bind_int64(stmt, ++i, Usn);
-  sqlite3_bind_text (stmt, ++i, Timestamp.c_str()                   , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, getReasonString().c_str()           , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Name.c_str()                        , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, getFullPath(records, Record).c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, getFullPath(records, Parent).c_str(), -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(stmt, ++i, FileOffset);
-  sqlite3_bind_text (stmt, ++i, Snapshot.c_str()                    , -1, SQLITE_TRANSIENT);
-  sqlite3_bind_text (stmt, ++i, Volume.c_str()                      , -1, SQLITE_TRANSIENT);
-
-  sqlite3_step(stmt);
-  sqlite3_reset(stmt);
+void UsnRecord::insert(SQLiteHelper& sqliteHelper, const std::vector<File>& records) {
+  SQLiteRow(sqliteHelper, INSERT_USN)
+    .integer(Record)
+    .integer(Parent)
+    .integer(Usn)
+    .text(Timestamp)
+    .text(getReasonString())
+    .text(Name)
+    .path(Version->SnapshotId, getFullPath(records, Record))
+    .path(Version->SnapshotId, getFullPath(records, Parent))
+    .integer(FileOffset)
+    .integer(Version->SnapshotId);
 }
 
-void UsnRecord::checkTypeAndInsert(sqlite3_stmt* stmt, bool strict) {
+void UsnRecord::checkTypeAndInsert(SQLiteHelper& sqliteHelper, bool strict) {
   if (Reason & UsnReasons::USN_FILE_CREATE)
-    insertEvent(EventTypes::TYPE_CREATE, stmt);
+    insertEvent(EventTypes::TYPE_CREATE, sqliteHelper);
   if (Reason & UsnReasons::USN_FILE_DELETE)
-    insertEvent(EventTypes::TYPE_DELETE, stmt);
+    insertEvent(EventTypes::TYPE_DELETE, sqliteHelper);
   if (PreviousName != Name
       && (Reason & (UsnReasons::USN_RENAME_NEW_NAME | UsnReasons::USN_RENAME_OLD_NAME))
       && (PreviousName != "" || !strict))
-    insertEvent(EventTypes::TYPE_RENAME, stmt);
+    insertEvent(EventTypes::TYPE_RENAME, sqliteHelper);
   if (Parent != PreviousParent
       && (Reason & (UsnReasons::USN_RENAME_NEW_NAME | UsnReasons::USN_RENAME_OLD_NAME))
       && (PreviousParent != -1 || !strict))
-    insertEvent(EventTypes::TYPE_MOVE, stmt);
+    insertEvent(EventTypes::TYPE_MOVE, sqliteHelper);
 }
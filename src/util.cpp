@@ -25,10 +25,12 @@
  */
 
 #include "file.h"
+#include "layout.h"
 #include "unicode.h"
 #include "util.h"
 
 #include <algorithm>
+#include <cctype>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
@@ -42,6 +44,12 @@
 
 #include <tsk/libtsk.h>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 /*
 Returns the first SIZE bytes of the character array as a int64_t
 If the result is too large to fit into a int64_t then overflow will occur
@@ -73,27 +81,108 @@ std::wstring string_to_wstring(const std::string &str) {
   return temp;
 }
 
+/*
+Writes the N least significant decimal digits of val to buf, zero padded
+*/
+static inline void write_digits(char* buf, unsigned int val, int n) {
+  for (int i = n - 1; i >= 0; --i) {
+    buf[i] = '0' + val % 10;
+    val /= 10;
+  }
+}
+
 /*
 Converts the filetime format used by microsoft windows files into ISO 8601 human-readable strings
 The filetime format is the number of 100 nanoseconds since 1601-01-01 (Assumed to be after the Gregorian Calendar cross-over date)
-Returned string format is YYYY-MM-DD HH:MM:SS 0000000 (nanoseconds)
+Written string format is YYYY-MM-DD HH:MM:SS.0000000 (nanoseconds), and is not NUL terminated
+buf must have room for ISO_8601_LENGTH characters. Returns the number of characters written,
+which is 0 if the timestamp is out of range.
+The calendar arithmetic is done by hand (rather than gmtime) so that it is reentrant
 */
-std::string filetime_to_iso_8601(uint64_t t) {
+size_t filetime_to_iso_8601(uint64_t t, char* buf) {
   int64_t unixtime = filetime_to_unixtime(t);
-  if (unixtime > INT32_MAX) {
-    return "";
+  if (unixtime > INT32_MAX || unixtime < -11644473600LL) {
+    return 0;
+  }
+  int64_t days = unixtime / 86400;
+  int64_t secs = unixtime % 86400;
+  if (secs < 0) {
+    secs += 86400;
+    --days;
+  }
+
+  // Days since 1970-01-01 to year/month/day in the proleptic Gregorian calendar
+  // ref: http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+  days += 719468;
+  const int64_t era       = (days >= 0 ? days : days - 146096) / 146097;
+  const unsigned int doe  = static_cast<unsigned int>(days - era * 146097);
+  const unsigned int yoe  = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned int doy  = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned int mp   = (5 * doy + 2) / 153;
+  const unsigned int day  = doy - (153 * mp + 2) / 5 + 1;
+  const unsigned int mon  = mp < 10 ? mp + 3 : mp - 9;
+  const unsigned int year = static_cast<unsigned int>(yoe + era * 400 + (mon <= 2));
+
+  write_digits(buf,      year, 4);
+  buf[4] = '-';
+  write_digits(buf + 5,  mon, 2);
+  buf[7] = '-';
+  write_digits(buf + 8,  day, 2);
+  buf[10] = ' ';
+  write_digits(buf + 11, secs / 3600, 2);
+  buf[13] = ':';
+  write_digits(buf + 14, (secs / 60) % 60, 2);
+  buf[16] = ':';
+  write_digits(buf + 17, secs % 60, 2);
+  buf[19] = '.';
+  write_digits(buf + 20, t % 10000000, 7);
+  return ISO_8601_LENGTH;
+}
+
+std::string filetime_to_iso_8601(uint64_t t) {
+  char buf[ISO_8601_LENGTH];
+  return std::string(buf, filetime_to_iso_8601(t, buf));
+}
+
+int64_t iso_8601_to_filetime(const std::string& str) {
+  static const char format[] = "0000-00-00 00:00:00.0000000";
+  if (str.size() != ISO_8601_LENGTH)
+    return -1;
+  for (unsigned int i = 0; i < ISO_8601_LENGTH; i++) {
+    if (format[i] == '0' ? !isdigit(static_cast<unsigned char>(str[i])) : str[i] != format[i])
+      return -1;
   }
-  time_t* time = (time_t*) &unixtime;
-  struct tm* date = gmtime(time);
+  auto number = [&str](unsigned int pos, unsigned int len) {
+    int64_t val = 0;
+    for (unsigned int i = pos; i < pos + len; i++)
+      val = val * 10 + (str[i] - '0');
+    return val;
+  };
+  int64_t year = number(0, 4), mon = number(5, 2), day = number(8, 2);
 
-  char str[21];
+  // The inverse of civil_from_days above
+  // ref: http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+  year -= mon <= 2;
+  const int64_t era  = year / 400;
+  const int64_t yoe  = year - era * 400;
+  const int64_t doy  = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + day - 1;
+  const int64_t doe  = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  const int64_t days = era * 146097 + doe - 719468;
 
-  if (!strftime(str, 20, "%Y-%m-%d %H:%M:%S", date))
+  int64_t secs = days * 86400 + number(11, 2) * 3600 + number(14, 2) * 60 + number(17, 2);
+  return (secs + 11644473600LL) * 10000000 + number(20, 7);
+}
+
+std::string complete_iso_8601(const std::string& str) {
+  static const char epoch[] = "1601-01-01 00:00:00.0000000";
+  if (str.size() != 10 && str.size() != 19 && (str.size() < 21 || str.size() > ISO_8601_LENGTH))
+    return "";
+  std::string full(str + (epoch + str.size()));
+  // Out of range fields, like a 30th of February or a 25th hour, don't come back the same
+  int64_t t = iso_8601_to_filetime(full);
+  if (t < 0 || filetime_to_iso_8601(t) != full)
     return "";
-  std::stringstream ss;
-  ss << str << ".";
-  ss << std::setw(7) << std::setfill('0') << (t % 10000000);
-  return ss.str();
+  return full;
 }
 
 /*
@@ -119,66 +208,64 @@ Length of output string is len, reads len*2 bytes
 //  return utf8;
 //}
 
-std::string mbcatos(const char* buf, uint64_t len) {
-  std::unique_ptr<char[]> utf8(new char[2 * len]);
-  char* utf8Buf = utf8.get();
-  const char* end = buf + len;
+/*
+Decodes len bytes of UTF-16LE into out, reusing out's storage
+out is set to "ERROR" if the input is not valid UTF-16
+*/
+void mbcatos(const char* buf, uint64_t len, std::string& out) {
+  // Each UTF-16 code unit takes at most 3 bytes of UTF-8, and surrogate pairs take 4
+  out.resize(2 * len);
+  char* utf8Buf = &out[0];
+  // Decode from unsigned bytes, as a signed char would sign-extend any byte >= 0x80
+  const byte* in = reinterpret_cast<const byte*>(buf);
+  const byte* end = in + len;
   int32_t cp;
-  while (buf < end) {
+  while (in < end) {
     int rtn;
-    rtn = utf16_to_cp<true>(buf, end, cp);
-    if (rtn == 0)
-      return "ERROR";
-    buf += rtn;
+    rtn = utf16_to_cp<true>(in, end, cp);
+    if (rtn == 0) {
+      out = "ERROR";
+      return;
+    }
+    in += rtn;
     rtn = cp_to_utf8(cp, utf8Buf);
-    if (rtn == 0)
-      return "ERROR";
+    if (rtn == 0) {
+      out = "ERROR";
+      return;
+    }
     utf8Buf+= rtn;
   }
-  return std::string(utf8.get(), utf8Buf);
+  out.resize(utf8Buf - out.data());
 }
 
-/*
-Uses the map of file records to construct the full file path.
-If a file record is not present in the map then the empty stry "" is returned
-*/
-std::string getFullPath(const std::vector<File>& records, unsigned int record, std::vector<unsigned int>& stack) {
-  std::stringstream ss;
-  if (record >= records.size())
-    return "";
-  if (std::find(stack.begin(), stack.end(), record) != stack.end())
-    return "CYCLICAL_HARD_LINK";
-  File file(records[record]);
-  if(record == file.Parent)
-    return "";
-  stack.push_back(record);
-  ss << getFullPath(records, file.Parent, stack);
-  ss << "\\" << file.Name;
-  return ss.str();
-}
-
-std::string getFullPath(const std::vector<File>& records, unsigned int recordNo) {
-  std::vector<unsigned int> stack;
-  return getFullPath(records, recordNo, stack);
+std::string mbcatos(const char* buf, uint64_t len) {
+  std::string utf8;
+  mbcatos(buf, len, utf8);
+  return utf8;
 }
 
 /*
-prepares the ofstream for writing
-opens the stream with whatever necessary flags, and writes any necessary start bits
+Quotes and escapes str as a JSON string
 */
-void prep_ofstream(std::ofstream& out, const std::string& name, bool overwrite) {
-  std::ios_base::openmode mode = std::ios::out | std::ios::binary;
-  if (overwrite)
-    mode |= std::ios::trunc;
-  else
-    mode |= std::ios::app;
-
-  out.open(name, mode);
-//  unsigned char smarker[3];
-//  smarker[0] = 0xEF;
-//  smarker[1] = 0xBB;
-//  smarker[2] = 0xBF;
-//  out << smarker;
+std::string jsonString(const std::string& str) {
+  static const char hex[] = "0123456789abcdef";
+  std::string out("\"");
+  for (char c: str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    }
+    else if (static_cast<unsigned char>(c) < 0x20) {
+      out += "\\u00";
+      out += hex[(c >> 4) & 0xF];
+      out += hex[c & 0xF];
+    }
+    else {
+      out += c;
+    }
+  }
+  out += '"';
+  return out;
 }
 
 std::string toString(EventTypes e) {
@@ -202,6 +289,8 @@ std::string toString(EventSources e) {
       return "$LogFile";
     case EventSources::SOURCE_EMBEDDED_USN:
       return "$UsnJrnl entry in $LogFile";
+    case EventSources::SOURCE_LOG_CARVED:
+      return "$LogFile (carved)";
     default:
       return "N/A";
   }
@@ -228,6 +317,8 @@ std::ostream& operator<<(std::ostream& out, EventSources e) {
       return out << "$LogFile";
     case EventSources::SOURCE_EMBEDDED_USN:
       return out << "$UsnJrnl entry in $LogFile";
+    case EventSources::SOURCE_LOG_CARVED:
+      return out << "$LogFile (carved)";
     default:
       return out << "N/A";
   }
@@ -241,8 +332,9 @@ int doFixup(char* buffer, unsigned int len, unsigned int sectorSize) {
   // size, but ensures to not attempt to access outside the buffer.
   bool corrupt = false;
   if (len > 8) {
-    unsigned int seqOffset = hex_to_long(buffer + 4, 2);
-    unsigned int seqLen = hex_to_long(buffer + 6, 2);
+    MultiSectorHeader header(buffer);
+    unsigned int seqOffset = header.usaOffset();
+    unsigned int seqLen = header.usaCount();
     for(unsigned int i = 1; i < seqLen && 2*i + seqOffset < len && sectorSize * i <= len; i++) {
       unsigned int arrayOffset = seqOffset + 2*i;
       unsigned int dataOffset = sectorSize * i - 2;
@@ -267,3 +359,11 @@ int ceilingDivide(int n, int m) {
   // Returns ceil(n/m), without using clunky FP arithmetic
   return (n + m - 1) / m;
 }
+
+long writeFd(int fd, const char* data, size_t size) {
+#ifdef _WIN32
+  return ::_write(fd, data, static_cast<unsigned int>(size));
+#else
+  return ::write(fd, data, size);
+#endif
+}
@@ -0,0 +1,139 @@
+#include <scope/test.h>
+
+#include "aggregate.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+  #include <fcntl.h>
+  #include <io.h>
+#else
+  #include <unistd.h>
+#endif
+
+SCOPE_TEST(testEventToJSON) {
+  std::vector<File> records(3);
+  records[0] = File("", 0, 0, "");
+  records[1] = File("dir", 1, 0, "");
+  records[2] = File("a\tb.txt", 2, 1, "");
+
+  Event event;
+  event.setVersion(VersionInfo("vss_0", "vol"));
+  event.Order = 7;
+  event.Timestamp = "2012-12-14 23:13:26.0000000";
+  event.IsAnchor = false;
+  event.IsEmbedded = false;
+  event.Source = EventSources::SOURCE_USN;
+  event.Type = EventTypes::TYPE_CREATE;
+  event.Name = "a\tb.txt";
+  event.Record = 2;
+  event.Parent = 1;
+  event.UsnLsn = 1234;
+  event.Offset = 56;
+  event.Comment = "say \"hi\"";
+  event.Paths = event.pathsIn(records);
+
+  SCOPE_ASSERT_EQUAL(
+    "{\"position\": 7, \"timestamp\": null, \"source\": \"$UsnJrnl/$J\", \"type\": \"Create\", "
+    "\"file_name\": \"a\\u0009b.txt\", \"folder\": \"\\\\dir\", \"full_path\": \"\\\\dir\\\\a\\u0009b.txt\", "
+    "\"mft_record\": 2, \"parent_mft_record\": 1, \"usn_lsn\": 1234, \"old_file_name\": \"\", "
+    "\"old_folder\": \"\", \"old_parent_record\": null, \"offset\": 56, \"created\": \"\", \"modified\": \"\", "
+    "\"comment\": \"say \\\"hi\\\"\", \"snapshot\": \"vss_0\", \"volume\": \"vol\"}\n",
+    event.toJSON());
+
+  event.IsAnchor = true;
+  SCOPE_ASSERT(event.toJSON().find("\"timestamp\": \"2012-12-14 23:13:26.0000000\"") != std::string::npos);
+}
+
+SCOPE_TEST(testRecordVersions) {
+  std::vector<File> records(4);
+  records[0] = File("", 0, 0, "");
+  records[1] = File("dir", 1, 0, "");
+  records[2] = File("new.txt", 2, 1, "");
+  records[3] = File("other", 3, 0, "");
+  RecordVersions versions(records);
+
+  // Newest first: renamed from old.txt, then moved into dir
+  Event rename, move, create;
+  rename.Type = EventTypes::TYPE_RENAME;
+  rename.IsEmbedded = false;
+  rename.Record = 2;
+  rename.Name = "new.txt";
+  rename.PreviousName = "old.txt";
+  move.Type = EventTypes::TYPE_MOVE;
+  move.IsEmbedded = false;
+  move.Record = 2;
+  move.PreviousParent = 3;
+  create.Type = EventTypes::TYPE_CREATE;
+  create.Record = 2;
+  SCOPE_ASSERT(versions.apply(rename, 0));
+  SCOPE_ASSERT(versions.apply(move, 1));
+  SCOPE_ASSERT(!versions.apply(create, 2));
+
+  // Undoing the events changed the records, but each step can still be looked up
+  SCOPE_ASSERT_EQUAL("\\other\\old.txt", getFullPath(records, 2));
+  SCOPE_ASSERT_EQUAL("\\dir\\new.txt", getFullPath(versions.at(0), 2));
+  SCOPE_ASSERT_EQUAL("\\dir\\old.txt", getFullPath(versions.at(1), 2));
+  SCOPE_ASSERT_EQUAL("\\other\\old.txt", getFullPath(versions.at(2), 2));
+  SCOPE_ASSERT_EQUAL("\\other\\old.txt", getFullPath(versions.at(3), 2));
+  SCOPE_ASSERT_EQUAL("\\dir", getFullPath(versions.at(0), 1));
+
+  versions.clear();
+  SCOPE_ASSERT_EQUAL("\\other\\old.txt", getFullPath(versions.at(0), 2));
+}
+
+SCOPE_TEST(testEventStreamLinesWhole) {
+  int fds[2];
+#ifdef _WIN32
+  SCOPE_ASSERT_EQUAL(0, _pipe(fds, 4096, _O_BINARY));
+#else
+  SCOPE_ASSERT_EQUAL(0, pipe(fds));
+#endif
+  std::string output;
+  std::thread reader([&output, &fds]{
+    char buf[4096];
+    long got;
+    while ((got = read(fds[0], buf, sizeof(buf))) > 0)
+      output.append(buf, got);
+  });
+
+  // Names long enough that a pipe takes each line in more than one write
+  const unsigned int threads = 4, events = 50;
+  Event::StreamFd = fds[1];
+  std::vector<std::thread> writers;
+  for (unsigned int i = 0; i < threads; i++) {
+    writers.push_back(std::thread([i]{
+      Event event;
+      event.setVersion(VersionInfo("vss_0", "vol"));
+      event.IsAnchor = false;
+      event.IsEmbedded = false;
+      event.Source = EventSources::SOURCE_USN;
+      event.Type = EventTypes::TYPE_CREATE;
+      event.Name = std::string(20000, static_cast<char>('a' + i));
+      for (unsigned int j = 0; j < events; j++)
+        event.stream();
+    }));
+  }
+  for (auto& writer: writers)
+    writer.join();
+  Event::StreamFd = -1;
+  close(fds[1]);
+  reader.join();
+  close(fds[0]);
+
+  unsigned int lines = 0;
+  size_t start = 0, end;
+  while ((end = output.find('\n', start)) != std::string::npos) {
+    std::string line = output.substr(start, end - start);
+    size_t name = line.find("\"file_name\": \"") + 14;
+    SCOPE_ASSERT(name > 14);
+    SCOPE_ASSERT_EQUAL(std::string(20000, line[name]) + "\"", line.substr(name, 20001));
+    SCOPE_ASSERT(line.find("\"volume\": \"vol\"}") != std::string::npos);
+    ++lines;
+    start = end + 1;
+  }
+  SCOPE_ASSERT_EQUAL(start, output.size());
+  SCOPE_ASSERT_EQUAL(threads * events, lines);
+}
@@ -0,0 +1,115 @@
+#include <scope/test.h>
+
+#include "ntfs_linker.h"
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+class Collector : public ntfs_linker::Handler {
+public:
+  void usnRecord(const ntfs_linker::UsnRecord& rec) { UsnRecords.push_back(rec); }
+  void logRecord(const ntfs_linker::LogRecord& rec) { LogRecords.push_back(rec); }
+  void event(const ntfs_linker::Event& event) { Events.push_back(event); }
+
+  std::vector<ntfs_linker::UsnRecord> UsnRecords;
+  std::vector<ntfs_linker::LogRecord> LogRecords;
+  std::vector<ntfs_linker::Event> Events;
+};
+
+void putLE(std::string& buf, size_t offset, uint64_t value, int len) {
+  for (int i = 0; i < len; ++i)
+    buf[offset + i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+// A V2 $J record for "a.txt" in the root folder
+std::string usnRecord(uint64_t usn, uint32_t reason) {
+  std::string buf(72, '\0');
+  putLE(buf, 0, buf.size(), 4);
+  putLE(buf, 4, 2, 2);
+  putLE(buf, 8, 40 | (1ULL << 48), 8);
+  putLE(buf, 16, 5 | (5ULL << 48), 8);
+  putLE(buf, 24, usn, 8);
+  putLE(buf, 32, 131000000000000000ULL, 8);
+  putLE(buf, 40, reason, 4);
+  putLE(buf, 56, 10, 2);
+  putLE(buf, 58, 60, 2);
+  const char name[] = "a\0.\0t\0x\0t\0";
+  buf.replace(60, 10, name, 10);
+  return buf;
+}
+
+}
+
+SCOPE_TEST(testApiVolume) {
+  Collector collector;
+  std::stringstream mft, usnJrnl, logFile;
+  // $J is read in 64 KiB blocks, with zeros after the last record as on disk
+  std::string jrnl = usnRecord(0, 0x100) + usnRecord(72, 0x80000100);
+  jrnl.resize(65536, '\0');
+  usnJrnl << jrnl;
+
+  ntfs_linker::Volume volume("C", collector);
+  volume.addSnapshot("Live", mft, usnJrnl, logFile);
+  uint64_t count = volume.run();
+
+  SCOPE_ASSERT_EQUAL(2u, collector.UsnRecords.size());
+  SCOPE_ASSERT_EQUAL(40, collector.UsnRecords[0].Record);
+  SCOPE_ASSERT_EQUAL(5, collector.UsnRecords[0].Parent);
+  SCOPE_ASSERT_EQUAL("a.txt", collector.UsnRecords[0].Name);
+  SCOPE_ASSERT_EQUAL(131000000000000000, collector.UsnRecords[0].Timestamp);
+  SCOPE_ASSERT_EQUAL("USN|FILE_CREATE", collector.UsnRecords[0].Reasons);
+  SCOPE_ASSERT_EQUAL("Live", collector.UsnRecords[0].Snapshot);
+  SCOPE_ASSERT_EQUAL(72u, collector.UsnRecords[1].Offset);
+  // Not in the empty $MFT
+  SCOPE_ASSERT_EQUAL(-1, collector.UsnRecords[0].DataSize);
+  SCOPE_ASSERT(!collector.UsnRecords[0].DataResident);
+  SCOPE_ASSERT(collector.LogRecords.empty());
+
+  SCOPE_ASSERT_EQUAL(count, collector.Events.size());
+  SCOPE_ASSERT(!collector.Events.empty());
+  SCOPE_ASSERT_EQUAL("Create", collector.Events.back().Type);
+  SCOPE_ASSERT_EQUAL("a.txt", collector.Events.back().Name);
+  SCOPE_ASSERT_EQUAL("C", collector.Events.back().Volume);
+}
+
+SCOPE_TEST(testApiVolumesOnThreads) {
+  // Enough records for the parses to overlap
+  std::string jrnl;
+  for (uint64_t i = 0; i < 4000; i++)
+    jrnl += usnRecord(72 * i, i % 2 ? 0x80000100 : 0x100);
+  jrnl.resize((jrnl.size() / 65536 + 1) * 65536, '\0');
+
+  const char* names[] = {"C", "D"};
+  Collector collectors[2];
+  std::stringstream mfts[2], usnJrnls[2], logFiles[2];
+  uint64_t counts[2];
+  std::ostringstream progress;
+  std::streambuf* coutBuf = std::cout.rdbuf(progress.rdbuf());
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < 2; i++) {
+    usnJrnls[i] << jrnl;
+    workers.push_back(std::thread([&, i]{
+      ntfs_linker::Volume volume(names[i], collectors[i]);
+      volume.addSnapshot("Live", mfts[i], usnJrnls[i], logFiles[i]);
+      counts[i] = volume.run();
+    }));
+  }
+  // Turning progress off while they run is safe, and it's off to begin with
+  ntfs_linker::showProgress(false);
+  for (auto& worker: workers)
+    worker.join();
+  std::cout.rdbuf(coutBuf);
+  SCOPE_ASSERT_EQUAL("", progress.str());
+
+  for (unsigned int i = 0; i < 2; i++) {
+    SCOPE_ASSERT_EQUAL(4000u, collectors[i].UsnRecords.size());
+    SCOPE_ASSERT_EQUAL(counts[i], collectors[i].Events.size());
+    SCOPE_ASSERT(!collectors[i].Events.empty());
+    for (auto& event: collectors[i].Events)
+      SCOPE_ASSERT_EQUAL(names[i], event.Volume);
+  }
+  SCOPE_ASSERT_EQUAL(counts[0], counts[1]);
+}
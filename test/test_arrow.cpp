@@ -0,0 +1,79 @@
+#include <scope/test.h>
+
+#include "arrow.h"
+
+#include <cstring>
+#include <sstream>
+
+static uint32_t readLE32(const std::string& str, size_t pos) {
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--)
+    value = (value << 8) | static_cast<unsigned char>(str[pos + i]);
+  return value;
+}
+
+/*
+Follows a table's field to the position of its value, or returns 0 if it's absent
+*/
+static size_t tableField(const std::string& buf, size_t table, unsigned int id) {
+  size_t vtable = table - static_cast<int32_t>(readLE32(buf, table));
+  uint16_t vtableSize = static_cast<unsigned char>(buf[vtable]) | (static_cast<unsigned char>(buf[vtable + 1]) << 8);
+  if (4 + 2 * id >= vtableSize)
+    return 0;
+  size_t entry = vtable + 4 + 2 * id;
+  uint16_t offset = static_cast<unsigned char>(buf[entry]) | (static_cast<unsigned char>(buf[entry + 1]) << 8);
+  return offset ? table + offset : 0;
+}
+
+static size_t follow(const std::string& buf, size_t pos) {
+  return pos + readLE32(buf, pos);
+}
+
+SCOPE_TEST(testFlatBufferTable) {
+  FlatBufferBuilder fbb;
+  uint32_t name = fbb.string("abc");
+  fbb.startTable();
+  fbb.add<int64_t>(0, 42);
+  fbb.addOffset(2, name);
+  std::string buf(fbb.finish(fbb.endTable()));
+
+  size_t table = follow(buf, 0);
+  size_t value = tableField(buf, table, 0);
+  SCOPE_ASSERT_EQUAL(0u, value % 8);
+  SCOPE_ASSERT_EQUAL(42u, readLE32(buf, value));
+  SCOPE_ASSERT_EQUAL(0u, tableField(buf, table, 1));
+  size_t str = follow(buf, tableField(buf, table, 2));
+  SCOPE_ASSERT_EQUAL(3u, readLE32(buf, str));
+  SCOPE_ASSERT_EQUAL(std::string("abc"), buf.substr(str + 4, 3));
+}
+
+SCOPE_TEST(testArrowFile) {
+  std::vector<ArrowWriter::Column> columns;
+  columns.push_back(ArrowWriter::Column("Number", ArrowWriter::INT64));
+  columns.push_back(ArrowWriter::Column("Name", ArrowWriter::UTF8));
+  columns.push_back(ArrowWriter::Column("Kind", ArrowWriter::DICTIONARY));
+  std::ostringstream out;
+  {
+    ArrowWriter arrow(out, columns, 2);
+    arrow.field(1).field("one").field("odd").endRow();
+    arrow.field(2).null().field("even").endRow();
+    arrow.null().field("three").field("odd").endRow();
+  }
+  std::string file(out.str());
+  SCOPE_ASSERT_EQUAL(std::string("ARROW1\0\0", 8), file.substr(0, 8));
+  SCOPE_ASSERT_EQUAL(std::string("ARROW1"), file.substr(file.size() - 6));
+
+  // The footer lists one dictionary and two record batches, each at a message
+  uint32_t footerSize = readLE32(file, file.size() - 10);
+  std::string footer(file.substr(file.size() - 10 - footerSize, footerSize));
+  size_t table = follow(footer, 0);
+  size_t dictionaries = follow(footer, tableField(footer, table, 2));
+  size_t batches = follow(footer, tableField(footer, table, 3));
+  SCOPE_ASSERT_EQUAL(1u, readLE32(footer, dictionaries));
+  SCOPE_ASSERT_EQUAL(2u, readLE32(footer, batches));
+  for (unsigned int i = 0; i < 2; i++) {
+    uint32_t offset = readLE32(footer, batches + 4 + 24 * i);
+    SCOPE_ASSERT_EQUAL(0u, offset % 8);
+    SCOPE_ASSERT_EQUAL(0xFFFFFFFFu, readLE32(file, offset));
+  }
+}
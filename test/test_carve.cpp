@@ -0,0 +1,62 @@
+#include <scope/test.h>
+#include <cstring>
+
+#include "carve.h"
+
+static void putLE(char* buf, uint64_t val, unsigned int len) {
+  for (unsigned int i = 0; i < len; i++)
+    buf[i] = (val >> (8 * i)) & 0xFF;
+}
+
+static void makeRecord(char* buf, uint64_t lsn, unsigned int redoOp, unsigned int undoOp) {
+  memset(buf, 0, 0x58);
+  putLE(buf, lsn, 8);
+  putLE(buf + 0x8, lsn - 1, 8);
+  putLE(buf + 0x18, 0x28, 4);
+  putLE(buf + 0x20, 1, 4);
+  putLE(buf + 0x30, redoOp, 2);
+  putLE(buf + 0x32, undoOp, 2);
+}
+
+SCOPE_TEST(testCarveRecordLength) {
+  static char buffer[0x100];
+  makeRecord(buffer, 100, 0x1B, 0x01);
+  SCOPE_ASSERT_EQUAL(0x58u, carveRecordLength(buffer, sizeof(buffer)));
+  // Truncated by the end of the region
+  SCOPE_ASSERT_EQUAL(0u, carveRecordLength(buffer, 0x50));
+}
+
+SCOPE_TEST(testCarveRejectsJunk) {
+  static char buffer[0x100];
+  makeRecord(buffer, 100, 0x30, 0x01);
+  SCOPE_ASSERT_EQUAL(0u, carveRecordLength(buffer, sizeof(buffer)));
+
+  makeRecord(buffer, 100, 0x1B, 0x01);
+  putLE(buffer + 0x8, 200, 8);
+  SCOPE_ASSERT_EQUAL(0u, carveRecordLength(buffer, sizeof(buffer)));
+
+  makeRecord(buffer, 100, 0x1B, 0x01);
+  putLE(buffer + 0x34, 0x28, 2);
+  putLE(buffer + 0x36, 0x10, 2);
+  SCOPE_ASSERT_EQUAL(0u, carveRecordLength(buffer, sizeof(buffer)));
+
+  memset(buffer, 0, sizeof(buffer));
+  SCOPE_ASSERT_EQUAL(0u, carveRecordLength(buffer, sizeof(buffer)));
+}
+
+SCOPE_TEST(testCarverKeepsLsnOrder) {
+  static char page[4096];
+  memset(page, 0, sizeof(page));
+  makeRecord(page + 0x40, 100, 0x1B, 0x01);
+  makeRecord(page + 0x98, 101, 0x1B, 0x01);
+  // Older than the preceding record, so it's not part of the same run
+  makeRecord(page + 0xF0, 50, 0x1B, 0x01);
+
+  LogCarver carver;
+  carver.submit(page, 0x8000, 0x40, 4096);
+  std::vector<CarvedRecord>& carved = carver.finish();
+  SCOPE_ASSERT_EQUAL(2u, carved.size());
+  SCOPE_ASSERT_EQUAL(0x8040u, carved[0].Offset);
+  SCOPE_ASSERT_EQUAL(0x8098u, carved[1].Offset);
+  SCOPE_ASSERT_EQUAL(0x58u, carved[1].Data.size());
+}
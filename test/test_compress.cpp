@@ -0,0 +1,95 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <scope/test.h>
+
+#include "compress.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+
+static uint32_t readLE32(const std::string& str, size_t pos) {
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--)
+    value = (value << 8) | static_cast<unsigned char>(str[pos + i]);
+  return value;
+}
+
+SCOPE_TEST(testZstdFrames) {
+  std::stringstream expected;
+  for (int i = 0; expected.tellp() < static_cast<std::streamoff>(ZstdFrameBuf::FrameSize * 2 + 100); i++)
+    expected << i << "\trow\n";
+
+  std::stringbuf file;
+  {
+    WorkerPool pool(2);
+    ZstdFrameBuf zstd(&file, pool);
+    std::ostream out(&zstd);
+    out << expected.str();
+    out.flush();
+    SCOPE_ASSERT(zstd.close());
+  }
+  std::string compressed(file.str());
+
+  // The seek table's footer and entries
+  size_t footer = compressed.size() - 9;
+  SCOPE_ASSERT_EQUAL(0x8F92EAB1u, readLE32(compressed, footer + 5));
+  SCOPE_ASSERT_EQUAL(3u, readLE32(compressed, footer));
+  size_t table = footer - 3 * 8;
+  SCOPE_ASSERT_EQUAL(0x184D2A5Eu, readLE32(compressed, table - 8));
+
+  // Each frame decompresses on its own
+  std::string decompressed;
+  size_t pos = 0;
+  for (int i = 0; i < 3; i++) {
+    uint32_t size = readLE32(compressed, table + i * 8);
+    uint32_t rawSize = readLE32(compressed, table + i * 8 + 4);
+    std::string frame(rawSize, '\0');
+    SCOPE_ASSERT_EQUAL(rawSize, ZSTD_decompress(&frame[0], rawSize, compressed.data() + pos, size));
+    decompressed += frame;
+    pos += size;
+  }
+  SCOPE_ASSERT_EQUAL(table - 8, pos);
+  SCOPE_ASSERT(decompressed == expected.str());
+}
+
+SCOPE_TEST(testZstdAppend) {
+  const char* name = "test_compress.txt";
+  std::string first(ZstdFrameBuf::FrameSize + 10, 'a'), second("second run\n");
+  for (int run = 0; run < 2; run++) {
+    TextFile out;
+    out.open(name, run == 0, COMPRESS_ZSTD);
+    out << (run == 0 ? first : second);
+    SCOPE_ASSERT(out.good());
+  }
+
+  // One seek table over the frames of both runs
+  std::ifstream in(std::string(name) + ".zst", std::ios::binary);
+  SeekTable frames;
+  uint64_t tableSize;
+  SCOPE_ASSERT(ZstdFrameBuf::readSeekTable(in, frames, tableSize));
+  SCOPE_ASSERT_EQUAL(3u, frames.size());
+
+  std::string decompressed;
+  in.clear();
+  in.seekg(0);
+  for (auto& entry: frames) {
+    std::string compressed(entry.first, '\0'), frame(entry.second, '\0');
+    in.read(&compressed[0], compressed.size());
+    SCOPE_ASSERT_EQUAL(entry.second, ZSTD_decompress(&frame[0], frame.size(), compressed.data(), compressed.size()));
+    decompressed += frame;
+  }
+  SCOPE_ASSERT(decompressed == first + second);
+  uint64_t framesEnd = in.tellg();
+  in.seekg(0, std::ios::end);
+  SCOPE_ASSERT_EQUAL(tableSize, static_cast<uint64_t>(in.tellg()) - framesEnd);
+  in.close();
+  std::remove((std::string(name) + ".zst").c_str());
+}
+
+#endif
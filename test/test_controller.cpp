@@ -0,0 +1,195 @@
+#include <scope/test.h>
+
+#include "controller.h"
+#include "progress.h"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const unsigned int RECORD_SIZE = 1024;
+
+void putLE(std::string& buf, size_t offset, uint64_t value, unsigned int size) {
+  for (unsigned int i = 0; i < size; i++)
+    buf.at(offset + i) = static_cast<char>(value >> (8 * i));
+}
+
+// An in-use FILE record with a $STANDARD_INFORMATION and a $FILE_NAME
+std::string mftRecord(unsigned int record, const std::string& name, unsigned int parent) {
+  std::string buf(RECORD_SIZE, '\0');
+  const unsigned int attributes = 0x38;
+  putLE(buf, 0x0, 0x454C4946, 4);
+  putLE(buf, 0x4, 0x30, 2);
+  putLE(buf, 0x6, 3, 2);
+  putLE(buf, 0x14, attributes, 2);
+  putLE(buf, 0x16, 1, 2);
+  putLE(buf, 0x1C, RECORD_SIZE, 4);
+  putLE(buf, 0x2C, record, 4);
+
+  unsigned int offset = attributes;
+  putLE(buf, offset, 0x10, 4);
+  putLE(buf, offset + 0x4, 0x60, 4);
+  putLE(buf, offset + 0x10, 0x48, 4);
+  putLE(buf, offset + 0x14, 0x18, 2);
+  offset += 0x60;
+
+  unsigned int contentSize = 0x42 + 2 * name.size();
+  unsigned int length = (0x18 + contentSize + 7) / 8 * 8;
+  putLE(buf, offset, 0x30, 4);
+  putLE(buf, offset + 0x4, length, 4);
+  putLE(buf, offset + 0x10, contentSize, 4);
+  putLE(buf, offset + 0x14, 0x18, 2);
+  putLE(buf, offset + 0x18, parent, 6);
+  putLE(buf, offset + 0x18 + 0x40, name.size(), 1);
+  putLE(buf, offset + 0x18 + 0x41, 1, 1);
+  for (unsigned int i = 0; i < name.size(); i++)
+    putLE(buf, offset + 0x18 + 0x42 + 2 * i, name[i], 2);
+  offset += length;
+
+  putLE(buf, offset, 0xFFFFFFFF, 4);
+  putLE(buf, 0x18, offset + 8, 4);
+  return buf;
+}
+
+// A V2 $J record
+std::string usnRecord(unsigned int record, unsigned int parent, uint64_t usn, uint64_t timestamp,
+                      uint32_t reason, const std::string& name) {
+  std::string buf((60 + 2 * name.size() + 7) / 8 * 8, '\0');
+  putLE(buf, 0, buf.size(), 4);
+  putLE(buf, 4, 2, 2);
+  putLE(buf, 8, record | (1ULL << 48), 8);
+  putLE(buf, 16, parent | (1ULL << 48), 8);
+  putLE(buf, 24, usn, 8);
+  putLE(buf, 32, timestamp, 8);
+  putLE(buf, 40, reason, 4);
+  putLE(buf, 56, 2 * name.size(), 2);
+  putLE(buf, 58, 60, 2);
+  for (unsigned int i = 0; i < name.size(); i++)
+    putLE(buf, 60 + 2 * i, name[i], 2);
+  return buf;
+}
+
+void writeFile(const boost::filesystem::path& path, const std::string& contents) {
+  std::ofstream out(path.string(), std::ios::binary);
+  out << contents;
+}
+
+/*
+A volume of snapshots, oldest first. Files in a folder are created, renamed and deleted in
+turn, with each snapshot's $J carrying on where the one before it left off
+*/
+void writeVolume(const boost::filesystem::path& dir, unsigned int numSnapshots, unsigned int changesPerSnapshot) {
+  const uint32_t reasons[] = {0x100, 0x1000, 0x2000, 0x80000000, 0x200};
+  uint64_t usn = 0, timestamp = 131000000000000000ULL;
+  for (unsigned int snapshot = 0; snapshot < numSnapshots; snapshot++) {
+    boost::filesystem::path snapshotDir = dir / (snapshot + 1 < numSnapshots ? "vss_" + std::to_string(snapshot) : "vss_base");
+    boost::filesystem::create_directories(snapshotDir);
+
+    std::string mft;
+    for (unsigned int record = 0; record < 64; record++) {
+      if (record == 5)
+        mft += mftRecord(5, ".", 5);
+      else if (record == 30)
+        mft += mftRecord(30, "docs", 5);
+      else if (record >= 40)
+        mft += mftRecord(record, "file" + std::to_string(record) + "_" + std::to_string(snapshot) + ".txt", 30);
+      else
+        mft += std::string(RECORD_SIZE, '\0');
+    }
+    writeFile(snapshotDir / "$MFT", mft);
+
+    std::string jrnl;
+    for (unsigned int i = 0; i < changesPerSnapshot; i++, timestamp += 10000000) {
+      unsigned int record = 40 + i % 24;
+      std::string name = "file" + std::to_string(record) + "_" + std::to_string(i % 3) + ".txt";
+      std::string rec = usnRecord(record, i % 7 ? 30 : 5, usn, timestamp, reasons[i % 5], name);
+      jrnl += rec;
+      usn += rec.size();
+    }
+    jrnl.resize((jrnl.size() / 65536 + 1) * 65536, '\0');
+    writeFile(snapshotDir / "$J", jrnl);
+    writeFile(snapshotDir / "$LogFile", "");
+  }
+}
+
+std::string readFile(const boost::filesystem::path& path) {
+  std::ifstream in(path.string(), std::ios::binary);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+// Each row of the query, its columns separated by tabs
+std::string query(const boost::filesystem::path& dbName, const std::string& sql) {
+  sqlite3* db = NULL;
+  sqlite3_stmt* stmt = NULL;
+  std::string rows;
+  sqlite3_open(dbName.string().c_str(), &db);
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) == SQLITE_OK) {
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      for (int i = 0; i < sqlite3_column_count(stmt); i++) {
+        const unsigned char* text = sqlite3_column_text(stmt, i);
+        rows += (i ? "\t" : "") + (text ? std::string(reinterpret_cast<const char*>(text)) : "NULL");
+      }
+      rows += "\n";
+    }
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return rows;
+}
+
+void runLinker(const boost::filesystem::path& input, const boost::filesystem::path& output, bool serial) {
+  Options opts;
+  opts.input = input;
+  opts.output = output;
+  opts.overwrite = true;
+  opts.serial = serial;
+  std::ostringstream status;
+  std::streambuf* coutBuf = std::cout.rdbuf(status.rdbuf());
+  run(opts);
+  std::cout.rdbuf(coutBuf);
+}
+
+}
+
+SCOPE_TEST(testFinalizeThreadedMatchesSerial) {
+  const boost::filesystem::path input("test_controller_in"), serial("test_controller_serial"), threaded("test_controller_threaded");
+  // More events in each of c's snapshots than fit in one batch
+  writeVolume(input / "c", 3, 170000);
+  writeVolume(input / "d", 2, 500);
+  bool visible = ProgressBar::Visible;
+  ProgressBar::Visible = false;
+  runLinker(input, serial, true);
+  runLinker(input, threaded, false);
+  ProgressBar::Visible = visible;
+
+  for (const char* volume: {"c", "d"}) {
+    std::string events = readFile(serial / volume / "events.txt");
+    SCOPE_ASSERT(events.find("file40_0.txt") != std::string::npos);
+    SCOPE_ASSERT_EQUAL(events, readFile(threaded / volume / "events.txt"));
+  }
+
+  // The compatibility views read the same from both, names and all
+  const std::string events = "select Position, Timestamp, EventSource, EventType, FileName, Folder, FullPath, MFTRecord, "
+                             "USN_LSN, OldFileName, OldFolder, Snapshot, Volume from event order by rowid;";
+  std::string rows = query(serial / "ntfs.db", events);
+  SCOPE_ASSERT(!rows.empty());
+  SCOPE_ASSERT_EQUAL(rows, query(threaded / "ntfs.db", events));
+  const std::string usn = "select * from usn order by rowid;";
+  SCOPE_ASSERT_EQUAL(query(serial / "ntfs.db", usn), query(threaded / "ntfs.db", usn));
+  SCOPE_ASSERT_EQUAL("", query(threaded / "ntfs.db", "select * from event where EventSource is null or EventType is null "
+                                                      "or Snapshot is null or Volume is null;"));
+  // Positions run through each volume's events without gaps
+  SCOPE_ASSERT_EQUAL("", query(threaded / "ntfs.db", "select Volume from event group by Volume "
+                                                      "having min(Position) != 1 or max(Position) != count(*);"));
+
+  boost::filesystem::remove_all(input);
+  boost::filesystem::remove_all(serial);
+  boost::filesystem::remove_all(threaded);
+}
@@ -0,0 +1,49 @@
+#include <scope/test.h>
+
+#include "diagnostics.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+SCOPE_TEST(testDiagnosticsSampling) {
+  SCOPE_ASSERT(Diagnostics::isSampled(1));
+  SCOPE_ASSERT(Diagnostics::isSampled(16));
+  SCOPE_ASSERT(!Diagnostics::isSampled(17));
+  SCOPE_ASSERT(Diagnostics::isSampled(32));
+  SCOPE_ASSERT(!Diagnostics::isSampled(1000));
+  SCOPE_ASSERT(Diagnostics::isSampled(1024));
+}
+
+SCOPE_TEST(testDiagnosticsCounts) {
+  VersionInfo version("vss_base", "vol");
+  Diagnostics diagnostics(version, "$UsnJrnl");
+  for (unsigned int i = 0; i < 100; i++)
+    diagnostics.record(AnomalyKinds::ANOMALY_USN_BAD_RECORD, i * 8, 0x20000);
+  diagnostics.record(AnomalyKinds::ANOMALY_USN_RECOVERY_FAILED, 0x1000);
+
+  SCOPE_ASSERT_EQUAL(100u, diagnostics.count(AnomalyKinds::ANOMALY_USN_BAD_RECORD));
+  SCOPE_ASSERT_EQUAL(0u, diagnostics.count(AnomalyKinds::ANOMALY_USN_RECOVERED));
+  SCOPE_ASSERT_EQUAL(101u, diagnostics.total());
+  // 16 always kept, then 32 and 64, plus the failure
+  SCOPE_ASSERT_EQUAL(19u, diagnostics.samples().size());
+  SCOPE_ASSERT_EQUAL(0x1000u, diagnostics.samples().back().Offset);
+}
+
+SCOPE_TEST(testDiagnosticsReports) {
+  VersionInfo version("vss_base", "vol");
+  Diagnostics diagnostics(version, "$LogFile");
+  std::chrono::steady_clock::duration interval = Diagnostics::ReportInterval;
+  Diagnostics::ReportInterval = std::chrono::steady_clock::duration::zero();
+  std::ostringstream err;
+  std::streambuf* errBuf = std::cerr.rdbuf(err.rdbuf());
+  for (unsigned int i = 0; i < 5000; i++)
+    diagnostics.record(AnomalyKinds::ANOMALY_LOG_INVALID_OP_CODE, i);
+  std::cerr.rdbuf(errBuf);
+  Diagnostics::ReportInterval = interval;
+
+  // The clock is looked at every 1024 anomalies, whether or not they're sampled
+  std::string reports = err.str();
+  SCOPE_ASSERT_EQUAL(4, std::count(reports.begin(), reports.end(), '\n'));
+  SCOPE_ASSERT(reports.find("1024 more anomalies (3072 total)") != std::string::npos);
+}
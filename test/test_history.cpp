@@ -0,0 +1,68 @@
+#include <scope/test.h>
+
+#include "aggregate.h"
+#include "history.h"
+
+#include <cstdio>
+
+namespace {
+
+Event makeEvent(int64_t order, unsigned int type, const std::string& timestamp, const std::string& name, int64_t parent) {
+  Event event;
+  event.Order = order;
+  event.Type = type;
+  event.Timestamp = timestamp;
+  event.IsAnchor = true;
+  event.IsEmbedded = false;
+  event.Record = 40;
+  event.Name = name;
+  event.Parent = parent;
+  return event;
+}
+
+}
+
+SCOPE_TEST(testPathAtTime) {
+  const char* dbName = "test_history.db";
+  SQLiteHelper helper;
+  helper.init(dbName, true);
+  helper.beginTransaction();
+
+  std::vector<File> records(41);
+  records[5] = File(".", 5, 5, "");
+  records[30] = File("docs", 30, 5, "");
+  records[40] = File("b.txt", 40, 30, "");
+  RecordHistory history(helper);
+  history.seed(records);
+  history.start(VersionInfo("Live", "C"), records.size());
+
+  // Newest first: created as \a.txt, moved into \docs, then renamed
+  Event rename = makeEvent(1, EventTypes::TYPE_RENAME, "2020-01-03 00:00:00.0000000", "b.txt", 30);
+  rename.PreviousName = "a.txt";
+  Event move = makeEvent(2, EventTypes::TYPE_MOVE, "2020-01-02 00:00:00.0000000", "a.txt", 30);
+  move.PreviousParent = 5;
+  Event create = makeEvent(3, EventTypes::TYPE_CREATE, "2020-01-01 00:00:00.0000000", "a.txt", 5);
+  for (const Event* event: {&rename, &move, &create})
+    history.event(*event);
+  history.finish();
+  helper.endTransaction();
+  helper.close();
+
+  PathHistory paths(dbName);
+  SCOPE_ASSERT(paths.good());
+  SCOPE_ASSERT_EQUAL(1u, paths.volumes().size());
+  int64_t volume = paths.volumes()[0].second;
+  std::string path;
+  SCOPE_ASSERT(paths.pathAt(volume, 40, "2020-01-04", path));
+  SCOPE_ASSERT_EQUAL("\\docs\\b.txt", path);
+  SCOPE_ASSERT(paths.pathAt(volume, 40, "2020-01-03 00:00:00.0000000", path));
+  SCOPE_ASSERT_EQUAL("\\docs\\b.txt", path);
+  SCOPE_ASSERT(paths.pathAt(volume, 40, "2020-01-02 12:00:00", path));
+  SCOPE_ASSERT_EQUAL("\\docs\\a.txt", path);
+  SCOPE_ASSERT(paths.pathAt(volume, 40, "2020-01-01 12:00:00", path));
+  SCOPE_ASSERT_EQUAL("\\a.txt", path);
+  SCOPE_ASSERT(!paths.pathAt(volume, 40, "2019-12-31", path));
+  SCOPE_ASSERT(paths.pathAt(volume, 30, "2019-12-31", path));
+  SCOPE_ASSERT_EQUAL("\\docs", path);
+  std::remove(dbName);
+}
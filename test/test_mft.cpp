@@ -0,0 +1,180 @@
+#include <scope/test.h>
+
+#include "mft.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+const uint64_t CREATED = 130000000000000000ull;
+
+static void putLE(std::vector<char>& buf, size_t offset, uint64_t value, unsigned int size) {
+  for (unsigned int i = 0; i < size; i++)
+    buf.at(offset + i) = static_cast<char>(value >> (8 * i));
+}
+
+static unsigned int attributeOffset(unsigned int recordSize) {
+  return (0x30 + 2 * (recordSize / 512 + 1) + 7) / 8 * 8;
+}
+
+/*
+Builds an in-use FILE record with a $STANDARD_INFORMATION, unless name is empty a $FILE_NAME,
+and unless dataSize is -1 a resident unnamed $DATA
+*/
+static std::vector<char> makeRecord(unsigned int record, unsigned int base, const std::string& name,
+                                    unsigned int parent, unsigned int recordSize = 1024, int64_t dataSize = -1) {
+  std::vector<char> buf(recordSize, 0);
+  putLE(buf, 0x0, 0x454C4946, 4);
+  putLE(buf, 0x4, 0x30, 2);
+  putLE(buf, 0x6, recordSize / 512 + 1, 2);
+  putLE(buf, 0x14, attributeOffset(recordSize), 2);
+  putLE(buf, 0x16, 1, 2);
+  putLE(buf, 0x1C, recordSize, 4);
+  putLE(buf, 0x20, base, 6);
+  putLE(buf, 0x2C, record, 4);
+
+  unsigned int offset = attributeOffset(recordSize);
+  putLE(buf, offset, 0x10, 4);
+  putLE(buf, offset + 0x4, 0x60, 4);
+  putLE(buf, offset + 0x10, 0x48, 4);
+  putLE(buf, offset + 0x14, 0x18, 2);
+  putLE(buf, offset + 0x18, CREATED, 8);
+  offset += 0x60;
+
+  if (!name.empty()) {
+    unsigned int contentSize = FNAttribute::NAME_OFFSET + 2 * name.size();
+    unsigned int length = (0x18 + contentSize + 7) / 8 * 8;
+    putLE(buf, offset, 0x30, 4);
+    putLE(buf, offset + 0x4, length, 4);
+    putLE(buf, offset + 0x10, contentSize, 4);
+    putLE(buf, offset + 0x14, 0x18, 2);
+    putLE(buf, offset + 0x18, parent, 6);
+    putLE(buf, offset + 0x18 + 0x8, CREATED, 8);
+    putLE(buf, offset + 0x18 + 0x40, name.size(), 1);
+    putLE(buf, offset + 0x18 + 0x41, 1, 1);
+    for (unsigned int i = 0; i < name.size(); i++)
+      putLE(buf, offset + 0x18 + FNAttribute::NAME_OFFSET + 2 * i, name[i], 2);
+    offset += length;
+  }
+  if (dataSize >= 0) {
+    unsigned int length = (0x18 + dataSize + 7) / 8 * 8;
+    putLE(buf, offset, 0x80, 4);
+    putLE(buf, offset + 0x4, length, 4);
+    putLE(buf, offset + 0x10, dataSize, 4);
+    putLE(buf, offset + 0x14, 0x18, 2);
+    offset += length;
+  }
+  putLE(buf, offset, 0xFFFFFFFF, 4);
+  putLE(buf, 0x18, offset + 8, 4);
+  return buf;
+}
+
+SCOPE_TEST(testTruncatedRecord) {
+  const std::vector<char> full = makeRecord(40, 0, "notes.txt", 5);
+  const unsigned int siContent = attributeOffset(1024) + 0x18;
+  const unsigned int fnAttribute = attributeOffset(1024) + 0x60;
+  const unsigned int nameEnd = fnAttribute + 0x18 + FNAttribute::NAME_OFFSET + 2 * 9;
+
+  MFTRecord record;
+  SCOPE_ASSERT(record.init(const_cast<char*>(full.data()), full.size()));
+  SCOPE_ASSERT(record.Fna.Valid);
+  SCOPE_ASSERT_EQUAL("notes.txt", record.Fna.Name);
+  SCOPE_ASSERT_EQUAL(5u, record.Fna.Parent);
+  SCOPE_ASSERT_EQUAL(CREATED, record.Sia.Created);
+
+  // Each copy is exactly as long as it claims to be, so reading past it is caught by ASan
+  // Cut off in the middle of the name: the $FILE_NAME is dropped, the $STANDARD_INFORMATION kept
+  std::vector<char> cut(full.begin(), full.begin() + nameEnd - 1);
+  SCOPE_ASSERT(record.init(cut.data(), cut.size()));
+  SCOPE_ASSERT(!record.Fna.Valid);
+  SCOPE_ASSERT_EQUAL(CREATED, record.Sia.Created);
+
+  // Cut off in the middle of the $STANDARD_INFORMATION
+  cut.assign(full.begin(), full.begin() + siContent + 0x40);
+  SCOPE_ASSERT(record.init(cut.data(), cut.size()));
+  SCOPE_ASSERT_EQUAL(0u, record.Sia.Created);
+  SCOPE_ASSERT(!record.Fna.Valid);
+
+  // Content claiming to be longer than its attribute
+  std::vector<char> bad(full);
+  putLE(bad, fnAttribute + 0x10, 0x200, 4);
+  SCOPE_ASSERT(record.init(bad.data(), bad.size()));
+  SCOPE_ASSERT(!record.Fna.Valid);
+
+  // Too short to hold a header
+  cut.assign(full.begin(), full.begin() + 0x20);
+  SCOPE_ASSERT(!record.init(cut.data(), cut.size()));
+}
+
+static std::string makeMFT(unsigned int numRecords, unsigned int recordSize) {
+  std::string mft;
+  for (unsigned int i = 0; i < numRecords; i++) {
+    // Some unused records, and files in a few directories
+    std::vector<char> record = i % 7 == 3 ? std::vector<char>(recordSize, 0)
+                                          : makeRecord(i, 0, "file_" + std::to_string(i), 5 + i % 5, recordSize);
+    mft.append(record.data(), record.size());
+  }
+  return mft;
+}
+
+static std::string describe(const std::vector<File>& records) {
+  std::string table;
+  for (auto& file: records) {
+    table += std::to_string(file.Valid) + "\t" + std::to_string(file.Record) + "\t" + std::to_string(file.Parent)
+             + "\t" + file.Name + "\t" + file.Timestamp + "\n";
+  }
+  return table;
+}
+
+SCOPE_TEST(testParseMFTShards) {
+  const unsigned int numRecords = 300;
+  std::string expected;
+  for (unsigned int recordSize: {1024u, 4096u}) {
+    for (unsigned int threads: {1u, 4u}) {
+      // Little enough in flight for several rounds of shards
+      WorkerPool pool(threads);
+      std::istringstream input(makeMFT(numRecords, recordSize));
+      std::vector<File> records;
+      parseMFT(records, input, pool, 16 * recordSize * threads);
+      SCOPE_ASSERT_EQUAL(numRecords, records.size());
+      if (expected.empty())
+        expected = describe(records);
+      SCOPE_ASSERT_EQUAL(expected, describe(records));
+    }
+  }
+  SCOPE_ASSERT(expected.find("file_299") != std::string::npos);
+}
+
+SCOPE_TEST(testExtensionRecords) {
+  std::string mft;
+  auto add = [&mft](const std::vector<char>& record) { mft.append(record.data(), record.size()); };
+  add(makeRecord(0, 0, "$MFT", 5));
+  for (unsigned int i = 1; i < 40; i++)
+    add(std::vector<char>(1024, 0));
+  // 40's $FILE_NAME and $DATA were moved to an extension record
+  add(makeRecord(40, 0, "", 0));
+  add(makeRecord(41, 40, "report.docx", 30, 1024, 100));
+  // 42 has its own, which are kept over its extension's
+  add(makeRecord(42, 0, "kept.txt", 5, 1024, 7));
+  add(makeRecord(43, 42, "other.txt", 6, 1024, 500));
+  // An extension of a record past the end of the $MFT
+  add(makeRecord(44, 99, "lost.txt", 5));
+
+  WorkerPool pool(2);
+  std::istringstream input(mft);
+  std::vector<File> records;
+  parseMFT(records, input, pool);
+  SCOPE_ASSERT_EQUAL(45u, records.size());
+
+  SCOPE_ASSERT(records[40].Valid);
+  SCOPE_ASSERT_EQUAL("report.docx", records[40].Name);
+  SCOPE_ASSERT_EQUAL(30u, records[40].Parent);
+  SCOPE_ASSERT(records[40].HasData);
+  SCOPE_ASSERT(records[40].DataResident);
+  SCOPE_ASSERT_EQUAL(100u, records[40].DataSize);
+
+  SCOPE_ASSERT_EQUAL("kept.txt", records[42].Name);
+  SCOPE_ASSERT_EQUAL(5u, records[42].Parent);
+  SCOPE_ASSERT_EQUAL(7u, records[42].DataSize);
+  SCOPE_ASSERT(!records[1].HasData);
+}
@@ -0,0 +1,121 @@
+#include <scope/test.h>
+
+#include "perf.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+SCOPE_TEST(testPerfStatsRows) {
+  const char* dbName = "test_perf.db";
+  SQLiteHelper helper;
+  helper.init(dbName, true);
+  PerfCounters perf(helper);
+  std::vector<PhaseObserver*> observers(1, &perf);
+  SCOPE_ASSERT(!perf.isThreadSafe());
+
+  helper.beginTransaction();
+  // Some instructions to count
+  volatile uint64_t sum = 0;
+  {
+    PhaseScope outer(observers, Phases::PHASE_FINALIZE, "C", "vss_base");
+    {
+      PhaseScope inner(observers, Phases::PHASE_MFT, "C", "vss_base");
+      for (uint64_t i = 0; i < 1000000; i++)
+        sum += i * i;
+      inner.Info.Records = 40;
+      inner.Info.Bytes = 40960;
+    }
+    outer.Info.Records = 7;
+  }
+  helper.endTransaction();
+  helper.close();
+
+  sqlite3* db = NULL;
+  sqlite3_stmt* stmt = NULL;
+  sqlite3_open(dbName, &db);
+  SCOPE_ASSERT_EQUAL(SQLITE_OK, sqlite3_prepare_v2(db, "select Phase, Instructions, Records, Bytes, Snapshot, Volume "
+                                                       "from perf_stats order by rowid;", -1, &stmt, NULL));
+  // Inner phases end first
+  const char* phases[] = {"$MFT", "Finalize"};
+  const int64_t records[] = {40, 7}, bytes[] = {40960, 0};
+  for (unsigned int i = 0; i < 2; i++) {
+    SCOPE_ASSERT_EQUAL(SQLITE_ROW, sqlite3_step(stmt));
+    SCOPE_ASSERT_EQUAL(std::string(phases[i]), reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+    // Without counters, as where perf_event_open isn't allowed, the row is still written with NULLs
+    if (perf.good() && perf.read()[PERF_INSTRUCTIONS] >= 0)
+      SCOPE_ASSERT(sqlite3_column_int64(stmt, 1) > 0);
+    else
+      SCOPE_ASSERT_EQUAL(SQLITE_NULL, sqlite3_column_type(stmt, 1));
+    SCOPE_ASSERT_EQUAL(records[i], sqlite3_column_int64(stmt, 2));
+    SCOPE_ASSERT_EQUAL(bytes[i], sqlite3_column_int64(stmt, 3));
+    SCOPE_ASSERT_EQUAL(std::string("vss_base"), reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4)));
+    SCOPE_ASSERT_EQUAL(std::string("C"), reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5)));
+  }
+  SCOPE_ASSERT_EQUAL(SQLITE_DONE, sqlite3_step(stmt));
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  std::remove(dbName);
+}
+
+namespace {
+
+// The instructions counted in a phase which does nothing but insert rows, or -1, and the rows in the table
+int64_t insertInstructions(const char* dbName, bool writerThread, int64_t rows, int64_t& written) {
+  SQLiteHelper helper;
+  helper.init(dbName, true, writerThread);
+  PerfCounters perf(helper);
+  std::vector<PhaseObserver*> observers(1, &perf);
+  helper.beginTransaction();
+  {
+    PhaseScope phase(observers, Phases::PHASE_USN, "C", "vss_base");
+    for (int64_t i = 0; i < rows; i++)
+      SQLiteRow(helper, INSERT_DIAGNOSTIC_SAMPLE).text("torn_fixup").integer(i).integer(0).text("vss_base").text("C");
+  }
+  helper.endTransaction();
+  helper.close();
+
+  int64_t instructions = -1;
+  sqlite3* db = NULL;
+  sqlite3_stmt* stmt = NULL;
+  sqlite3_open(dbName, &db);
+  sqlite3_prepare_v2(db, "select Instructions, (select count(*) from diagnostic_samples) from perf_stats;", -1, &stmt, NULL);
+  written = 0;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    if (sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+      instructions = sqlite3_column_int64(stmt, 0);
+    written = sqlite3_column_int64(stmt, 1);
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  std::remove(dbName);
+  return instructions;
+}
+
+}
+
+SCOPE_TEST(testPerfCountsRowsWritten) {
+  const int64_t rows = 20000;
+  int64_t threadedRows, inlineRows;
+  int64_t encoded = insertInstructions("test_perf_rows.db", true, rows, threadedRows);
+  int64_t written = insertInstructions("test_perf_rows.db", false, rows, inlineRows);
+  SCOPE_ASSERT_EQUAL(rows, threadedRows);
+  SCOPE_ASSERT_EQUAL(rows, inlineRows);
+  SQLiteHelper helper;
+  helper.init(":memory:", false);
+  bool counted;
+  {
+    PerfCounters perf(helper);
+    counted = perf.good() && perf.read()[PERF_INSTRUCTIONS] >= 0;
+  }
+  helper.close();
+  if (!counted) {
+    // Where perf_event_open isn't allowed, there's nothing to count
+    SCOPE_ASSERT_EQUAL(-1, written);
+    return;
+  }
+  // A writer thread's inserts are only counted once it exits, while inserting a row takes
+  // several times the instructions of encoding it
+  SCOPE_ASSERT(encoded > 0);
+  SCOPE_ASSERT(written > 2 * encoded);
+}
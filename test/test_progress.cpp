@@ -0,0 +1,38 @@
+#include <scope/test.h>
+
+#include "progress.h"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+SCOPE_TEST(testProgressJSONLines) {
+  FILE* file = std::tmpfile();
+  ProgressBar::JSONFd = fileno(file);
+  {
+    ProgressBar status(4000, "$MFT");
+    std::vector<std::thread> workers;
+    for (int i = 0; i < 4; i++) {
+      workers.push_back(std::thread([&status]{
+        for (int j = 0; j < 250; j++)
+          status.addDone(4, 1);
+      }));
+    }
+    for (auto& worker: workers)
+      worker.join();
+    status.finish();
+  }
+  ProgressBar::JSONFd = -1;
+
+  std::rewind(file);
+  std::string json;
+  char buf[256];
+  while (std::fgets(buf, sizeof(buf), file))
+    json = buf;
+  std::fclose(file);
+
+  // The last line is the finished one, with every record the workers added
+  SCOPE_ASSERT(json.find("{\"phase\": \"$MFT\", \"bytes_done\": 4000, \"bytes_total\": 4000, \"records\": 1000,") == 0);
+  SCOPE_ASSERT(json.find("\"finished\": true}") != std::string::npos);
+}
@@ -0,0 +1,197 @@
+#include <scope/test.h>
+
+#include "sqlite_util.h"
+
+#include <cstdio>
+#include <string>
+
+SCOPE_TEST(testIdentifyVersions) {
+  SQLiteHelper helper;
+  helper.init(":memory:", false);
+  VersionInfo base("vss_base", "vol"), shadow("vss_0", "vol"), again("vss_base", "vol");
+  helper.identify(base);
+  helper.identify(shadow);
+  helper.identify(again);
+  SCOPE_ASSERT(base.SnapshotId != -1);
+  SCOPE_ASSERT(base.SnapshotId != shadow.SnapshotId);
+  SCOPE_ASSERT_EQUAL(base.VolumeId, shadow.VolumeId);
+  SCOPE_ASSERT_EQUAL(base.SnapshotId, again.SnapshotId);
+  helper.close();
+}
+
+SCOPE_TEST(testPathIds) {
+  SQLiteHelper helper;
+  helper.init(":memory:", false);
+  VersionInfo base("vss_base", "vol"), shadow("vss_0", "vol");
+  helper.identify(base);
+  helper.identify(shadow);
+
+  int64_t dir = helper.pathId(base.SnapshotId, "\\Users\\foo");
+  SCOPE_ASSERT(dir != -1);
+  SCOPE_ASSERT(helper.pathId(base.SnapshotId, "\\Users") != dir);
+  SCOPE_ASSERT_EQUAL(dir, helper.pathId(base.SnapshotId, "\\Users\\foo"));
+  // Paths are kept per snapshot, and are found again after switching back
+  int64_t other = helper.pathId(shadow.SnapshotId, "\\Users\\foo");
+  SCOPE_ASSERT(other != dir);
+  SCOPE_ASSERT_EQUAL(dir, helper.pathId(base.SnapshotId, "\\Users\\foo"));
+  // Once a snapshot's ids are forgotten, its paths are looked up in the table again
+  helper.forgetPaths(base.SnapshotId);
+  helper.drain();
+  SCOPE_ASSERT_EQUAL(dir, helper.pathId(base.SnapshotId, "\\Users\\foo"));
+  SCOPE_ASSERT_EQUAL(other, helper.pathId(shadow.SnapshotId, "\\Users\\foo"));
+  helper.close();
+}
+
+SCOPE_TEST(testWriterBatches) {
+  SQLiteHelper helper;
+  helper.init(":memory:", false);
+  VersionInfo base("vss_base", "vol");
+  helper.identify(base);
+
+  helper.beginTransaction();
+  for (size_t i = 0; i <= SQLiteHelper::BatchRows; i++) {
+    SQLiteRow(helper, INSERT_DIAGNOSTIC_SAMPLE)
+      .text("torn_fixup")
+      .integer(i)
+      .integer(0)
+      .text(base.Snapshot)
+      .text(base.Volume);
+  }
+  // Ending the transaction waits for the rows, the last in a batch of its own
+  helper.endTransaction();
+  WriterStats stats = helper.writerStats();
+  SCOPE_ASSERT_EQUAL(SQLiteHelper::BatchRows + 1, stats.Rows);
+  SCOPE_ASSERT_EQUAL(2u, stats.Batches);
+  SCOPE_ASSERT_EQUAL(0u, stats.Depth);
+  helper.close();
+}
+
+SCOPE_TEST(testWriterRowsDontBlock) {
+  SQLiteHelper helper;
+  helper.init(":memory:", false);
+  VersionInfo base("vss_base", "vol");
+  helper.identify(base);
+
+  {
+    // A row being built holds nothing up, neither another row nor the writer's stats
+    SQLiteRow outer(helper, INSERT_DIAGNOSTIC_SAMPLE);
+    outer.text("torn_fixup").integer(1);
+    SQLiteRow(helper, INSERT_DIAGNOSTIC_SAMPLE).text("torn_fixup").integer(2).integer(0).text(base.Snapshot).text(base.Volume);
+    SCOPE_ASSERT_EQUAL(0u, helper.writerStats().Errors);
+    outer.integer(0).text(base.Snapshot).text(base.Volume);
+  }
+  helper.drain();
+  WriterStats stats = helper.writerStats();
+  SCOPE_ASSERT_EQUAL(2u, stats.Rows);
+  SCOPE_ASSERT_EQUAL(0u, stats.Errors);
+  helper.close();
+}
+
+SCOPE_TEST(testWriterErrors) {
+  const char* dbName = "test_writer_errors.db";
+  SQLiteHelper helper;
+  helper.init(dbName, true);
+  VersionInfo base("vss_base", "vol");
+  helper.identify(base);
+
+  // Another connection drops the table the rows are meant for
+  sqlite3* other = NULL;
+  sqlite3_open(dbName, &other);
+  SCOPE_ASSERT_EQUAL(SQLITE_OK, sqlite3_exec(other, "drop table diagnostic_samples;", 0, 0, 0));
+  sqlite3_close(other);
+
+  for (int64_t i = 0; i < 3; i++)
+    SQLiteRow(helper, INSERT_DIAGNOSTIC_SAMPLE).text("torn_fixup").integer(i).integer(0).text(base.Snapshot).text(base.Volume);
+  helper.drain();
+  WriterStats stats = helper.writerStats();
+  SCOPE_ASSERT_EQUAL(3u, stats.Rows);
+  SCOPE_ASSERT_EQUAL(3u, stats.Errors);
+  helper.close();
+  std::remove(dbName);
+}
+
+namespace {
+
+// One $UsnJrnl row of a file and its folder, as usn.cpp writes them
+void writeUsn(SQLiteHelper& helper, const VersionInfo& version, int64_t record, const std::string& folder, const std::string& name) {
+  SQLiteRow(helper, INSERT_USN)
+    .integer(record)
+    .integer(5)
+    .integer(record * 8)
+    .text("2020-01-01 00:00:00.0000000")
+    .text("FILE_CREATE")
+    .text(name)
+    .path(version.SnapshotId, folder + "\\" + name)
+    .path(version.SnapshotId, folder)
+    .integer(0)
+    .integer(version.SnapshotId);
+}
+
+void writeDatabase(const char* dbName, bool overwrite, const std::vector<VersionInfo>& versions, int64_t record) {
+  SQLiteHelper helper;
+  helper.init(dbName, overwrite);
+  helper.beginTransaction();
+  for (auto& version: versions) {
+    helper.identify(version);
+    writeUsn(helper, version, record++, "\\Users", "a.txt");
+  }
+  helper.endTransaction();
+  helper.close();
+}
+
+// Each row of the query, its columns separated by tabs
+std::string query(const char* dbName, const std::string& sql) {
+  sqlite3* db = NULL;
+  sqlite3_stmt* stmt = NULL;
+  std::string rows;
+  sqlite3_open(dbName, &db);
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) == SQLITE_OK) {
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      for (int i = 0; i < sqlite3_column_count(stmt); i++) {
+        const unsigned char* text = sqlite3_column_text(stmt, i);
+        rows += (i ? "\t" : "") + (text ? std::string(reinterpret_cast<const char*>(text)) : "NULL");
+      }
+      rows += "\n";
+    }
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return rows;
+}
+
+}
+
+SCOPE_TEST(testMergeShards) {
+  const char* dbName = "test_merge.db";
+  const char* shardNames[] = {"test_merge_shard1.db", "test_merge_shard2.db"};
+  // The database already has a volume, and the shards share its names and paths
+  writeDatabase(dbName, true, {VersionInfo("vss_base", "C")}, 100);
+  writeDatabase(shardNames[0], true, {VersionInfo("vss_0", "D"), VersionInfo("vss_base", "C")}, 200);
+  writeDatabase(shardNames[1], true, {VersionInfo("vss_base", "D"), VersionInfo("vss_0", "D")}, 300);
+
+  SQLiteHelper helper;
+  helper.init(dbName, false);
+  for (const char* shardName: shardNames)
+    helper.merge(shardName);
+  helper.close();
+
+  SCOPE_ASSERT_EQUAL("C\nD\n", query(dbName, "select Name from volumes order by VolumeID;"));
+  SCOPE_ASSERT_EQUAL("vss_base\tC\nvss_0\tD\nvss_base\tD\n",
+                     query(dbName, "select s.Name, v.Name from snapshots s join volumes v on v.VolumeID = s.VolumeID "
+                                   "order by s.SnapshotID;"));
+  // A path shared with a snapshot already in the database is stored once
+  SCOPE_ASSERT_EQUAL("6\t6\n", query(dbName, "select count(*), count(distinct SnapshotID || Path) from paths;"));
+  SCOPE_ASSERT_EQUAL("", query(dbName, "select * from usn_records where SnapshotID not in (select SnapshotID from snapshots) "
+                                       "or FullPathID not in (select PathID from paths) "
+                                       "or FolderID not in (select PathID from paths);"));
+  SCOPE_ASSERT_EQUAL("100\tC\tvss_base\t\\Users\\a.txt\t\\Users\n"
+                     "200\tD\tvss_0\t\\Users\\a.txt\t\\Users\n"
+                     "201\tC\tvss_base\t\\Users\\a.txt\t\\Users\n"
+                     "300\tD\tvss_base\t\\Users\\a.txt\t\\Users\n"
+                     "301\tD\tvss_0\t\\Users\\a.txt\t\\Users\n",
+                     query(dbName, "select MFTRecord, Volume, Snapshot, FullPath, Folder from usn order by rowid;"));
+
+  std::remove(dbName);
+  for (const char* shardName: shardNames)
+    std::remove(shardName);
+}
@@ -0,0 +1,47 @@
+#include <scope/test.h>
+
+#include "trace.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+SCOPE_TEST(testTraceSpanOff) {
+  TraceLog::Active = NULL;
+  TraceSpan span("$MFT shard", "mft");
+  span.arg("records", 10);
+}
+
+SCOPE_TEST(testTraceWrite) {
+  TraceLog log;
+  TraceLog::Active = &log;
+  SCOPE_ASSERT_EQUAL(1u, log.threadId("main"));
+  {
+    TraceSpan span("vol\\vss_base", "snapshot");
+    span.arg("records", 42);
+    std::thread worker([]{ TraceSpan inner("$MFT shard", "mft"); });
+    worker.join();
+  }
+  PhaseTracer tracer(log);
+  std::vector<PhaseObserver*> observers(1, &tracer);
+  {
+    PhaseScope phase(observers, Phases::PHASE_USN, "vol", "vss_base");
+    phase.Info.Records = 7;
+  }
+  TraceLog::Active = NULL;
+
+  std::string fileName = "test_trace.json";
+  SCOPE_ASSERT(log.write(fileName));
+  std::ifstream in(fileName);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  std::string json = ss.str();
+  std::remove(fileName.c_str());
+
+  SCOPE_ASSERT(json.find("\"name\": \"vol\\\\vss_base\", \"cat\": \"snapshot\", \"ph\": \"X\"") != std::string::npos);
+  SCOPE_ASSERT(json.find("\"tid\": 1, \"args\": {\"records\": 42}") != std::string::npos);
+  SCOPE_ASSERT(json.find("\"name\": \"$MFT shard\", \"cat\": \"mft\", \"ph\": \"X\"") != std::string::npos);
+  SCOPE_ASSERT(json.find("\"tid\": 2, \"args\": {\"name\": \"worker 2\"}") != std::string::npos);
+  SCOPE_ASSERT(json.find("\"snapshot\": \"vss_base\", \"records\": 7, \"bytes\": 0") != std::string::npos);
+}
@@ -0,0 +1,41 @@
+#include <scope/test.h>
+
+#include "tsv.h"
+
+#include <cstdint>
+#include <sstream>
+
+SCOPE_TEST(testTsvIntegers) {
+  std::ostringstream out;
+  {
+    TsvWriter tsv(out);
+    tsv.field(0).field(7).field(-1).field(10).field(99).field(100).endRow();
+    tsv.field(INT64_MIN).field(INT64_MAX).field(UINT64_MAX).field(static_cast<unsigned int>(4096)).endRow();
+  }
+  SCOPE_ASSERT_EQUAL("0\t7\t-1\t10\t99\t100\n"
+                     "-9223372036854775808\t9223372036854775807\t18446744073709551615\t4096\n", out.str());
+}
+
+SCOPE_TEST(testTsvStrings) {
+  std::ostringstream out;
+  TsvWriter tsv(out, 16);
+  tsv.field("").field("a").endRow();
+  // Longer than the buffer
+  tsv.field(std::string(40, 'x')).field(std::string("tail")).endRow();
+  tsv.flush();
+  SCOPE_ASSERT_EQUAL("\ta\n" + std::string(40, 'x') + "\ttail\n", out.str());
+}
+
+SCOPE_TEST(testTsvThreaded) {
+  std::ostringstream out, expected;
+  TsvWriter::Threaded = true;
+  {
+    TsvWriter tsv(out, 64);
+    for (int i = 0; i < 1000; i++) {
+      tsv.field(i).field("row").endRow();
+      expected << i << "\trow\n";
+    }
+  }
+  TsvWriter::Threaded = false;
+  SCOPE_ASSERT_EQUAL(expected.str(), out.str());
+}
@@ -23,3 +23,21 @@ SCOPE_TEST(testAdvancing) {
   for(int i = 0; i < 4; i++)
     advanceStream(i&1, i&2);
 }
+
+SCOPE_TEST(testReasonCache) {
+  ReasonCache cache;
+  SCOPE_ASSERT_EQUAL("USN", cache.get(0));
+  SCOPE_ASSERT_EQUAL("USN|CLOSE|FILE_CREATE", cache.get(UsnReasons::USN_CLOSE | UsnReasons::USN_FILE_CREATE));
+  // Cached strings are rendered once
+  SCOPE_ASSERT_EQUAL(&cache.get(UsnReasons::USN_CLOSE), &cache.get(UsnReasons::USN_CLOSE));
+
+  // Once the table fills with masks from damaged records, later masks are still rendered
+  for (unsigned int i = 0; i < 4096; i++) {
+    unsigned int reason = (i << 22) | (i & 3);
+    std::string expected = "USN";
+    if (reason & UsnReasons::USN_CLOSE)          expected += "|CLOSE";
+    if (reason & UsnReasons::USN_DATA_EXTEND)    expected += "|DATA_EXTEND";
+    if (reason & UsnReasons::USN_DATA_OVERWRITE) expected += "|DATA_OVERWRITE";
+    SCOPE_ASSERT_EQUAL(expected, cache.get(reason));
+  }
+}
@@ -1,6 +1,7 @@
 #include <scope/test.h>
 #include <cstring>
 
+#include "layout.h"
 #include "util.h"
 
 SCOPE_TEST(testUnpack) {
@@ -26,3 +27,53 @@ SCOPE_TEST(testFixup) {
     SCOPE_ASSERT_EQUAL(0, buffer[i]);
   }
 }
+
+SCOPE_TEST(testMbcatos) {
+  SCOPE_ASSERT_EQUAL("a.txt", mbcatos("a\0.\0t\0x\0t\0", 10));
+  // U+00E9, U+4E8A and U+1F600 each have a byte >= 0x80
+  SCOPE_ASSERT_EQUAL("\xC3\xA9", mbcatos("\xE9\x00", 2));
+  SCOPE_ASSERT_EQUAL("\xE4\xBA\x8A", mbcatos("\x8A\x4E", 2));
+  SCOPE_ASSERT_EQUAL("\xF0\x9F\x98\x80", mbcatos("\x3D\xD8\x00\xDE", 4));
+  // A lone trail surrogate is not valid UTF-16
+  SCOPE_ASSERT_EQUAL("ERROR", mbcatos("\x00\xDC", 2));
+}
+
+SCOPE_TEST(testLittleEndian) {
+  const char buf[] = "\x01\x02\x03\x04\x05\x06\x07\x88\xFF";
+  SCOPE_ASSERT_EQUAL(0x01u, le<uint8_t>(buf));
+  SCOPE_ASSERT_EQUAL(0x0302u, le<uint16_t>(buf + 1));
+  SCOPE_ASSERT_EQUAL(0x04030201u, le<uint32_t>(buf));
+  SCOPE_ASSERT_EQUAL(0x060504030201ULL, le48(buf));
+  SCOPE_ASSERT_EQUAL(0xFF88070605040302ULL, le<uint64_t>(buf + 1));
+  for (int size = 1; size <= 8; size++)
+    SCOPE_ASSERT_EQUAL(hex_to_long(buf + 1, size), le<uint64_t>(buf + 1) & (~0ULL >> (64 - 8 * size)));
+}
+
+SCOPE_TEST(testIso8601ToFiletime) {
+  const uint64_t times[] = {0, 116444736000000000ULL, 130000000004550000ULL, 131000000123456789ULL};
+  for (auto t: times) {
+    SCOPE_ASSERT_EQUAL(static_cast<int64_t>(t), iso_8601_to_filetime(filetime_to_iso_8601(t)));
+  }
+  SCOPE_ASSERT_EQUAL(-1, iso_8601_to_filetime(""));
+  SCOPE_ASSERT_EQUAL(-1, iso_8601_to_filetime("2011-12-13 14:15:16"));
+  SCOPE_ASSERT_EQUAL(-1, iso_8601_to_filetime("2011-12-13T14:15:16.0000000"));
+}
+
+SCOPE_TEST(testCompleteIso8601) {
+  SCOPE_ASSERT_EQUAL("2012-12-14 23:13:26.0000000", complete_iso_8601("2012-12-14 23:13:26"));
+  SCOPE_ASSERT_EQUAL("2012-12-14 23:13:26.5000000", complete_iso_8601("2012-12-14 23:13:26.5"));
+  SCOPE_ASSERT_EQUAL("2012-12-14 23:13:26.1234567", complete_iso_8601("2012-12-14 23:13:26.1234567"));
+  SCOPE_ASSERT_EQUAL("2012-12-14 00:00:00.0000000", complete_iso_8601("2012-12-14"));
+  SCOPE_ASSERT_EQUAL("2012-02-29 00:00:00.0000000", complete_iso_8601("2012-02-29"));
+
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601(""));
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601("yesterday"));
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601("2012-12-14T23:13:26"));
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601("2012-12-14 23:13"));
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601("2012-12-14 23:13:26."));
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601("2012-12-14 23:13:26.12345678"));
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601("2013-02-29"));
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601("2012-13-01"));
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601("2012-12-14 24:00:00"));
+  SCOPE_ASSERT_EQUAL("", complete_iso_8601("1600-12-31"));
+}